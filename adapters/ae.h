@@ -40,6 +40,7 @@ typedef struct redisAeEvents {
     aeEventLoop *loop;
     int fd;
     int reading, writing;
+    long long timer_id; /* -1 when no timer is pending */
 } redisAeEvents;
 
 static void redisAeReadEvent(aeEventLoop *el, int fd, void *privdata, int mask) {
@@ -92,10 +93,30 @@ static void redisAeDelWrite(void *privdata) {
     }
 }
 
+static int redisAeTimeout(aeEventLoop *el, long long id, void *privdata) {
+    ((void)el); ((void)id);
+
+    redisAeEvents *e = (redisAeEvents*)privdata;
+    e->timer_id = -1;
+    redisAsyncHandleTimeout(e->context);
+    return AE_NOMORE;
+}
+
+static void redisAeScheduleTimer(void *privdata, struct timeval tv) {
+    redisAeEvents *e = (redisAeEvents*)privdata;
+    long long ms = tv.tv_sec*1000+(tv.tv_usec+999)/1000;
+
+    if (e->timer_id != -1)
+        aeDeleteTimeEvent(e->loop,e->timer_id);
+    e->timer_id = aeCreateTimeEvent(e->loop,ms,redisAeTimeout,e,NULL);
+}
+
 static void redisAeCleanup(void *privdata) {
     redisAeEvents *e = (redisAeEvents*)privdata;
     redisAeDelRead(privdata);
     redisAeDelWrite(privdata);
+    if (e->timer_id != -1)
+        aeDeleteTimeEvent(e->loop,e->timer_id);
     free(e);
 }
 
@@ -113,6 +134,7 @@ static int redisAeAttach(aeEventLoop *loop, redisAsyncContext *ac) {
     e->loop = loop;
     e->fd = c->fd;
     e->reading = e->writing = 0;
+    e->timer_id = -1;
 
     /* Register functions to start/stop listening for events */
     ac->ev.addRead = redisAeAddRead;
@@ -120,6 +142,7 @@ static int redisAeAttach(aeEventLoop *loop, redisAsyncContext *ac) {
     ac->ev.addWrite = redisAeAddWrite;
     ac->ev.delWrite = redisAeDelWrite;
     ac->ev.cleanup = redisAeCleanup;
+    ac->ev.scheduleTimer = redisAeScheduleTimer;
     ac->ev.data = e;
 
     return REDIS_OK;
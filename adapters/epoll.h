@@ -0,0 +1,479 @@
+/*
+ * Copyright (c) 2009-2011, Salvatore Sanfilippo <antirez at gmail dot com>
+ * Copyright (c) 2010-2011, Pieter Noordhuis <pcnoordhuis at gmail dot com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Minimal edge-triggered epoll event loop with timers, for programs that
+ * want to use asynchronous contexts without linking an event library.
+ *
+ * Every socket is registered once for both directions and never modified
+ * afterwards (it is only unregistered while a context waits to reconnect,
+ * when reads are stopped): the loop remembers whether a socket is readable and writable
+ * and only uses the kernel to learn about the edges. Reads go straight into
+ * the reply parser, sized like those of redisAsyncHandleRead(): a socket gets
+ * one read per loop iteration, or as many as its read budget allows, and what
+ * is left waits for the next iteration. Writes are batched, so that commands
+ * issued while processing replies go out together at the end of the loop
+ * iteration. */
+
+#ifndef __HIREDIS_EPOLL_H__
+#define __HIREDIS_EPOLL_H__
+#include <sys/types.h>
+#include <sys/epoll.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include "../hiredis.h"
+#include "../async.h"
+
+#define REDIS_EPOLL_MAX_EVENTS 1024
+
+struct redisEpollLoop;
+
+typedef void (redisEpollTimerProc)(struct redisEpollLoop *loop, void *privdata);
+
+typedef struct redisEpollTimer {
+    long long when; /* Monotonic milliseconds */
+    int idx; /* Position in the heap, -1 when not scheduled */
+    redisEpollTimerProc *proc;
+    void *privdata;
+} redisEpollTimer;
+
+typedef struct redisEpollEvents {
+    redisAsyncContext *context;
+    struct redisEpollLoop *loop;
+    int fd;
+    int reading, writing;
+    int readable, writable; /* Last known state of the socket */
+    int hup; /* The peer hung up: EOF raises no further edge */
+    int registered; /* The socket is in the epoll set */
+    int queued; /* Linked in the loop's ready or deferred list */
+    int dead; /* Cleaned up while being dispatched */
+    redisEpollTimer *timer; /* Deadline timer of the context */
+    struct redisEpollEvents *next;
+} redisEpollEvents;
+
+typedef struct redisEpollLoop {
+    int epfd;
+    int stop;
+    int contexts; /* Number of attached contexts */
+    redisEpollEvents *ready; /* Contexts with work that needs no new edge */
+    redisEpollEvents *deferred; /* Reads that used up their budget */
+    redisEpollEvents *current; /* Context being dispatched */
+    redisEpollTimer **timers; /* Binary min-heap on "when" */
+    int ntimers, timers_size;
+    struct epoll_event events[REDIS_EPOLL_MAX_EVENTS];
+} redisEpollLoop;
+
+static long long redisEpollNow(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (long long)ts.tv_sec*1000+ts.tv_nsec/1000000;
+}
+
+static inline redisEpollLoop *redisEpollCreate(void) {
+    redisEpollLoop *loop = (redisEpollLoop*)calloc(1,sizeof(*loop));
+    if (loop == NULL)
+        return NULL;
+    if ((loop->epfd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+        free(loop);
+        return NULL;
+    }
+    return loop;
+}
+
+/* Free the loop. Contexts that are still attached must be freed first. */
+static inline void redisEpollFree(redisEpollLoop *loop) {
+    if (loop == NULL)
+        return;
+    close(loop->epfd);
+    free(loop->timers);
+    free(loop);
+}
+
+static void redisEpollHeapSet(redisEpollLoop *loop, int i, redisEpollTimer *t) {
+    loop->timers[i] = t;
+    t->idx = i;
+}
+
+static void redisEpollHeapUp(redisEpollLoop *loop, int i) {
+    redisEpollTimer *t = loop->timers[i];
+    while (i > 0 && loop->timers[(i-1)/2]->when > t->when) {
+        redisEpollHeapSet(loop,i,loop->timers[(i-1)/2]);
+        i = (i-1)/2;
+    }
+    redisEpollHeapSet(loop,i,t);
+}
+
+static void redisEpollHeapDown(redisEpollLoop *loop, int i) {
+    redisEpollTimer *t = loop->timers[i];
+    int child;
+
+    while ((child = 2*i+1) < loop->ntimers) {
+        if (child+1 < loop->ntimers &&
+            loop->timers[child+1]->when < loop->timers[child]->when)
+            child++;
+        if (loop->timers[child]->when >= t->when)
+            break;
+        redisEpollHeapSet(loop,i,loop->timers[child]);
+        i = child;
+    }
+    redisEpollHeapSet(loop,i,t);
+}
+
+/* Schedule "proc" to run once after "ms" milliseconds. Returns NULL when out
+ * of memory. The returned handle stays valid until the timer fired or was
+ * deleted. */
+static inline redisEpollTimer *redisEpollAddTimer(redisEpollLoop *loop,
+                                                  long long ms,
+                                                  redisEpollTimerProc *proc,
+                                                  void *privdata) {
+    redisEpollTimer *t, **timers;
+    int size;
+
+    if (loop->ntimers == loop->timers_size) {
+        size = loop->timers_size ? loop->timers_size*2 : 16;
+        timers = (redisEpollTimer**)realloc(loop->timers,sizeof(*timers)*size);
+        if (timers == NULL)
+            return NULL;
+        loop->timers = timers;
+        loop->timers_size = size;
+    }
+    if ((t = (redisEpollTimer*)malloc(sizeof(*t))) == NULL)
+        return NULL;
+    t->when = redisEpollNow()+ms;
+    t->proc = proc;
+    t->privdata = privdata;
+    loop->timers[loop->ntimers] = t;
+    t->idx = loop->ntimers++;
+    redisEpollHeapUp(loop,t->idx);
+    return t;
+}
+
+static inline void redisEpollDelTimer(redisEpollLoop *loop, redisEpollTimer *t) {
+    int i = t->idx;
+
+    if (i >= 0) {
+        loop->ntimers--;
+        if (i != loop->ntimers) {
+            redisEpollHeapSet(loop,i,loop->timers[loop->ntimers]);
+            redisEpollHeapDown(loop,i);
+            redisEpollHeapUp(loop,loop->timers[i]->idx);
+        }
+    }
+    free(t);
+}
+
+static void redisEpollProcessTimers(redisEpollLoop *loop) {
+    long long now = redisEpollNow();
+    redisEpollTimer *t;
+
+    while (loop->ntimers > 0 && loop->timers[0]->when <= now) {
+        t = loop->timers[0];
+        loop->ntimers--;
+        if (loop->ntimers > 0) {
+            redisEpollHeapSet(loop,0,loop->timers[loop->ntimers]);
+            redisEpollHeapDown(loop,0);
+        }
+        t->idx = -1;
+        t->proc(loop,t->privdata);
+        free(t);
+    }
+}
+
+static void redisEpollSchedule(redisEpollEvents *e) {
+    if (!e->queued) {
+        e->queued = 1;
+        e->next = e->loop->ready;
+        e->loop->ready = e;
+    }
+}
+
+/* Read until the socket is drained or the read budget of the context is used
+ * up. With the default budget of 0 that is a single read, so a large reply
+ * takes a few iterations of the loop while other connections get their turn
+ * in between. A short read means the receive queue was empty at that point:
+ * data arriving later raises a new edge. After a hang up the EOF itself still
+ * has to be read. */
+static void redisEpollRead(redisEpollEvents *e) {
+    redisEpollEvents **pe;
+    size_t total = 0, size;
+    int nread;
+
+    while (e->reading && !e->dead) {
+        if (total > 0 && total >= e->context->read_budget) {
+            /* Callbacks may have queued it again meanwhile: move it over. */
+            if (e->queued) {
+                for (pe = &e->loop->ready; *pe != e; pe = &(*pe)->next);
+                *pe = e->next;
+            }
+            e->queued = 1;
+            e->next = e->loop->deferred;
+            e->loop->deferred = e;
+            break;
+        }
+        size = e->context->c.readsize;
+        if ((nread = redisAsyncHandleReadOnce(e->context)) == -1)
+            break;
+        if (nread == 0) {
+            e->readable = 0;
+            break;
+        }
+        total += (size_t)nread;
+        if ((size_t)nread < size && !e->hup) {
+            e->readable = 0;
+            break;
+        }
+    }
+}
+
+static void redisEpollWrite(redisEpollEvents *e) {
+    redisContext *c = &(e->context->c);
+
+    e->writing = 0;
+    redisAsyncHandleWrite(e->context);
+    /* Anything left means the send buffer is full: wait for the edge. */
+    if (!e->dead && e->writing && sdslen(c->obuf) > 0)
+        e->writable = 0;
+}
+
+static void redisEpollDispatch(redisEpollEvents *e) {
+    redisContext *c = &(e->context->c);
+
+    e->loop->current = e;
+    if (!(c->flags & REDIS_CONNECTED)) {
+        /* The first edge reports the outcome of connect(2). */
+        redisEpollWrite(e);
+        if (!e->dead && e->readable && e->reading &&
+            (c->flags & REDIS_CONNECTED))
+            redisEpollRead(e);
+    } else {
+        if (e->readable && e->reading)
+            redisEpollRead(e);
+        if (!e->dead && e->writable && e->writing)
+            redisEpollWrite(e);
+    }
+    e->loop->current = NULL;
+    if (e->dead)
+        free(e);
+}
+
+/* After a reconnect the descriptor refers to a new socket, which has to be
+ * added to the epoll set again. */
+static void redisEpollRegister(redisEpollEvents *e) {
+    struct epoll_event ev;
+
+    ev.events = EPOLLIN|EPOLLOUT|EPOLLRDHUP|EPOLLET;
+    ev.data.ptr = e;
+    if (epoll_ctl(e->loop->epfd,EPOLL_CTL_ADD,e->fd,&ev) == 0)
+        e->registered = 1;
+}
+
+static void redisEpollAddRead(void *privdata) {
+    redisEpollEvents *e = (redisEpollEvents*)privdata;
+    if (!e->registered)
+        redisEpollRegister(e);
+    e->reading = 1;
+    if (e->readable)
+        redisEpollSchedule(e);
+}
+
+/* Reads are only stopped when the connection dropped. */
+static void redisEpollDelRead(void *privdata) {
+    redisEpollEvents *e = (redisEpollEvents*)privdata;
+    e->reading = 0;
+    if (e->registered) {
+        epoll_ctl(e->loop->epfd,EPOLL_CTL_DEL,e->fd,NULL);
+        e->registered = 0;
+        e->readable = e->writable = e->hup = 0;
+    }
+}
+
+static void redisEpollAddWrite(void *privdata) {
+    redisEpollEvents *e = (redisEpollEvents*)privdata;
+    if (!e->registered)
+        redisEpollRegister(e);
+    e->writing = 1;
+    if (e->writable)
+        redisEpollSchedule(e);
+}
+
+static void redisEpollDelWrite(void *privdata) {
+    redisEpollEvents *e = (redisEpollEvents*)privdata;
+    e->writing = 0;
+}
+
+static void redisEpollTimeout(redisEpollLoop *loop, void *privdata) {
+    redisEpollEvents *e = (redisEpollEvents*)privdata;
+    ((void)loop);
+
+    /* The loop frees the timer once this returns. */
+    e->timer = NULL;
+    redisAsyncHandleTimeout(e->context);
+}
+
+static void redisEpollScheduleTimer(void *privdata, struct timeval tv) {
+    redisEpollEvents *e = (redisEpollEvents*)privdata;
+
+    if (e->timer != NULL)
+        redisEpollDelTimer(e->loop,e->timer);
+    e->timer = redisEpollAddTimer(e->loop,tv.tv_sec*1000+(tv.tv_usec+999)/1000,
+                                  redisEpollTimeout,e);
+}
+
+static void redisEpollCleanup(void *privdata) {
+    redisEpollEvents *e = (redisEpollEvents*)privdata;
+    redisEpollEvents **pe;
+    redisEpollLoop *loop = e->loop;
+
+    if (e->timer != NULL) {
+        redisEpollDelTimer(loop,e->timer);
+        e->timer = NULL;
+    }
+    if (e->registered)
+        epoll_ctl(loop->epfd,EPOLL_CTL_DEL,e->fd,NULL);
+    loop->contexts--;
+    if (e->queued) {
+        for (pe = &loop->ready; *pe != NULL && *pe != e; pe = &(*pe)->next);
+        if (*pe == NULL)
+            for (pe = &loop->deferred; *pe != NULL && *pe != e; pe = &(*pe)->next);
+        if (*pe != NULL)
+            *pe = e->next;
+    }
+    e->reading = e->writing = 0;
+    if (loop->current == e)
+        e->dead = 1;
+    else
+        free(e);
+}
+
+static int redisEpollAttach(redisEpollLoop *loop, redisAsyncContext *ac) {
+    redisContext *c = &(ac->c);
+    redisEpollEvents *e;
+
+    /* Nothing should be attached when something is already attached */
+    if (ac->ev.data != NULL)
+        return REDIS_ERR;
+
+    /* Create container for context and r/w events */
+    e = (redisEpollEvents*)calloc(1,sizeof(*e));
+    if (e == NULL)
+        return REDIS_ERR;
+    e->context = ac;
+    e->loop = loop;
+    e->fd = c->fd;
+
+    redisEpollRegister(e);
+    if (!e->registered) {
+        free(e);
+        return REDIS_ERR;
+    }
+
+    /* Register functions to start/stop listening for events */
+    ac->ev.addRead = redisEpollAddRead;
+    ac->ev.delRead = redisEpollDelRead;
+    ac->ev.addWrite = redisEpollAddWrite;
+    ac->ev.delWrite = redisEpollDelWrite;
+    ac->ev.cleanup = redisEpollCleanup;
+    ac->ev.scheduleTimer = redisEpollScheduleTimer;
+    ac->ev.data = e;
+    loop->contexts++;
+
+    return REDIS_OK;
+}
+
+/* Run one iteration of the loop: wait up to timeout_ms (-1 is forever, but
+ * never beyond the next timer) for events, then process the ready contexts
+ * and expired timers. Returns the number of processed socket events or -1 on
+ * error. */
+static inline int redisEpollRunOnce(redisEpollLoop *loop, long long timeout_ms) {
+    redisEpollEvents *e, **pe;
+    long long next;
+    int i, n;
+
+    if (loop->ready != NULL || loop->deferred != NULL) {
+        timeout_ms = 0;
+    } else if (loop->ntimers > 0) {
+        next = loop->timers[0]->when-redisEpollNow();
+        if (next < 0) next = 0;
+        if (timeout_ms < 0 || next < timeout_ms)
+            timeout_ms = next;
+    }
+
+    n = epoll_wait(loop->epfd,loop->events,REDIS_EPOLL_MAX_EVENTS,(int)timeout_ms);
+    if (n == -1 && errno != EINTR)
+        return -1;
+
+    for (i = 0; i < n; i++) {
+        e = (redisEpollEvents*)loop->events[i].data.ptr;
+        if (loop->events[i].events & (EPOLLIN|EPOLLRDHUP|EPOLLHUP|EPOLLERR))
+            e->readable = 1;
+        if (loop->events[i].events & (EPOLLRDHUP|EPOLLHUP|EPOLLERR))
+            e->hup = 1;
+        if (loop->events[i].events & (EPOLLOUT|EPOLLHUP|EPOLLERR))
+            e->writable = 1;
+        redisEpollSchedule(e);
+    }
+
+    /* Reads deferred by the last iteration go after the new events */
+    if (loop->deferred != NULL) {
+        for (pe = &loop->ready; *pe != NULL; pe = &(*pe)->next);
+        *pe = loop->deferred;
+        loop->deferred = NULL;
+    }
+
+    /* Contexts scheduled while dispatching (e.g. commands issued from a reply
+     * callback) are handled in this same iteration, writes last. */
+    while ((e = loop->ready) != NULL) {
+        loop->ready = e->next;
+        e->queued = 0;
+        redisEpollDispatch(e);
+    }
+
+    redisEpollProcessTimers(loop);
+    return n < 0 ? 0 : n;
+}
+
+/* Run the loop until redisEpollStop() is called, or until there are no more
+ * attached contexts and no more timers. */
+static inline int redisEpollRun(redisEpollLoop *loop) {
+    loop->stop = 0;
+    while (!loop->stop && (loop->contexts > 0 || loop->ntimers > 0)) {
+        if (redisEpollRunOnce(loop,-1) == -1)
+            return REDIS_ERR;
+    }
+    return REDIS_OK;
+}
+
+static inline void redisEpollStop(redisEpollLoop *loop) {
+    loop->stop = 1;
+}
+
+#endif
@@ -11,6 +11,7 @@ typedef struct
     GSource source;
     redisAsyncContext *ac;
     GPollFD poll_fd;
+    GSource *timer;
 } RedisSource;
 
 static void
@@ -49,6 +50,39 @@ redis_source_del_write (gpointer data)
     g_main_context_wakeup(g_source_get_context((GSource *)data));
 }
 
+static void
+redis_source_del_timer (RedisSource *source)
+{
+    if (source->timer) {
+        g_source_destroy(source->timer);
+        g_source_unref(source->timer);
+        source->timer = NULL;
+    }
+}
+
+static gboolean
+redis_source_timeout (gpointer data)
+{
+    RedisSource *source = (RedisSource *)data;
+
+    g_source_unref(source->timer);
+    source->timer = NULL;
+    redisAsyncHandleTimeout(source->ac);
+    return FALSE;
+}
+
+static void
+redis_source_schedule_timer (gpointer data, struct timeval tv)
+{
+    RedisSource *source = (RedisSource *)data;
+    g_return_if_fail(source);
+
+    redis_source_del_timer(source);
+    source->timer = g_timeout_source_new(tv.tv_sec * 1000 + (tv.tv_usec + 999) / 1000);
+    g_source_set_callback(source->timer, redis_source_timeout, source, NULL);
+    g_source_attach(source->timer, g_source_get_context((GSource *)data));
+}
+
 static void
 redis_source_cleanup (gpointer data)
 {
@@ -58,6 +92,7 @@ redis_source_cleanup (gpointer data)
 
     redis_source_del_read(source);
     redis_source_del_write(source);
+    redis_source_del_timer(source);
     /*
      * It is not our responsibility to remove ourself from the
      * current main loop. However, we will remove the GPollFD.
@@ -138,6 +173,7 @@ redis_source_new (redisAsyncContext *ac)
     source->poll_fd.fd = c->fd;
     source->poll_fd.events = 0;
     source->poll_fd.revents = 0;
+    source->timer = NULL;
     g_source_add_poll((GSource *)source, &source->poll_fd);
 
     ac->ev.addRead = redis_source_add_read;
@@ -145,6 +181,7 @@ redis_source_new (redisAsyncContext *ac)
     ac->ev.addWrite = redis_source_add_write;
     ac->ev.delWrite = redis_source_del_write;
     ac->ev.cleanup = redis_source_cleanup;
+    ac->ev.scheduleTimer = redis_source_schedule_timer;
     ac->ev.data = source;
 
     return (GSource *)source;
@@ -0,0 +1,816 @@
+/*
+ * Copyright (c) 2009-2011, Salvatore Sanfilippo <antirez at gmail dot com>
+ * Copyright (c) 2010-2011, Pieter Noordhuis <pcnoordhuis at gmail dot com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Completion based backend on top of Linux io_uring (5.11 or newer), talking
+ * to the kernel through the raw system calls so there are no dependencies.
+ *
+ * Unlike the other adapters this one is its own event loop: the sends and
+ * receives of every attached context are queued on one ring and submitted
+ * together with a single io_uring_enter(2) per loop iteration. Received data
+ * is fed straight to the reply parser. When the kernel supports it (5.19+ and
+ * 6.0+ respectively), receive buffers come from a provided buffer ring that is
+ * registered once and shared by all connections, and every connection has a
+ * single multishot receive armed for its whole lifetime. */
+
+#ifndef __HIREDIS_IOURING_H__
+#define __HIREDIS_IOURING_H__
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include "../hiredis.h"
+#include "../async.h"
+
+#define REDIS_IOURING_BUFFERS 256 /* Must be a power of two */
+#define REDIS_IOURING_BUFSIZE (1024*16)
+#define REDIS_IOURING_BGID 7
+
+/* Operation tags stored in the low bits of the user_data field */
+#define REDIS_IOURING_OP_RECV 1
+#define REDIS_IOURING_OP_SEND 2
+#define REDIS_IOURING_OP_POLL 3
+#define REDIS_IOURING_OP_SYNC 4
+#define REDIS_IOURING_OP_TIMEOUT 5
+#define REDIS_IOURING_OP_MASK 7
+
+struct redisIoUring;
+
+typedef struct redisIoUringEvents {
+    redisAsyncContext *context;
+    struct redisIoUring *ring;
+    int fd;
+    int inflight; /* Submitted operations that did not complete yet */
+    int receiving, polling, sending;
+    int flushing; /* Linked in the ring's list of pending sends */
+    sds sbuf; /* Output buffer handed to the kernel */
+    size_t soff;
+    char *rbuf; /* Receive buffer when there is no provided buffer ring */
+    int timers; /* Pending deadline timeouts */
+    struct __kernel_timespec timer_ts;
+    struct redisIoUringEvents *next;
+} redisIoUringEvents;
+
+/* Completion of an operation issued for a blocking context */
+typedef struct redisIoUringSync {
+    int done;
+    int res;
+} redisIoUringSync;
+
+typedef struct redisIoUring {
+    int fd;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ptr, *cq_ptr;
+    size_t sq_size, cq_size, sqes_size;
+    unsigned queued; /* SQEs filled in but not yet submitted */
+
+    /* Provided buffer ring, NULL when not supported */
+    struct io_uring_buf_ring *br;
+    char *bufs;
+    int multishot;
+
+    int contexts; /* Number of attached contexts */
+    redisIoUringEvents *flush; /* Contexts with output to send */
+} redisIoUring;
+
+static int redisIoUringSetup(unsigned entries, struct io_uring_params *p) {
+    return (int)syscall(__NR_io_uring_setup,entries,p);
+}
+
+static int redisIoUringEnter(redisIoUring *r, unsigned submit, unsigned wait,
+                             unsigned flags, void *arg, size_t argsz) {
+    return (int)syscall(__NR_io_uring_enter,r->fd,submit,wait,flags,arg,argsz);
+}
+
+static int redisIoUringRegister(redisIoUring *r, unsigned op, void *arg,
+                                unsigned nargs) {
+    return (int)syscall(__NR_io_uring_register,r->fd,op,arg,nargs);
+}
+
+static void redisIoUringRecycle(redisIoUring *r, unsigned short bid) {
+    struct io_uring_buf *buf;
+    unsigned short tail = r->br->tail;
+
+    buf = &r->br->bufs[tail & (REDIS_IOURING_BUFFERS-1)];
+    buf->addr = (unsigned long)(r->bufs+(size_t)bid*REDIS_IOURING_BUFSIZE);
+    buf->len = REDIS_IOURING_BUFSIZE;
+    buf->bid = bid;
+    __atomic_store_n(&r->br->tail,(unsigned short)(tail+1),__ATOMIC_RELEASE);
+}
+
+/* Register the shared pool of receive buffers. Failure is not fatal: the
+ * ring falls back to one buffer per connection. */
+static void redisIoUringSetupBuffers(redisIoUring *r) {
+    struct io_uring_buf_reg reg;
+    size_t size = sizeof(struct io_uring_buf)*REDIS_IOURING_BUFFERS;
+    void *ptr;
+    int i;
+
+    ptr = mmap(NULL,size,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+    if (ptr == MAP_FAILED)
+        return;
+    r->bufs = malloc((size_t)REDIS_IOURING_BUFFERS*REDIS_IOURING_BUFSIZE);
+    if (r->bufs == NULL) {
+        munmap(ptr,size);
+        return;
+    }
+
+    memset(&reg,0,sizeof(reg));
+    reg.ring_addr = (unsigned long)ptr;
+    reg.ring_entries = REDIS_IOURING_BUFFERS;
+    reg.bgid = REDIS_IOURING_BGID;
+    if (redisIoUringRegister(r,IORING_REGISTER_PBUF_RING,&reg,1) != 0) {
+        munmap(ptr,size);
+        free(r->bufs);
+        r->bufs = NULL;
+        return;
+    }
+
+    r->br = (struct io_uring_buf_ring*)ptr;
+    r->br->tail = 0;
+    for (i = 0; i < REDIS_IOURING_BUFFERS; i++)
+        redisIoUringRecycle(r,(unsigned short)i);
+    r->multishot = 1;
+}
+
+static inline void redisIoUringFree(redisIoUring *r) {
+    if (r == NULL)
+        return;
+    if (r->br != NULL)
+        munmap(r->br,sizeof(struct io_uring_buf)*REDIS_IOURING_BUFFERS);
+    free(r->bufs);
+    if (r->sqes != NULL)
+        munmap(r->sqes,r->sqes_size);
+    if (r->cq_ptr != NULL && r->cq_ptr != r->sq_ptr)
+        munmap(r->cq_ptr,r->cq_size);
+    if (r->sq_ptr != NULL)
+        munmap(r->sq_ptr,r->sq_size);
+    if (r->fd >= 0)
+        close(r->fd);
+    free(r);
+}
+
+static inline redisIoUring *redisIoUringCreate(unsigned entries) {
+    struct io_uring_params p;
+    redisIoUring *r;
+    char *sq, *cq;
+
+    r = (redisIoUring*)calloc(1,sizeof(*r));
+    if (r == NULL)
+        return NULL;
+
+    memset(&p,0,sizeof(p));
+    if ((r->fd = redisIoUringSetup(entries,&p)) < 0) {
+        free(r);
+        return NULL;
+    }
+
+    /* Waiting with a timeout needs IORING_ENTER_EXT_ARG (5.11). */
+    if (!(p.features & IORING_FEAT_EXT_ARG)) {
+        redisIoUringFree(r);
+        return NULL;
+    }
+
+    r->sq_size = p.sq_off.array+p.sq_entries*sizeof(unsigned);
+    r->cq_size = p.cq_off.cqes+p.cq_entries*sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (r->cq_size > r->sq_size)
+            r->sq_size = r->cq_size;
+        r->cq_size = r->sq_size;
+    }
+
+    r->sq_ptr = mmap(NULL,r->sq_size,PROT_READ|PROT_WRITE,
+                     MAP_SHARED|MAP_POPULATE,r->fd,IORING_OFF_SQ_RING);
+    if (r->sq_ptr == MAP_FAILED) {
+        r->sq_ptr = NULL;
+        redisIoUringFree(r);
+        return NULL;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        r->cq_ptr = r->sq_ptr;
+    } else {
+        r->cq_ptr = mmap(NULL,r->cq_size,PROT_READ|PROT_WRITE,
+                         MAP_SHARED|MAP_POPULATE,r->fd,IORING_OFF_CQ_RING);
+        if (r->cq_ptr == MAP_FAILED) {
+            r->cq_ptr = NULL;
+            redisIoUringFree(r);
+            return NULL;
+        }
+    }
+    r->sqes_size = p.sq_entries*sizeof(struct io_uring_sqe);
+    r->sqes = (struct io_uring_sqe*)mmap(NULL,r->sqes_size,
+        PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,r->fd,IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) {
+        r->sqes = NULL;
+        redisIoUringFree(r);
+        return NULL;
+    }
+
+    sq = (char*)r->sq_ptr;
+    cq = (char*)r->cq_ptr;
+    r->sq_head = (unsigned*)(sq+p.sq_off.head);
+    r->sq_tail = (unsigned*)(sq+p.sq_off.tail);
+    r->sq_mask = (unsigned*)(sq+p.sq_off.ring_mask);
+    r->sq_array = (unsigned*)(sq+p.sq_off.array);
+    r->cq_head = (unsigned*)(cq+p.cq_off.head);
+    r->cq_tail = (unsigned*)(cq+p.cq_off.tail);
+    r->cq_mask = (unsigned*)(cq+p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe*)(cq+p.cq_off.cqes);
+
+    redisIoUringSetupBuffers(r);
+    return r;
+}
+
+/* Hand the queued SQEs to the kernel, waiting for "wait" completions. */
+static int redisIoUringSubmit(redisIoUring *r, unsigned wait, long timeout_ms) {
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    unsigned flags = 0;
+    int ret;
+
+    memset(&arg,0,sizeof(arg));
+    if (wait > 0) {
+        flags |= IORING_ENTER_GETEVENTS|IORING_ENTER_EXT_ARG;
+        arg.sigmask_sz = _NSIG/8;
+        if (timeout_ms >= 0) {
+            ts.tv_sec = timeout_ms/1000;
+            ts.tv_nsec = (timeout_ms%1000)*1000000;
+            arg.ts = (unsigned long)&ts;
+        }
+    }
+    if (r->queued == 0 && wait == 0)
+        return 0;
+
+    do {
+        ret = redisIoUringEnter(r,r->queued,wait,flags,&arg,sizeof(arg));
+    } while (ret == -1 && errno == EINTR);
+
+    if (ret >= 0) {
+        r->queued -= (unsigned)ret < r->queued ? (unsigned)ret : r->queued;
+    } else if (errno == ETIME) {
+        ret = 0;
+        r->queued = 0;
+    }
+    return ret;
+}
+
+static struct io_uring_sqe *redisIoUringGetSqe(redisIoUring *r) {
+    unsigned head, tail, mask = *r->sq_mask;
+    struct io_uring_sqe *sqe;
+
+    head = __atomic_load_n(r->sq_head,__ATOMIC_ACQUIRE);
+    tail = *r->sq_tail;
+    if (tail-head > mask) {
+        /* Submission queue is full: make room by submitting it. */
+        if (redisIoUringSubmit(r,0,0) < 0)
+            return NULL;
+        head = __atomic_load_n(r->sq_head,__ATOMIC_ACQUIRE);
+        if (tail-head > mask)
+            return NULL;
+    }
+
+    sqe = &r->sqes[tail & mask];
+    memset(sqe,0,sizeof(*sqe));
+    r->sq_array[tail & mask] = tail & mask;
+    __atomic_store_n(r->sq_tail,tail+1,__ATOMIC_RELEASE);
+    r->queued++;
+    return sqe;
+}
+
+static int redisIoUringQueue(redisIoUringEvents *e, unsigned char opcode,
+                             unsigned long long tag, const void *buf,
+                             unsigned len) {
+    struct io_uring_sqe *sqe = redisIoUringGetSqe(e->ring);
+    if (sqe == NULL)
+        return REDIS_ERR;
+
+    sqe->opcode = opcode;
+    sqe->fd = e->fd;
+    sqe->addr = (unsigned long)buf;
+    sqe->len = len;
+    sqe->user_data = (unsigned long long)(unsigned long)e | tag;
+    if (opcode == IORING_OP_RECV && buf == NULL) {
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = REDIS_IOURING_BGID;
+        if (e->ring->multishot)
+            sqe->ioprio = IORING_RECV_MULTISHOT;
+    } else if (opcode == IORING_OP_POLL_ADD) {
+        sqe->poll32_events = POLLOUT;
+    } else if (opcode == IORING_OP_SEND) {
+        sqe->msg_flags = MSG_NOSIGNAL;
+    } else if (opcode == IORING_OP_TIMEOUT) {
+        sqe->fd = -1;
+    }
+    e->inflight++;
+    return REDIS_OK;
+}
+
+static void redisIoUringArmRecv(redisIoUringEvents *e) {
+    if (e->receiving || e->context == NULL)
+        return;
+    if (e->ring->br == NULL) {
+        if (e->rbuf == NULL && (e->rbuf = (char*)malloc(REDIS_IOURING_BUFSIZE)) == NULL)
+            return;
+        if (redisIoUringQueue(e,IORING_OP_RECV,REDIS_IOURING_OP_RECV,
+                              e->rbuf,REDIS_IOURING_BUFSIZE) != REDIS_OK)
+            return;
+    } else {
+        if (redisIoUringQueue(e,IORING_OP_RECV,REDIS_IOURING_OP_RECV,
+                              NULL,0) != REDIS_OK)
+            return;
+    }
+    e->receiving = 1;
+}
+
+/* Send the output buffer. It is detached from the context first, because
+ * the kernel may still read from it after the call returns while new
+ * commands are appended to a fresh buffer. */
+static void redisIoUringSend(redisIoUringEvents *e) {
+    redisContext *c;
+    sds empty;
+
+    if (e->sending || e->context == NULL)
+        return;
+    c = &(e->context->c);
+    if (e->sbuf == NULL) {
+        if (sdslen(c->obuf) == 0 || (empty = sdsempty()) == NULL)
+            return;
+        e->sbuf = c->obuf;
+        e->soff = 0;
+        c->obuf = empty;
+    }
+    if (redisIoUringQueue(e,IORING_OP_SEND,REDIS_IOURING_OP_SEND,
+            e->sbuf+e->soff,(unsigned)(sdslen(e->sbuf)-e->soff)) == REDIS_OK)
+        e->sending = 1;
+}
+
+/* Queue sends for every context with pending output. */
+static void redisIoUringFlush(redisIoUring *r) {
+    redisIoUringEvents *e;
+
+    while ((e = r->flush) != NULL) {
+        r->flush = e->next;
+        e->next = NULL;
+        e->flushing = 0;
+        redisIoUringSend(e);
+    }
+}
+
+static void redisIoUringRelease(redisIoUringEvents *e) {
+    if (e->context != NULL || e->inflight > 0)
+        return;
+    if (e->sbuf != NULL)
+        sdsfree(e->sbuf);
+    free(e->rbuf);
+    free(e);
+}
+
+static void redisIoUringComplete(redisIoUring *r, struct io_uring_cqe *cqe) {
+    unsigned long long tag = cqe->user_data & REDIS_IOURING_OP_MASK;
+    redisIoUringEvents *e;
+    redisIoUringSync *sync;
+    unsigned short bid;
+    char *buf;
+    int res = cqe->res;
+
+    if (cqe->user_data == 0)
+        return;
+
+    if (tag == REDIS_IOURING_OP_SYNC) {
+        sync = (redisIoUringSync*)(unsigned long)(cqe->user_data & ~(unsigned long long)REDIS_IOURING_OP_MASK);
+        sync->res = res;
+        sync->done = 1;
+        return;
+    }
+
+    e = (redisIoUringEvents*)(unsigned long)(cqe->user_data & ~(unsigned long long)REDIS_IOURING_OP_MASK);
+    if (!(cqe->flags & IORING_CQE_F_MORE))
+        e->inflight--;
+
+    /* Callbacks may free the context, which must not free e under our feet. */
+    e->inflight++;
+    if (tag == REDIS_IOURING_OP_RECV) {
+        if (!(cqe->flags & IORING_CQE_F_MORE))
+            e->receiving = 0;
+
+        if (res == -ENOBUFS || (res == -EINVAL && r->multishot)) {
+            /* Out of buffers, or no multishot receive on this kernel. */
+            if (res == -EINVAL)
+                r->multishot = 0;
+            redisIoUringArmRecv(e);
+        } else if (e->context != NULL) {
+            buf = e->rbuf;
+            if (cqe->flags & IORING_CQE_F_BUFFER) {
+                bid = (unsigned short)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+                buf = r->bufs+(size_t)bid*REDIS_IOURING_BUFSIZE;
+            }
+            if (res < 0) {
+                errno = -res;
+                res = -1;
+            }
+            redisAsyncHandleReadCompletion(e->context,buf,res);
+            if (cqe->flags & IORING_CQE_F_BUFFER)
+                redisIoUringRecycle(r,bid);
+            if (res > 0)
+                redisIoUringArmRecv(e);
+        } else if (cqe->flags & IORING_CQE_F_BUFFER) {
+            redisIoUringRecycle(r,(unsigned short)(cqe->flags >> IORING_CQE_BUFFER_SHIFT));
+        }
+    } else if (tag == REDIS_IOURING_OP_SEND) {
+        e->sending = 0;
+        if (res > 0)
+            e->soff += (size_t)res;
+        if (res < 0 || e->soff == sdslen(e->sbuf)) {
+            sdsfree(e->sbuf);
+            e->sbuf = NULL;
+        }
+        if (res < 0 && e->context != NULL) {
+            errno = -res;
+            redisAsyncHandleWriteCompletion(e->context,-1);
+        } else {
+            /* Send the rest of this buffer or whatever was appended. */
+            redisIoUringSend(e);
+        }
+    } else if (tag == REDIS_IOURING_OP_TIMEOUT) {
+        /* Timeouts that were replaced by an earlier one are not removed and
+         * fire later on, which redisAsyncHandleTimeout() copes with. */
+        e->timers--;
+        if (res == -ETIME && e->context != NULL)
+            redisAsyncHandleTimeout(e->context);
+    } else if (tag == REDIS_IOURING_OP_POLL) {
+        /* The socket became writable: the connection is established. The
+         * regular handler checks the socket and flushes the first commands. */
+        e->polling = 0;
+        if (e->context != NULL)
+            redisAsyncHandleWrite(e->context);
+    }
+
+    e->inflight--;
+    redisIoUringRelease(e);
+}
+
+/* Process every completion that is available. */
+static int redisIoUringReap(redisIoUring *r) {
+    unsigned head, tail;
+    struct io_uring_cqe cqe;
+    int n = 0;
+
+    head = *r->cq_head;
+    while (1) {
+        tail = __atomic_load_n(r->cq_tail,__ATOMIC_ACQUIRE);
+        if (head == tail)
+            break;
+        /* Copy the entry and release its slot before running callbacks,
+         * which may end up submitting and reaping from the ring again. */
+        memcpy(&cqe,&r->cqes[head & *r->cq_mask],sizeof(cqe));
+        head++;
+        __atomic_store_n(r->cq_head,head,__ATOMIC_RELEASE);
+        redisIoUringComplete(r,&cqe);
+        head = *r->cq_head;
+        n++;
+    }
+    return n;
+}
+
+static void redisIoUringAddRead(void *privdata) {
+    redisIoUringEvents *e = (redisIoUringEvents*)privdata;
+    redisIoUringArmRecv(e);
+}
+
+static void redisIoUringCleanup(void *privdata);
+
+/* The receive stays armed otherwise: replies can only arrive when asked for.
+ * Reads are only stopped when the connection dropped and the context is going
+ * to reconnect on the same descriptor. What is still in flight belongs to the
+ * old socket, so it is left to the events struct, which is retired like on
+ * cleanup, and the context continues with a fresh one. */
+static void redisIoUringDelRead(void *privdata) {
+    redisIoUringEvents *e = (redisIoUringEvents*)privdata, *fresh;
+    redisAsyncContext *ac = e->context;
+
+    if (ac == NULL || (fresh = (redisIoUringEvents*)calloc(1,sizeof(*fresh))) == NULL)
+        return;
+    fresh->context = ac;
+    fresh->ring = e->ring;
+    fresh->fd = e->fd;
+    e->ring->contexts++;
+    redisIoUringCleanup(e);
+    ac->ev.data = fresh;
+}
+
+static void redisIoUringAddWrite(void *privdata) {
+    redisIoUringEvents *e = (redisIoUringEvents*)privdata;
+    redisContext *c = &(e->context->c);
+
+    if (!(c->flags & REDIS_CONNECTED)) {
+        /* Wait for connect(2) to finish before sending anything. */
+        if (!e->polling &&
+            redisIoUringQueue(e,IORING_OP_POLL_ADD,REDIS_IOURING_OP_POLL,
+                              NULL,0) == REDIS_OK)
+            e->polling = 1;
+        return;
+    }
+    if (!e->flushing) {
+        e->flushing = 1;
+        e->next = e->ring->flush;
+        e->ring->flush = e;
+    }
+}
+
+static void redisIoUringDelWrite(void *privdata) {
+    ((void)privdata);
+}
+
+static void redisIoUringScheduleTimer(void *privdata, struct timeval tv) {
+    redisIoUringEvents *e = (redisIoUringEvents*)privdata;
+
+    /* The kernel copies the timespec when the SQE is submitted. */
+    e->timer_ts.tv_sec = tv.tv_sec;
+    e->timer_ts.tv_nsec = tv.tv_usec*1000;
+    if (redisIoUringQueue(e,IORING_OP_TIMEOUT,REDIS_IOURING_OP_TIMEOUT,
+                          &e->timer_ts,1) == REDIS_OK)
+        e->timers++;
+}
+
+static void redisIoUringCleanup(void *privdata) {
+    redisIoUringEvents *e = (redisIoUringEvents*)privdata;
+    redisIoUringEvents **pe;
+    struct io_uring_sqe *sqe;
+    int i;
+
+    /* Operations that are still in flight keep a reference on the socket, so
+     * the armed receive is cancelled. The events struct is freed once the
+     * kernel completed everything that points at it. */
+    e->context = NULL;
+    e->ring->contexts--;
+    for (pe = &e->ring->flush; *pe != NULL; pe = &(*pe)->next) {
+        if (*pe == e) {
+            *pe = e->next;
+            break;
+        }
+    }
+    if (e->receiving && (sqe = redisIoUringGetSqe(e->ring)) != NULL) {
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = (unsigned long long)(unsigned long)e | REDIS_IOURING_OP_RECV;
+    }
+    if (e->polling && (sqe = redisIoUringGetSqe(e->ring)) != NULL) {
+        sqe->opcode = IORING_OP_POLL_REMOVE;
+        sqe->fd = -1;
+        sqe->addr = (unsigned long long)(unsigned long)e | REDIS_IOURING_OP_POLL;
+    }
+    for (i = 0; i < e->timers && (sqe = redisIoUringGetSqe(e->ring)) != NULL; i++) {
+        sqe->opcode = IORING_OP_TIMEOUT_REMOVE;
+        sqe->fd = -1;
+        sqe->addr = (unsigned long long)(unsigned long)e | REDIS_IOURING_OP_TIMEOUT;
+    }
+    redisIoUringRelease(e);
+}
+
+static int redisIoUringAttach(redisIoUring *r, redisAsyncContext *ac) {
+    redisContext *c = &(ac->c);
+    redisIoUringEvents *e;
+
+    /* Nothing should be attached when something is already attached */
+    if (ac->ev.data != NULL)
+        return REDIS_ERR;
+
+    /* Create container for context and r/w events */
+    e = (redisIoUringEvents*)calloc(1,sizeof(*e));
+    if (e == NULL)
+        return REDIS_ERR;
+    e->context = ac;
+    e->ring = r;
+    e->fd = c->fd;
+
+    /* Register functions to start/stop listening for events */
+    ac->ev.addRead = redisIoUringAddRead;
+    ac->ev.delRead = redisIoUringDelRead;
+    ac->ev.addWrite = redisIoUringAddWrite;
+    ac->ev.delWrite = redisIoUringDelWrite;
+    ac->ev.cleanup = redisIoUringCleanup;
+    ac->ev.scheduleTimer = redisIoUringScheduleTimer;
+    ac->ev.data = e;
+    r->contexts++;
+
+    return REDIS_OK;
+}
+
+/* Run one iteration of the loop: submit everything that was queued, wait up
+ * to timeout_ms (-1 is forever) for at least one completion and process all
+ * completions. Returns the number of processed completions or -1 on error. */
+static inline int redisIoUringRunOnce(redisIoUring *r, long timeout_ms) {
+    int n;
+
+    redisIoUringFlush(r);
+    if (redisIoUringSubmit(r,1,timeout_ms) < 0)
+        return -1;
+    n = redisIoUringReap(r);
+    redisIoUringFlush(r);
+    return n;
+}
+
+/* Run the loop until no context is attached anymore. */
+static inline int redisIoUringRun(redisIoUring *r) {
+    while (r->contexts > 0 || r->queued > 0) {
+        if (redisIoUringRunOnce(r,-1) < 0)
+            return REDIS_ERR;
+    }
+    return REDIS_OK;
+}
+
+/* Queue an operation for a blocking context. When "ts" is not NULL, a linked
+ * timeout cancels the operation after that long, as the socket timeouts of
+ * the context don't apply to io_uring. */
+static int redisIoUringSyncOp(redisIoUring *r, unsigned char opcode, int fd,
+                              void *buf, unsigned len, redisIoUringSync *sync,
+                              struct __kernel_timespec *ts) {
+    struct io_uring_sqe *sqe, *link;
+    unsigned head = __atomic_load_n(r->sq_head,__ATOMIC_ACQUIRE);
+
+    /* Both entries have to go out in the same submission */
+    if (ts != NULL && *r->sq_tail-head+2 > *r->sq_mask+1 && redisIoUringSubmit(r,0,0) < 0)
+        return -1;
+    if ((sqe = redisIoUringGetSqe(r)) == NULL)
+        return -1;
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long)buf;
+    sqe->len = len;
+    if (opcode == IORING_OP_SEND)
+        sqe->msg_flags = MSG_NOSIGNAL|MSG_WAITALL;
+    sqe->user_data = (unsigned long long)(unsigned long)sync | REDIS_IOURING_OP_SYNC;
+    sync->done = 0;
+
+    /* The timeout's own completion has no user data and is ignored */
+    if (ts != NULL && (link = redisIoUringGetSqe(r)) != NULL) {
+        sqe->flags |= IOSQE_IO_LINK;
+        link->opcode = IORING_OP_LINK_TIMEOUT;
+        link->fd = -1;
+        link->addr = (unsigned long)ts;
+        link->len = 1;
+    }
+    return 0;
+}
+
+/* Wait until "a" completed, or "b" when it is not NULL, processing the
+ * completions of asynchronous contexts sharing the ring in the meantime. */
+static int redisIoUringWaitSync(redisIoUring *r, redisIoUringSync *a, redisIoUringSync *b) {
+    while (!a->done && (b == NULL || !b->done)) {
+        if (redisIoUringSubmit(r,1,-1) < 0)
+            return -1;
+        redisIoUringReap(r);
+    }
+    return 0;
+}
+
+/* Cancel an operation and wait until the kernel is done with it, as it may
+ * point at the stack of the caller. */
+static void redisIoUringCancelSync(redisIoUring *r, redisIoUringSync *sync) {
+    struct io_uring_sqe *sqe;
+
+    if (!sync->done && (sqe = redisIoUringGetSqe(r)) != NULL) {
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = (unsigned long long)(unsigned long)sync | REDIS_IOURING_OP_SYNC;
+    }
+    while (!sync->done) {
+        redisIoUringSubmit(r,1,-1);
+        redisIoUringReap(r);
+    }
+}
+
+/* Result of a blocking operation as errno, with a timeout like SO_RCVTIMEO
+ * and SO_SNDTIMEO report it. */
+static int redisIoUringSyncErrno(int res) {
+    return res == -ECANCELED ? EAGAIN : -res;
+}
+
+/* Blocking-context mode: the equivalent of redisGetReply() where the output
+ * buffer is sent and the first read is issued with a single system call. The
+ * connect timeout of the context limits every send and receive, like it does
+ * through the socket options otherwise. No operation is left in flight on
+ * return. */
+static inline int redisIoUringGetReply(redisIoUring *r, redisContext *c, void **reply) {
+    redisIoUringSync send, recv;
+    struct __kernel_timespec ts, *tsp = NULL;
+    char buf[REDIS_IOURING_BUFSIZE];
+    void *aux = NULL;
+    int sending = 0, receiving = 0, status = REDIS_OK;
+
+    if (redisGetReplyFromReader(c,&aux) == REDIS_ERR)
+        return REDIS_ERR;
+
+    if (aux == NULL && c->flags & REDIS_BLOCK) {
+        if (c->timeout != NULL && (c->timeout->tv_sec || c->timeout->tv_usec)) {
+            ts.tv_sec = c->timeout->tv_sec;
+            ts.tv_nsec = (long long)c->timeout->tv_usec*1000;
+            tsp = &ts;
+        }
+
+        do {
+            if (!sending && sdslen(c->obuf) > 0) {
+                if (redisIoUringSyncOp(r,IORING_OP_SEND,c->fd,c->obuf,
+                                       (unsigned)sdslen(c->obuf),&send,tsp) < 0)
+                    break;
+                sending = 1;
+            }
+            if (!receiving) {
+                if (redisIoUringSyncOp(r,IORING_OP_RECV,c->fd,buf,sizeof(buf),&recv,tsp) < 0)
+                    break;
+                receiving = 1;
+            }
+            if (redisIoUringWaitSync(r,&recv,sending ? &send : NULL) < 0)
+                break;
+
+            if (sending && send.done) {
+                sending = 0;
+                if (send.res < 0) {
+                    errno = redisIoUringSyncErrno(send.res);
+                    break;
+                }
+                sdsrange(c->obuf,send.res,-1);
+            }
+            if (receiving && recv.done) {
+                receiving = 0;
+                if (recv.res < 0) {
+                    errno = redisIoUringSyncErrno(recv.res);
+                    recv.res = -1;
+                }
+                if (redisBufferFeed(c,buf,recv.res) == REDIS_ERR ||
+                    redisGetReplyFromReader(c,&aux) == REDIS_ERR)
+                {
+                    status = REDIS_ERR;
+                    break;
+                }
+            }
+        } while (aux == NULL);
+
+        if (aux == NULL && status == REDIS_OK) {
+            /* Broke out on a failed submission or send */
+            redisBufferFeed(c,NULL,-1);
+            status = REDIS_ERR;
+        }
+        if (receiving)
+            redisIoUringCancelSync(r,&recv);
+        if (sending) {
+            /* The reply came before the rest of a pipeline was sent: the
+             * send has to finish, or the stream would be cut in the middle
+             * of a command. Its linked timeout still bounds it. */
+            if (status == REDIS_OK)
+                redisIoUringWaitSync(r,&send,NULL);
+            redisIoUringCancelSync(r,&send);
+            if (send.res >= 0) {
+                sdsrange(c->obuf,send.res,-1);
+            } else if (status == REDIS_OK) {
+                errno = redisIoUringSyncErrno(send.res);
+                redisBufferFeed(c,NULL,-1);
+            }
+        }
+        if (status != REDIS_OK)
+            return REDIS_ERR;
+    }
+
+    if (reply != NULL) *reply = aux;
+    return REDIS_OK;
+}
+
+#endif
@@ -7,6 +7,7 @@
 typedef struct redisIvykisEvents {
     redisAsyncContext *context;
     struct iv_fd fd;
+    struct iv_timer timer;
 } redisIvykisEvents;
 
 static void redisIvykisReadEvent(void *arg) {
@@ -19,30 +20,69 @@ static void redisIvykisWriteEvent(void *arg) {
     redisAsyncHandleWrite(context);
 }
 
+/* After a reconnect the descriptor refers to a new socket, which has to be
+ * registered again. */
+static void redisIvykisRegister(redisIvykisEvents *e) {
+    if (!iv_fd_registered(&e->fd)) {
+        e->fd.handler_in = NULL;
+        e->fd.handler_out = NULL;
+        iv_fd_register(&e->fd);
+    }
+}
+
 static void redisIvykisAddRead(void *privdata) {
     redisIvykisEvents *e = (redisIvykisEvents*)privdata;
+    redisIvykisRegister(e);
     iv_fd_set_handler_in(&e->fd, redisIvykisReadEvent);
 }
 
+/* Reads are only stopped when the connection dropped. */
 static void redisIvykisDelRead(void *privdata) {
     redisIvykisEvents *e = (redisIvykisEvents*)privdata;
-    iv_fd_set_handler_in(&e->fd, NULL);
+    if (iv_fd_registered(&e->fd))
+        iv_fd_unregister(&e->fd);
 }
 
 static void redisIvykisAddWrite(void *privdata) {
     redisIvykisEvents *e = (redisIvykisEvents*)privdata;
+    redisIvykisRegister(e);
     iv_fd_set_handler_out(&e->fd, redisIvykisWriteEvent);
 }
 
 static void redisIvykisDelWrite(void *privdata) {
     redisIvykisEvents *e = (redisIvykisEvents*)privdata;
-    iv_fd_set_handler_out(&e->fd, NULL);
+    if (iv_fd_registered(&e->fd))
+        iv_fd_set_handler_out(&e->fd, NULL);
+}
+
+static void redisIvykisTimeout(void *arg) {
+    redisAsyncContext *context = (redisAsyncContext *)arg;
+    redisAsyncHandleTimeout(context);
+}
+
+static void redisIvykisScheduleTimer(void *privdata, struct timeval tv) {
+    redisIvykisEvents *e = (redisIvykisEvents*)privdata;
+
+    if (iv_timer_registered(&e->timer))
+        iv_timer_unregister(&e->timer);
+    iv_validate_now();
+    e->timer.expires = iv_now;
+    e->timer.expires.tv_sec += tv.tv_sec;
+    e->timer.expires.tv_nsec += tv.tv_usec * 1000;
+    if (e->timer.expires.tv_nsec >= 1000000000) {
+        e->timer.expires.tv_sec++;
+        e->timer.expires.tv_nsec -= 1000000000;
+    }
+    iv_timer_register(&e->timer);
 }
 
 static void redisIvykisCleanup(void *privdata) {
     redisIvykisEvents *e = (redisIvykisEvents*)privdata;
 
-    iv_fd_unregister(&e->fd);
+    if (iv_fd_registered(&e->fd))
+        iv_fd_unregister(&e->fd);
+    if (iv_timer_registered(&e->timer))
+        iv_timer_unregister(&e->timer);
     free(e);
 }
 
@@ -64,6 +104,7 @@ static int redisIvykisAttach(redisAsyncContext *ac) {
     ac->ev.addWrite = redisIvykisAddWrite;
     ac->ev.delWrite = redisIvykisDelWrite;
     ac->ev.cleanup = redisIvykisCleanup;
+    ac->ev.scheduleTimer = redisIvykisScheduleTimer;
     ac->ev.data = e;
 
     /* Initialize and install read/write events */
@@ -76,6 +117,10 @@ static int redisIvykisAttach(redisAsyncContext *ac) {
 
     iv_fd_register(&e->fd);
 
+    IV_TIMER_INIT(&e->timer);
+    e->timer.cookie = e->context;
+    e->timer.handler = redisIvykisTimeout;
+
     return REDIS_OK;
 }
 #endif
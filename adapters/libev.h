@@ -41,6 +41,7 @@ typedef struct redisLibevEvents {
     struct ev_loop *loop;
     int reading, writing;
     ev_io rev, wev;
+    ev_timer timer;
 } redisLibevEvents;
 
 static void redisLibevReadEvent(EV_P_ ev_io *watcher, int revents) {
@@ -103,10 +104,34 @@ static void redisLibevDelWrite(void *privdata) {
     }
 }
 
+static void redisLibevTimeout(EV_P_ ev_timer *timer, int revents) {
+#if EV_MULTIPLICITY
+    ((void)loop);
+#endif
+    ((void)revents);
+
+    redisLibevEvents *e = (redisLibevEvents*)timer->data;
+    redisAsyncHandleTimeout(e->context);
+}
+
+static void redisLibevScheduleTimer(void *privdata, struct timeval tv) {
+    redisLibevEvents *e = (redisLibevEvents*)privdata;
+    struct ev_loop *loop = e->loop;
+    ((void)loop);
+
+    ev_timer_stop(EV_A_ &e->timer);
+    ev_timer_set(&e->timer,tv.tv_sec+tv.tv_usec/1000000.0,0);
+    ev_timer_start(EV_A_ &e->timer);
+}
+
 static void redisLibevCleanup(void *privdata) {
     redisLibevEvents *e = (redisLibevEvents*)privdata;
+    struct ev_loop *loop = e->loop;
+    ((void)loop);
+
     redisLibevDelRead(privdata);
     redisLibevDelWrite(privdata);
+    ev_timer_stop(EV_A_ &e->timer);
     free(e);
 }
 
@@ -129,6 +154,7 @@ static int redisLibevAttach(EV_P_ redisAsyncContext *ac) {
     e->reading = e->writing = 0;
     e->rev.data = e;
     e->wev.data = e;
+    e->timer.data = e;
 
     /* Register functions to start/stop listening for events */
     ac->ev.addRead = redisLibevAddRead;
@@ -136,11 +162,13 @@ static int redisLibevAttach(EV_P_ redisAsyncContext *ac) {
     ac->ev.addWrite = redisLibevAddWrite;
     ac->ev.delWrite = redisLibevDelWrite;
     ac->ev.cleanup = redisLibevCleanup;
+    ac->ev.scheduleTimer = redisLibevScheduleTimer;
     ac->ev.data = e;
 
     /* Initialize read/write events */
     ev_io_init(&e->rev,redisLibevReadEvent,c->fd,EV_READ);
     ev_io_init(&e->wev,redisLibevWriteEvent,c->fd,EV_WRITE);
+    ev_timer_init(&e->timer,redisLibevTimeout,0,0);
     return REDIS_OK;
 }
 
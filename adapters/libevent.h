@@ -36,7 +36,7 @@
 
 typedef struct redisLibeventEvents {
     redisAsyncContext *context;
-    struct event *rev, *wev;
+    struct event *rev, *wev, *timer;
 } redisLibeventEvents;
 
 static void redisLibeventReadEvent(int fd, short event, void *arg) {
@@ -71,10 +71,22 @@ static void redisLibeventDelWrite(void *privdata) {
     event_del(e->wev);
 }
 
+static void redisLibeventTimeout(int fd, short event, void *arg) {
+    ((void)fd); ((void)event);
+    redisLibeventEvents *e = (redisLibeventEvents*)arg;
+    redisAsyncHandleTimeout(e->context);
+}
+
+static void redisLibeventScheduleTimer(void *privdata, struct timeval tv) {
+    redisLibeventEvents *e = (redisLibeventEvents*)privdata;
+    evtimer_add(e->timer,&tv);
+}
+
 static void redisLibeventCleanup(void *privdata) {
     redisLibeventEvents *e = (redisLibeventEvents*)privdata;
     event_free(e->rev);
     event_free(e->wev);
+    event_free(e->timer);
     free(e);
 }
 
@@ -96,11 +108,13 @@ static int redisLibeventAttach(redisAsyncContext *ac, struct event_base *base) {
     ac->ev.addWrite = redisLibeventAddWrite;
     ac->ev.delWrite = redisLibeventDelWrite;
     ac->ev.cleanup = redisLibeventCleanup;
+    ac->ev.scheduleTimer = redisLibeventScheduleTimer;
     ac->ev.data = e;
 
     /* Initialize and install read/write events */
     e->rev = event_new(base, c->fd, EV_READ, redisLibeventReadEvent, e);
     e->wev = event_new(base, c->fd, EV_WRITE, redisLibeventWriteEvent, e);
+    e->timer = evtimer_new(base, redisLibeventTimeout, e);
     event_add(e->rev, NULL);
     event_add(e->wev, NULL);
     return REDIS_OK;
@@ -9,7 +9,9 @@
 typedef struct redisLibuvEvents {
   redisAsyncContext* context;
   uv_poll_t          handle;
+  uv_timer_t         timer;
   int                events;
+  int                handles; /* handles not closed yet */
 } redisLibuvEvents;
 
 
@@ -73,10 +75,29 @@ static void redisLibuvDelWrite(void *privdata) {
 }
 
 
+static void redisLibuvTimeout(uv_timer_t* timer) {
+  redisLibuvEvents* p = (redisLibuvEvents*)timer->data;
+
+  if (p->context != NULL) {
+    redisAsyncHandleTimeout(p->context);
+  }
+}
+
+
+static void redisLibuvScheduleTimer(void *privdata, struct timeval tv) {
+  redisLibuvEvents* p = (redisLibuvEvents*)privdata;
+  uint64_t ms = tv.tv_sec * 1000 + (tv.tv_usec + 999) / 1000;
+
+  uv_timer_start(&p->timer, redisLibuvTimeout, ms, 0);
+}
+
+
 static void on_close(uv_handle_t* handle) {
   redisLibuvEvents* p = (redisLibuvEvents*)handle->data;
 
-  free(p);
+  if (--p->handles == 0) {
+    free(p);
+  }
 }
 
 
@@ -85,6 +106,7 @@ static void redisLibuvCleanup(void *privdata) {
 
   p->context = NULL; // indicate that context might no longer exist
   uv_close((uv_handle_t*)&p->handle, on_close);
+  uv_close((uv_handle_t*)&p->timer, on_close);
 }
 
 
@@ -100,6 +122,7 @@ static int redisLibuvAttach(redisAsyncContext* ac, uv_loop_t* loop) {
   ac->ev.addWrite = redisLibuvAddWrite;
   ac->ev.delWrite = redisLibuvDelWrite;
   ac->ev.cleanup  = redisLibuvCleanup;
+  ac->ev.scheduleTimer = redisLibuvScheduleTimer;
 
   redisLibuvEvents* p = (redisLibuvEvents*)malloc(sizeof(*p));
 
@@ -112,10 +135,13 @@ static int redisLibuvAttach(redisAsyncContext* ac, uv_loop_t* loop) {
   if (uv_poll_init(loop, &p->handle, c->fd) != 0) {
     return REDIS_ERR;
   }
+  uv_timer_init(loop, &p->timer);
 
   ac->ev.data    = p;
   p->handle.data = p;
+  p->timer.data  = p;
   p->context     = ac;
+  p->handles     = 2;
 
   return REDIS_OK;
 }
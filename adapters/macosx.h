@@ -15,10 +15,21 @@ typedef struct {
     redisAsyncContext *context;
     CFSocketRef socketRef;
     CFRunLoopSourceRef sourceRef;
+    CFRunLoopRef runLoop;
+    CFRunLoopTimerRef timerRef;
 } RedisRunLoop;
 
+static void redisMacOSDelTimer(RedisRunLoop *redisRunLoop) {
+    if( redisRunLoop->timerRef != NULL ) {
+        CFRunLoopTimerInvalidate(redisRunLoop->timerRef);
+        CFRelease(redisRunLoop->timerRef);
+        redisRunLoop->timerRef = NULL;
+    }
+}
+
 static int freeRedisRunLoop(RedisRunLoop* redisRunLoop) {
     if( redisRunLoop != NULL ) {
+        redisMacOSDelTimer(redisRunLoop);
         if( redisRunLoop->sourceRef != NULL ) {
             CFRunLoopSourceInvalidate(redisRunLoop->sourceRef);
             CFRelease(redisRunLoop->sourceRef);
@@ -52,6 +63,24 @@ static void redisMacOSDelWrite(void *privdata) {
     CFSocketDisableCallBacks(redisRunLoop->socketRef, kCFSocketWriteCallBack);
 }
 
+static void redisMacOSTimeout(CFRunLoopTimerRef __unused timer, void *info) {
+    RedisRunLoop *redisRunLoop = (RedisRunLoop*)info;
+    redisMacOSDelTimer(redisRunLoop);
+    redisAsyncHandleTimeout(redisRunLoop->context);
+}
+
+static void redisMacOSScheduleTimer(void *privdata, struct timeval tv) {
+    RedisRunLoop *redisRunLoop = (RedisRunLoop*)privdata;
+    CFRunLoopTimerContext timerCtx = { 0, redisRunLoop, NULL, NULL, NULL };
+    CFAbsoluteTime fireDate = CFAbsoluteTimeGetCurrent() + tv.tv_sec + tv.tv_usec / 1000000.0;
+
+    redisMacOSDelTimer(redisRunLoop);
+    redisRunLoop->timerRef = CFRunLoopTimerCreate(NULL, fireDate, 0, 0, 0,
+                                                  redisMacOSTimeout, &timerCtx);
+    if( redisRunLoop->timerRef )
+        CFRunLoopAddTimer(redisRunLoop->runLoop, redisRunLoop->timerRef, kCFRunLoopDefaultMode);
+}
+
 static void redisMacOSCleanup(void *privdata) {
     RedisRunLoop *redisRunLoop = (RedisRunLoop*)privdata;
     freeRedisRunLoop(redisRunLoop);
@@ -85,12 +114,14 @@ static int redisMacOSAttach(redisAsyncContext *redisAsyncCtx, CFRunLoopRef runLo
 
     /* Setup redis stuff */
     redisRunLoop->context = redisAsyncCtx;
+    redisRunLoop->runLoop = runLoop;
 
     redisAsyncCtx->ev.addRead  = redisMacOSAddRead;
     redisAsyncCtx->ev.delRead  = redisMacOSDelRead;
     redisAsyncCtx->ev.addWrite = redisMacOSAddWrite;
     redisAsyncCtx->ev.delWrite = redisMacOSDelWrite;
     redisAsyncCtx->ev.cleanup  = redisMacOSCleanup;
+    redisAsyncCtx->ev.scheduleTimer = redisMacOSScheduleTimer;
     redisAsyncCtx->ev.data     = redisRunLoop;
 
     /* Initialize and install read/write events */
@@ -26,6 +26,7 @@
 #ifndef __HIREDIS_QT_H__
 #define __HIREDIS_QT_H__
 #include <QSocketNotifier>
+#include <QTimer>
 #include "../async.h"
 
 static void RedisQtAddRead(void *);
@@ -33,6 +34,7 @@ static void RedisQtDelRead(void *);
 static void RedisQtAddWrite(void *);
 static void RedisQtDelWrite(void *);
 static void RedisQtCleanup(void *);
+static void RedisQtScheduleTimer(void *, struct timeval);
 
 class RedisQtAdapter : public QObject {
 
@@ -68,9 +70,18 @@ class RedisQtAdapter : public QObject {
         a->cleanup();
     }
 
+    friend
+    void RedisQtScheduleTimer(void * adapter, struct timeval tv) {
+        RedisQtAdapter * a = static_cast<RedisQtAdapter *>(adapter);
+        a->scheduleTimer(tv);
+    }
+
     public:
         RedisQtAdapter(QObject * parent = 0)
-            : QObject(parent), m_ctx(0), m_read(0), m_write(0) { }
+            : QObject(parent), m_ctx(0), m_read(0), m_write(0) {
+            m_timer.setSingleShot(true);
+            connect(&m_timer, SIGNAL(timeout()), this, SLOT(timeout()));
+        }
 
         ~RedisQtAdapter() {
             if (m_ctx != 0) {
@@ -89,6 +100,7 @@ class RedisQtAdapter : public QObject {
             m_ctx->ev.addWrite = RedisQtAddWrite;
             m_ctx->ev.delWrite = RedisQtDelWrite;
             m_ctx->ev.cleanup = RedisQtCleanup;
+            m_ctx->ev.scheduleTimer = RedisQtScheduleTimer;
             return REDIS_OK;
         }
 
@@ -117,19 +129,26 @@ class RedisQtAdapter : public QObject {
             m_write = 0;
         }
 
+        void scheduleTimer(struct timeval tv) {
+            m_timer.start(tv.tv_sec * 1000 + (tv.tv_usec + 999) / 1000);
+        }
+
         void cleanup() {
             delRead();
             delWrite();
+            m_timer.stop();
         }
 
     private slots:
         void read() { redisAsyncHandleRead(m_ctx); }
         void write() { redisAsyncHandleWrite(m_ctx); }
+        void timeout() { redisAsyncHandleTimeout(m_ctx); }
 
     private:
         redisAsyncContext * m_ctx;
         QSocketNotifier * m_read;
         QSocketNotifier * m_write;
+        QTimer m_timer;
 };
 
 #endif /* !__HIREDIS_QT_H__ */
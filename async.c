@@ -36,18 +36,25 @@
 #include <assert.h>
 #include <ctype.h>
 #include <errno.h>
+#include <time.h>
+#include <unistd.h>
 #include "async.h"
 #include "net.h"
+#include "dns.h"
 #include "dict.c"
 #include "sds.h"
 
 #define _EL_ADD_READ(ctx) do { \
+        if ((ctx)->c.flags & REDIS_RECONNECTING) break; \
+        __redisAsyncScheduleTimer(ctx); \
         if ((ctx)->ev.addRead) (ctx)->ev.addRead((ctx)->ev.data); \
     } while(0)
 #define _EL_DEL_READ(ctx) do { \
         if ((ctx)->ev.delRead) (ctx)->ev.delRead((ctx)->ev.data); \
     } while(0)
 #define _EL_ADD_WRITE(ctx) do { \
+        if ((ctx)->c.flags & REDIS_RECONNECTING) break; \
+        __redisAsyncScheduleTimer(ctx); \
         if ((ctx)->ev.addWrite) (ctx)->ev.addWrite((ctx)->ev.data); \
     } while(0)
 #define _EL_DEL_WRITE(ctx) do { \
@@ -57,8 +64,49 @@
         if ((ctx)->ev.cleanup) (ctx)->ev.cleanup((ctx)->ev.data); \
     } while(0);
 
+static long long __redisAsyncMsec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return ((long long)ts.tv_sec)*1000+ts.tv_nsec/1000000;
+}
+
+static long long __redisAsyncTimevalMsec(const struct timeval *tv) {
+    return ((long long)tv->tv_sec)*1000+(tv->tv_usec+999)/1000;
+}
+
+/* Make sure the event library fires a timer no later than the earliest
+ * deadline of this context. A single timer per context is enough: replies
+ * arrive in order and any expired deadline tears the connection down, so only
+ * the earliest one matters. "deadline" may be earlier than the deadline that
+ * is actually pending, which only results in a timer that fires early and is
+ * re-armed by redisAsyncHandleTimeout(). */
+static void __redisAsyncScheduleTimer(redisAsyncContext *ac) {
+    struct timeval tv;
+    long long ms;
+
+    if (ac->deadline == 0 || ac->ev.scheduleTimer == NULL)
+        return;
+    if (ac->timer_at != 0 && ac->timer_at <= ac->deadline)
+        return;
+
+    ms = ac->deadline-__redisAsyncMsec();
+    if (ms < 0) ms = 0;
+    tv.tv_sec = ms/1000;
+    tv.tv_usec = (ms%1000)*1000;
+    ac->timer_at = ac->deadline;
+    ac->ev.scheduleTimer(ac->ev.data,tv);
+}
+
+static void __redisAsyncAddDeadline(redisAsyncContext *ac, long long deadline) {
+    if (ac->deadline == 0 || deadline < ac->deadline)
+        ac->deadline = deadline;
+}
+
 /* Forward declaration of function in hiredis.c */
+redisContext *__redisConnectWithFlags(const redisOptions *options, int flags);
 int __redisAppendCommand(redisContext *c, const char *cmd, size_t len);
+void __redisSetError(redisContext *c, int type, const char *str);
+int __redisBufferRead(redisContext *c, int *nread);
 
 /* Functions managing dictionary of callbacks for pub/sub. */
 static unsigned int callbackHash(const void *key) {
@@ -66,6 +114,10 @@ static unsigned int callbackHash(const void *key) {
                                sdslen((const sds)key));
 }
 
+static unsigned int callbackBufferHash(const void *buf, size_t len) {
+    return dictGenHashFunction((const unsigned char *)buf,(int)len);
+}
+
 static void *callbackValDup(void *privdata, const void *src) {
     ((void) privdata);
     redisCallback *dup = malloc(sizeof(*dup));
@@ -83,6 +135,10 @@ static int callbackKeyCompare(void *privdata, const void *key1, const void *key2
     return memcmp(key1,key2,l1) == 0;
 }
 
+static int callbackKeyBufferCompare(const void *key, const void *buf, size_t len) {
+    return sdslen((const sds)key) == len && memcmp(key,buf,len) == 0;
+}
+
 static void callbackKeyDestructor(void *privdata, void *key) {
     ((void) privdata);
     sdsfree((sds)key);
@@ -99,7 +155,9 @@ static dictType callbackDict = {
     callbackValDup,
     callbackKeyCompare,
     callbackKeyDestructor,
-    callbackValDestructor
+    callbackValDestructor,
+    callbackBufferHash,
+    callbackKeyBufferCompare
 };
 
 static redisAsyncContext *redisAsyncInitialize(redisContext *c) {
@@ -119,6 +177,14 @@ static redisAsyncContext *redisAsyncInitialize(redisContext *c) {
     ac->err = 0;
     ac->errstr = NULL;
     ac->data = NULL;
+    ac->read_budget = 0;
+    ac->command_timeout = 0;
+    ac->connect_deadline = 0;
+    ac->deadline = 0;
+    ac->timer_at = 0;
+    ac->ping_interval = 0;
+    ac->ping_at = 0;
+    memset(&ac->reconnect,0,sizeof(ac->reconnect));
 
     ac->ev.data = NULL;
     ac->ev.addRead = NULL;
@@ -126,16 +192,16 @@ static redisAsyncContext *redisAsyncInitialize(redisContext *c) {
     ac->ev.addWrite = NULL;
     ac->ev.delWrite = NULL;
     ac->ev.cleanup = NULL;
+    ac->ev.scheduleTimer = NULL;
 
     ac->onConnect = NULL;
     ac->onDisconnect = NULL;
 
-    ac->replies.head = NULL;
-    ac->replies.tail = NULL;
-    ac->sub.invalid.head = NULL;
-    ac->sub.invalid.tail = NULL;
+    memset(&ac->replies,0,sizeof(ac->replies));
+    memset(&ac->sub.invalid,0,sizeof(ac->sub.invalid));
     ac->sub.channels = dictCreate(&callbackDict,NULL);
     ac->sub.patterns = dictCreate(&callbackDict,NULL);
+    memset(&ac->sub.batch,0,sizeof(ac->sub.batch));
     return ac;
 }
 
@@ -150,11 +216,15 @@ static void __redisAsyncCopyError(redisAsyncContext *ac) {
     ac->errstr = c->errstr;
 }
 
-redisAsyncContext *redisAsyncConnect(const char *ip, int port) {
+/* Same as redisConnectWithOptions(), but the connection is always non-blocking
+ * and a host that needs to be resolved is resolved off the event loop. */
+redisAsyncContext *redisAsyncConnectWithOptions(const redisOptions *options) {
+    redisOptions nonblock = *options;
     redisContext *c;
     redisAsyncContext *ac;
 
-    c = redisConnectNonBlock(ip,port);
+    nonblock.options |= REDIS_OPT_NONBLOCK;
+    c = __redisConnectWithFlags(&nonblock,REDIS_DEFER_LOOKUP);
     if (c == NULL)
         return NULL;
 
@@ -165,23 +235,49 @@ redisAsyncContext *redisAsyncConnect(const char *ip, int port) {
     }
 
     __redisAsyncCopyError(ac);
+    if (ac->err == 0 && options->timeout != NULL)
+        redisAsyncSetConnectTimeout(ac,*options->timeout);
     return ac;
 }
 
+redisAsyncContext *redisAsyncConnect(const char *ip, int port) {
+    redisOptions options;
+
+    memset(&options,0,sizeof(options));
+    REDIS_OPTIONS_SET_TCP(&options,ip,port);
+    return redisAsyncConnectWithOptions(&options);
+}
+
 redisAsyncContext *redisAsyncConnectBind(const char *ip, int port,
                                          const char *source_addr) {
-    redisContext *c = redisConnectBindNonBlock(ip,port,source_addr);
-    redisAsyncContext *ac = redisAsyncInitialize(c);
-    __redisAsyncCopyError(ac);
-    return ac;
+    redisOptions options;
+
+    memset(&options,0,sizeof(options));
+    REDIS_OPTIONS_SET_TCP(&options,ip,port);
+    options.endpoint.tcp.source_addr = source_addr;
+    return redisAsyncConnectWithOptions(&options);
 }
 
 redisAsyncContext *redisAsyncConnectBindWithReuse(const char *ip, int port,
                                                   const char *source_addr) {
-    redisContext *c = redisConnectBindNonBlockWithReuse(ip,port,source_addr);
-    redisAsyncContext *ac = redisAsyncInitialize(c);
-    __redisAsyncCopyError(ac);
-    return ac;
+    redisOptions options;
+
+    memset(&options,0,sizeof(options));
+    REDIS_OPTIONS_SET_TCP(&options,ip,port);
+    options.endpoint.tcp.source_addr = source_addr;
+    options.options = REDIS_OPT_REUSEADDR;
+    return redisAsyncConnectWithOptions(&options);
+}
+
+/* Commands issued before the connection is established go out with the SYN,
+ * see redisConnectFastOpen(). */
+redisAsyncContext *redisAsyncConnectFastOpen(const char *ip, int port) {
+    redisOptions options;
+
+    memset(&options,0,sizeof(options));
+    REDIS_OPTIONS_SET_TCP(&options,ip,port);
+    options.options = REDIS_OPT_FASTOPEN;
+    return redisAsyncConnectWithOptions(&options);
 }
 
 redisAsyncContext *redisAsyncConnectUnix(const char *path) {
@@ -223,43 +319,275 @@ int redisAsyncSetDisconnectCallback(redisAsyncContext *ac, redisDisconnectCallba
     return REDIS_ERR;
 }
 
+/* Let a single read event drain up to "bytes" from the socket before the
+ * replies are parsed and control goes back to the event loop. With the
+ * default of 0, every read event does exactly one read. */
+void redisAsyncSetReadBudget(redisAsyncContext *ac, size_t bytes) {
+    ac->read_budget = bytes;
+}
+
+/* Fail commands that were not answered within "tv": their callbacks are
+ * called with a NULL reply, the error is set to REDIS_ERR_TIMEOUT and the
+ * connection is closed. Applies to commands issued after this call; a zero
+ * timeout disables the deadline. Needs an adapter with a timer. */
+int redisAsyncSetTimeout(redisAsyncContext *ac, const struct timeval tv) {
+    if (tv.tv_sec < 0 || tv.tv_usec < 0)
+        return REDIS_ERR;
+    ac->command_timeout = __redisAsyncTimevalMsec(&tv);
+    return REDIS_OK;
+}
+
+/* Give up connecting when the connection was not established within "tv" from
+ * now. The connect callback is called with REDIS_ERR and the error is set to
+ * REDIS_ERR_TIMEOUT. */
+int redisAsyncSetConnectTimeout(redisAsyncContext *ac, const struct timeval tv) {
+    if ((ac->c.flags & REDIS_CONNECTED) || tv.tv_sec < 0 || tv.tv_usec < 0)
+        return REDIS_ERR;
+    ac->reconnect.connect_timeout = __redisAsyncTimevalMsec(&tv);
+    ac->connect_deadline = __redisAsyncMsec()+ac->reconnect.connect_timeout;
+    __redisAsyncAddDeadline(ac,ac->connect_deadline);
+    __redisAsyncScheduleTimer(ac);
+    return REDIS_OK;
+}
+
+/* Send a PING every "tv" while connected, so a peer that went away unnoticed
+ * is found out by the command timeout, see redisAsyncSetTimeout(), even on a
+ * connection that only receives, such as a subscribed one. A zero interval
+ * stops the PINGs. Needs an adapter with a timer. */
+int redisAsyncSetPingInterval(redisAsyncContext *ac, const struct timeval tv) {
+    if (tv.tv_sec < 0 || tv.tv_usec < 0)
+        return REDIS_ERR;
+    ac->ping_interval = __redisAsyncTimevalMsec(&tv);
+    ac->ping_at = 0;
+    if (ac->ping_interval && (ac->c.flags & REDIS_CONNECTED)) {
+        ac->ping_at = __redisAsyncMsec()+ac->ping_interval;
+        __redisAsyncAddDeadline(ac,ac->ping_at);
+        __redisAsyncScheduleTimer(ac);
+    }
+    return REDIS_OK;
+}
+
+/* Reconnect when the connection drops instead of failing every pending
+ * command. Commands that were not sent yet are kept, as are the commands that
+ * were sent but not answered when their REDIS_CMD_* flags match the "replay"
+ * field of the policy. Subscriptions are restored. Other pending commands fail
+ * with a NULL reply. Commands issued during the outage are sent once the
+ * connection is back, unless their deadline passes first. Only commands that
+ * are issued after this call can be kept. Needs an adapter with a timer.
+ * With "retry_connect" set, a first connect that fails is retried the same
+ * way, and the connect callback is only called once it succeeds. A NULL
+ * policy disables reconnecting. */
+int redisAsyncSetReconnect(redisAsyncContext *ac, const redisReconnectPolicy *policy) {
+    redisContext *c = &(ac->c);
+
+    if (policy == NULL) {
+        ac->reconnect.enabled = 0;
+        return REDIS_OK;
+    }
+    if (c->connection_type != REDIS_CONN_TCP && c->connection_type != REDIS_CONN_UNIX)
+        return REDIS_ERR;
+    if (policy->min_delay.tv_sec < 0 || policy->min_delay.tv_usec < 0 ||
+        policy->max_attempts < 0 ||
+        __redisAsyncTimevalMsec(&policy->max_delay) <
+        __redisAsyncTimevalMsec(&policy->min_delay))
+        return REDIS_ERR;
+
+    ac->reconnect.policy = *policy;
+    ac->reconnect.enabled = 1;
+    if (ac->reconnect.seed == 0)
+        ac->reconnect.seed = ((unsigned int)__redisAsyncMsec()^
+                              (unsigned int)(unsigned long)ac)|1;
+    return REDIS_OK;
+}
+
+/* Called when the connection is back, before the pending commands are sent
+ * again. Commands issued from the callback (such as AUTH and SELECT) go out
+ * first. The connect callback is only called for the first connection. */
+int redisAsyncSetReconnectCallback(redisAsyncContext *ac, redisReconnectCallback *fn) {
+    ac->reconnect.fn = fn;
+    return REDIS_OK;
+}
+
+static int __redisAsyncStartReconnect(redisAsyncContext *ac, int now);
+
+/* Move a reconnecting TCP context to another server, such as the new master
+ * after a failover. The connection is dropped and made again to "ip" right
+ * away, as if it had failed: commands that were not written yet are sent to
+ * the new server, in-flight commands are replayed or failed according to the
+ * reconnect policy. Not from the callbacks of this context. */
+int redisAsyncRedirect(redisAsyncContext *ac, const char *ip, int port) {
+    redisContext *c = &(ac->c);
+    char *host;
+
+    if (!ac->reconnect.enabled || ac->ev.scheduleTimer == NULL ||
+        c->connection_type != REDIS_CONN_TCP ||
+        (c->flags & (REDIS_DISCONNECTING|REDIS_FREEING|REDIS_IN_CALLBACK)))
+        return REDIS_ERR;
+    /* The first connect is still in progress */
+    if (!(c->flags & (REDIS_CONNECTED|REDIS_RECONNECTING)))
+        return REDIS_ERR;
+    if ((host = strdup(ip)) == NULL)
+        return REDIS_ERR;
+    free(c->tcp.host);
+    c->tcp.host = host;
+    c->tcp.port = port;
+
+    if (c->flags & REDIS_RECONNECTING) {
+        /* Already waiting for the next attempt: make it now */
+        ac->reconnect.at = __redisAsyncMsec();
+        __redisAsyncAddDeadline(ac,ac->reconnect.at);
+        ac->timer_at = 0;
+        __redisAsyncScheduleTimer(ac);
+        return REDIS_OK;
+    }
+    __redisSetError(c,REDIS_ERR_OTHER,"Redirected to another server");
+    __redisAsyncCopyError(ac);
+    __redisAsyncStartReconnect(ac,1);
+    return REDIS_OK;
+}
+
+/* Hand pub/sub messages to "fn" in batches instead of calling the callback of
+ * their channel or pattern for each: a batch holds the messages parsed from
+ * one read, or "max" of them when it is not 0. Subscribe and unsubscribe
+ * replies still go to the callbacks of their channels, after the messages
+ * that came before them. Pass a NULL "fn" to go back to per-message calls. */
+int redisAsyncSetBatchCallback(redisAsyncContext *ac, redisBatchCallbackFn *fn,
+                               void *privdata, size_t max)
+{
+    ac->sub.batch.fn = fn;
+    ac->sub.batch.privdata = privdata;
+    ac->sub.batch.max = max;
+    return REDIS_OK;
+}
+
 /* Helper functions to push/shift callbacks */
-static int __redisPushCallback(redisCallbackList *list, redisCallback *source) {
+#define __redisCallbackAt(list,i) (&(list)->cb[((list)->head+(i)) & ((list)->cap-1)])
+#define __redisDeadlineAt(list,i) ((list)->deadlines[((list)->dlhead+(i)) & ((list)->cap-1)])
+
+/* Make room for at least "len" callbacks, unwrapping the rings. */
+static int __redisGrowCallbacks(redisCallbackList *list, size_t len) {
     redisCallback *cb;
+    size_t cap = list->cap ? list->cap : 16, first, *deadlines, i;
 
-    /* Copy callback from stack to heap */
-    cb = malloc(sizeof(*cb));
-    if (cb == NULL)
-        return REDIS_ERR_OOM;
+    if (len <= list->cap)
+        return REDIS_OK;
+    while (cap < len)
+        cap *= 2;
+    if ((cb = malloc(cap*sizeof(*cb))) == NULL)
+        return REDIS_ERR;
+    if ((deadlines = malloc(cap*sizeof(*deadlines))) == NULL) {
+        free(cb);
+        return REDIS_ERR;
+    }
+
+    first = list->cap-list->head;
+    if (first > list->len) first = list->len;
+    if (list->len > 0) {
+        memcpy(cb,list->cb+list->head,first*sizeof(*cb));
+        memcpy(cb+first,list->cb,(list->len-first)*sizeof(*cb));
+    }
+    for (i = 0; i < list->dllen; i++)
+        deadlines[i] = __redisDeadlineAt(list,i);
+    free(list->cb);
+    free(list->deadlines);
+    list->cb = cb;
+    list->head = 0;
+    list->deadlines = deadlines;
+    list->dlhead = 0;
+    list->cap = cap;
+    return REDIS_OK;
+}
 
-    if (source != NULL) {
-        memcpy(cb,source,sizeof(*cb));
-        cb->next = NULL;
+static void __redisFreeCallbacks(redisCallbackList *list) {
+    free(list->cb);
+    free(list->deadlines);
+    memset(list,0,sizeof(*list));
+}
+
+/* Note the deadline of callback "i", the last one of the list. Callbacks
+ * before it with a later deadline can't be the earliest anymore. */
+static void __redisTrackDeadline(redisCallbackList *list, size_t i) {
+    long long deadline = __redisCallbackAt(list,i)->deadline;
+    size_t last;
+
+    if (deadline == 0)
+        return;
+    while (list->dllen > 0) {
+        last = __redisDeadlineAt(list,list->dllen-1)-list->shifted;
+        if (__redisCallbackAt(list,last)->deadline <= deadline)
+            break;
+        list->dllen--;
     }
+    __redisDeadlineAt(list,list->dllen) = list->shifted+i;
+    list->dllen++;
+}
+
+/* Track the deadlines again after callbacks were removed out of order. */
+static void __redisIndexDeadlines(redisCallbackList *list) {
+    size_t i;
+
+    list->dlhead = 0;
+    list->dllen = 0;
+    for (i = 0; i < list->len; i++)
+        __redisTrackDeadline(list,i);
+}
+
+/* The earliest deadline of the callbacks of "list", 0 when there is none. */
+static long long __redisEarliestDeadline(redisCallbackList *list) {
+    if (list->dllen == 0)
+        return 0;
+    return __redisCallbackAt(list,__redisDeadlineAt(list,0)-list->shifted)->deadline;
+}
 
-    /* Store callback in list */
-    if (list->head == NULL)
-        list->head = cb;
-    if (list->tail != NULL)
-        list->tail->next = cb;
-    list->tail = cb;
+static int __redisPushCallback(redisCallbackList *list, redisCallback *source) {
+    if (list->len == list->cap &&
+        __redisGrowCallbacks(list,list->len+1) != REDIS_OK)
+        return REDIS_ERR_OOM;
+
+    /* Copy callback from stack to the ring */
+    memcpy(__redisCallbackAt(list,list->len),source,sizeof(*source));
+    __redisTrackDeadline(list,list->len);
+    list->len++;
     return REDIS_OK;
 }
 
 static int __redisShiftCallback(redisCallbackList *list, redisCallback *target) {
-    redisCallback *cb = list->head;
-    if (cb != NULL) {
-        list->head = cb->next;
-        if (cb == list->tail)
-            list->tail = NULL;
-
-        /* Copy callback from heap to stack */
-        if (target != NULL)
-            memcpy(target,cb,sizeof(*cb));
-        free(cb);
-        return REDIS_OK;
+    redisCallback *cb;
+
+    if (list->len == 0)
+        return REDIS_ERR;
+    cb = __redisCallbackAt(list,0);
+    list->head = (list->head+1) & (list->cap-1);
+    list->len--;
+    if (list->dllen > 0 && __redisDeadlineAt(list,0) == list->shifted) {
+        list->dlhead = (list->dlhead+1) & (list->cap-1);
+        list->dllen--;
     }
-    return REDIS_ERR;
+    list->shifted++;
+
+    /* Copy callback from the ring to stack */
+    if (target != NULL) {
+        memcpy(target,cb,sizeof(*cb));
+        target->cmd = NULL;
+    }
+    free(cb->cmd);
+    return REDIS_OK;
+}
+
+/* Append the callbacks of "src" to "dst" and empty "src". */
+static int __redisMoveCallbacks(redisCallbackList *dst, redisCallbackList *src) {
+    size_t i;
+
+    if (__redisGrowCallbacks(dst,dst->len+src->len) != REDIS_OK)
+        return REDIS_ERR;
+    for (i = 0; i < src->len; i++) {
+        memcpy(__redisCallbackAt(dst,dst->len),__redisCallbackAt(src,i),
+               sizeof(redisCallback));
+        __redisTrackDeadline(dst,dst->len);
+        dst->len++;
+    }
+    __redisFreeCallbacks(src);
+    return REDIS_OK;
 }
 
 static void __redisRunCallback(redisAsyncContext *ac, redisCallback *cb, redisReply *reply) {
@@ -285,6 +613,8 @@ static void __redisAsyncFree(redisAsyncContext *ac) {
     /* Execute callbacks for invalid commands */
     while (__redisShiftCallback(&ac->sub.invalid,&cb) == REDIS_OK)
         __redisRunCallback(ac,&cb,NULL);
+    __redisFreeCallbacks(&ac->replies);
+    __redisFreeCallbacks(&ac->sub.invalid);
 
     /* Run subscription callbacks callbacks with NULL reply */
     it = dictGetIterator(ac->sub.channels);
@@ -299,12 +629,16 @@ static void __redisAsyncFree(redisAsyncContext *ac) {
     dictReleaseIterator(it);
     dictRelease(ac->sub.patterns);
 
+    while (ac->sub.batch.len > 0)
+        c->reader->fn->freeObject(ac->sub.batch.replies[--ac->sub.batch.len]);
+    free(ac->sub.batch.replies);
+
     /* Signal event lib to clean up */
     _EL_CLEANUP(ac);
 
     /* Execute disconnect callback. When redisAsyncFree() initiated destroying
      * this context, the status will always be REDIS_OK. */
-    if (ac->onDisconnect && (c->flags & REDIS_CONNECTED)) {
+    if (ac->onDisconnect && ((c->flags & REDIS_CONNECTED) || ac->reconnect.attempts)) {
         if (c->flags & REDIS_FREEING) {
             ac->onDisconnect(ac,REDIS_OK);
         } else {
@@ -327,6 +661,209 @@ void redisAsyncFree(redisAsyncContext *ac) {
         __redisAsyncFree(ac);
 }
 
+/* Move the callbacks of "list" for which "drop" returns non-zero to "dropped",
+ * keeping the order of both. A callback that doesn't fit in "dropped" stays. */
+static void __redisDropCallbacks(redisAsyncContext *ac, redisCallbackList *list,
+                                 redisCallbackList *dropped,
+                                 int (*drop)(redisAsyncContext*, redisCallback*, long long),
+                                 long long arg)
+{
+    redisCallback *cb;
+    size_t i, kept = 0;
+
+    for (i = 0; i < list->len; i++) {
+        cb = __redisCallbackAt(list,i);
+        if (drop(ac,cb,arg) && __redisPushCallback(dropped,cb) == REDIS_OK)
+            continue;
+        if (kept != i)
+            memcpy(__redisCallbackAt(list,kept),cb,sizeof(*cb));
+        kept++;
+    }
+    list->len = kept;
+    __redisIndexDeadlines(list);
+}
+
+/* Call the callbacks that __redisDropCallbacks() collected with a NULL reply.
+ * Returns REDIS_ERR when the context was free'd. */
+static int __redisFailCallbacks(redisAsyncContext *ac, redisCallbackList *dropped) {
+    redisCallback cb;
+
+    __redisAsyncCopyError(ac);
+    while (__redisShiftCallback(dropped,&cb) == REDIS_OK)
+        __redisRunCallback(ac,&cb,NULL);
+    __redisFreeCallbacks(dropped);
+    if (ac->c.flags & REDIS_FREEING) {
+        __redisAsyncFree(ac);
+        return REDIS_ERR;
+    }
+    return REDIS_OK;
+}
+
+/* Commands that were sent may or may not have been executed, so they are only
+ * sent again when the policy allows it. "written" is the offset in the output
+ * stream up to which the old connection accepted bytes. */
+static int __redisNotReplayable(redisAsyncContext *ac, redisCallback *cb, long long written) {
+    if (cb->cmd == NULL)
+        return 1;
+    if (cb->end-cb->cmdlen >= (unsigned long long)written)
+        return 0;
+    return (cb->cmdflags & ac->reconnect.policy.replay) == 0;
+}
+
+static int __redisExpired(redisAsyncContext *ac, redisCallback *cb, long long now) {
+    ((void) ac);
+    return cb->deadline != 0 && cb->deadline <= now;
+}
+
+/* When the connection dropped with reconnecting enabled, stop I/O on the
+ * socket, fail the commands that can't be sent again and schedule the next
+ * attempt, right away when "now" is set. Returns REDIS_ERR when the context
+ * should be torn down instead, or when the attempts of this outage are used
+ * up. */
+static int __redisAsyncStartReconnect(redisAsyncContext *ac, int now) {
+    redisContext *c = &(ac->c);
+    redisReconnectPolicy *p = &ac->reconnect.policy;
+    redisCallbackList failed;
+    long long written, delay, max;
+    unsigned int x;
+    int i;
+
+    if (!ac->reconnect.enabled || ac->ev.scheduleTimer == NULL ||
+        (c->flags & (REDIS_DISCONNECTING|REDIS_FREEING)))
+        return REDIS_ERR;
+    /* A failed first connect is reported to the connect callback as usual. */
+    if (!(c->flags & REDIS_CONNECTED) && ac->reconnect.attempts == 0 &&
+        !p->retry_connect)
+        return REDIS_ERR;
+    if (p->max_attempts && ac->reconnect.attempts >= p->max_attempts)
+        return REDIS_ERR;
+
+    _EL_DEL_READ(ac);
+    _EL_DEL_WRITE(ac);
+    c->flags |= REDIS_RECONNECTING;
+    c->flags &= ~(REDIS_CONNECTED|REDIS_MONITORING);
+
+    /* Backoff with jitter: wait between half of and the full delay, so
+     * clients that lost the same server don't come back all at once. */
+    delay = __redisAsyncTimevalMsec(&p->min_delay);
+    max = __redisAsyncTimevalMsec(&p->max_delay);
+    for (i = 0; i < ac->reconnect.attempts && delay < max; i++)
+        delay *= 2;
+    if (delay > max) delay = max;
+    x = ac->reconnect.seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    ac->reconnect.seed = x;
+    delay -= x % (delay/2+1);
+    if (now) delay = 0;
+
+    ac->reconnect.attempts++;
+    ac->reconnect.at = __redisAsyncMsec()+delay;
+    __redisAsyncAddDeadline(ac,ac->reconnect.at);
+    ac->timer_at = 0; /* The adapter may have dropped it with the socket */
+    __redisAsyncScheduleTimer(ac);
+
+    written = ac->reconnect.appended-sdslen(c->obuf)-redisContextZeroCopyPending(c);
+    memset(&failed,0,sizeof(failed));
+    __redisDropCallbacks(ac,&ac->replies,&failed,__redisNotReplayable,written);
+    __redisDropCallbacks(ac,&ac->sub.invalid,&failed,__redisNotReplayable,written);
+    __redisFailCallbacks(ac,&failed);
+    return REDIS_OK;
+}
+
+static void __redisAsyncDisconnect(redisAsyncContext *ac);
+
+/* Start over on a new connection that reuses the file descriptor of the old
+ * one, so the event library can keep watching the same descriptor. The output
+ * buffer is rebuilt from the kept commands and the subscriptions. */
+static void __redisAsyncReconnect(redisAsyncContext *ac) {
+    redisContext *c = &(ac->c);
+    dict *subs[2] = {ac->sub.channels, ac->sub.patterns};
+    const char *argv[2];
+    size_t argvlen[2];
+    redisReader *r = NULL;
+    redisCallback *cb;
+    dictIterator *it;
+    size_t j;
+    dictEntry *de;
+    sds buf, cmd;
+    int oldfd = c->fd, ret, i, len;
+
+    c->err = 0;
+    c->errstr[0] = '\0';
+    if (c->connection_type == REDIS_CONN_TCP)
+        ret = redisContextConnectBindTcp(c,c->tcp.host,c->tcp.port,c->timeout,
+                                         c->tcp.source_addr);
+    else
+        ret = redisContextConnectUnix(c,c->unix_sock.path,c->timeout);
+
+    if (ret == REDIS_OK && c->fd != oldfd) {
+        if (dup2(c->fd,oldfd) == -1) {
+            __redisSetError(c,REDIS_ERR_IO,NULL);
+            ret = REDIS_ERR;
+        }
+        close(c->fd);
+    }
+    c->fd = oldfd;
+    c->flags &= ~REDIS_CONNECTED; /* Set once the first write event fires */
+    if (ret == REDIS_OK &&
+        (r = redisReaderCreateWithFunctions(c->reader->fn)) == NULL)
+    {
+        __redisSetError(c,REDIS_ERR_OOM,"Out of memory");
+        ret = REDIS_ERR;
+    }
+    if (ret != REDIS_OK) {
+        /* Counts as an attempt: wait for the next one or give up. */
+        __redisAsyncDisconnect(ac);
+        return;
+    }
+
+    r->maxbuf = c->reader->maxbuf;
+    r->privdata = c->reader->privdata;
+    redisReaderFree(c->reader);
+    c->reader = r;
+
+    /* Regular commands were issued before the subscriptions, commands that
+     * were issued while subscribed after them. */
+    buf = sdsempty();
+    for (j = 0; j < ac->replies.len; j++) {
+        cb = __redisCallbackAt(&ac->replies,j);
+        buf = sdscatlen(buf,cb->cmd,cb->cmdlen);
+        cb->end = sdslen(buf);
+    }
+    for (i = 0; i < 2; i++) {
+        argv[0] = (i == 0) ? "SUBSCRIBE" : "PSUBSCRIBE";
+        argvlen[0] = strlen(argv[0]);
+        it = dictGetIterator(subs[i]);
+        while ((de = dictNext(it)) != NULL) {
+            argv[1] = dictGetEntryKey(de);
+            argvlen[1] = sdslen((sds)argv[1]);
+            if ((len = redisFormatSdsCommandArgv(&cmd,2,argv,argvlen)) < 0)
+                continue;
+            buf = sdscatlen(buf,cmd,len);
+            sdsfree(cmd);
+        }
+        dictReleaseIterator(it);
+    }
+    for (j = 0; j < ac->sub.invalid.len; j++) {
+        cb = __redisCallbackAt(&ac->sub.invalid,j);
+        buf = sdscatlen(buf,cb->cmd,cb->cmdlen);
+        cb->end = sdslen(buf);
+    }
+    sdsfree(c->obuf);
+    c->obuf = buf;
+    ac->reconnect.appended = sdslen(buf);
+
+    c->flags &= ~REDIS_RECONNECTING;
+    __redisAsyncCopyError(ac);
+    if (ac->reconnect.connect_timeout) {
+        ac->connect_deadline = __redisAsyncMsec()+ac->reconnect.connect_timeout;
+        __redisAsyncAddDeadline(ac,ac->connect_deadline);
+    }
+    _EL_ADD_WRITE(ac);
+}
+
 /* Helper function to make the disconnect happen and clean up. */
 static void __redisAsyncDisconnect(redisAsyncContext *ac) {
     redisContext *c = &(ac->c);
@@ -334,6 +871,10 @@ static void __redisAsyncDisconnect(redisAsyncContext *ac) {
     /* Make sure error is accessible if there is any */
     __redisAsyncCopyError(ac);
 
+    /* Keep the context when it is going to reconnect. */
+    if (ac->err != 0 && __redisAsyncStartReconnect(ac,0) == REDIS_OK)
+        return;
+
     if (ac->err == 0) {
         /* For clean disconnects, there should be no pending callbacks. */
         int ret = __redisShiftCallback(&ac->replies,NULL);
@@ -358,7 +899,7 @@ static void __redisAsyncDisconnect(redisAsyncContext *ac) {
 void redisAsyncDisconnect(redisAsyncContext *ac) {
     redisContext *c = &(ac->c);
     c->flags |= REDIS_DISCONNECTING;
-    if (!(c->flags & REDIS_IN_CALLBACK) && ac->replies.head == NULL)
+    if (!(c->flags & REDIS_IN_CALLBACK) && ac->replies.len == 0)
         __redisAsyncDisconnect(ac);
 }
 
@@ -367,16 +908,24 @@ static int __redisGetSubscribeCallback(redisAsyncContext *ac, redisReply *reply,
     dict *callbacks;
     dictEntry *de;
     int pvariant;
-    char *stype;
-    sds sname;
+    redisReply *type;
 
     /* Custom reply functions are not supported for pub/sub. This will fail
      * very hard when they are used... */
-    if (reply->type == REDIS_REPLY_ARRAY) {
+    if (reply->type == REDIS_REPLY_ARRAY && reply->elements == 2 &&
+        reply->element[0]->type == REDIS_REPLY_STRING &&
+        strcmp(reply->element[0]->str,"pong") == 0)
+    {
+        /* A subscribed connection answers PING with ["pong", <message>] */
+        __redisShiftCallback(&ac->sub.invalid,dstcb);
+    } else if (reply->type == REDIS_REPLY_ARRAY) {
         assert(reply->elements >= 2);
         assert(reply->element[0]->type == REDIS_REPLY_STRING);
-        stype = reply->element[0]->str;
-        pvariant = (tolower(stype[0]) == 'p') ? 1 : 0;
+        /* The server names the message types in lower case: the pattern
+         * variants start with 'p' and "unsubscribe" is the only type of its
+         * length that starts with 'u'. */
+        type = reply->element[0];
+        pvariant = (type->str[0] == 'p') ? 1 : 0;
 
         if (pvariant)
             callbacks = ac->sub.patterns;
@@ -385,14 +934,13 @@ static int __redisGetSubscribeCallback(redisAsyncContext *ac, redisReply *reply,
 
         /* Locate the right callback */
         assert(reply->element[1]->type == REDIS_REPLY_STRING);
-        sname = sdsnewlen(reply->element[1]->str,reply->element[1]->len);
-        de = dictFind(callbacks,sname);
+        de = dictFindBuffer(callbacks,reply->element[1]->str,reply->element[1]->len);
         if (de != NULL) {
             memcpy(dstcb,dictGetEntryVal(de),sizeof(*dstcb));
 
             /* If this is an unsubscribe message, remove it. */
-            if (strcasecmp(stype+pvariant,"unsubscribe") == 0) {
-                dictDelete(callbacks,sname);
+            if (type->len == (size_t)pvariant+11 && type->str[pvariant] == 'u') {
+                dictDelete(callbacks,dictGetEntryKey(de));
 
                 /* If this was the last unsubscribe message, revert to
                  * non-subscribe mode. */
@@ -401,7 +949,6 @@ static int __redisGetSubscribeCallback(redisAsyncContext *ac, redisReply *reply,
                     c->flags &= ~REDIS_SUBSCRIBED;
             }
         }
-        sdsfree(sname);
     } else {
         /* Shift callback for invalid commands. */
         __redisShiftCallback(&ac->sub.invalid,dstcb);
@@ -409,18 +956,83 @@ static int __redisGetSubscribeCallback(redisAsyncContext *ac, redisReply *reply,
     return REDIS_OK;
 }
 
+/* Whether a reply of a subscribed context is a (p)message. */
+static int __redisIsMessage(redisReply *reply) {
+    redisReply *type;
+
+    if (reply->type != REDIS_REPLY_ARRAY || reply->elements < 3)
+        return 0;
+    type = reply->element[0];
+    return type->type == REDIS_REPLY_STRING &&
+           type->len == (type->str[0] == 'p' ? 8 : 7);
+}
+
+static int __redisBatchMessage(redisAsyncContext *ac, void *reply) {
+    size_t cap = ac->sub.batch.cap ? ac->sub.batch.cap*2 : 64;
+    void **replies;
+
+    if (ac->sub.batch.len == ac->sub.batch.cap) {
+        if ((replies = realloc(ac->sub.batch.replies,cap*sizeof(*replies))) == NULL)
+            return REDIS_ERR;
+        ac->sub.batch.replies = replies;
+        ac->sub.batch.cap = cap;
+    }
+    ac->sub.batch.replies[ac->sub.batch.len++] = reply;
+    return REDIS_OK;
+}
+
+/* Run the batch callback on the collected messages. Returns REDIS_ERR when
+ * the context was free'd from the callback. */
+static int __redisFlushBatch(redisAsyncContext *ac) {
+    redisContext *c = &(ac->c);
+    size_t j, len = ac->sub.batch.len;
+
+    if (len == 0)
+        return REDIS_OK;
+    ac->sub.batch.len = 0;
+    c->flags |= REDIS_IN_CALLBACK;
+    ac->sub.batch.fn(ac,ac->sub.batch.replies,len,ac->sub.batch.privdata);
+    c->flags &= ~REDIS_IN_CALLBACK;
+    if (!(c->flags & REDIS_NO_AUTO_FREE_REPLIES))
+        for (j = 0; j < len; j++)
+            c->reader->fn->freeObject(ac->sub.batch.replies[j]);
+
+    if (c->flags & REDIS_FREEING) {
+        __redisAsyncFree(ac);
+        return REDIS_ERR;
+    }
+    return REDIS_OK;
+}
+
 void redisProcessCallbacks(redisAsyncContext *ac) {
     redisContext *c = &(ac->c);
-    redisCallback cb = {NULL, NULL, NULL};
+    redisCallback cb = {NULL, NULL, 0, NULL, 0, 0, 0};
     void *reply = NULL;
     int status;
 
     while((status = redisGetReply(c,&reply)) == REDIS_OK) {
+        /* Messages are only sent when no regular reply is pending. */
+        if (reply != NULL && ac->sub.batch.fn != NULL && (c->flags & REDIS_SUBSCRIBED) &&
+            ac->replies.len == 0 && __redisIsMessage(reply))
+        {
+            if (__redisBatchMessage(ac,reply) != REDIS_OK) {
+                c->reader->fn->freeObject(reply);
+                __redisSetError(c,REDIS_ERR_OOM,"Out of memory");
+                status = REDIS_ERR;
+                break;
+            }
+            if (ac->sub.batch.len == ac->sub.batch.max && __redisFlushBatch(ac) != REDIS_OK)
+                return;
+            continue;
+        }
+        if (__redisFlushBatch(ac) != REDIS_OK)
+            return;
+
         if (reply == NULL) {
             /* When the connection is being disconnected and there are
              * no more replies, this is the cue to really disconnect. */
             if (c->flags & REDIS_DISCONNECTING && sdslen(c->obuf) == 0
-                && ac->replies.head == NULL) {
+                && ac->replies.len == 0) {
                 __redisAsyncDisconnect(ac);
                 return;
             }
@@ -468,7 +1080,8 @@ void redisProcessCallbacks(redisAsyncContext *ac) {
 
         if (cb.fn != NULL) {
             __redisRunCallback(ac,&cb,reply);
-            c->reader->fn->freeObject(reply);
+            if (!(c->flags & REDIS_NO_AUTO_FREE_REPLIES))
+                c->reader->fn->freeObject(reply);
 
             /* Proceed with free'ing when redisAsyncFree() was called. */
             if (c->flags & REDIS_FREEING) {
@@ -485,8 +1098,80 @@ void redisProcessCallbacks(redisAsyncContext *ac) {
     }
 
     /* Disconnect when there was an error reading the reply */
-    if (status != REDIS_OK)
+    if (status != REDIS_OK) {
+        if (__redisFlushBatch(ac) != REDIS_OK)
+            return;
         __redisAsyncDisconnect(ac);
+    }
+}
+
+/* Run the reconnect callback. The commands it issues are put in front of the
+ * ones that were waiting for the connection to come back. */
+static int __redisAsyncHandleReconnected(redisAsyncContext *ac) {
+    redisContext *c = &(ac->c);
+    redisCallbackList pending = ac->replies;
+    sds obuf = c->obuf;
+    unsigned long long appended = ac->reconnect.appended;
+    int subscribed = c->flags & REDIS_SUBSCRIBED;
+    size_t i;
+
+    if (ac->reconnect.fn == NULL)
+        return REDIS_OK;
+    if ((c->obuf = sdsempty()) == NULL) {
+        c->obuf = obuf;
+        return REDIS_OK;
+    }
+    memset(&ac->replies,0,sizeof(ac->replies));
+    ac->reconnect.appended = 0;
+
+    /* The replies to these commands arrive before any pub/sub message. */
+    c->flags &= ~REDIS_SUBSCRIBED;
+    c->flags |= REDIS_IN_CALLBACK;
+    ac->reconnect.fn(ac);
+    c->flags &= ~REDIS_IN_CALLBACK;
+    c->flags |= subscribed;
+
+    for (i = 0; i < pending.len; i++)
+        __redisCallbackAt(&pending,i)->end += ac->reconnect.appended;
+    for (i = 0; i < ac->sub.invalid.len; i++)
+        __redisCallbackAt(&ac->sub.invalid,i)->end += ac->reconnect.appended;
+    c->obuf = sdscatsds(c->obuf,obuf);
+    sdsfree(obuf);
+    ac->reconnect.appended += appended;
+    if (__redisMoveCallbacks(&ac->replies,&pending) != REDIS_OK) {
+        /* The replies can't be matched to their commands anymore. */
+        __redisSetError(c,REDIS_ERR_OOM,"Out of memory");
+        if (__redisFailCallbacks(ac,&pending) == REDIS_OK)
+            __redisAsyncDisconnect(ac);
+        return REDIS_ERR;
+    }
+
+    if (c->flags & REDIS_FREEING) {
+        __redisAsyncFree(ac);
+        return REDIS_ERR;
+    }
+    return REDIS_OK;
+}
+
+/* Whether a failed connect is left to the reconnect logic rather than
+ * reported to the connect callback. */
+static int __redisAsyncRetriesConnect(redisAsyncContext *ac) {
+    redisContext *c = &(ac->c);
+
+    if (ac->reconnect.attempts)
+        return 1;
+    return ac->reconnect.enabled && ac->reconnect.policy.retry_connect &&
+           ac->ev.scheduleTimer != NULL &&
+           !(c->flags & (REDIS_DISCONNECTING|REDIS_FREEING));
+}
+
+/* Report a connect that failed for good and tear the context down. */
+static int __redisAsyncConnectFailed(redisAsyncContext *ac) {
+    __redisAsyncCopyError(ac);
+    if (ac->onConnect && !__redisAsyncRetriesConnect(ac))
+        ac->onConnect(ac,REDIS_ERR);
+    __redisAsyncDisconnect(ac);
+    return REDIS_ERR;
 }
 
 /* Internal helper function to detect socket status the first time a read or
@@ -495,18 +1180,52 @@ void redisProcessCallbacks(redisAsyncContext *ac) {
 static int __redisAsyncHandleConnect(redisAsyncContext *ac) {
     redisContext *c = &(ac->c);
 
+    /* While the host is resolved the descriptor is a placeholder, which
+     * becomes readable once the answer is in. Then the connect starts on a
+     * new socket behind the same descriptor number. */
+    if (c->lookup != NULL) {
+        if (!redisDnsLookupDone(c->lookup)) {
+            _EL_DEL_WRITE(ac);
+            _EL_ADD_READ(ac);
+            return REDIS_OK;
+        }
+        _EL_DEL_READ(ac);
+        _EL_DEL_WRITE(ac);
+        if (redisContextConnectResolved(c) != REDIS_OK)
+            return __redisAsyncConnectFailed(ac);
+        _EL_ADD_WRITE(ac);
+        return REDIS_OK;
+    }
+
     if (redisCheckSocketError(c) == REDIS_ERR) {
         /* Try again later when connect(2) is still in progress. */
         if (errno == EINPROGRESS)
             return REDIS_OK;
 
-        if (ac->onConnect) ac->onConnect(ac,REDIS_ERR);
-        __redisAsyncDisconnect(ac);
-        return REDIS_ERR;
+        /* Move on to the next address of the host, if there is one left. The
+         * descriptor number stays, but the socket behind it is new. */
+        _EL_DEL_READ(ac);
+        _EL_DEL_WRITE(ac);
+        if (redisContextConnectNext(c) != REDIS_OK)
+            return __redisAsyncConnectFailed(ac);
+        _EL_ADD_WRITE(ac);
+        return REDIS_OK;
     }
 
     /* Mark context as connected. */
     c->flags |= REDIS_CONNECTED;
+    ac->connect_deadline = 0;
+    if (ac->ping_interval) {
+        ac->ping_at = __redisAsyncMsec()+ac->ping_interval;
+        __redisAsyncAddDeadline(ac,ac->ping_at);
+        __redisAsyncScheduleTimer(ac);
+    }
+    if (ac->reconnect.attempts) {
+        ac->reconnect.attempts = 0;
+        if (ac->reconnect.established)
+            return __redisAsyncHandleReconnected(ac);
+    }
+    ac->reconnect.established = 1;
     if (ac->onConnect) ac->onConnect(ac,REDIS_OK);
     return REDIS_OK;
 }
@@ -516,6 +1235,12 @@ static int __redisAsyncHandleConnect(redisAsyncContext *ac) {
  */
 void redisAsyncHandleRead(redisAsyncContext *ac) {
     redisContext *c = &(ac->c);
+    size_t size, total = 0;
+    int nread;
+
+    /* Stale event for the connection that dropped */
+    if (c->flags & REDIS_RECONNECTING)
+        return;
 
     if (!(c->flags & REDIS_CONNECTED)) {
         /* Abort connect was not successful. */
@@ -526,19 +1251,31 @@ void redisAsyncHandleRead(redisAsyncContext *ac) {
             return;
     }
 
-    if (redisBufferRead(c) == REDIS_ERR) {
-        __redisAsyncDisconnect(ac);
-    } else {
-        /* Always re-schedule reads */
-        _EL_ADD_READ(ac);
-        redisProcessCallbacks(ac);
-    }
+    /* With a read budget, keep reading until the socket is drained (a short
+     * read) or the budget is used up, and parse everything at once. What is
+     * left is picked up by the next event, so other connections on the same
+     * loop get their turn. */
+    do {
+        size = c->readsize;
+        if (__redisBufferRead(c,&nread) == REDIS_ERR) {
+            __redisAsyncDisconnect(ac);
+            return;
+        }
+        if (nread > 0) total += nread;
+    } while (nread > 0 && (size_t)nread == size && total < ac->read_budget);
+
+    /* Always re-schedule reads */
+    _EL_ADD_READ(ac);
+    redisProcessCallbacks(ac);
 }
 
 void redisAsyncHandleWrite(redisAsyncContext *ac) {
     redisContext *c = &(ac->c);
     int done = 0;
 
+    if (c->flags & REDIS_RECONNECTING)
+        return;
+
     if (!(c->flags & REDIS_CONNECTED)) {
         /* Abort connect was not successful. */
         if (__redisAsyncHandleConnect(ac) != REDIS_OK)
@@ -562,6 +1299,170 @@ void redisAsyncHandleWrite(redisAsyncContext *ac) {
     }
 }
 
+/* The earliest deadline of a pending command, 0 when there is none. */
+static long long __redisAsyncEarliestDeadline(redisAsyncContext *ac) {
+    long long next = __redisEarliestDeadline(&ac->replies);
+    long long invalid = __redisEarliestDeadline(&ac->sub.invalid);
+
+    if (invalid != 0 && (next == 0 || invalid < next))
+        next = invalid;
+    return next;
+}
+
+/* While waiting to reconnect, commands past their deadline fail on their own
+ * without tearing anything down. */
+static void __redisAsyncHandleOutageTimeout(redisAsyncContext *ac) {
+    redisContext *c = &(ac->c);
+    redisCallbackList failed;
+    long long now = __redisAsyncMsec(), next;
+
+    memset(&failed,0,sizeof(failed));
+    __redisDropCallbacks(ac,&ac->replies,&failed,__redisExpired,now);
+    __redisDropCallbacks(ac,&ac->sub.invalid,&failed,__redisExpired,now);
+    if (failed.len > 0) {
+        __redisSetError(c,REDIS_ERR_TIMEOUT,"Command timed out");
+        if (__redisFailCallbacks(ac,&failed) != REDIS_OK)
+            return;
+    }
+
+    if (now >= ac->reconnect.at) {
+        __redisAsyncReconnect(ac);
+        return;
+    }
+    next = __redisAsyncEarliestDeadline(ac);
+    if (next == 0 || next > ac->reconnect.at)
+        next = ac->reconnect.at;
+    ac->deadline = next;
+    __redisAsyncScheduleTimer(ac);
+}
+
+/* Send the PING of the health check and plan the next one. Monitoring
+ * connections can't take commands anymore. */
+static void __redisAsyncPing(redisAsyncContext *ac) {
+    ac->ping_at = __redisAsyncMsec()+ac->ping_interval;
+    if (!(ac->c.flags & REDIS_MONITORING))
+        redisAsyncCommand(ac,NULL,NULL,"PING");
+}
+
+/* This function should be called when the timer scheduled through the
+ * scheduleTimer hook fires. It fails the connection when its connect deadline
+ * or the deadline of a pending command has passed, sends the PING of the
+ * health check when it is due, and re-arms the timer for the next deadline
+ * otherwise. */
+void redisAsyncHandleTimeout(redisAsyncContext *ac) {
+    redisContext *c = &(ac->c);
+    long long next = 0;
+
+    ac->timer_at = 0;
+    if (c->flags & REDIS_FREEING)
+        return;
+    if (c->flags & REDIS_RECONNECTING) {
+        __redisAsyncHandleOutageTimeout(ac);
+        return;
+    }
+
+    if (!(c->flags & REDIS_CONNECTED)) {
+        next = ac->connect_deadline;
+    } else {
+        if (ac->ping_at != 0 && ac->ping_at <= __redisAsyncMsec())
+            __redisAsyncPing(ac);
+        next = __redisAsyncEarliestDeadline(ac);
+        if (ac->ping_at != 0 && (next == 0 || ac->ping_at < next))
+            next = ac->ping_at;
+    }
+
+    ac->deadline = next;
+    if (next == 0)
+        return;
+    if (next > __redisAsyncMsec()) {
+        __redisAsyncScheduleTimer(ac);
+        return;
+    }
+
+    if (!(c->flags & REDIS_CONNECTED)) {
+        __redisSetError(c,REDIS_ERR_TIMEOUT,"Connection timed out");
+        __redisAsyncCopyError(ac);
+        if (ac->onConnect && !__redisAsyncRetriesConnect(ac))
+            ac->onConnect(ac,REDIS_ERR);
+    } else {
+        __redisSetError(c,REDIS_ERR_TIMEOUT,"Command timed out");
+    }
+    __redisAsyncDisconnect(ac);
+}
+
+/* A single read of redisAsyncHandleRead(), straight into the reader, for
+ * event loops that keep track of readiness themselves. Returns the number of
+ * bytes read after their replies were dispatched, 0 when there was nothing to
+ * read, or -1 when the connection failed and "ac" may be gone. Fewer bytes
+ * than c->readsize held before the call means the socket was drained. */
+int redisAsyncHandleReadOnce(redisAsyncContext *ac) {
+    redisContext *c = &(ac->c);
+    int nread;
+
+    if (c->flags & REDIS_RECONNECTING)
+        return 0;
+
+    if (!(c->flags & REDIS_CONNECTED)) {
+        /* Abort connect was not successful. */
+        if (__redisAsyncHandleConnect(ac) != REDIS_OK)
+            return -1;
+        /* Try again later when the context is still not connected. */
+        if (!(c->flags & REDIS_CONNECTED))
+            return 0;
+    }
+
+    do {
+        if (__redisBufferRead(c,&nread) == REDIS_ERR) {
+            __redisAsyncDisconnect(ac);
+            return -1;
+        }
+    } while (nread == -1 && errno == EINTR);
+    if (nread <= 0)
+        return 0;
+    redisProcessCallbacks(ac);
+    return nread;
+}
+
+/* Counterparts of redisAsyncHandleRead() and redisAsyncHandleWrite() for
+ * event libraries that perform the I/O themselves, such as completion based
+ * interfaces. The bytes that were read are fed to the reply parser and the
+ * replies are dispatched to their callbacks. Both "nread" and "nwritten"
+ * follow the semantics of read(2) and write(2): -1 means an error is stored in
+ * errno. The library owns whatever it wrote, so only errors are of interest
+ * to the write handler. */
+void redisAsyncHandleReadCompletion(redisAsyncContext *ac, const char *buf, int nread) {
+    redisContext *c = &(ac->c);
+
+    if (c->flags & REDIS_RECONNECTING)
+        return;
+
+    if (!(c->flags & REDIS_CONNECTED)) {
+        /* Abort connect was not successful. */
+        if (__redisAsyncHandleConnect(ac) != REDIS_OK)
+            return;
+        /* Try again later when the context is still not connected. */
+        if (!(c->flags & REDIS_CONNECTED))
+            return;
+    }
+
+    if (redisBufferFeed(c,buf,nread) == REDIS_ERR) {
+        __redisAsyncDisconnect(ac);
+    } else {
+        redisProcessCallbacks(ac);
+    }
+}
+
+void redisAsyncHandleWriteCompletion(redisAsyncContext *ac, int nwritten) {
+    redisContext *c = &(ac->c);
+
+    if (c->flags & REDIS_RECONNECTING)
+        return;
+    if (nwritten == -1 && errno != EAGAIN && errno != EINTR) {
+        __redisSetError(c,REDIS_ERR_IO,NULL);
+        __redisAsyncDisconnect(ac);
+    }
+}
+
 /* Sets a pointer to the first argument and its length starting at p. Returns
  * the number of bytes to skip to get to the following argument. */
 static const char *nextArgument(const char *start, const char **str, size_t *len) {
@@ -587,7 +1488,9 @@ static int __redisAsyncCommand(redisAsyncContext *ac, redisCallbackFn *fn, void
     int pvariant, hasnext;
     const char *cstr, *astr;
     size_t clen, alen;
-    const char *p;
+    const char *p, *q;
+    unsigned long n;
+    dict *subs;
     sds sname;
     int ret;
 
@@ -597,27 +1500,36 @@ static int __redisAsyncCommand(redisAsyncContext *ac, redisCallbackFn *fn, void
     /* Setup callback */
     cb.fn = fn;
     cb.privdata = privdata;
+    cb.deadline = 0;
+    cb.cmd = NULL;
+    cb.cmdlen = 0;
+    cb.cmdflags = 0;
+    cb.end = ac->reconnect.appended+len;
 
     /* Find out which command will be appended. */
     p = nextArgument(cmd,&cstr,&clen);
     assert(p != NULL);
     hasnext = (p[0] == '$');
+    if (ac->reconnect.enabled)
+        cb.cmdflags = redisCommandFlags(cstr,clen);
     pvariant = (tolower(cstr[0]) == 'p') ? 1 : 0;
     cstr += pvariant;
     clen -= pvariant;
 
     if (hasnext && strncasecmp(cstr,"subscribe\r\n",11) == 0) {
+        subs = pvariant ? ac->sub.patterns : ac->sub.channels;
+
+        /* Refuse the command rather than lose track of some of the names. */
+        for (n = 0, q = p; (q = nextArgument(q,&astr,&alen)) != NULL; n++);
+        if (dictReserve(subs,n) != DICT_OK)
+            return REDIS_ERR;
         c->flags |= REDIS_SUBSCRIBED;
 
         /* Add every channel/pattern to the list of subscription callbacks. */
         while ((p = nextArgument(p,&astr,&alen)) != NULL) {
             sname = sdsnewlen(astr,alen);
-            if (pvariant)
-                ret = dictReplace(ac->sub.patterns,sname,&cb);
-            else
-                ret = dictReplace(ac->sub.channels,sname,&cb);
-
-            if (ret == 0) sdsfree(sname);
+            ret = dictReplace(subs,sname,&cb);
+            if (ret != 1) sdsfree(sname);
         }
     } else if (strncasecmp(cstr,"unsubscribe\r\n",13) == 0) {
         /* It is only useful to call (P)UNSUBSCRIBE when the context is
@@ -630,17 +1542,34 @@ static int __redisAsyncCommand(redisAsyncContext *ac, redisCallbackFn *fn, void
      } else if(strncasecmp(cstr,"monitor\r\n",9) == 0) {
          /* Set monitor flag and push callback */
          c->flags |= REDIS_MONITORING;
-         __redisPushCallback(&ac->replies,&cb);
+         if (__redisPushCallback(&ac->replies,&cb) != REDIS_OK)
+             return REDIS_ERR;
     } else {
+        if (ac->command_timeout) {
+            cb.deadline = __redisAsyncMsec()+ac->command_timeout;
+            __redisAsyncAddDeadline(ac,cb.deadline);
+        }
+        /* Keep a copy to send it again after a reconnect */
+        if (ac->reconnect.enabled) {
+            if ((cb.cmd = malloc(len)) == NULL)
+                return REDIS_ERR;
+            memcpy(cb.cmd,cmd,len);
+            cb.cmdlen = len;
+        }
         if (c->flags & REDIS_SUBSCRIBED)
             /* This will likely result in an error reply, but it needs to be
              * received and passed to the callback. */
-            __redisPushCallback(&ac->sub.invalid,&cb);
+            ret = __redisPushCallback(&ac->sub.invalid,&cb);
         else
-            __redisPushCallback(&ac->replies,&cb);
+            ret = __redisPushCallback(&ac->replies,&cb);
+        if (ret != REDIS_OK) {
+            free(cb.cmd);
+            return REDIS_ERR;
+        }
     }
 
     __redisAppendCommand(c,cmd,len);
+    ac->reconnect.appended += len;
 
     /* Always schedule a write when the write buffer is non-empty */
     _EL_ADD_WRITE(ac);
@@ -43,19 +43,53 @@ struct dict; /* dictionary header is included in async.c */
 /* Reply callback prototype and container */
 typedef void (redisCallbackFn)(struct redisAsyncContext*, void*, void*);
 typedef struct redisCallback {
-    struct redisCallback *next; /* simple singly linked list */
     redisCallbackFn *fn;
     void *privdata;
+    long long deadline; /* monotonic msec, 0 = no deadline */
+
+    /* Copy of the command, kept when reconnecting is enabled */
+    char *cmd;
+    size_t cmdlen;
+    int cmdflags; /* REDIS_CMD_* flags of the command */
+    unsigned long long end; /* Offset of its end in the output stream */
 } redisCallback;
 
-/* List of callbacks for either regular replies or pub/sub */
+/* Queue of callbacks for either regular replies or pub/sub. The callbacks are
+ * stored inline in a ring buffer that only grows, so a steady pipeline pushes
+ * and shifts them without allocating. */
 typedef struct redisCallbackList {
-    redisCallback *head, *tail;
+    redisCallback *cb;
+    size_t head; /* Index of the first callback */
+    size_t len;
+    size_t cap; /* 0 or a power of two */
+    size_t shifted; /* Callbacks shifted so far, numbering the first one */
+
+    /* Ring of the numbers of the callbacks whose deadline is earlier than the
+     * deadlines of all callbacks after them, so the first has the earliest */
+    size_t *deadlines;
+    size_t dlhead;
+    size_t dllen;
 } redisCallbackList;
 
+/* Callback for a batch of pub/sub messages, see redisAsyncSetBatchCallback() */
+typedef void (redisBatchCallbackFn)(struct redisAsyncContext*, void **replies,
+                                    size_t count, void *privdata);
+
 /* Connection callback prototypes */
 typedef void (redisDisconnectCallback)(const struct redisAsyncContext*, int status);
 typedef void (redisConnectCallback)(const struct redisAsyncContext*, int status);
+typedef void (redisReconnectCallback)(struct redisAsyncContext*);
+
+/* How to reconnect after the connection dropped, see redisAsyncSetReconnect().
+ * The n-th attempt waits a random delay between half of and the full
+ * min(min_delay*2^(n-1), max_delay). */
+typedef struct redisReconnectPolicy {
+    struct timeval min_delay;
+    struct timeval max_delay;
+    int max_attempts; /* Attempts per outage before giving up, 0 = forever */
+    int replay; /* REDIS_CMD_* flags of in-flight commands that are sent again */
+    int retry_connect; /* A failed first connect is an outage too */
+} redisReconnectPolicy;
 
 /* Context for an async connection to Redis */
 typedef struct redisAsyncContext {
@@ -69,6 +103,33 @@ typedef struct redisAsyncContext {
     /* Not used by hiredis */
     void *data;
 
+    /* Bytes to read per read event before yielding, 0 = a single read */
+    size_t read_budget;
+
+    /* Deadlines, see redisAsyncSetTimeout() and redisAsyncSetConnectTimeout().
+     * All times are in monotonic msec, 0 means none. */
+    long long command_timeout; /* Relative deadline of new commands */
+    long long connect_deadline;
+    long long deadline; /* No pending deadline is earlier than this */
+    long long timer_at; /* When the scheduled timer fires */
+
+    /* Health check, see redisAsyncSetPingInterval() */
+    long long ping_interval; /* msec, 0 = none */
+    long long ping_at; /* When the next PING is sent, 0 when not connected */
+
+    /* Automatic reconnect, see redisAsyncSetReconnect() */
+    struct {
+        int enabled;
+        redisReconnectPolicy policy;
+        redisReconnectCallback *fn;
+        int attempts; /* Attempts in the current outage, 0 when there is none */
+        int established; /* Whether a connection was ever made */
+        long long at; /* When to try again */
+        long long connect_timeout; /* msec, 0 = none */
+        unsigned long long appended; /* Bytes of commands appended to obuf */
+        unsigned int seed; /* State of the jitter generator */
+    } reconnect;
+
     /* Event library data and hooks */
     struct {
         void *data;
@@ -80,6 +141,12 @@ typedef struct redisAsyncContext {
         void (*addWrite)(void *privdata);
         void (*delWrite)(void *privdata);
         void (*cleanup)(void *privdata);
+
+        /* (Re)arm the one-shot timer of this context to fire after "tv",
+         * replacing a timer that is still pending. When it fires, the
+         * library calls redisAsyncHandleTimeout(); extra calls are harmless.
+         * Optional: without it, deadlines are not enforced. */
+        void (*scheduleTimer)(void *privdata, struct timeval tv);
     } ev;
 
     /* Called when either the connection is terminated due to an error or per
@@ -97,23 +164,50 @@ typedef struct redisAsyncContext {
         redisCallbackList invalid;
         struct dict *channels;
         struct dict *patterns;
+
+        /* Messages collected for the batch callback */
+        struct {
+            redisBatchCallbackFn *fn;
+            void *privdata;
+            size_t max; /* 0 = all messages parsed from one read */
+            void **replies;
+            size_t len;
+            size_t cap;
+        } batch;
     } sub;
 } redisAsyncContext;
 
 /* Functions that proxy to hiredis */
+redisAsyncContext *redisAsyncConnectWithOptions(const redisOptions *options);
 redisAsyncContext *redisAsyncConnect(const char *ip, int port);
 redisAsyncContext *redisAsyncConnectBind(const char *ip, int port, const char *source_addr);
 redisAsyncContext *redisAsyncConnectBindWithReuse(const char *ip, int port,
                                                   const char *source_addr);
+redisAsyncContext *redisAsyncConnectFastOpen(const char *ip, int port);
 redisAsyncContext *redisAsyncConnectUnix(const char *path);
 int redisAsyncSetConnectCallback(redisAsyncContext *ac, redisConnectCallback *fn);
 int redisAsyncSetDisconnectCallback(redisAsyncContext *ac, redisDisconnectCallback *fn);
+void redisAsyncSetReadBudget(redisAsyncContext *ac, size_t bytes);
+int redisAsyncSetTimeout(redisAsyncContext *ac, const struct timeval tv);
+int redisAsyncSetConnectTimeout(redisAsyncContext *ac, const struct timeval tv);
+int redisAsyncSetPingInterval(redisAsyncContext *ac, const struct timeval tv);
+int redisAsyncSetReconnect(redisAsyncContext *ac, const redisReconnectPolicy *policy);
+int redisAsyncSetReconnectCallback(redisAsyncContext *ac, redisReconnectCallback *fn);
+int redisAsyncRedirect(redisAsyncContext *ac, const char *ip, int port);
+int redisAsyncSetBatchCallback(redisAsyncContext *ac, redisBatchCallbackFn *fn,
+                               void *privdata, size_t max);
 void redisAsyncDisconnect(redisAsyncContext *ac);
 void redisAsyncFree(redisAsyncContext *ac);
 
 /* Handle read/write events */
 void redisAsyncHandleRead(redisAsyncContext *ac);
 void redisAsyncHandleWrite(redisAsyncContext *ac);
+void redisAsyncHandleTimeout(redisAsyncContext *ac);
+int redisAsyncHandleReadOnce(redisAsyncContext *ac);
+
+/* Handle completed I/O for event libraries that read and write themselves */
+void redisAsyncHandleReadCompletion(redisAsyncContext *ac, const char *buf, int nread);
+void redisAsyncHandleWriteCompletion(redisAsyncContext *ac, int nwritten);
 
 /* Command functions for an async context. Write the command to the
  * output buffer and register the provided callback. */
@@ -0,0 +1,1186 @@
+/*
+ * Copyright (c) 2009-2011, Salvatore Sanfilippo <antirez at gmail dot com>
+ * Copyright (c) 2010-2011, Pieter Noordhuis <pcnoordhuis at gmail dot com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "fmacros.h"
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include "cluster.h"
+
+/* CRC16 as used for hash slots: XMODEM, polynomial 0x1021, initial value 0.
+ * crc16tab[k][i] is the CRC of byte i followed by k zero bytes, so crc16()
+ * can take eight bytes per step (slicing-by-8). Row 0 is the classic byte at
+ * a time table, row k is (row k-1 << 8) ^ row 0 [row k-1 >> 8]. */
+static const uint16_t crc16tab[8][256] = {
+    {
+        0x0000,0x1021,0x2042,0x3063,0x4084,0x50a5,0x60c6,0x70e7,
+        0x8108,0x9129,0xa14a,0xb16b,0xc18c,0xd1ad,0xe1ce,0xf1ef,
+        0x1231,0x0210,0x3273,0x2252,0x52b5,0x4294,0x72f7,0x62d6,
+        0x9339,0x8318,0xb37b,0xa35a,0xd3bd,0xc39c,0xf3ff,0xe3de,
+        0x2462,0x3443,0x0420,0x1401,0x64e6,0x74c7,0x44a4,0x5485,
+        0xa56a,0xb54b,0x8528,0x9509,0xe5ee,0xf5cf,0xc5ac,0xd58d,
+        0x3653,0x2672,0x1611,0x0630,0x76d7,0x66f6,0x5695,0x46b4,
+        0xb75b,0xa77a,0x9719,0x8738,0xf7df,0xe7fe,0xd79d,0xc7bc,
+        0x48c4,0x58e5,0x6886,0x78a7,0x0840,0x1861,0x2802,0x3823,
+        0xc9cc,0xd9ed,0xe98e,0xf9af,0x8948,0x9969,0xa90a,0xb92b,
+        0x5af5,0x4ad4,0x7ab7,0x6a96,0x1a71,0x0a50,0x3a33,0x2a12,
+        0xdbfd,0xcbdc,0xfbbf,0xeb9e,0x9b79,0x8b58,0xbb3b,0xab1a,
+        0x6ca6,0x7c87,0x4ce4,0x5cc5,0x2c22,0x3c03,0x0c60,0x1c41,
+        0xedae,0xfd8f,0xcdec,0xddcd,0xad2a,0xbd0b,0x8d68,0x9d49,
+        0x7e97,0x6eb6,0x5ed5,0x4ef4,0x3e13,0x2e32,0x1e51,0x0e70,
+        0xff9f,0xefbe,0xdfdd,0xcffc,0xbf1b,0xaf3a,0x9f59,0x8f78,
+        0x9188,0x81a9,0xb1ca,0xa1eb,0xd10c,0xc12d,0xf14e,0xe16f,
+        0x1080,0x00a1,0x30c2,0x20e3,0x5004,0x4025,0x7046,0x6067,
+        0x83b9,0x9398,0xa3fb,0xb3da,0xc33d,0xd31c,0xe37f,0xf35e,
+        0x02b1,0x1290,0x22f3,0x32d2,0x4235,0x5214,0x6277,0x7256,
+        0xb5ea,0xa5cb,0x95a8,0x8589,0xf56e,0xe54f,0xd52c,0xc50d,
+        0x34e2,0x24c3,0x14a0,0x0481,0x7466,0x6447,0x5424,0x4405,
+        0xa7db,0xb7fa,0x8799,0x97b8,0xe75f,0xf77e,0xc71d,0xd73c,
+        0x26d3,0x36f2,0x0691,0x16b0,0x6657,0x7676,0x4615,0x5634,
+        0xd94c,0xc96d,0xf90e,0xe92f,0x99c8,0x89e9,0xb98a,0xa9ab,
+        0x5844,0x4865,0x7806,0x6827,0x18c0,0x08e1,0x3882,0x28a3,
+        0xcb7d,0xdb5c,0xeb3f,0xfb1e,0x8bf9,0x9bd8,0xabbb,0xbb9a,
+        0x4a75,0x5a54,0x6a37,0x7a16,0x0af1,0x1ad0,0x2ab3,0x3a92,
+        0xfd2e,0xed0f,0xdd6c,0xcd4d,0xbdaa,0xad8b,0x9de8,0x8dc9,
+        0x7c26,0x6c07,0x5c64,0x4c45,0x3ca2,0x2c83,0x1ce0,0x0cc1,
+        0xef1f,0xff3e,0xcf5d,0xdf7c,0xaf9b,0xbfba,0x8fd9,0x9ff8,
+        0x6e17,0x7e36,0x4e55,0x5e74,0x2e93,0x3eb2,0x0ed1,0x1ef0
+    },
+    {
+        0x0000,0x3331,0x6662,0x5553,0xccc4,0xfff5,0xaaa6,0x9997,
+        0x89a9,0xba98,0xefcb,0xdcfa,0x456d,0x765c,0x230f,0x103e,
+        0x0373,0x3042,0x6511,0x5620,0xcfb7,0xfc86,0xa9d5,0x9ae4,
+        0x8ada,0xb9eb,0xecb8,0xdf89,0x461e,0x752f,0x207c,0x134d,
+        0x06e6,0x35d7,0x6084,0x53b5,0xca22,0xf913,0xac40,0x9f71,
+        0x8f4f,0xbc7e,0xe92d,0xda1c,0x438b,0x70ba,0x25e9,0x16d8,
+        0x0595,0x36a4,0x63f7,0x50c6,0xc951,0xfa60,0xaf33,0x9c02,
+        0x8c3c,0xbf0d,0xea5e,0xd96f,0x40f8,0x73c9,0x269a,0x15ab,
+        0x0dcc,0x3efd,0x6bae,0x589f,0xc108,0xf239,0xa76a,0x945b,
+        0x8465,0xb754,0xe207,0xd136,0x48a1,0x7b90,0x2ec3,0x1df2,
+        0x0ebf,0x3d8e,0x68dd,0x5bec,0xc27b,0xf14a,0xa419,0x9728,
+        0x8716,0xb427,0xe174,0xd245,0x4bd2,0x78e3,0x2db0,0x1e81,
+        0x0b2a,0x381b,0x6d48,0x5e79,0xc7ee,0xf4df,0xa18c,0x92bd,
+        0x8283,0xb1b2,0xe4e1,0xd7d0,0x4e47,0x7d76,0x2825,0x1b14,
+        0x0859,0x3b68,0x6e3b,0x5d0a,0xc49d,0xf7ac,0xa2ff,0x91ce,
+        0x81f0,0xb2c1,0xe792,0xd4a3,0x4d34,0x7e05,0x2b56,0x1867,
+        0x1b98,0x28a9,0x7dfa,0x4ecb,0xd75c,0xe46d,0xb13e,0x820f,
+        0x9231,0xa100,0xf453,0xc762,0x5ef5,0x6dc4,0x3897,0x0ba6,
+        0x18eb,0x2bda,0x7e89,0x4db8,0xd42f,0xe71e,0xb24d,0x817c,
+        0x9142,0xa273,0xf720,0xc411,0x5d86,0x6eb7,0x3be4,0x08d5,
+        0x1d7e,0x2e4f,0x7b1c,0x482d,0xd1ba,0xe28b,0xb7d8,0x84e9,
+        0x94d7,0xa7e6,0xf2b5,0xc184,0x5813,0x6b22,0x3e71,0x0d40,
+        0x1e0d,0x2d3c,0x786f,0x4b5e,0xd2c9,0xe1f8,0xb4ab,0x879a,
+        0x97a4,0xa495,0xf1c6,0xc2f7,0x5b60,0x6851,0x3d02,0x0e33,
+        0x1654,0x2565,0x7036,0x4307,0xda90,0xe9a1,0xbcf2,0x8fc3,
+        0x9ffd,0xaccc,0xf99f,0xcaae,0x5339,0x6008,0x355b,0x066a,
+        0x1527,0x2616,0x7345,0x4074,0xd9e3,0xead2,0xbf81,0x8cb0,
+        0x9c8e,0xafbf,0xfaec,0xc9dd,0x504a,0x637b,0x3628,0x0519,
+        0x10b2,0x2383,0x76d0,0x45e1,0xdc76,0xef47,0xba14,0x8925,
+        0x991b,0xaa2a,0xff79,0xcc48,0x55df,0x66ee,0x33bd,0x008c,
+        0x13c1,0x20f0,0x75a3,0x4692,0xdf05,0xec34,0xb967,0x8a56,
+        0x9a68,0xa959,0xfc0a,0xcf3b,0x56ac,0x659d,0x30ce,0x03ff
+    },
+    {
+        0x0000,0x3730,0x6e60,0x5950,0xdcc0,0xebf0,0xb2a0,0x8590,
+        0xa9a1,0x9e91,0xc7c1,0xf0f1,0x7561,0x4251,0x1b01,0x2c31,
+        0x4363,0x7453,0x2d03,0x1a33,0x9fa3,0xa893,0xf1c3,0xc6f3,
+        0xeac2,0xddf2,0x84a2,0xb392,0x3602,0x0132,0x5862,0x6f52,
+        0x86c6,0xb1f6,0xe8a6,0xdf96,0x5a06,0x6d36,0x3466,0x0356,
+        0x2f67,0x1857,0x4107,0x7637,0xf3a7,0xc497,0x9dc7,0xaaf7,
+        0xc5a5,0xf295,0xabc5,0x9cf5,0x1965,0x2e55,0x7705,0x4035,
+        0x6c04,0x5b34,0x0264,0x3554,0xb0c4,0x87f4,0xdea4,0xe994,
+        0x1dad,0x2a9d,0x73cd,0x44fd,0xc16d,0xf65d,0xaf0d,0x983d,
+        0xb40c,0x833c,0xda6c,0xed5c,0x68cc,0x5ffc,0x06ac,0x319c,
+        0x5ece,0x69fe,0x30ae,0x079e,0x820e,0xb53e,0xec6e,0xdb5e,
+        0xf76f,0xc05f,0x990f,0xae3f,0x2baf,0x1c9f,0x45cf,0x72ff,
+        0x9b6b,0xac5b,0xf50b,0xc23b,0x47ab,0x709b,0x29cb,0x1efb,
+        0x32ca,0x05fa,0x5caa,0x6b9a,0xee0a,0xd93a,0x806a,0xb75a,
+        0xd808,0xef38,0xb668,0x8158,0x04c8,0x33f8,0x6aa8,0x5d98,
+        0x71a9,0x4699,0x1fc9,0x28f9,0xad69,0x9a59,0xc309,0xf439,
+        0x3b5a,0x0c6a,0x553a,0x620a,0xe79a,0xd0aa,0x89fa,0xbeca,
+        0x92fb,0xa5cb,0xfc9b,0xcbab,0x4e3b,0x790b,0x205b,0x176b,
+        0x7839,0x4f09,0x1659,0x2169,0xa4f9,0x93c9,0xca99,0xfda9,
+        0xd198,0xe6a8,0xbff8,0x88c8,0x0d58,0x3a68,0x6338,0x5408,
+        0xbd9c,0x8aac,0xd3fc,0xe4cc,0x615c,0x566c,0x0f3c,0x380c,
+        0x143d,0x230d,0x7a5d,0x4d6d,0xc8fd,0xffcd,0xa69d,0x91ad,
+        0xfeff,0xc9cf,0x909f,0xa7af,0x223f,0x150f,0x4c5f,0x7b6f,
+        0x575e,0x606e,0x393e,0x0e0e,0x8b9e,0xbcae,0xe5fe,0xd2ce,
+        0x26f7,0x11c7,0x4897,0x7fa7,0xfa37,0xcd07,0x9457,0xa367,
+        0x8f56,0xb866,0xe136,0xd606,0x5396,0x64a6,0x3df6,0x0ac6,
+        0x6594,0x52a4,0x0bf4,0x3cc4,0xb954,0x8e64,0xd734,0xe004,
+        0xcc35,0xfb05,0xa255,0x9565,0x10f5,0x27c5,0x7e95,0x49a5,
+        0xa031,0x9701,0xce51,0xf961,0x7cf1,0x4bc1,0x1291,0x25a1,
+        0x0990,0x3ea0,0x67f0,0x50c0,0xd550,0xe260,0xbb30,0x8c00,
+        0xe352,0xd462,0x8d32,0xba02,0x3f92,0x08a2,0x51f2,0x66c2,
+        0x4af3,0x7dc3,0x2493,0x13a3,0x9633,0xa103,0xf853,0xcf63
+    },
+    {
+        0x0000,0x76b4,0xed68,0x9bdc,0xcaf1,0xbc45,0x2799,0x512d,
+        0x85c3,0xf377,0x68ab,0x1e1f,0x4f32,0x3986,0xa25a,0xd4ee,
+        0x1ba7,0x6d13,0xf6cf,0x807b,0xd156,0xa7e2,0x3c3e,0x4a8a,
+        0x9e64,0xe8d0,0x730c,0x05b8,0x5495,0x2221,0xb9fd,0xcf49,
+        0x374e,0x41fa,0xda26,0xac92,0xfdbf,0x8b0b,0x10d7,0x6663,
+        0xb28d,0xc439,0x5fe5,0x2951,0x787c,0x0ec8,0x9514,0xe3a0,
+        0x2ce9,0x5a5d,0xc181,0xb735,0xe618,0x90ac,0x0b70,0x7dc4,
+        0xa92a,0xdf9e,0x4442,0x32f6,0x63db,0x156f,0x8eb3,0xf807,
+        0x6e9c,0x1828,0x83f4,0xf540,0xa46d,0xd2d9,0x4905,0x3fb1,
+        0xeb5f,0x9deb,0x0637,0x7083,0x21ae,0x571a,0xccc6,0xba72,
+        0x753b,0x038f,0x9853,0xeee7,0xbfca,0xc97e,0x52a2,0x2416,
+        0xf0f8,0x864c,0x1d90,0x6b24,0x3a09,0x4cbd,0xd761,0xa1d5,
+        0x59d2,0x2f66,0xb4ba,0xc20e,0x9323,0xe597,0x7e4b,0x08ff,
+        0xdc11,0xaaa5,0x3179,0x47cd,0x16e0,0x6054,0xfb88,0x8d3c,
+        0x4275,0x34c1,0xaf1d,0xd9a9,0x8884,0xfe30,0x65ec,0x1358,
+        0xc7b6,0xb102,0x2ade,0x5c6a,0x0d47,0x7bf3,0xe02f,0x969b,
+        0xdd38,0xab8c,0x3050,0x46e4,0x17c9,0x617d,0xfaa1,0x8c15,
+        0x58fb,0x2e4f,0xb593,0xc327,0x920a,0xe4be,0x7f62,0x09d6,
+        0xc69f,0xb02b,0x2bf7,0x5d43,0x0c6e,0x7ada,0xe106,0x97b2,
+        0x435c,0x35e8,0xae34,0xd880,0x89ad,0xff19,0x64c5,0x1271,
+        0xea76,0x9cc2,0x071e,0x71aa,0x2087,0x5633,0xcdef,0xbb5b,
+        0x6fb5,0x1901,0x82dd,0xf469,0xa544,0xd3f0,0x482c,0x3e98,
+        0xf1d1,0x8765,0x1cb9,0x6a0d,0x3b20,0x4d94,0xd648,0xa0fc,
+        0x7412,0x02a6,0x997a,0xefce,0xbee3,0xc857,0x538b,0x253f,
+        0xb3a4,0xc510,0x5ecc,0x2878,0x7955,0x0fe1,0x943d,0xe289,
+        0x3667,0x40d3,0xdb0f,0xadbb,0xfc96,0x8a22,0x11fe,0x674a,
+        0xa803,0xdeb7,0x456b,0x33df,0x62f2,0x1446,0x8f9a,0xf92e,
+        0x2dc0,0x5b74,0xc0a8,0xb61c,0xe731,0x9185,0x0a59,0x7ced,
+        0x84ea,0xf25e,0x6982,0x1f36,0x4e1b,0x38af,0xa373,0xd5c7,
+        0x0129,0x779d,0xec41,0x9af5,0xcbd8,0xbd6c,0x26b0,0x5004,
+        0x9f4d,0xe9f9,0x7225,0x0491,0x55bc,0x2308,0xb8d4,0xce60,
+        0x1a8e,0x6c3a,0xf7e6,0x8152,0xd07f,0xa6cb,0x3d17,0x4ba3
+    },
+    {
+        0x0000,0xaa51,0x4483,0xeed2,0x8906,0x2357,0xcd85,0x67d4,
+        0x022d,0xa87c,0x46ae,0xecff,0x8b2b,0x217a,0xcfa8,0x65f9,
+        0x045a,0xae0b,0x40d9,0xea88,0x8d5c,0x270d,0xc9df,0x638e,
+        0x0677,0xac26,0x42f4,0xe8a5,0x8f71,0x2520,0xcbf2,0x61a3,
+        0x08b4,0xa2e5,0x4c37,0xe666,0x81b2,0x2be3,0xc531,0x6f60,
+        0x0a99,0xa0c8,0x4e1a,0xe44b,0x839f,0x29ce,0xc71c,0x6d4d,
+        0x0cee,0xa6bf,0x486d,0xe23c,0x85e8,0x2fb9,0xc16b,0x6b3a,
+        0x0ec3,0xa492,0x4a40,0xe011,0x87c5,0x2d94,0xc346,0x6917,
+        0x1168,0xbb39,0x55eb,0xffba,0x986e,0x323f,0xdced,0x76bc,
+        0x1345,0xb914,0x57c6,0xfd97,0x9a43,0x3012,0xdec0,0x7491,
+        0x1532,0xbf63,0x51b1,0xfbe0,0x9c34,0x3665,0xd8b7,0x72e6,
+        0x171f,0xbd4e,0x539c,0xf9cd,0x9e19,0x3448,0xda9a,0x70cb,
+        0x19dc,0xb38d,0x5d5f,0xf70e,0x90da,0x3a8b,0xd459,0x7e08,
+        0x1bf1,0xb1a0,0x5f72,0xf523,0x92f7,0x38a6,0xd674,0x7c25,
+        0x1d86,0xb7d7,0x5905,0xf354,0x9480,0x3ed1,0xd003,0x7a52,
+        0x1fab,0xb5fa,0x5b28,0xf179,0x96ad,0x3cfc,0xd22e,0x787f,
+        0x22d0,0x8881,0x6653,0xcc02,0xabd6,0x0187,0xef55,0x4504,
+        0x20fd,0x8aac,0x647e,0xce2f,0xa9fb,0x03aa,0xed78,0x4729,
+        0x268a,0x8cdb,0x6209,0xc858,0xaf8c,0x05dd,0xeb0f,0x415e,
+        0x24a7,0x8ef6,0x6024,0xca75,0xada1,0x07f0,0xe922,0x4373,
+        0x2a64,0x8035,0x6ee7,0xc4b6,0xa362,0x0933,0xe7e1,0x4db0,
+        0x2849,0x8218,0x6cca,0xc69b,0xa14f,0x0b1e,0xe5cc,0x4f9d,
+        0x2e3e,0x846f,0x6abd,0xc0ec,0xa738,0x0d69,0xe3bb,0x49ea,
+        0x2c13,0x8642,0x6890,0xc2c1,0xa515,0x0f44,0xe196,0x4bc7,
+        0x33b8,0x99e9,0x773b,0xdd6a,0xbabe,0x10ef,0xfe3d,0x546c,
+        0x3195,0x9bc4,0x7516,0xdf47,0xb893,0x12c2,0xfc10,0x5641,
+        0x37e2,0x9db3,0x7361,0xd930,0xbee4,0x14b5,0xfa67,0x5036,
+        0x35cf,0x9f9e,0x714c,0xdb1d,0xbcc9,0x1698,0xf84a,0x521b,
+        0x3b0c,0x915d,0x7f8f,0xd5de,0xb20a,0x185b,0xf689,0x5cd8,
+        0x3921,0x9370,0x7da2,0xd7f3,0xb027,0x1a76,0xf4a4,0x5ef5,
+        0x3f56,0x9507,0x7bd5,0xd184,0xb650,0x1c01,0xf2d3,0x5882,
+        0x3d7b,0x972a,0x79f8,0xd3a9,0xb47d,0x1e2c,0xf0fe,0x5aaf
+    },
+    {
+        0x0000,0x45a0,0x8b40,0xcee0,0x06a1,0x4301,0x8de1,0xc841,
+        0x0d42,0x48e2,0x8602,0xc3a2,0x0be3,0x4e43,0x80a3,0xc503,
+        0x1a84,0x5f24,0x91c4,0xd464,0x1c25,0x5985,0x9765,0xd2c5,
+        0x17c6,0x5266,0x9c86,0xd926,0x1167,0x54c7,0x9a27,0xdf87,
+        0x3508,0x70a8,0xbe48,0xfbe8,0x33a9,0x7609,0xb8e9,0xfd49,
+        0x384a,0x7dea,0xb30a,0xf6aa,0x3eeb,0x7b4b,0xb5ab,0xf00b,
+        0x2f8c,0x6a2c,0xa4cc,0xe16c,0x292d,0x6c8d,0xa26d,0xe7cd,
+        0x22ce,0x676e,0xa98e,0xec2e,0x246f,0x61cf,0xaf2f,0xea8f,
+        0x6a10,0x2fb0,0xe150,0xa4f0,0x6cb1,0x2911,0xe7f1,0xa251,
+        0x6752,0x22f2,0xec12,0xa9b2,0x61f3,0x2453,0xeab3,0xaf13,
+        0x7094,0x3534,0xfbd4,0xbe74,0x7635,0x3395,0xfd75,0xb8d5,
+        0x7dd6,0x3876,0xf696,0xb336,0x7b77,0x3ed7,0xf037,0xb597,
+        0x5f18,0x1ab8,0xd458,0x91f8,0x59b9,0x1c19,0xd2f9,0x9759,
+        0x525a,0x17fa,0xd91a,0x9cba,0x54fb,0x115b,0xdfbb,0x9a1b,
+        0x459c,0x003c,0xcedc,0x8b7c,0x433d,0x069d,0xc87d,0x8ddd,
+        0x48de,0x0d7e,0xc39e,0x863e,0x4e7f,0x0bdf,0xc53f,0x809f,
+        0xd420,0x9180,0x5f60,0x1ac0,0xd281,0x9721,0x59c1,0x1c61,
+        0xd962,0x9cc2,0x5222,0x1782,0xdfc3,0x9a63,0x5483,0x1123,
+        0xcea4,0x8b04,0x45e4,0x0044,0xc805,0x8da5,0x4345,0x06e5,
+        0xc3e6,0x8646,0x48a6,0x0d06,0xc547,0x80e7,0x4e07,0x0ba7,
+        0xe128,0xa488,0x6a68,0x2fc8,0xe789,0xa229,0x6cc9,0x2969,
+        0xec6a,0xa9ca,0x672a,0x228a,0xeacb,0xaf6b,0x618b,0x242b,
+        0xfbac,0xbe0c,0x70ec,0x354c,0xfd0d,0xb8ad,0x764d,0x33ed,
+        0xf6ee,0xb34e,0x7dae,0x380e,0xf04f,0xb5ef,0x7b0f,0x3eaf,
+        0xbe30,0xfb90,0x3570,0x70d0,0xb891,0xfd31,0x33d1,0x7671,
+        0xb372,0xf6d2,0x3832,0x7d92,0xb5d3,0xf073,0x3e93,0x7b33,
+        0xa4b4,0xe114,0x2ff4,0x6a54,0xa215,0xe7b5,0x2955,0x6cf5,
+        0xa9f6,0xec56,0x22b6,0x6716,0xaf57,0xeaf7,0x2417,0x61b7,
+        0x8b38,0xce98,0x0078,0x45d8,0x8d99,0xc839,0x06d9,0x4379,
+        0x867a,0xc3da,0x0d3a,0x489a,0x80db,0xc57b,0x0b9b,0x4e3b,
+        0x91bc,0xd41c,0x1afc,0x5f5c,0x971d,0xd2bd,0x1c5d,0x59fd,
+        0x9cfe,0xd95e,0x17be,0x521e,0x9a5f,0xdfff,0x111f,0x54bf
+    },
+    {
+        0x0000,0xb861,0x60e3,0xd882,0xc1c6,0x79a7,0xa125,0x1944,
+        0x93ad,0x2bcc,0xf34e,0x4b2f,0x526b,0xea0a,0x3288,0x8ae9,
+        0x377b,0x8f1a,0x5798,0xeff9,0xf6bd,0x4edc,0x965e,0x2e3f,
+        0xa4d6,0x1cb7,0xc435,0x7c54,0x6510,0xdd71,0x05f3,0xbd92,
+        0x6ef6,0xd697,0x0e15,0xb674,0xaf30,0x1751,0xcfd3,0x77b2,
+        0xfd5b,0x453a,0x9db8,0x25d9,0x3c9d,0x84fc,0x5c7e,0xe41f,
+        0x598d,0xe1ec,0x396e,0x810f,0x984b,0x202a,0xf8a8,0x40c9,
+        0xca20,0x7241,0xaac3,0x12a2,0x0be6,0xb387,0x6b05,0xd364,
+        0xddec,0x658d,0xbd0f,0x056e,0x1c2a,0xa44b,0x7cc9,0xc4a8,
+        0x4e41,0xf620,0x2ea2,0x96c3,0x8f87,0x37e6,0xef64,0x5705,
+        0xea97,0x52f6,0x8a74,0x3215,0x2b51,0x9330,0x4bb2,0xf3d3,
+        0x793a,0xc15b,0x19d9,0xa1b8,0xb8fc,0x009d,0xd81f,0x607e,
+        0xb31a,0x0b7b,0xd3f9,0x6b98,0x72dc,0xcabd,0x123f,0xaa5e,
+        0x20b7,0x98d6,0x4054,0xf835,0xe171,0x5910,0x8192,0x39f3,
+        0x8461,0x3c00,0xe482,0x5ce3,0x45a7,0xfdc6,0x2544,0x9d25,
+        0x17cc,0xafad,0x772f,0xcf4e,0xd60a,0x6e6b,0xb6e9,0x0e88,
+        0xabf9,0x1398,0xcb1a,0x737b,0x6a3f,0xd25e,0x0adc,0xb2bd,
+        0x3854,0x8035,0x58b7,0xe0d6,0xf992,0x41f3,0x9971,0x2110,
+        0x9c82,0x24e3,0xfc61,0x4400,0x5d44,0xe525,0x3da7,0x85c6,
+        0x0f2f,0xb74e,0x6fcc,0xd7ad,0xcee9,0x7688,0xae0a,0x166b,
+        0xc50f,0x7d6e,0xa5ec,0x1d8d,0x04c9,0xbca8,0x642a,0xdc4b,
+        0x56a2,0xeec3,0x3641,0x8e20,0x9764,0x2f05,0xf787,0x4fe6,
+        0xf274,0x4a15,0x9297,0x2af6,0x33b2,0x8bd3,0x5351,0xeb30,
+        0x61d9,0xd9b8,0x013a,0xb95b,0xa01f,0x187e,0xc0fc,0x789d,
+        0x7615,0xce74,0x16f6,0xae97,0xb7d3,0x0fb2,0xd730,0x6f51,
+        0xe5b8,0x5dd9,0x855b,0x3d3a,0x247e,0x9c1f,0x449d,0xfcfc,
+        0x416e,0xf90f,0x218d,0x99ec,0x80a8,0x38c9,0xe04b,0x582a,
+        0xd2c3,0x6aa2,0xb220,0x0a41,0x1305,0xab64,0x73e6,0xcb87,
+        0x18e3,0xa082,0x7800,0xc061,0xd925,0x6144,0xb9c6,0x01a7,
+        0x8b4e,0x332f,0xebad,0x53cc,0x4a88,0xf2e9,0x2a6b,0x920a,
+        0x2f98,0x97f9,0x4f7b,0xf71a,0xee5e,0x563f,0x8ebd,0x36dc,
+        0xbc35,0x0454,0xdcd6,0x64b7,0x7df3,0xc592,0x1d10,0xa571
+    },
+    {
+        0x0000,0x47d3,0x8fa6,0xc875,0x0f6d,0x48be,0x80cb,0xc718,
+        0x1eda,0x5909,0x917c,0xd6af,0x11b7,0x5664,0x9e11,0xd9c2,
+        0x3db4,0x7a67,0xb212,0xf5c1,0x32d9,0x750a,0xbd7f,0xfaac,
+        0x236e,0x64bd,0xacc8,0xeb1b,0x2c03,0x6bd0,0xa3a5,0xe476,
+        0x7b68,0x3cbb,0xf4ce,0xb31d,0x7405,0x33d6,0xfba3,0xbc70,
+        0x65b2,0x2261,0xea14,0xadc7,0x6adf,0x2d0c,0xe579,0xa2aa,
+        0x46dc,0x010f,0xc97a,0x8ea9,0x49b1,0x0e62,0xc617,0x81c4,
+        0x5806,0x1fd5,0xd7a0,0x9073,0x576b,0x10b8,0xd8cd,0x9f1e,
+        0xf6d0,0xb103,0x7976,0x3ea5,0xf9bd,0xbe6e,0x761b,0x31c8,
+        0xe80a,0xafd9,0x67ac,0x207f,0xe767,0xa0b4,0x68c1,0x2f12,
+        0xcb64,0x8cb7,0x44c2,0x0311,0xc409,0x83da,0x4baf,0x0c7c,
+        0xd5be,0x926d,0x5a18,0x1dcb,0xdad3,0x9d00,0x5575,0x12a6,
+        0x8db8,0xca6b,0x021e,0x45cd,0x82d5,0xc506,0x0d73,0x4aa0,
+        0x9362,0xd4b1,0x1cc4,0x5b17,0x9c0f,0xdbdc,0x13a9,0x547a,
+        0xb00c,0xf7df,0x3faa,0x7879,0xbf61,0xf8b2,0x30c7,0x7714,
+        0xaed6,0xe905,0x2170,0x66a3,0xa1bb,0xe668,0x2e1d,0x69ce,
+        0xfd81,0xba52,0x7227,0x35f4,0xf2ec,0xb53f,0x7d4a,0x3a99,
+        0xe35b,0xa488,0x6cfd,0x2b2e,0xec36,0xabe5,0x6390,0x2443,
+        0xc035,0x87e6,0x4f93,0x0840,0xcf58,0x888b,0x40fe,0x072d,
+        0xdeef,0x993c,0x5149,0x169a,0xd182,0x9651,0x5e24,0x19f7,
+        0x86e9,0xc13a,0x094f,0x4e9c,0x8984,0xce57,0x0622,0x41f1,
+        0x9833,0xdfe0,0x1795,0x5046,0x975e,0xd08d,0x18f8,0x5f2b,
+        0xbb5d,0xfc8e,0x34fb,0x7328,0xb430,0xf3e3,0x3b96,0x7c45,
+        0xa587,0xe254,0x2a21,0x6df2,0xaaea,0xed39,0x254c,0x629f,
+        0x0b51,0x4c82,0x84f7,0xc324,0x043c,0x43ef,0x8b9a,0xcc49,
+        0x158b,0x5258,0x9a2d,0xddfe,0x1ae6,0x5d35,0x9540,0xd293,
+        0x36e5,0x7136,0xb943,0xfe90,0x3988,0x7e5b,0xb62e,0xf1fd,
+        0x283f,0x6fec,0xa799,0xe04a,0x2752,0x6081,0xa8f4,0xef27,
+        0x7039,0x37ea,0xff9f,0xb84c,0x7f54,0x3887,0xf0f2,0xb721,
+        0x6ee3,0x2930,0xe145,0xa696,0x618e,0x265d,0xee28,0xa9fb,
+        0x4d8d,0x0a5e,0xc22b,0x85f8,0x42e0,0x0533,0xcd46,0x8a95,
+        0x5357,0x1484,0xdcf1,0x9b22,0x5c3a,0x1be9,0xd39c,0x944f
+    }
+};
+
+static uint16_t crc16(const unsigned char *p, size_t len) {
+    uint16_t crc = 0;
+
+    /* The CRC so far is folded into the first two bytes of the block. */
+    for (; len >= 8; p += 8, len -= 8) {
+        crc = crc16tab[7][p[0] ^ (crc >> 8)] ^ crc16tab[6][p[1] ^ (crc & 0xff)] ^
+              crc16tab[5][p[2]] ^ crc16tab[4][p[3]] ^
+              crc16tab[3][p[4]] ^ crc16tab[2][p[5]] ^
+              crc16tab[1][p[6]] ^ crc16tab[0][p[7]];
+    }
+    while (len--)
+        crc = (crc << 8) ^ crc16tab[0][(crc >> 8) ^ *p++];
+    return crc;
+}
+
+static unsigned int clusterKeySlot(const char *key, size_t len) {
+    const char *open, *close;
+
+    if ((open = memchr(key,'{',len)) != NULL &&
+        (close = memchr(open+1,'}',len-(open+1-key))) != NULL &&
+        close > open+1)
+    {
+        key = open+1;
+        len = close-key;
+    }
+    return crc16((const unsigned char *)key,len) & (REDIS_CLUSTER_SLOTS-1);
+}
+
+unsigned int redisKeySlot(const char *key, size_t len) {
+    return clusterKeySlot(key,len);
+}
+
+void redisKeySlots(const char **keys, const size_t *lens, size_t n, unsigned int *slots) {
+    size_t j;
+
+    for (j = 0; j < n; j++)
+        slots[j] = clusterKeySlot(keys[j],lens[j]);
+}
+
+static void clusterSetError(redisClusterContext *cc, int type, const char *str) {
+    size_t len = strlen(str);
+    len = len < (sizeof(cc->errstr)-1) ? len : (sizeof(cc->errstr)-1);
+    memcpy(cc->errstr,str,len);
+    cc->errstr[len] = '\0';
+    cc->err = type;
+}
+
+/* Next argument of a formatted command, NULL past its end. */
+static const char *clusterNextArg(const char *p, const char *end,
+                                  const char **str, size_t *len)
+{
+    long n;
+
+    if (p >= end || *p != '$')
+        return NULL;
+    n = strtol(p+1,NULL,10);
+    if (n < 0 || (p = memchr(p,'\n',end-p)) == NULL || end-(p+1) < n+2)
+        return NULL;
+    *str = p+1;
+    *len = (size_t)n;
+    return p+1+n+2;
+}
+
+/* Slot of the first key of a formatted command: its first argument, or the
+ * first key after the number of keys for scripts and functions. */
+static int clusterCommandSlot(const char *cmd, size_t len) {
+    const char *end = cmd+len, *p, *name, *arg;
+    size_t namelen, arglen;
+
+    if ((p = memchr(cmd,'\n',len)) == NULL ||
+        (p = clusterNextArg(p+1,end,&name,&namelen)) == NULL ||
+        (p = clusterNextArg(p,end,&arg,&arglen)) == NULL)
+        return -1;
+
+    if ((namelen == 4 && strncasecmp(name,"eval",4) == 0) ||
+        (namelen == 7 && strncasecmp(name,"evalsha",7) == 0) ||
+        (namelen == 5 && strncasecmp(name,"fcall",5) == 0))
+    {
+        if ((p = clusterNextArg(p,end,&arg,&arglen)) == NULL ||
+            strtol(arg,NULL,10) < 1 ||
+            clusterNextArg(p,end,&arg,&arglen) == NULL)
+            return -1;
+    }
+    return (int)redisKeySlot(arg,arglen);
+}
+
+static redisClusterNode *clusterGetNode(redisClusterContext *cc, const char *host,
+                                        size_t hostlen, int port)
+{
+    redisClusterNode *node, **nodes;
+    int i;
+
+    for (i = 0; i < cc->nnodes; i++) {
+        node = cc->nodes[i];
+        if (node->port == port && strlen(node->host) == hostlen &&
+            memcmp(node->host,host,hostlen) == 0)
+            return node;
+    }
+
+    if ((nodes = realloc(cc->nodes,(cc->nnodes+1)*sizeof(*nodes))) == NULL)
+        return NULL;
+    cc->nodes = nodes;
+    if ((node = calloc(1,sizeof(*node))) == NULL)
+        return NULL;
+    if ((node->host = malloc(hostlen+1)) == NULL) {
+        free(node);
+        return NULL;
+    }
+    memcpy(node->host,host,hostlen);
+    node->host[hostlen] = '\0';
+    node->port = port;
+    cc->nodes[cc->nnodes++] = node;
+    return node;
+}
+
+static int clusterConnectNode(redisClusterContext *cc, redisClusterNode *node) {
+    if (node->c != NULL && node->c->err == 0)
+        return REDIS_OK;
+    if (node->c != NULL)
+        redisFree(node->c);
+
+    if (cc->timeout)
+        node->c = redisConnectWithTimeout(node->host,node->port,*cc->timeout);
+    else
+        node->c = redisConnect(node->host,node->port);
+    if (node->c == NULL) {
+        clusterSetError(cc,REDIS_ERR_OOM,"Out of memory");
+        return REDIS_ERR;
+    }
+    if (node->c->err) {
+        clusterSetError(cc,node->c->err,node->c->errstr);
+        redisFree(node->c);
+        node->c = NULL;
+        return REDIS_ERR;
+    }
+    return REDIS_OK;
+}
+
+/* Replace the slot map with the one that "from" knows about. */
+static int clusterLoadSlots(redisClusterContext *cc, redisClusterNode *from) {
+    redisClusterNode **slots = NULL, *node;
+    redisReply *reply, *range, *master;
+    long long start, end;
+    size_t j;
+    int ret = REDIS_ERR;
+
+    if (clusterConnectNode(cc,from) != REDIS_OK)
+        return REDIS_ERR;
+    if ((reply = redisCommand(from->c,"CLUSTER SLOTS")) == NULL) {
+        clusterSetError(cc,from->c->err,from->c->errstr);
+        return REDIS_ERR;
+    }
+    if (reply->type == REDIS_REPLY_ERROR) {
+        clusterSetError(cc,REDIS_ERR_OTHER,reply->str);
+        goto done;
+    }
+    if (reply->type != REDIS_REPLY_ARRAY) {
+        clusterSetError(cc,REDIS_ERR_PROTOCOL,"Bad CLUSTER SLOTS reply");
+        goto done;
+    }
+
+    if ((slots = calloc(REDIS_CLUSTER_SLOTS,sizeof(*slots))) == NULL) {
+        clusterSetError(cc,REDIS_ERR_OOM,"Out of memory");
+        goto done;
+    }
+    for (j = 0; j < reply->elements; j++) {
+        range = reply->element[j];
+        if (range->type != REDIS_REPLY_ARRAY || range->elements < 3 ||
+            range->element[0]->type != REDIS_REPLY_INTEGER ||
+            range->element[1]->type != REDIS_REPLY_INTEGER ||
+            (master = range->element[2])->type != REDIS_REPLY_ARRAY ||
+            master->elements < 2 ||
+            master->element[0]->type != REDIS_REPLY_STRING ||
+            master->element[1]->type != REDIS_REPLY_INTEGER)
+        {
+            clusterSetError(cc,REDIS_ERR_PROTOCOL,"Bad CLUSTER SLOTS reply");
+            goto done;
+        }
+        start = range->element[0]->integer;
+        end = range->element[1]->integer;
+        if (start < 0 || end >= REDIS_CLUSTER_SLOTS || start > end) {
+            clusterSetError(cc,REDIS_ERR_PROTOCOL,"Bad CLUSTER SLOTS reply");
+            goto done;
+        }
+
+        /* An empty host is the one that was asked */
+        if (master->element[0]->len == 0)
+            node = clusterGetNode(cc,from->host,strlen(from->host),
+                                  (int)master->element[1]->integer);
+        else
+            node = clusterGetNode(cc,master->element[0]->str,master->element[0]->len,
+                                  (int)master->element[1]->integer);
+        if (node == NULL) {
+            clusterSetError(cc,REDIS_ERR_OOM,"Out of memory");
+            goto done;
+        }
+        for (; start <= end; start++)
+            slots[start] = node;
+    }
+    memcpy(cc->slots,slots,sizeof(cc->slots));
+    ret = REDIS_OK;
+
+done:
+    free(slots);
+    freeReplyObject(reply);
+    return ret;
+}
+
+redisClusterContext *redisClusterConnect(const char *addrs, const struct timeval *timeout) {
+    redisClusterContext *cc;
+    redisClusterNode *node;
+    const char *p, *end, *colon;
+
+    if ((cc = calloc(1,sizeof(*cc))) == NULL)
+        return NULL;
+    if (timeout) {
+        if ((cc->timeout = malloc(sizeof(*cc->timeout))) == NULL) {
+            free(cc);
+            return NULL;
+        }
+        memcpy(cc->timeout,timeout,sizeof(*timeout));
+    }
+
+    clusterSetError(cc,REDIS_ERR_OTHER,"No cluster address to connect to");
+    for (p = addrs; *p != '\0'; p = (*end == ',') ? end+1 : end) {
+        if ((end = strchr(p,',')) == NULL)
+            end = p+strlen(p);
+        for (colon = end; colon > p && *colon != ':'; colon--);
+        if (colon == p)
+            continue;
+
+        if ((node = clusterGetNode(cc,p,colon-p,atoi(colon+1))) == NULL) {
+            redisClusterFree(cc);
+            return NULL;
+        }
+        if (clusterLoadSlots(cc,node) == REDIS_OK) {
+            cc->err = 0;
+            cc->errstr[0] = '\0';
+            break;
+        }
+    }
+    return cc;
+}
+
+/* Forget the commands of the pipeline. Connections that still owe replies
+ * are closed, as there is no telling where their replies start. */
+static void clusterResetPipeline(redisClusterContext *cc) {
+    redisClusterNode *node;
+    size_t j;
+    int i;
+
+    for (i = 0; i < cc->nnodes; i++) {
+        node = cc->nodes[i];
+        if (node->len > node->head && node->c != NULL) {
+            redisFree(node->c);
+            node->c = NULL;
+        }
+        node->head = node->len = 0;
+    }
+    for (j = 0; j < cc->ncmds; j++) {
+        free(cc->cmds[j].cmd);
+        if (cc->cmds[j].reply) freeReplyObject(cc->cmds[j].reply);
+    }
+    cc->ncmds = cc->sent = cc->next = 0;
+}
+
+void redisClusterFree(redisClusterContext *cc) {
+    int i;
+
+    if (cc == NULL)
+        return;
+    clusterResetPipeline(cc);
+    for (i = 0; i < cc->nnodes; i++) {
+        if (cc->nodes[i]->c) redisFree(cc->nodes[i]->c);
+        free(cc->nodes[i]->waiting);
+        free(cc->nodes[i]->host);
+        free(cc->nodes[i]);
+    }
+    free(cc->nodes);
+    free(cc->cmds);
+    free(cc->timeout);
+    free(cc);
+}
+
+int redisClusterUpdateSlotMap(redisClusterContext *cc) {
+    int i;
+
+    if (cc->next < cc->ncmds) {
+        clusterSetError(cc,REDIS_ERR_OTHER,"Replies are pending");
+        return REDIS_ERR;
+    }
+    for (i = 0; i < cc->nnodes; i++) {
+        if (clusterLoadSlots(cc,cc->nodes[i]) == REDIS_OK) {
+            cc->err = 0;
+            cc->errstr[0] = '\0';
+            return REDIS_OK;
+        }
+    }
+    return REDIS_ERR;
+}
+
+/* Takes ownership of "cmd". */
+static int clusterAppend(redisClusterContext *cc, char *cmd, size_t len) {
+    redisClusterRequest *cmds;
+    size_t cap;
+
+    /* A new pipeline starts once all replies of the last one were read. */
+    if (cc->next == cc->ncmds) {
+        clusterResetPipeline(cc);
+        cc->err = 0;
+        cc->errstr[0] = '\0';
+    }
+    if (cc->ncmds == cc->cap) {
+        cap = cc->cap ? cc->cap*2 : 16;
+        if ((cmds = realloc(cc->cmds,cap*sizeof(*cmds))) == NULL) {
+            free(cmd);
+            clusterSetError(cc,REDIS_ERR_OOM,"Out of memory");
+            return REDIS_ERR;
+        }
+        cc->cmds = cmds;
+        cc->cap = cap;
+    }
+    cmds = &cc->cmds[cc->ncmds++];
+    cmds->cmd = cmd;
+    cmds->len = len;
+    cmds->slot = clusterCommandSlot(cmd,len);
+    cmds->redirects = 0;
+    cmds->node = NULL;
+    cmds->reply = NULL;
+    return REDIS_OK;
+}
+
+int redisvClusterAppendCommand(redisClusterContext *cc, const char *format, va_list ap) {
+    char *cmd;
+    int len;
+
+    if ((len = redisvFormatCommand(&cmd,format,ap)) == -1) {
+        clusterSetError(cc,REDIS_ERR_OOM,"Out of memory");
+        return REDIS_ERR;
+    } else if (len == -2) {
+        clusterSetError(cc,REDIS_ERR_OTHER,"Invalid format string");
+        return REDIS_ERR;
+    }
+    return clusterAppend(cc,cmd,len);
+}
+
+int redisClusterAppendCommand(redisClusterContext *cc, const char *format, ...) {
+    va_list ap;
+    int ret;
+
+    va_start(ap,format);
+    ret = redisvClusterAppendCommand(cc,format,ap);
+    va_end(ap);
+    return ret;
+}
+
+int redisClusterAppendCommandArgv(redisClusterContext *cc, int argc, const char **argv,
+                                  const size_t *argvlen)
+{
+    char *cmd;
+    long long len;
+
+    if ((len = redisFormatCommandArgv(&cmd,argc,argv,argvlen)) == -1) {
+        clusterSetError(cc,REDIS_ERR_OOM,"Out of memory");
+        return REDIS_ERR;
+    }
+    return clusterAppend(cc,cmd,(size_t)len);
+}
+
+static int clusterWait(redisClusterNode *node, long idx) {
+    long *waiting;
+    size_t cap;
+
+    if (node->len == node->cap) {
+        if (node->head > 0) {
+            memmove(node->waiting,node->waiting+node->head,
+                    (node->len-node->head)*sizeof(*waiting));
+            node->len -= node->head;
+            node->head = 0;
+        } else {
+            cap = node->cap ? node->cap*2 : 16;
+            if ((waiting = realloc(node->waiting,cap*sizeof(*waiting))) == NULL)
+                return REDIS_ERR;
+            node->waiting = waiting;
+            node->cap = cap;
+        }
+    }
+    node->waiting[node->len++] = idx;
+    return REDIS_OK;
+}
+
+/* Append command "i" to the output buffer of "node", after ASKING when the
+ * node was named by an ASK redirect. */
+static int clusterSend(redisClusterContext *cc, size_t i, redisClusterNode *node, int asking) {
+    redisClusterRequest *cmd = &cc->cmds[i];
+
+    if (clusterConnectNode(cc,node) != REDIS_OK)
+        return REDIS_ERR;
+    if ((asking && (redisAppendCommand(node->c,"ASKING") != REDIS_OK ||
+                    clusterWait(node,-1) != REDIS_OK)) ||
+        redisAppendFormattedCommand(node->c,cmd->cmd,cmd->len) != REDIS_OK ||
+        clusterWait(node,(long)i) != REDIS_OK)
+    {
+        clusterSetError(cc,REDIS_ERR_OOM,"Out of memory");
+        return REDIS_ERR;
+    }
+    cmd->node = node;
+    return REDIS_OK;
+}
+
+/* Hand the commands that were appended since the last call to their nodes,
+ * then write every node's share before any reply is read. */
+static int clusterFlush(redisClusterContext *cc) {
+    redisClusterRequest *cmd;
+    redisClusterNode *node;
+    int i, done;
+
+    for (; cc->sent < cc->ncmds; cc->sent++) {
+        cmd = &cc->cmds[cc->sent];
+        node = (cmd->slot >= 0) ? cc->slots[cmd->slot] : NULL;
+        if (node == NULL && cc->nnodes == 0) {
+            clusterSetError(cc,REDIS_ERR_OTHER,"No cluster node");
+            return REDIS_ERR;
+        }
+        if (node == NULL) node = cc->nodes[0]; /* Redirected when wrong */
+        if (clusterSend(cc,cc->sent,node,0) != REDIS_OK)
+            return REDIS_ERR;
+    }
+
+    for (i = 0; i < cc->nnodes; i++) {
+        node = cc->nodes[i];
+        if (node->c == NULL || sdslen(node->c->obuf) == 0)
+            continue;
+        do {
+            if (redisBufferWrite(node->c,&done) != REDIS_OK) {
+                clusterSetError(cc,node->c->err,node->c->errstr);
+                return REDIS_ERR;
+            }
+        } while (!done);
+    }
+    return REDIS_OK;
+}
+
+/* Read the next reply of "node" into the command it belongs to. */
+static int clusterRead(redisClusterContext *cc, redisClusterNode *node) {
+    void *reply;
+    long idx;
+
+    if (redisGetReply(node->c,&reply) != REDIS_OK) {
+        clusterSetError(cc,node->c->err,node->c->errstr);
+        return REDIS_ERR;
+    }
+    idx = node->waiting[node->head++];
+    if (idx < 0)
+        freeReplyObject(reply);
+    else
+        cc->cmds[idx].reply = reply;
+    return REDIS_OK;
+}
+
+/* Send command "i" again when its reply is a redirect. Returns 1 when it was
+ * sent again, 0 when the reply is final and -1 on errors. */
+static int clusterRedirect(redisClusterContext *cc, size_t i) {
+    redisClusterRequest *cmd = &cc->cmds[i];
+    redisReply *reply = cmd->reply;
+    redisClusterNode *node;
+    const char *addr, *colon;
+    char *p;
+    long slot;
+    int ask;
+
+    if (reply->type != REDIS_REPLY_ERROR || cmd->redirects >= REDIS_CLUSTER_MAX_REDIRECTS)
+        return 0;
+    if (strncmp(reply->str,"MOVED ",6) == 0)
+        ask = 0;
+    else if (strncmp(reply->str,"ASK ",4) == 0)
+        ask = 1;
+    else
+        return 0;
+
+    /* "MOVED <slot> <host>:<port>", where the host may be empty */
+    slot = strtol(reply->str+(ask ? 4 : 6),&p,10);
+    if (*p != ' ' || slot < 0 || slot >= REDIS_CLUSTER_SLOTS ||
+        (colon = strrchr(addr = p+1,':')) == NULL)
+        return 0;
+    if (colon == addr)
+        node = clusterGetNode(cc,cmd->node->host,strlen(cmd->node->host),atoi(colon+1));
+    else
+        node = clusterGetNode(cc,addr,colon-addr,atoi(colon+1));
+    if (node == NULL) {
+        clusterSetError(cc,REDIS_ERR_OOM,"Out of memory");
+        return -1;
+    }
+
+    if (!ask)
+        cc->slots[slot] = node;
+    freeReplyObject(reply);
+    cmd->reply = NULL;
+    cmd->redirects++;
+    return (clusterSend(cc,i,node,ask) == REDIS_OK) ? 1 : -1;
+}
+
+int redisClusterGetReply(redisClusterContext *cc, void **reply) {
+    redisClusterRequest *cmd;
+    int ret;
+
+    if (cc->next == cc->ncmds) {
+        clusterSetError(cc,REDIS_ERR_OTHER,"No pending replies");
+        return REDIS_ERR;
+    }
+    if (cc->sent < cc->ncmds && clusterFlush(cc) != REDIS_OK)
+        goto error;
+
+    cmd = &cc->cmds[cc->next];
+    do {
+        while (cmd->reply == NULL)
+            if (clusterRead(cc,cmd->node) != REDIS_OK)
+                goto error;
+    } while ((ret = clusterRedirect(cc,cc->next)) == 1);
+    if (ret < 0)
+        goto error;
+
+    if (reply != NULL)
+        *reply = cmd->reply;
+    else
+        freeReplyObject(cmd->reply);
+    cmd->reply = NULL;
+    cc->next++;
+    return REDIS_OK;
+
+error:
+    clusterResetPipeline(cc);
+    return REDIS_ERR;
+}
+
+void *redisvClusterCommand(redisClusterContext *cc, const char *format, va_list ap) {
+    void *reply;
+
+    if (redisvClusterAppendCommand(cc,format,ap) != REDIS_OK ||
+        redisClusterGetReply(cc,&reply) != REDIS_OK)
+        return NULL;
+    return reply;
+}
+
+void *redisClusterCommand(redisClusterContext *cc, const char *format, ...) {
+    va_list ap;
+    void *reply;
+
+    va_start(ap,format);
+    reply = redisvClusterCommand(cc,format,ap);
+    va_end(ap);
+    return reply;
+}
+
+void *redisClusterCommandArgv(redisClusterContext *cc, int argc, const char **argv,
+                              const size_t *argvlen)
+{
+    void *reply;
+
+    if (redisClusterAppendCommandArgv(cc,argc,argv,argvlen) != REDIS_OK ||
+        redisClusterGetReply(cc,&reply) != REDIS_OK)
+        return NULL;
+    return reply;
+}
+
+/* Multi-key commands that are split by key and merged again */
+#define REDIS_MULTI_ARRAY 0 /* One element per key */
+#define REDIS_MULTI_SUM 1 /* Sum of the integer replies */
+#define REDIS_MULTI_STATUS 2 /* The first error, or else the status */
+
+static const struct {
+    const char *name;
+    int step; /* Arguments per key */
+    int merge;
+} multiCommands[] = {
+    {"mget", 1, REDIS_MULTI_ARRAY},
+    {"mset", 2, REDIS_MULTI_STATUS},
+    {"del", 1, REDIS_MULTI_SUM},
+    {"unlink", 1, REDIS_MULTI_SUM},
+    {"exists", 1, REDIS_MULTI_SUM},
+    {"touch", 1, REDIS_MULTI_SUM}
+};
+
+/* A multi-key command split in parts: the keys sorted by their shard (or
+ * slot), where every run of keys of the same shard is one part. */
+typedef struct multiSplit {
+    int merge;
+    int step;
+    size_t nkeys;
+    uint64_t *order; /* (shard << 32) | key index, sorted */
+    size_t nparts;
+    size_t *first; /* Index in "order" of the first key of every part, plus
+                      one entry past the last part */
+    char **cmds; /* Formatted command of every part */
+    size_t *lens;
+} multiSplit;
+
+static int multiCompare(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+#define multiShard(split,part) ((long)((split)->order[(split)->first[part]] >> 32))
+#define multiKey(split,i) ((size_t)((split)->order[i] & 0xffffffff))
+#define multiArgLen(argv,argvlen,i) ((argvlen) ? (argvlen)[i] : strlen((argv)[i]))
+
+static void multiFree(multiSplit *split) {
+    size_t j;
+
+    if (split->cmds)
+        for (j = 0; j < split->nparts; j++)
+            free(split->cmds[j]);
+    free(split->cmds);
+    free(split->lens);
+    free(split->first);
+    free(split->order);
+}
+
+/* Split a command when it is a multi-key command with more than one shard
+ * among its keys. Returns REDIS_ERR when out of memory; "nparts" is 0 when
+ * the command needs no splitting. */
+static int multiSplitCommand(multiSplit *split, int argc, const char **argv,
+                             const size_t *argvlen, long (*shardOf)(const char*, size_t, void*),
+                             void *privdata)
+{
+    const char **partv = NULL;
+    size_t *partlen = NULL, i, j, k, a;
+    long long len;
+    unsigned int m;
+
+    memset(split,0,sizeof(*split));
+    if (argc < 2)
+        return REDIS_OK;
+    for (m = 0; m < sizeof(multiCommands)/sizeof(multiCommands[0]); m++)
+        if (strlen(multiCommands[m].name) == multiArgLen(argv,argvlen,0) &&
+            strncasecmp(argv[0],multiCommands[m].name,strlen(multiCommands[m].name)) == 0)
+            break;
+    if (m == sizeof(multiCommands)/sizeof(multiCommands[0]) ||
+        (argc-1) % multiCommands[m].step != 0)
+        return REDIS_OK;
+
+    split->merge = multiCommands[m].merge;
+    split->step = multiCommands[m].step;
+    split->nkeys = (argc-1)/split->step;
+    if ((split->order = malloc(split->nkeys*sizeof(*split->order))) == NULL ||
+        (split->first = malloc((split->nkeys+1)*sizeof(*split->first))) == NULL)
+        goto oom;
+    for (k = 0; k < split->nkeys; k++) {
+        a = 1+k*split->step;
+        split->order[k] = ((uint64_t)shardOf(argv[a],multiArgLen(argv,argvlen,a),privdata) << 32) | k;
+    }
+    qsort(split->order,split->nkeys,sizeof(*split->order),multiCompare);
+
+    for (i = 0; i < split->nkeys; i++)
+        if (i == 0 || (split->order[i] >> 32) != (split->order[i-1] >> 32))
+            split->first[split->nparts++] = i;
+    split->first[split->nparts] = split->nkeys;
+    if (split->nparts == 1) {
+        multiFree(split);
+        memset(split,0,sizeof(*split));
+        return REDIS_OK;
+    }
+
+    if ((split->cmds = calloc(split->nparts,sizeof(*split->cmds))) == NULL ||
+        (split->lens = malloc(split->nparts*sizeof(*split->lens))) == NULL ||
+        (partv = malloc(argc*sizeof(*partv))) == NULL ||
+        (partlen = malloc(argc*sizeof(*partlen))) == NULL)
+        goto oom;
+    partv[0] = argv[0];
+    partlen[0] = multiArgLen(argv,argvlen,0);
+    for (j = 0; j < split->nparts; j++) {
+        a = 1;
+        for (i = split->first[j]; i < split->first[j+1]; i++) {
+            k = 1+multiKey(split,i)*split->step;
+            memcpy(partv+a,argv+k,split->step*sizeof(*partv));
+            for (m = 0; m < (unsigned int)split->step; m++)
+                partlen[a+m] = multiArgLen(argv,argvlen,k+m);
+            a += split->step;
+        }
+        if ((len = redisFormatCommandArgv(&split->cmds[j],(int)a,partv,partlen)) < 0)
+            goto oom;
+        split->lens[j] = (size_t)len;
+    }
+    free(partv);
+    free(partlen);
+    return REDIS_OK;
+
+oom:
+    free(partv);
+    free(partlen);
+    multiFree(split);
+    return REDIS_ERR;
+}
+
+/* Merge the replies of the parts, which are consumed. Returns NULL when out
+ * of memory. */
+static redisReply *multiMerge(multiSplit *split, redisReply **parts) {
+    redisReply *merged = NULL, *part;
+    size_t i, j;
+
+    /* An error of any part is the reply, as are unexpected replies */
+    for (j = 0; j < split->nparts; j++) {
+        part = parts[j];
+        if (part->type == REDIS_REPLY_ERROR ||
+            (split->merge == REDIS_MULTI_ARRAY &&
+             (part->type != REDIS_REPLY_ARRAY ||
+              part->elements != split->first[j+1]-split->first[j])) ||
+            (split->merge == REDIS_MULTI_SUM && part->type != REDIS_REPLY_INTEGER))
+        {
+            merged = part;
+            parts[j] = NULL;
+            goto done;
+        }
+    }
+
+    switch (split->merge) {
+    case REDIS_MULTI_ARRAY:
+        if ((merged = calloc(1,sizeof(*merged))) == NULL ||
+            (merged->element = calloc(split->nkeys,sizeof(*merged->element))) == NULL)
+        {
+            free(merged);
+            merged = NULL;
+            goto done;
+        }
+        merged->type = REDIS_REPLY_ARRAY;
+        merged->elements = split->nkeys;
+        for (j = 0; j < split->nparts; j++) {
+            for (i = split->first[j]; i < split->first[j+1]; i++) {
+                merged->element[multiKey(split,i)] = parts[j]->element[i-split->first[j]];
+                parts[j]->element[i-split->first[j]] = NULL;
+            }
+        }
+        break;
+    case REDIS_MULTI_SUM:
+        merged = parts[0];
+        parts[0] = NULL;
+        for (j = 1; j < split->nparts; j++)
+            merged->integer += parts[j]->integer;
+        break;
+    default:
+        merged = parts[0];
+        parts[0] = NULL;
+        break;
+    }
+
+done:
+    for (j = 0; j < split->nparts; j++)
+        freeReplyObject(parts[j]);
+    return merged;
+}
+
+static long multiClusterShard(const char *key, size_t len, void *privdata) {
+    ((void) privdata);
+    return (long)redisKeySlot(key,len);
+}
+
+void *redisClusterMultiCommandArgv(redisClusterContext *cc, int argc, const char **argv,
+                                   const size_t *argvlen)
+{
+    redisReply **parts = NULL, *merged = NULL;
+    multiSplit split;
+    size_t j;
+
+    if (cc->next < cc->ncmds) {
+        clusterSetError(cc,REDIS_ERR_OTHER,"Replies are pending");
+        return NULL;
+    }
+    if (multiSplitCommand(&split,argc,argv,argvlen,multiClusterShard,NULL) != REDIS_OK) {
+        clusterSetError(cc,REDIS_ERR_OOM,"Out of memory");
+        return NULL;
+    }
+    if (split.nparts == 0)
+        return redisClusterCommandArgv(cc,argc,argv,argvlen);
+
+    /* The parts form one pipeline, so every node gets its share at once. */
+    if ((parts = calloc(split.nparts,sizeof(*parts))) == NULL) {
+        clusterSetError(cc,REDIS_ERR_OOM,"Out of memory");
+        goto done;
+    }
+    for (j = 0; j < split.nparts; j++) {
+        if (clusterAppend(cc,split.cmds[j],split.lens[j]) != REDIS_OK) {
+            split.cmds[j] = NULL;
+            goto done;
+        }
+        split.cmds[j] = NULL; /* Owned by the pipeline */
+    }
+    for (j = 0; j < split.nparts; j++)
+        if (redisClusterGetReply(cc,(void**)&parts[j]) != REDIS_OK)
+            goto done;
+    if ((merged = multiMerge(&split,parts)) == NULL)
+        clusterSetError(cc,REDIS_ERR_OOM,"Out of memory");
+    split.nparts = 0; /* The replies were consumed */
+
+done:
+    if (parts)
+        for (j = 0; j < split.nparts; j++)
+            freeReplyObject(parts[j]);
+    free(parts);
+    multiFree(&split);
+    return merged;
+}
+
+typedef struct multiShardFn {
+    redisKeyShardFn *fn;
+    void *privdata;
+    int nshards;
+} multiShardFn;
+
+/* Out of range shards all become shard 0. */
+static long multiUserShard(const char *key, size_t len, void *privdata) {
+    multiShardFn *sf = privdata;
+    int i = sf->fn(key,len,sf->privdata);
+    return (i < 0 || i >= sf->nshards) ? 0 : i;
+}
+
+void *redisMultiCommandArgv(redisContext **shards, int nshards, redisKeyShardFn *fn,
+                            void *privdata, int argc, const char **argv,
+                            const size_t *argvlen)
+{
+    redisReply **parts = NULL, *merged = NULL;
+    redisContext *c;
+    multiShardFn sf;
+    multiSplit split;
+    size_t j;
+    int i, done;
+
+    sf.fn = fn;
+    sf.privdata = privdata;
+    sf.nshards = nshards;
+    if (multiSplitCommand(&split,argc,argv,argvlen,multiUserShard,&sf) != REDIS_OK)
+        return NULL;
+    if (split.nparts == 0)
+        return redisCommandArgv(shards[argc > 1 ?
+                                       multiUserShard(argv[1],multiArgLen(argv,argvlen,1),&sf) : 0],
+                                argc,argv,argvlen);
+
+    /* Queue every part before writing anything, then write all shards before
+     * the first reply is read. */
+    for (j = 0; j < split.nparts; j++) {
+        c = shards[multiShard(&split,j)];
+        if (redisAppendFormattedCommand(c,split.cmds[j],split.lens[j]) != REDIS_OK)
+            goto done;
+    }
+    for (i = 0; i < nshards; i++) {
+        c = shards[i];
+        if (c->flags & REDIS_BLOCK) {
+            done = 0;
+            while (!done)
+                if (redisBufferWrite(c,&done) == REDIS_ERR)
+                    goto done;
+        }
+    }
+
+    if ((parts = calloc(split.nparts,sizeof(*parts))) == NULL)
+        goto done;
+    for (j = 0; j < split.nparts; j++)
+        if (redisGetReply(shards[multiShard(&split,j)],(void**)&parts[j]) != REDIS_OK)
+            goto done;
+    merged = multiMerge(&split,parts);
+    split.nparts = 0;
+
+done:
+    if (parts)
+        for (j = 0; j < split.nparts; j++)
+            freeReplyObject(parts[j]);
+    free(parts);
+    multiFree(&split);
+    return merged;
+}
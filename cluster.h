@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) 2009-2011, Salvatore Sanfilippo <antirez at gmail dot com>
+ * Copyright (c) 2010-2011, Pieter Noordhuis <pcnoordhuis at gmail dot com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __HIREDIS_CLUSTER_H
+#define __HIREDIS_CLUSTER_H
+#include "hiredis.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define REDIS_CLUSTER_SLOTS 16384
+
+/* A command is sent again this many times after MOVED or ASK, before the
+ * redirect is returned as its reply. */
+#define REDIS_CLUSTER_MAX_REDIRECTS 5
+
+/* A master of the cluster. Its connection is made when it is first used. */
+typedef struct redisClusterNode {
+    char *host;
+    int port;
+    redisContext *c;
+
+    /* Private to the cluster context: commands waiting for a reply from this
+     * node, by index in the pipeline. -1 is an ASKING whose reply is dropped. */
+    long *waiting;
+    size_t head, len, cap;
+} redisClusterNode;
+
+/* A command of the pipeline */
+typedef struct redisClusterRequest {
+    char *cmd;
+    size_t len;
+    int slot; /* -1 for commands without a key */
+    int redirects;
+    redisClusterNode *node; /* Where it was sent last */
+    redisReply *reply; /* Read ahead of the commands before it */
+} redisClusterRequest;
+
+/* Blocking client of a cluster. Every command goes to the master of the slot
+ * of its key. Pipelined commands are split per node and all nodes get their
+ * share before any reply is read. MOVED updates the slot in the map and ASK
+ * doesn't; both send the command again to the named node. */
+typedef struct redisClusterContext {
+    int err; /* Error flags, 0 when there is no error */
+    char errstr[128]; /* String representation of error when applicable */
+
+    struct timeval *timeout;
+    redisClusterNode **nodes;
+    int nnodes;
+    redisClusterNode *slots[REDIS_CLUSTER_SLOTS]; /* NULL when not served */
+
+    /* Pipeline */
+    redisClusterRequest *cmds;
+    size_t ncmds, cap;
+    size_t sent; /* Commands that were handed to their node */
+    size_t next; /* Next reply to return */
+} redisClusterContext;
+
+/* Hash slot of a key: CRC16 of the key, or of the part between the first '{'
+ * and the next '}' when that is not empty. */
+unsigned int redisKeySlot(const char *key, size_t len);
+
+/* Slots of "n" keys at once, into "slots". */
+void redisKeySlots(const char **keys, const size_t *lens, size_t n, unsigned int *slots);
+
+/* Bootstrap from CLUSTER SLOTS of the first reachable address of the comma
+ * separated "host:port" list. Returns NULL when out of memory; check err for
+ * other errors. "timeout" may be NULL. */
+redisClusterContext *redisClusterConnect(const char *addrs, const struct timeval *timeout);
+void redisClusterFree(redisClusterContext *cc);
+
+/* Load the whole slot map again. Not while replies are pending. */
+int redisClusterUpdateSlotMap(redisClusterContext *cc);
+
+/* Pipelining works like it does for a single context: append commands, then
+ * fetch their replies in order. */
+int redisvClusterAppendCommand(redisClusterContext *cc, const char *format, va_list ap);
+int redisClusterAppendCommand(redisClusterContext *cc, const char *format, ...);
+int redisClusterAppendCommandArgv(redisClusterContext *cc, int argc, const char **argv,
+                                  const size_t *argvlen);
+int redisClusterGetReply(redisClusterContext *cc, void **reply);
+
+void *redisvClusterCommand(redisClusterContext *cc, const char *format, va_list ap);
+void *redisClusterCommand(redisClusterContext *cc, const char *format, ...);
+void *redisClusterCommandArgv(redisClusterContext *cc, int argc, const char **argv,
+                              const size_t *argvlen);
+
+/* MGET, MSET, DEL, UNLINK, EXISTS and TOUCH with keys in more than one slot
+ * are split per slot. The parts are pipelined, so all nodes work on them at
+ * once, and the replies are merged: MGET elements in the order of the keys,
+ * the sum of the integers, or the status of MSET. An error reply of any part
+ * is the reply. Other commands are sent like redisClusterCommandArgv() does.
+ * Not while replies are pending. */
+void *redisClusterMultiCommandArgv(redisClusterContext *cc, int argc, const char **argv,
+                                   const size_t *argvlen);
+
+/* Shard of a key, in [0,nshards). Other values mean the first shard. */
+typedef int (redisKeyShardFn)(const char *key, size_t len, void *privdata);
+
+/* The same over "nshards" blocking contexts, split by "fn" instead of the hash
+ * slot. Every shard gets its parts written before any reply is read. Returns
+ * NULL on errors, with err set in the failing context; the other contexts may
+ * still have replies pending then. */
+void *redisMultiCommandArgv(redisContext **shards, int nshards, redisKeyShardFn *fn,
+                            void *privdata, int argc, const char **argv,
+                            const size_t *argvlen);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,9 +1,9 @@
 /* Hash table implementation.
  *
- * This file implements in memory hash tables with insert/del/replace/find/
- * get-random-element operations. Hash tables will auto resize if needed
- * tables of power of two in size are used, collisions are handled by
- * chaining. See the source code for more information... :)
+ * This file implements in memory hash tables with insert/del/replace/find
+ * operations. Tables of power of two in size are used, collisions are handled
+ * by open addressing with linear probing, and tables are resized
+ * incrementally. See the source code for more information... :)
  *
  * Copyright (c) 2006-2010, Salvatore Sanfilippo <antirez at gmail dot com>
  * All rights reserved.
@@ -37,126 +37,147 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <limits.h>
+#include <stdint.h>
+#include <string.h>
 #include "dict.h"
 
+/* Marks a slot whose entry was deleted or moved. Probing continues past it,
+ * while inserts may reuse it. */
+static char _dictDeletedKey;
+#define DICT_DELETED ((void*)&_dictDeletedKey)
+#define _dictSlotUsed(he) ((he)->key != NULL && (he)->key != DICT_DELETED)
+
 /* -------------------------- private prototypes ---------------------------- */
 
 static int _dictExpandIfNeeded(dict *ht);
 static unsigned long _dictNextPower(unsigned long size);
-static int _dictKeyIndex(dict *ht, const void *key);
 static int _dictInit(dict *ht, dictType *type, void *privDataPtr);
+static void _dictRehashStep(dict *ht);
+static dictEntry *_dictLookup(dict *ht, dictht *t, unsigned int h,
+                              const void *key, const void *buf, size_t len);
+static dictEntry *_dictFreeSlot(dictht *t, unsigned int h);
 
 /* -------------------------- hash functions -------------------------------- */
 
-/* Generic hash function (a popular one from Bernstein).
- * I tested a few and this was the best. */
+/* Generic hash function. It mixes in 8 bytes per multiplication instead of
+ * one. The high half of a product depends on all bits of its operands, so
+ * the result is taken from there: the low bits select the slot. */
+#define DICT_HASH_MUL 0x9e3779b97f4a7c15ULL
+
 static unsigned int dictGenHashFunction(const unsigned char *buf, int len) {
-    unsigned int hash = 5381;
+    uint64_t hash = (uint64_t)len * DICT_HASH_MUL, w;
 
-    while (len--)
-        hash = ((hash << 5) + hash) + (*buf++); /* hash * 33 + c */
-    return hash;
+    for (; len >= 8; buf += 8, len -= 8) {
+        memcpy(&w,buf,8);
+        hash = ((hash << 5 | hash >> 59) ^ w) * DICT_HASH_MUL;
+    }
+    if (len > 0) {
+        w = 0;
+        memcpy(&w,buf,len);
+        hash = ((hash << 5 | hash >> 59) ^ w) * DICT_HASH_MUL;
+    }
+    hash ^= hash >> 32;
+    return (unsigned int)((hash * DICT_HASH_MUL) >> 32);
 }
 
 /* ----------------------------- API implementation ------------------------- */
 
-/* Reset an hashtable already initialized with ht_init().
- * NOTE: This function should only called by ht_destroy(). */
-static void _dictReset(dict *ht) {
-    ht->table = NULL;
-    ht->size = 0;
-    ht->sizemask = 0;
-    ht->used = 0;
+static void _dictReset(dictht *t) {
+    t->table = NULL;
+    t->size = 0;
+    t->sizemask = 0;
+    t->used = 0;
+    t->filled = 0;
 }
 
 /* Create a new hash table */
 static dict *dictCreate(dictType *type, void *privDataPtr) {
     dict *ht = malloc(sizeof(*ht));
+    if (ht == NULL)
+        return NULL;
     _dictInit(ht,type,privDataPtr);
     return ht;
 }
 
 /* Initialize the hash table */
 static int _dictInit(dict *ht, dictType *type, void *privDataPtr) {
-    _dictReset(ht);
+    _dictReset(&ht->ht[0]);
+    _dictReset(&ht->ht[1]);
     ht->type = type;
     ht->privdata = privDataPtr;
+    ht->rehashidx = -1;
+    ht->iterators = 0;
     return DICT_OK;
 }
 
-/* Expand or create the hashtable */
+/* Create the table, or start moving the entries to a new one of the given
+ * size. The entries move over while the table is used, see
+ * _dictRehashStep(). */
 static int dictExpand(dict *ht, unsigned long size) {
-    dict n; /* the new hashtable */
-    unsigned long realsize = _dictNextPower(size), i;
+    unsigned long realsize = _dictNextPower(size);
+    dictht n;
 
     /* the size is invalid if it is smaller than the number of
      * elements already inside the hashtable */
-    if (ht->used > size)
+    if (dictIsRehashing(ht) || ht->ht[0].used > size)
         return DICT_ERR;
 
-    _dictInit(&n, ht->type, ht->privdata);
+    _dictReset(&n);
     n.size = realsize;
     n.sizemask = realsize-1;
-    n.table = calloc(realsize,sizeof(dictEntry*));
-
-    /* Copy all the elements from the old to the new table:
-     * note that if the old hash table is empty ht->size is zero,
-     * so dictExpand just creates an hash table. */
-    n.used = ht->used;
-    for (i = 0; i < ht->size && ht->used > 0; i++) {
-        dictEntry *he, *nextHe;
-
-        if (ht->table[i] == NULL) continue;
-
-        /* For each hash entry on this slot... */
-        he = ht->table[i];
-        while(he) {
-            unsigned int h;
-
-            nextHe = he->next;
-            /* Get the new element index */
-            h = dictHashKey(ht, he->key) & n.sizemask;
-            he->next = n.table[h];
-            n.table[h] = he;
-            ht->used--;
-            /* Pass to the next element */
-            he = nextHe;
-        }
-    }
-    assert(ht->used == 0);
-    free(ht->table);
+    if ((n.table = calloc(realsize,sizeof(dictEntry))) == NULL)
+        return DICT_ERR;
 
-    /* Remap the new hashtable in the old */
-    *ht = n;
+    if (ht->ht[0].table == NULL) {
+        ht->ht[0] = n;
+    } else {
+        ht->ht[1] = n;
+        ht->rehashidx = 0;
+    }
     return DICT_OK;
 }
 
+/* Make sure "n" more entries can be added. This only fails while an iterator
+ * pauses a resize and the new table has no room left: the entries can't move
+ * without the iterator missing some or returning them twice. */
+static int dictReserve(dict *ht, unsigned long n) {
+    dictht *t = dictIsRehashing(ht) ? &ht->ht[1] : &ht->ht[0];
+
+    if (t->size > 0 && (t->filled+n)*4 <= t->size*3)
+        return DICT_OK;
+    if (!dictIsRehashing(ht))
+        return dictExpand(ht,(ht->ht[0].used+n+ht->ht[0].size/DICT_REHASH_SLOTS+1)*2);
+    return ht->iterators > 0 ? DICT_ERR : DICT_OK;
+}
+
 /* Add an element to the target hash table */
 static int dictAdd(dict *ht, void *key, void *val) {
-    int index;
+    unsigned int h = dictHashKey(ht, key);
     dictEntry *entry;
+    dictht *t;
 
-    /* Get the index of the new element, or -1 if
-     * the element already exists. */
-    if ((index = _dictKeyIndex(ht, key)) == -1)
+    if (dictIsRehashing(ht))
+        _dictRehashStep(ht);
+    if (_dictLookup(ht,&ht->ht[0],h,key,NULL,0) != NULL ||
+        _dictLookup(ht,&ht->ht[1],h,key,NULL,0) != NULL)
+        return DICT_ERR;
+    if (_dictExpandIfNeeded(ht) == DICT_ERR)
         return DICT_ERR;
 
-    /* Allocates the memory and stores key */
-    entry = malloc(sizeof(*entry));
-    entry->next = ht->table[index];
-    ht->table[index] = entry;
-
-    /* Set the hash entry fields. */
+    /* New entries go to the table that is being filled. */
+    t = dictIsRehashing(ht) ? &ht->ht[1] : &ht->ht[0];
+    entry = _dictFreeSlot(t,h);
+    entry->hash = h;
     dictSetHashKey(ht, entry, key);
     dictSetHashVal(ht, entry, val);
-    ht->used++;
+    t->used++;
     return DICT_OK;
 }
 
 /* Add an element, discarding the old if the key already exists.
  * Return 1 if the key was added from scratch, 0 if there was already an
  * element with such key and dictReplace() just performed a value update
- * operation. */
+ * operation, and -1 if the key could not be added (see dictReserve()). */
 static int dictReplace(dict *ht, void *key, void *val) {
     dictEntry *entry, auxentry;
 
@@ -165,7 +186,8 @@ static int dictReplace(dict *ht, void *key, void *val) {
     if (dictAdd(ht, key, val) == DICT_OK)
         return 1;
     /* It already exists, get the entry */
-    entry = dictFind(ht, key);
+    if ((entry = dictFind(ht, key)) == NULL)
+        return -1;
     /* Free the old value and set the new one */
     /* Set the new value and free the old one. Note that it is important
      * to do that in this order, as the value may just be exactly the same
@@ -180,31 +202,21 @@ static int dictReplace(dict *ht, void *key, void *val) {
 
 /* Search and remove an element */
 static int dictDelete(dict *ht, const void *key) {
-    unsigned int h;
-    dictEntry *de, *prevde;
-
-    if (ht->size == 0)
-        return DICT_ERR;
-    h = dictHashKey(ht, key) & ht->sizemask;
-    de = ht->table[h];
-
-    prevde = NULL;
-    while(de) {
-        if (dictCompareHashKeys(ht,key,de->key)) {
-            /* Unlink the element from the list */
-            if (prevde)
-                prevde->next = de->next;
-            else
-                ht->table[h] = de->next;
-
-            dictFreeEntryKey(ht,de);
-            dictFreeEntryVal(ht,de);
-            free(de);
-            ht->used--;
-            return DICT_OK;
-        }
-        prevde = de;
-        de = de->next;
+    unsigned int h = dictHashKey(ht, key);
+    dictEntry *de;
+    int i;
+
+    if (dictIsRehashing(ht))
+        _dictRehashStep(ht);
+    for (i = 0; i < 2; i++) {
+        if ((de = _dictLookup(ht,&ht->ht[i],h,key,NULL,0)) == NULL)
+            continue;
+        dictFreeEntryKey(ht,de);
+        dictFreeEntryVal(ht,de);
+        de->key = DICT_DELETED;
+        de->val = NULL;
+        ht->ht[i].used--;
+        return DICT_OK;
     }
     return DICT_ERR; /* not found */
 }
@@ -212,25 +224,24 @@ static int dictDelete(dict *ht, const void *key) {
 /* Destroy an entire hash table */
 static int _dictClear(dict *ht) {
     unsigned long i;
+    dictEntry *he;
+    int j;
 
-    /* Free all the elements */
-    for (i = 0; i < ht->size && ht->used > 0; i++) {
-        dictEntry *he, *nextHe;
-
-        if ((he = ht->table[i]) == NULL) continue;
-        while(he) {
-            nextHe = he->next;
+    for (j = 0; j < 2; j++) {
+        /* Free all the elements */
+        for (i = 0; i < ht->ht[j].size && ht->ht[j].used > 0; i++) {
+            he = &ht->ht[j].table[i];
+            if (!_dictSlotUsed(he)) continue;
             dictFreeEntryKey(ht, he);
             dictFreeEntryVal(ht, he);
-            free(he);
-            ht->used--;
-            he = nextHe;
+            ht->ht[j].used--;
         }
+        /* Free the table and the allocated cache structure */
+        free(ht->ht[j].table);
+        /* Re-initialize the table */
+        _dictReset(&ht->ht[j]);
     }
-    /* Free the table and the allocated cache structure */
-    free(ht->table);
-    /* Re-initialize the table */
-    _dictReset(ht);
+    ht->rehashidx = -1;
     return DICT_OK; /* never fails */
 }
 
@@ -241,64 +252,81 @@ static void dictRelease(dict *ht) {
 }
 
 static dictEntry *dictFind(dict *ht, const void *key) {
+    unsigned int h;
     dictEntry *he;
+
+    if (dictSize(ht) == 0) return NULL;
+    if (dictIsRehashing(ht))
+        _dictRehashStep(ht);
+    h = dictHashKey(ht, key);
+    if ((he = _dictLookup(ht,&ht->ht[0],h,key,NULL,0)) == NULL)
+        he = _dictLookup(ht,&ht->ht[1],h,key,NULL,0);
+    return he;
+}
+
+/* Find the entry whose key matches "len" bytes at "buf", so the caller
+ * doesn't have to build a key just for the lookup. */
+static dictEntry *dictFindBuffer(dict *ht, const void *buf, size_t len) {
     unsigned int h;
+    dictEntry *he;
 
-    if (ht->size == 0) return NULL;
-    h = dictHashKey(ht, key) & ht->sizemask;
-    he = ht->table[h];
-    while(he) {
-        if (dictCompareHashKeys(ht, key, he->key))
-            return he;
-        he = he->next;
-    }
-    return NULL;
+    if (dictSize(ht) == 0) return NULL;
+    if (dictIsRehashing(ht))
+        _dictRehashStep(ht);
+    h = ht->type->bufferHashFunction(buf, len);
+    if ((he = _dictLookup(ht,&ht->ht[0],h,NULL,buf,len)) == NULL)
+        he = _dictLookup(ht,&ht->ht[1],h,NULL,buf,len);
+    return he;
 }
 
+/* Entries may be deleted while iterating. The table doesn't resize while
+ * an iterator is alive, so every entry is returned once. */
 static dictIterator *dictGetIterator(dict *ht) {
     dictIterator *iter = malloc(sizeof(*iter));
 
     iter->ht = ht;
+    iter->table = 0;
     iter->index = -1;
-    iter->entry = NULL;
-    iter->nextEntry = NULL;
+    ht->iterators++;
     return iter;
 }
 
 static dictEntry *dictNext(dictIterator *iter) {
-    while (1) {
-        if (iter->entry == NULL) {
-            iter->index++;
-            if (iter->index >=
-                    (signed)iter->ht->size) break;
-            iter->entry = iter->ht->table[iter->index];
-        } else {
-            iter->entry = iter->nextEntry;
-        }
-        if (iter->entry) {
-            /* We need to save the 'next' here, the iterator user
-             * may delete the entry we are returning. */
-            iter->nextEntry = iter->entry->next;
-            return iter->entry;
+    dictht *t;
+
+    for (; iter->table < 2; iter->table++, iter->index = -1) {
+        t = &iter->ht->ht[iter->table];
+        while (++iter->index < (long)t->size) {
+            if (_dictSlotUsed(&t->table[iter->index]))
+                return &t->table[iter->index];
         }
     }
     return NULL;
 }
 
 static void dictReleaseIterator(dictIterator *iter) {
+    iter->ht->iterators--;
     free(iter);
 }
 
 /* ------------------------- private functions ------------------------------ */
 
-/* Expand the hash table if needed */
+/* Start resizing when the table is 3/4 full, counting deleted slots. The new
+ * table also has room for the entries that may be added before all were
+ * moved over, so it never needs to resize in turn. */
 static int _dictExpandIfNeeded(dict *ht) {
-    /* If the hash table is empty expand it to the initial size,
-     * if the table is "full" dobule its size. */
-    if (ht->size == 0)
+    dictht *t = &ht->ht[0];
+
+    if (dictIsRehashing(ht)) {
+        /* Only possible when an iterator paused the move. */
+        if ((ht->ht[1].filled+1)*4 > ht->ht[1].size*3)
+            return DICT_ERR;
+        return DICT_OK;
+    }
+    if (t->size == 0)
         return dictExpand(ht, DICT_HT_INITIAL_SIZE);
-    if (ht->used == ht->size)
-        return dictExpand(ht, ht->size*2);
+    if ((t->filled+1)*4 > t->size*3)
+        return dictExpand(ht, (t->used+t->size/DICT_REHASH_SLOTS+1)*2);
     return DICT_OK;
 }
 
@@ -314,25 +342,66 @@ static unsigned long _dictNextPower(unsigned long size) {
     }
 }
 
-/* Returns the index of a free slot that can be populated with
- * an hash entry for the given 'key'.
- * If the key already exists, -1 is returned. */
-static int _dictKeyIndex(dict *ht, const void *key) {
-    unsigned int h;
+/* Move the entries of the next DICT_REHASH_SLOTS slots of ht[0] to ht[1],
+ * and switch to ht[1] once ht[0] is empty. */
+static void _dictRehashStep(dict *ht) {
+    dictht *t = &ht->ht[0];
+    unsigned long end = ht->rehashidx+DICT_REHASH_SLOTS;
+    dictEntry *he, *to;
+
+    if (ht->iterators > 0)
+        return;
+    for (; (unsigned long)ht->rehashidx < end &&
+           (unsigned long)ht->rehashidx < t->size; ht->rehashidx++)
+    {
+        he = &t->table[ht->rehashidx];
+        if (!_dictSlotUsed(he)) continue;
+        to = _dictFreeSlot(&ht->ht[1],he->hash);
+        *to = *he;
+        ht->ht[1].used++;
+        /* Keep probe sequences that pass this slot intact. */
+        he->key = DICT_DELETED;
+        t->used--;
+    }
+    if ((unsigned long)ht->rehashidx == t->size) {
+        assert(t->used == 0);
+        free(t->table);
+        ht->ht[0] = ht->ht[1];
+        _dictReset(&ht->ht[1]);
+        ht->rehashidx = -1;
+    }
+}
+
+/* Find the entry of "t" with the given hash whose key matches "key", or
+ * "len" bytes at "buf" when "key" is NULL. */
+static dictEntry *_dictLookup(dict *ht, dictht *t, unsigned int h,
+                              const void *key, const void *buf, size_t len)
+{
+    unsigned long i;
     dictEntry *he;
 
-    /* Expand the hashtable if needed */
-    if (_dictExpandIfNeeded(ht) == DICT_ERR)
-        return -1;
-    /* Compute the key hash value */
-    h = dictHashKey(ht, key) & ht->sizemask;
-    /* Search if this slot does not already contain the given key */
-    he = ht->table[h];
-    while(he) {
-        if (dictCompareHashKeys(ht, key, he->key))
-            return -1;
-        he = he->next;
+    if (t->size == 0)
+        return NULL;
+    for (i = h & t->sizemask; (he = &t->table[i])->key != NULL;
+         i = (i+1) & t->sizemask)
+    {
+        if (he->hash != h || he->key == DICT_DELETED)
+            continue;
+        if (key != NULL ? dictCompareHashKeys(ht, key, he->key) :
+                          ht->type->keyBufferCompare(he->key, buf, len))
+            return he;
     }
-    return h;
+    return NULL;
 }
 
+/* Returns the slot where an entry with the given hash goes. The caller made
+ * sure that the key isn't in the table yet. */
+static dictEntry *_dictFreeSlot(dictht *t, unsigned int h) {
+    unsigned long i = h & t->sizemask;
+
+    while (_dictSlotUsed(&t->table[i]))
+        i = (i+1) & t->sizemask;
+    if (t->table[i].key == NULL)
+        t->filled++;
+    return &t->table[i];
+}
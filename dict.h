@@ -1,9 +1,9 @@
 /* Hash table implementation.
  *
- * This file implements in memory hash tables with insert/del/replace/find/
- * get-random-element operations. Hash tables will auto resize if needed
- * tables of power of two in size are used, collisions are handled by
- * chaining. See the source code for more information... :)
+ * This file implements in memory hash tables with insert/del/replace/find
+ * operations. Tables of power of two in size are used, collisions are handled
+ * by open addressing with linear probing, and tables are resized
+ * incrementally. See the source code for more information... :)
  *
  * Copyright (c) 2006-2010, Salvatore Sanfilippo <antirez at gmail dot com>
  * All rights reserved.
@@ -36,16 +36,21 @@
 #ifndef __DICT_H
 #define __DICT_H
 
+#include <stddef.h>
+
 #define DICT_OK 0
 #define DICT_ERR 1
 
 /* Unused arguments generate annoying warnings... */
 #define DICT_NOTUSED(V) ((void) V)
 
+/* Entries are stored inline in the table. The hash is kept next to the key,
+ * so probing compares keys only when their hashes match and resizing never
+ * hashes a key again. */
 typedef struct dictEntry {
-    void *key;
+    void *key; /* NULL for a free slot */
     void *val;
-    struct dictEntry *next;
+    unsigned int hash;
 } dictEntry;
 
 typedef struct dictType {
@@ -55,25 +60,40 @@ typedef struct dictType {
     int (*keyCompare)(void *privdata, const void *key1, const void *key2);
     void (*keyDestructor)(void *privdata, void *key);
     void (*valDestructor)(void *privdata, void *obj);
+    /* Optional, used by dictFindBuffer() */
+    unsigned int (*bufferHashFunction)(const void *buf, size_t len);
+    int (*keyBufferCompare)(const void *key, const void *buf, size_t len);
 } dictType;
 
-typedef struct dict {
-    dictEntry **table;
-    dictType *type;
+typedef struct dictht {
+    dictEntry *table;
     unsigned long size;
     unsigned long sizemask;
     unsigned long used;
+    unsigned long filled; /* Used slots plus deleted ones */
+} dictht;
+
+/* While the table grows, entries move from ht[0] to ht[1] a few slots per
+ * operation instead of all at once. */
+typedef struct dict {
+    dictType *type;
     void *privdata;
+    dictht ht[2];
+    long rehashidx; /* Next slot of ht[0] to move, -1 when not resizing */
+    int iterators; /* Resizing pauses while iterators are alive */
 } dict;
 
 typedef struct dictIterator {
     dict *ht;
-    int index;
-    dictEntry *entry, *nextEntry;
+    int table;
+    long index;
 } dictIterator;
 
 /* This is the initial size of every hash table */
-#define DICT_HT_INITIAL_SIZE     4
+#define DICT_HT_INITIAL_SIZE     8
+
+/* Slots of ht[0] that an operation moves while resizing */
+#define DICT_REHASH_SLOTS        64
 
 /* ------------------------------- Macros ------------------------------------*/
 #define dictFreeEntryVal(ht, entry) \
@@ -107,20 +127,29 @@ typedef struct dictIterator {
 
 #define dictGetEntryKey(he) ((he)->key)
 #define dictGetEntryVal(he) ((he)->val)
-#define dictSlots(ht) ((ht)->size)
-#define dictSize(ht) ((ht)->used)
-
-/* API */
-static unsigned int dictGenHashFunction(const unsigned char *buf, int len);
-static dict *dictCreate(dictType *type, void *privDataPtr);
-static int dictExpand(dict *ht, unsigned long size);
-static int dictAdd(dict *ht, void *key, void *val);
-static int dictReplace(dict *ht, void *key, void *val);
-static int dictDelete(dict *ht, const void *key);
-static void dictRelease(dict *ht);
-static dictEntry * dictFind(dict *ht, const void *key);
-static dictIterator *dictGetIterator(dict *ht);
-static dictEntry *dictNext(dictIterator *iter);
-static void dictReleaseIterator(dictIterator *iter);
+#define dictSlots(ht) ((ht)->ht[0].size+(ht)->ht[1].size)
+#define dictSize(ht) ((ht)->ht[0].used+(ht)->ht[1].used)
+#define dictIsRehashing(ht) ((ht)->rehashidx != -1)
+
+/* API. The functions are static: every module that uses the table includes
+ * dict.c, and not every one of them uses all of it. */
+#ifdef __GNUC__
+#define DICT_API static __attribute__((unused))
+#else
+#define DICT_API static
+#endif
+DICT_API unsigned int dictGenHashFunction(const unsigned char *buf, int len);
+DICT_API dict *dictCreate(dictType *type, void *privDataPtr);
+DICT_API int dictExpand(dict *ht, unsigned long size);
+DICT_API int dictReserve(dict *ht, unsigned long n);
+DICT_API int dictAdd(dict *ht, void *key, void *val);
+DICT_API int dictReplace(dict *ht, void *key, void *val);
+DICT_API int dictDelete(dict *ht, const void *key);
+DICT_API void dictRelease(dict *ht);
+DICT_API dictEntry * dictFind(dict *ht, const void *key);
+DICT_API dictEntry *dictFindBuffer(dict *ht, const void *buf, size_t len);
+DICT_API dictIterator *dictGetIterator(dict *ht);
+DICT_API dictEntry *dictNext(dictIterator *iter);
+DICT_API void dictReleaseIterator(dictIterator *iter);
 
 #endif /* __DICT_H */
@@ -0,0 +1,499 @@
+/*
+ * Copyright (c) 2009-2011, Salvatore Sanfilippo <antirez at gmail dot com>
+ * Copyright (c) 2010-2011, Pieter Noordhuis <pcnoordhuis at gmail dot com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "fmacros.h"
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "hiredis.h"
+#include "dns.h"
+
+typedef struct redisDnsAddr {
+    int family;
+    int protocol;
+    socklen_t addrlen;
+    struct sockaddr_storage addr;
+} redisDnsAddr;
+
+typedef struct redisDnsEntry {
+    char *host;
+    int error; /* getaddrinfo() error of a negative entry, 0 otherwise */
+    int naddrs;
+    redisDnsAddr *addrs;
+    long long expires; /* Monotonic msec */
+    int refreshing; /* Queued for the resolver thread */
+    struct redisDnsEntry *next;
+} redisDnsEntry;
+
+/* A lookup that a non-blocking connect waits for, see redisDnsLookupStart() */
+typedef struct redisDnsQuery {
+    int fd; /* End of the socket pair closed once the answer is in */
+    int refs; /* Held by the connect and by the resolver thread */
+    int done;
+    int error;
+    int naddrs;
+    redisDnsAddr *addrs;
+    struct redisDnsQuery *next;
+} redisDnsQuery;
+
+typedef struct redisDnsRequest {
+    char *host;
+    redisDnsQuery *queries; /* Waiting for this resolution */
+    struct redisDnsRequest *next;
+} redisDnsRequest;
+
+static pthread_mutex_t dnsLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t dnsCond = PTHREAD_COND_INITIALIZER;
+static redisDnsEntry *dnsEntries = NULL;
+static redisDnsRequest *dnsQueue = NULL;
+static int dnsWorkerStarted = 0;
+static long long dnsTTL = 0; /* Off until redisDnsSetTTL() */
+static long long dnsNegativeTTL = REDIS_DNS_DEFAULT_NEGATIVE_TTL;
+static redisDnsStats dnsStats;
+static redisDnsResolver *dnsResolver = getaddrinfo;
+static redisDnsFreeResolved *dnsFreeResolved = freeaddrinfo;
+
+static long long dnsMonotonicMsec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (long long)ts.tv_sec*1000+ts.tv_nsec/1000000;
+}
+
+/* Errors that say something about the name rather than about our ability to
+ * ask, and are worth caching. */
+static int dnsIsDefinitive(int error) {
+    return error != EAI_AGAIN && error != EAI_SYSTEM && error != EAI_MEMORY;
+}
+
+static int dnsResolve(const char *host, redisDnsAddr **addrs, int *naddrs) {
+    struct addrinfo hints, *servinfo, *p;
+    redisDnsResolver *resolve;
+    redisDnsFreeResolved *release;
+    int rv, n = 0;
+
+    pthread_mutex_lock(&dnsLock);
+    resolve = dnsResolver;
+    release = dnsFreeResolved;
+    pthread_mutex_unlock(&dnsLock);
+
+    memset(&hints,0,sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if ((rv = resolve(host,NULL,&hints,&servinfo)) != 0)
+        return rv;
+
+    for (p = servinfo; p != NULL; p = p->ai_next)
+        if (p->ai_addrlen <= sizeof(struct sockaddr_storage)) n++;
+    if (n == 0) {
+        /* A resolver that succeeds without a usable address */
+        release(servinfo);
+        return EAI_NONAME;
+    }
+    if ((*addrs = calloc(n,sizeof(redisDnsAddr))) == NULL) {
+        release(servinfo);
+        return EAI_MEMORY;
+    }
+    for (n = 0, p = servinfo; p != NULL; p = p->ai_next) {
+        if (p->ai_addrlen > sizeof(struct sockaddr_storage))
+            continue;
+        (*addrs)[n].family = p->ai_family;
+        (*addrs)[n].protocol = p->ai_protocol;
+        (*addrs)[n].addrlen = p->ai_addrlen;
+        memcpy(&(*addrs)[n].addr,p->ai_addr,p->ai_addrlen);
+        n++;
+    }
+    release(servinfo);
+    *naddrs = n;
+    return 0;
+}
+
+static redisDnsEntry *dnsFind(const char *host) {
+    redisDnsEntry *e;
+    for (e = dnsEntries; e != NULL; e = e->next)
+        if (strcmp(e->host,host) == 0)
+            return e;
+    return NULL;
+}
+
+static void dnsFreeEntry(redisDnsEntry *e) {
+    free(e->host);
+    free(e->addrs);
+    free(e);
+}
+
+/* Store the outcome of a resolution. Takes ownership of "addrs". A refresh
+ * that failed for a reason that says nothing about the name (a timeout, for
+ * example) keeps the previous addresses and is retried after the negative
+ * TTL. */
+static void dnsStore(const char *host, int error, redisDnsAddr *addrs, int naddrs) {
+    redisDnsEntry *e = dnsFind(host), **pe, **oldest;
+    long long now = dnsMonotonicMsec();
+
+    if (error != 0 && !dnsIsDefinitive(error) && e != NULL && e->error == 0) {
+        e->expires = now+dnsNegativeTTL;
+        free(addrs);
+        return;
+    }
+
+    if (e == NULL) {
+        if (dnsStats.entries >= REDIS_DNS_MAX_ENTRIES) {
+            /* Make room by dropping the entry that expires first. */
+            oldest = &dnsEntries;
+            for (pe = &dnsEntries; *pe != NULL; pe = &(*pe)->next)
+                if ((*pe)->expires < (*oldest)->expires)
+                    oldest = pe;
+            e = *oldest;
+            *oldest = e->next;
+            dnsFreeEntry(e);
+            dnsStats.entries--;
+        }
+        if ((e = calloc(1,sizeof(*e))) == NULL || (e->host = strdup(host)) == NULL) {
+            free(e);
+            free(addrs);
+            return;
+        }
+        e->next = dnsEntries;
+        dnsEntries = e;
+        dnsStats.entries++;
+    }
+
+    free(e->addrs);
+    e->error = error;
+    e->addrs = addrs;
+    e->naddrs = naddrs;
+    e->expires = now+(error ? dnsNegativeTTL : dnsTTL);
+}
+
+/* Build an addrinfo list for "port" in a single allocation. */
+static int dnsBuildResult(const redisDnsAddr *addrs, int naddrs, int port,
+                          struct addrinfo **res) {
+    struct addrinfo *ai;
+    struct sockaddr_storage *sa;
+    int i;
+
+    if (naddrs == 0)
+        return EAI_NONAME;
+    ai = calloc(naddrs,sizeof(struct addrinfo)+sizeof(struct sockaddr_storage));
+    if (ai == NULL)
+        return EAI_MEMORY;
+    sa = (struct sockaddr_storage*)(ai+naddrs);
+    for (i = 0; i < naddrs; i++) {
+        memcpy(&sa[i],&addrs[i].addr,addrs[i].addrlen);
+        if (addrs[i].family == AF_INET)
+            ((struct sockaddr_in*)&sa[i])->sin_port = htons(port);
+        else if (addrs[i].family == AF_INET6)
+            ((struct sockaddr_in6*)&sa[i])->sin6_port = htons(port);
+        ai[i].ai_family = addrs[i].family;
+        ai[i].ai_socktype = SOCK_STREAM;
+        ai[i].ai_protocol = addrs[i].protocol;
+        ai[i].ai_addrlen = addrs[i].addrlen;
+        ai[i].ai_addr = (struct sockaddr*)&sa[i];
+        ai[i].ai_next = i+1 < naddrs ? &ai[i+1] : NULL;
+    }
+    *res = ai;
+    return 0;
+}
+
+static void dnsReleaseQuery(redisDnsQuery *q) {
+    if (--q->refs > 0)
+        return;
+    if (q->fd != -1)
+        close(q->fd);
+    free(q->addrs);
+    free(q);
+}
+
+/* Hand the outcome of a resolution to a waiting connect and wake it up. Must
+ * be called with the lock held. */
+static void dnsAnswer(redisDnsQuery *q, int error, const redisDnsAddr *addrs, int naddrs) {
+    q->error = error;
+    if (error == 0) {
+        if ((q->addrs = malloc(naddrs*sizeof(*addrs))) == NULL) {
+            q->error = EAI_MEMORY;
+        } else {
+            memcpy(q->addrs,addrs,naddrs*sizeof(*addrs));
+            q->naddrs = naddrs;
+        }
+    }
+    q->done = 1;
+    close(q->fd);
+    q->fd = -1;
+    dnsReleaseQuery(q);
+}
+
+static void *dnsWorker(void *arg) {
+    redisDnsRequest *req;
+    redisDnsQuery *q;
+    redisDnsAddr *addrs;
+    redisDnsEntry *e;
+    int rv, naddrs;
+
+    ((void)arg);
+    pthread_mutex_lock(&dnsLock);
+    while (1) {
+        while (dnsQueue == NULL)
+            pthread_cond_wait(&dnsCond,&dnsLock);
+        req = dnsQueue;
+        dnsQueue = req->next;
+        pthread_mutex_unlock(&dnsLock);
+
+        addrs = NULL;
+        naddrs = 0;
+        rv = dnsResolve(req->host,&addrs,&naddrs);
+
+        pthread_mutex_lock(&dnsLock);
+        while ((q = req->queries) != NULL) {
+            req->queries = q->next;
+            dnsAnswer(q,rv,addrs,naddrs);
+        }
+        if (dnsTTL > 0)
+            dnsStore(req->host,rv,addrs,naddrs);
+        else
+            free(addrs);
+        if ((e = dnsFind(req->host)) != NULL)
+            e->refreshing = 0;
+        dnsStats.refreshes++;
+        free(req->host);
+        free(req);
+    }
+    return NULL;
+}
+
+/* Queue "host" for the resolver thread, starting it when needed. "q" is
+ * answered once it is resolved, together with every other query for the same
+ * host that is still queued. Must be called with the lock held. */
+static int dnsQueueRequest(const char *host, redisDnsQuery *q) {
+    redisDnsRequest *req, **last;
+    pthread_attr_t attr;
+    pthread_t tid;
+
+    for (last = &dnsQueue; *last != NULL; last = &(*last)->next) {
+        if (strcmp((*last)->host,host) == 0) {
+            if (q != NULL) {
+                q->next = (*last)->queries;
+                (*last)->queries = q;
+            }
+            return REDIS_OK;
+        }
+    }
+
+    if (!dnsWorkerStarted) {
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr,PTHREAD_CREATE_DETACHED);
+        dnsWorkerStarted = pthread_create(&tid,&attr,dnsWorker,NULL) == 0;
+        pthread_attr_destroy(&attr);
+        if (!dnsWorkerStarted)
+            return REDIS_ERR;
+    }
+
+    if ((req = malloc(sizeof(*req))) == NULL || (req->host = strdup(host)) == NULL) {
+        free(req);
+        return REDIS_ERR;
+    }
+    req->queries = q;
+    if (q != NULL)
+        q->next = NULL;
+    req->next = NULL;
+    *last = req;
+    pthread_cond_signal(&dnsCond);
+    return REDIS_OK;
+}
+
+int redisDnsLookup(const char *host, int port, struct addrinfo **res) {
+    redisDnsAddr *addrs = NULL;
+    redisDnsEntry *e;
+    int rv, error, naddrs = 0;
+
+    pthread_mutex_lock(&dnsLock);
+    if (dnsTTL > 0 && (e = dnsFind(host)) != NULL &&
+        (e->expires > dnsMonotonicMsec() || e->error == 0))
+    {
+        if (e->expires <= dnsMonotonicMsec()) {
+            /* Serve the stale addresses once more while refreshing them. */
+            dnsStats.stale++;
+            if (!e->refreshing && dnsQueueRequest(host,NULL) == REDIS_OK)
+                e->refreshing = 1;
+        }
+        dnsStats.hits++;
+        rv = e->error ? e->error : dnsBuildResult(e->addrs,e->naddrs,port,res);
+        pthread_mutex_unlock(&dnsLock);
+        return rv;
+    }
+    dnsStats.misses++;
+    pthread_mutex_unlock(&dnsLock);
+
+    error = dnsResolve(host,&addrs,&naddrs);
+    rv = error ? error : dnsBuildResult(addrs,naddrs,port,res);
+
+    pthread_mutex_lock(&dnsLock);
+    if (dnsTTL > 0)
+        dnsStore(host,error,addrs,naddrs);
+    else
+        free(addrs);
+    pthread_mutex_unlock(&dnsLock);
+    return rv;
+}
+
+void redisDnsFreeAddrinfo(struct addrinfo *res) {
+    free(res);
+}
+
+/* An entry that redisDnsLookup() answers without calling the resolver. Must
+ * be called with the lock held. */
+static int dnsIsCached(const char *host) {
+    redisDnsEntry *e;
+
+    return dnsTTL > 0 && (e = dnsFind(host)) != NULL &&
+           (e->expires > dnsMonotonicMsec() || e->error == 0);
+}
+
+redisDnsQuery *redisDnsLookupStart(const char *host, int *fd) {
+    struct in6_addr addr;
+    redisDnsQuery *q;
+    int sv[2];
+
+    /* Numeric addresses are converted without asking anyone. */
+    if (inet_pton(AF_INET,host,&addr) == 1 || inet_pton(AF_INET6,host,&addr) == 1)
+        return NULL;
+
+    pthread_mutex_lock(&dnsLock);
+    if (dnsIsCached(host) ||
+        (q = calloc(1,sizeof(*q))) == NULL)
+    {
+        pthread_mutex_unlock(&dnsLock);
+        return NULL;
+    }
+    if (socketpair(AF_UNIX,SOCK_STREAM,0,sv) == -1) {
+        pthread_mutex_unlock(&dnsLock);
+        free(q);
+        return NULL;
+    }
+    fcntl(sv[0],F_SETFL,fcntl(sv[0],F_GETFL)|O_NONBLOCK);
+    q->fd = sv[1];
+    q->refs = 2;
+    if (dnsQueueRequest(host,q) != REDIS_OK) {
+        pthread_mutex_unlock(&dnsLock);
+        close(sv[0]);
+        close(sv[1]);
+        free(q);
+        return NULL;
+    }
+    pthread_mutex_unlock(&dnsLock);
+    *fd = sv[0];
+    return q;
+}
+
+int redisDnsLookupDone(redisDnsQuery *q) {
+    int done;
+
+    pthread_mutex_lock(&dnsLock);
+    done = q->done;
+    pthread_mutex_unlock(&dnsLock);
+    return done;
+}
+
+int redisDnsLookupResult(redisDnsQuery *q, int port, struct addrinfo **res) {
+    int rv;
+
+    pthread_mutex_lock(&dnsLock);
+    rv = q->error ? q->error : dnsBuildResult(q->addrs,q->naddrs,port,res);
+    pthread_mutex_unlock(&dnsLock);
+    return rv;
+}
+
+void redisDnsLookupRelease(redisDnsQuery *q) {
+    if (q == NULL)
+        return;
+    pthread_mutex_lock(&dnsLock);
+    dnsReleaseQuery(q);
+    pthread_mutex_unlock(&dnsLock);
+}
+
+int redisDnsPrefetch(const char *host) {
+    redisDnsEntry *e;
+    int rv = REDIS_OK;
+
+    pthread_mutex_lock(&dnsLock);
+    if (dnsTTL <= 0) {
+        pthread_mutex_unlock(&dnsLock);
+        return REDIS_OK;
+    }
+    e = dnsFind(host);
+    if (e == NULL || (!e->refreshing && e->expires <= dnsMonotonicMsec())) {
+        rv = dnsQueueRequest(host,NULL);
+        if (rv == REDIS_OK && e != NULL)
+            e->refreshing = 1;
+    }
+    pthread_mutex_unlock(&dnsLock);
+    return rv;
+}
+
+void redisDnsSetTTL(const struct timeval positive, const struct timeval negative) {
+    pthread_mutex_lock(&dnsLock);
+    dnsTTL = (long long)positive.tv_sec*1000+positive.tv_usec/1000;
+    dnsNegativeTTL = (long long)negative.tv_sec*1000+negative.tv_usec/1000;
+    pthread_mutex_unlock(&dnsLock);
+}
+
+void redisDnsSetResolver(redisDnsResolver *fn, redisDnsFreeResolved *freefn) {
+    pthread_mutex_lock(&dnsLock);
+    dnsResolver = fn ? fn : getaddrinfo;
+    dnsFreeResolved = fn ? freefn : freeaddrinfo;
+    pthread_mutex_unlock(&dnsLock);
+}
+
+void redisDnsFlush(void) {
+    redisDnsEntry *e, *next;
+
+    pthread_mutex_lock(&dnsLock);
+    for (e = dnsEntries; e != NULL; e = next) {
+        next = e->next;
+        dnsFreeEntry(e);
+    }
+    dnsEntries = NULL;
+    dnsStats.entries = 0;
+    pthread_mutex_unlock(&dnsLock);
+}
+
+void redisDnsGetStats(redisDnsStats *stats) {
+    pthread_mutex_lock(&dnsLock);
+    *stats = dnsStats;
+    pthread_mutex_unlock(&dnsLock);
+}
@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2009-2011, Salvatore Sanfilippo <antirez at gmail dot com>
+ * Copyright (c) 2010-2011, Pieter Noordhuis <pcnoordhuis at gmail dot com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __HIREDIS_DNS_H
+#define __HIREDIS_DNS_H
+#include <sys/time.h> /* for struct timeval */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* In-process cache of host name lookups, used by every TCP connect once it
+ * was turned on with redisDnsSetTTL(). Without it, every connect resolves the
+ * host again.
+ *
+ * getaddrinfo(3) does not expose record TTLs, so positive and negative
+ * results are kept for configurable times instead. An expired positive entry
+ * is still used for one more connect while a resolver thread refreshes it in
+ * the background, so that only the very first connect to a host can block on
+ * DNS. Asynchronous contexts don't block at all: what is not cached is
+ * resolved by the resolver thread while their connect waits, and
+ * redisDnsPrefetch() can warm the cache ahead of time. */
+
+#define REDIS_DNS_DEFAULT_TTL 30000 /* msec, suggested value */
+#define REDIS_DNS_DEFAULT_NEGATIVE_TTL 1000 /* msec */
+#define REDIS_DNS_MAX_ENTRIES 1024
+
+struct addrinfo; /* need forward declaration of addrinfo */
+struct redisDnsQuery; /* defined in dns.c */
+
+typedef struct redisDnsStats {
+    unsigned long long hits; /* Lookups answered from the cache */
+    unsigned long long misses; /* Lookups that called the resolver inline */
+    unsigned long long stale; /* Hits on expired entries (refresh queued) */
+    unsigned long long refreshes; /* Background resolutions performed */
+    int entries;
+} redisDnsStats;
+
+/* Functions with the signatures of getaddrinfo(3) and freeaddrinfo(3). */
+typedef int redisDnsResolver(const char *node, const char *service,
+                             const struct addrinfo *hints, struct addrinfo **res);
+typedef void redisDnsFreeResolved(struct addrinfo *res);
+
+/* Set the time positive and negative results are cached. The cache is off
+ * until this is called with a positive TTL, and a positive TTL of zero turns
+ * it off again. */
+void redisDnsSetTTL(const struct timeval positive, const struct timeval negative);
+
+/* Resolve host names with "fn" instead of getaddrinfo(3), and release its
+ * results with "freefn". NULL restores the system resolver. */
+void redisDnsSetResolver(redisDnsResolver *fn, redisDnsFreeResolved *freefn);
+
+/* Resolve "host" in a background thread unless it is cached and fresh. Does
+ * nothing while the cache is off. Returns REDIS_ERR when the request could
+ * not be queued. */
+int redisDnsPrefetch(const char *host);
+
+/* Drop every cached entry. */
+void redisDnsFlush(void);
+
+void redisDnsGetStats(redisDnsStats *stats);
+
+/* Used by the connect code: resolve host:port like getaddrinfo(3) with
+ * AF_UNSPEC and SOCK_STREAM would. The result is released with
+ * redisDnsFreeAddrinfo(). */
+int redisDnsLookup(const char *host, int port, struct addrinfo **res);
+void redisDnsFreeAddrinfo(struct addrinfo *res);
+
+/* Used by non-blocking connects that must not wait for the resolver, see
+ * REDIS_DEFER_LOOKUP. Unless redisDnsLookup() would answer right away, because
+ * "host" is a numeric address or cached, "host" is resolved on the resolver
+ * thread and "fd" is set to a socket that becomes readable once the answer is
+ * in. Returns NULL when the lookup should be done with redisDnsLookup(). The
+ * answer is taken with redisDnsLookupResult() once redisDnsLookupDone() says
+ * so, and the query is released with redisDnsLookupRelease() either way. */
+struct redisDnsQuery *redisDnsLookupStart(const char *host, int *fd);
+int redisDnsLookupDone(struct redisDnsQuery *q);
+int redisDnsLookupResult(struct redisDnsQuery *q, int port, struct addrinfo **res);
+void redisDnsLookupRelease(struct redisDnsQuery *q);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
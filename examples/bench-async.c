@@ -0,0 +1,154 @@
+/* Per-command overhead of the event library adapters. Every connection keeps
+ * a fixed number of PINGs in flight until the requested number of commands
+ * was answered. Build one binary per adapter, e.g. "make hiredis-bench-epoll",
+ * and run them against the same server:
+ *
+ *   hiredis-bench-<adapter> [-h host] [-p port] [-c connections]
+ *                           [-d pipeline depth] [-n commands]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+
+#include <hiredis.h>
+#include <async.h>
+
+#if defined(BENCH_EPOLL)
+#include <adapters/epoll.h>
+#define BENCH_ADAPTER "epoll"
+static redisEpollLoop *loop;
+#define BENCH_INIT() loop = redisEpollCreate()
+#define BENCH_ATTACH(ac) redisEpollAttach(loop,ac)
+#define BENCH_RUN() redisEpollRun(loop)
+#elif defined(BENCH_IOURING)
+#include <adapters/iouring.h>
+#define BENCH_ADAPTER "io_uring"
+static redisIoUring *loop;
+#define BENCH_INIT() loop = redisIoUringCreate(4096)
+#define BENCH_ATTACH(ac) redisIoUringAttach(loop,ac)
+#define BENCH_RUN() redisIoUringRun(loop)
+#elif defined(BENCH_LIBEVENT)
+#include <adapters/libevent.h>
+#define BENCH_ADAPTER "libevent"
+static struct event_base *loop;
+#define BENCH_INIT() loop = event_base_new()
+#define BENCH_ATTACH(ac) redisLibeventAttach(ac,loop)
+#define BENCH_RUN() event_base_dispatch(loop)
+#elif defined(BENCH_LIBEV)
+#include <adapters/libev.h>
+#define BENCH_ADAPTER "libev"
+#define BENCH_INIT()
+#define BENCH_ATTACH(ac) redisLibevAttach(EV_DEFAULT_ ac)
+#define BENCH_RUN() ev_loop(EV_DEFAULT_ 0)
+#elif defined(BENCH_AE)
+#include <adapters/ae.h>
+#define BENCH_ADAPTER "ae"
+static aeEventLoop *loop;
+#define BENCH_INIT() loop = aeCreateEventLoop(connections+64)
+#define BENCH_ATTACH(ac) redisAeAttach(loop,ac)
+#define BENCH_RUN() aeMain(loop)
+#define BENCH_DONE() aeStop(loop)
+#elif defined(BENCH_LIBUV)
+#include <adapters/libuv.h>
+#define BENCH_ADAPTER "libuv"
+static uv_loop_t *loop;
+#define BENCH_INIT() loop = uv_default_loop()
+#define BENCH_ATTACH(ac) redisLibuvAttach(ac,loop)
+#define BENCH_RUN() uv_run(loop,UV_RUN_DEFAULT)
+#else
+#error "Define one of BENCH_EPOLL, BENCH_IOURING, BENCH_LIBEVENT, BENCH_LIBEV, BENCH_AE or BENCH_LIBUV"
+#endif
+
+#ifndef BENCH_DONE
+#define BENCH_DONE() do {} while (0)
+#endif
+
+static int connections = 100, depth = 16;
+static long total = 1000000, sent = 0, received = 0;
+static int closed = 0, warm = 0;
+static redisAsyncContext **ctx;
+static long long start;
+
+static long long ustime(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (long long)ts.tv_sec*1000000+ts.tv_nsec/1000;
+}
+
+static void replyCallback(redisAsyncContext *c, void *r, void *privdata) {
+    int i;
+
+    ((void)privdata);
+    if (r == NULL) return;
+    received++;
+    if (sent < total) {
+        sent++;
+        redisAsyncCommand(c,replyCallback,NULL,"PING");
+    } else if (received == total) {
+        printf("%s: %ld commands, %d connections, depth %d: %.1f ns/command\n",
+            BENCH_ADAPTER,total,connections,depth,
+            (double)(ustime()-start)*1000/total);
+        for (i = 0; i < connections; i++)
+            redisAsyncDisconnect(ctx[i]);
+    }
+}
+
+/* Every connection answered its first PING: start the clock, so connecting
+ * is not part of the figure. */
+static void warmupCallback(redisAsyncContext *c, void *r, void *privdata) {
+    int i, j;
+
+    ((void)c); ((void)privdata);
+    if (r == NULL || ++warm < connections) return;
+    start = ustime();
+    for (i = 0; i < connections; i++)
+        for (j = 0; j < depth && sent < total; j++, sent++)
+            redisAsyncCommand(ctx[i],replyCallback,NULL,"PING");
+}
+
+static void connectCallback(const redisAsyncContext *c, int status) {
+    if (status != REDIS_OK) {
+        printf("Error: %s\n", c->errstr);
+        exit(1);
+    }
+}
+
+static void disconnectCallback(const redisAsyncContext *c, int status) {
+    ((void)c); ((void)status);
+    if (++closed == connections)
+        BENCH_DONE();
+}
+
+int main(int argc, char **argv) {
+    const char *host = "127.0.0.1";
+    int port = 6379, i;
+
+    for (i = 1; i+1 < argc; i += 2) {
+        if (!strcmp(argv[i],"-h")) host = argv[i+1];
+        else if (!strcmp(argv[i],"-p")) port = atoi(argv[i+1]);
+        else if (!strcmp(argv[i],"-c")) connections = atoi(argv[i+1]);
+        else if (!strcmp(argv[i],"-d")) depth = atoi(argv[i+1]);
+        else if (!strcmp(argv[i],"-n")) total = atol(argv[i+1]);
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    BENCH_INIT();
+
+    ctx = malloc(sizeof(*ctx)*connections);
+    for (i = 0; i < connections; i++) {
+        ctx[i] = redisAsyncConnect(host,port);
+        if (ctx[i]->err) {
+            printf("Error: %s\n", ctx[i]->errstr);
+            return 1;
+        }
+        BENCH_ATTACH(ctx[i]);
+        redisAsyncSetConnectCallback(ctx[i],connectCallback);
+        redisAsyncSetDisconnectCallback(ctx[i],disconnectCallback);
+        redisAsyncCommand(ctx[i],warmupCallback,NULL,"PING");
+    }
+    BENCH_RUN();
+    free(ctx);
+    return 0;
+}
@@ -0,0 +1,103 @@
+/* Mass subscribe, message lookup and unsubscribe on the table that holds the
+ * subscription callbacks of an async context (dict.c). Besides the time per
+ * operation it reports the slowest single operation of every phase, which is
+ * what stalls the event loop while the table grows:
+ *
+ *   hiredis-bench-dict [channels]
+ */
+#include "fmacros.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <sds.h>
+#include "dict.c"
+
+static long long nstime(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (long long)ts.tv_sec*1000000000+ts.tv_nsec;
+}
+
+/* The same key type as the callback dict in async.c */
+static unsigned int keyHash(const void *key) {
+    return dictGenHashFunction((const unsigned char *)key,sdslen((const sds)key));
+}
+
+static unsigned int bufferHash(const void *buf, size_t len) {
+    return dictGenHashFunction((const unsigned char *)buf,(int)len);
+}
+
+static int keyCompare(void *privdata, const void *key1, const void *key2) {
+    ((void) privdata);
+    return sdslen((const sds)key1) == sdslen((const sds)key2) &&
+           memcmp(key1,key2,sdslen((const sds)key1)) == 0;
+}
+
+static int keyBufferCompare(const void *key, const void *buf, size_t len) {
+    return sdslen((const sds)key) == len && memcmp(key,buf,len) == 0;
+}
+
+static void keyDestructor(void *privdata, void *key) {
+    ((void) privdata);
+    sdsfree((sds)key);
+}
+
+static dictType channelDict = {
+    keyHash, NULL, NULL, keyCompare, keyDestructor, NULL,
+    bufferHash, keyBufferCompare
+};
+
+static void report(const char *phase, long n, long long total, long long max) {
+    printf("%-12s %8.1f ns/op  slowest %8.1f us\n", phase,
+        (double)total/n, (double)max/1000);
+}
+
+int main(int argc, char **argv) {
+    long n = argc > 1 ? atol(argv[1]) : 2000000, i;
+    long long start, t, max;
+    char name[64];
+    int len;
+    dict *d;
+
+    if (n < 1) n = 1;
+    d = dictCreate(&channelDict,NULL);
+    printf("%ld channels\n", n);
+
+    max = 0;
+    start = nstime();
+    for (i = 0; i < n; i++) {
+        len = snprintf(name,sizeof(name),"news:channel:%ld",i);
+        t = nstime();
+        dictAdd(d,sdsnewlen(name,len),NULL);
+        if ((t = nstime()-t) > max) max = t;
+    }
+    report("subscribe",n,nstime()-start,max);
+
+    max = 0;
+    start = nstime();
+    for (i = 0; i < n; i++) {
+        len = snprintf(name,sizeof(name),"news:channel:%ld",(i*7919)%n);
+        t = nstime();
+        if (dictFindBuffer(d,name,len) == NULL) {
+            printf("Error: channel %s is missing\n", name);
+            return 1;
+        }
+        if ((t = nstime()-t) > max) max = t;
+    }
+    report("lookup",n,nstime()-start,max);
+
+    max = 0;
+    start = nstime();
+    for (i = 0; i < n; i++) {
+        len = snprintf(name,sizeof(name),"news:channel:%ld",i);
+        t = nstime();
+        dictDelete(d,dictGetEntryKey(dictFindBuffer(d,name,len)));
+        if ((t = nstime()-t) > max) max = t;
+    }
+    report("unsubscribe",n,nstime()-start,max);
+
+    dictRelease(d);
+    return 0;
+}
@@ -0,0 +1,144 @@
+/* Round trip latency of blocking PINGs with and without spin mode (see
+ * redisSetSpin()). Without -p, the commands go to a minimal stand-in server
+ * that is forked on loopback and answers every PING right away, so what is
+ * measured is the client side: the system calls and the wake-up after the
+ * reply arrived. Use -h/-p to measure against a real server instead:
+ *
+ *   hiredis-bench-latency [-h host] [-p port] [-n commands] [-s spin usec]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <hiredis.h>
+
+static long long nstime(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (long long)ts.tv_sec*1000000000+ts.tv_nsec;
+}
+
+/* Accept connections one at a time and answer each PING with +PONG. A PING
+ * formatted by hiredis is always 14 bytes long. */
+static void standInServer(int lfd) {
+    static const char cmd[] = "*1\r\n$4\r\nPING\r\n";
+    char buf[16384];
+    long long in, out;
+    ssize_t n;
+    int fd;
+
+    while ((fd = accept(lfd,NULL,NULL)) != -1) {
+        in = out = 0;
+        while ((n = read(fd,buf,sizeof(buf))) > 0) {
+            in += n;
+            for (; out < in/(long long)(sizeof(cmd)-1); out++)
+                if (write(fd,"+PONG\r\n",7) != 7) break;
+        }
+        close(fd);
+    }
+    exit(0);
+}
+
+static pid_t startStandIn(int *port) {
+    struct sockaddr_in sa;
+    socklen_t len = sizeof(sa);
+    pid_t pid;
+    int lfd;
+
+    lfd = socket(AF_INET,SOCK_STREAM,0);
+    memset(&sa,0,sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (lfd == -1 || bind(lfd,(struct sockaddr*)&sa,sizeof(sa)) == -1 ||
+        listen(lfd,16) == -1 || getsockname(lfd,(struct sockaddr*)&sa,&len) == -1)
+    {
+        perror("stand-in server");
+        exit(1);
+    }
+    *port = ntohs(sa.sin_port);
+
+    if ((pid = fork()) == 0)
+        standInServer(lfd);
+    close(lfd);
+    return pid;
+}
+
+static int cmpll(const void *a, const void *b) {
+    long long x = *(const long long*)a, y = *(const long long*)b;
+    return (x > y) - (x < y);
+}
+
+static void run(const char *host, int port, long n, int spin, long long *lat) {
+    redisContext *c = redisConnect(host,port);
+    redisReply *reply;
+    long long t;
+    long i;
+
+    if (c == NULL || c->err) {
+        printf("Error: %s\n", c ? c->errstr : "can't allocate redis context");
+        exit(1);
+    }
+    if (spin && redisSetSpin(c,spin) != REDIS_OK) {
+        printf("Error: can't enable spin mode\n");
+        exit(1);
+    }
+
+    /* Warm up the connection and the caches before measuring. */
+    for (i = 0; i < n/10; i++)
+        freeReplyObject(redisCommand(c,"PING"));
+    for (i = 0; i < n; i++) {
+        t = nstime();
+        reply = redisCommand(c,"PING");
+        lat[i] = nstime()-t;
+        if (reply == NULL) {
+            printf("Error: %s\n", c->errstr);
+            exit(1);
+        }
+        freeReplyObject(reply);
+    }
+    redisFree(c);
+
+    qsort(lat,n,sizeof(*lat),cmpll);
+    printf("%-9s p50 %7.2f us  p99 %7.2f us  p99.9 %7.2f us\n",
+        spin ? "spin" : "blocking",
+        lat[n/2]/1000.0, lat[n*99/100]/1000.0, lat[n*999/1000]/1000.0);
+}
+
+int main(int argc, char **argv) {
+    const char *host = "127.0.0.1";
+    int port = 0, spin = 50, i;
+    long n = 100000;
+    long long *lat;
+    pid_t pid = 0;
+
+    for (i = 1; i+1 < argc; i += 2) {
+        if (!strcmp(argv[i],"-h")) host = argv[i+1];
+        else if (!strcmp(argv[i],"-p")) port = atoi(argv[i+1]);
+        else if (!strcmp(argv[i],"-n")) n = atol(argv[i+1]);
+        else if (!strcmp(argv[i],"-s")) spin = atoi(argv[i+1]);
+    }
+    if (n < 1000) n = 1000;
+    if (spin < 1) spin = 1;
+
+    signal(SIGPIPE, SIG_IGN);
+    if (port == 0) pid = startStandIn(&port);
+
+    lat = malloc(sizeof(*lat)*n);
+    printf("%ld PINGs to %s:%d%s\n", n, host, port, pid ? " (stand-in)" : "");
+    run(host,port,n,0,lat);
+    run(host,port,n,spin,lat);
+    free(lat);
+
+    if (pid) {
+        kill(pid,SIGTERM);
+        waitpid(pid,NULL,0);
+    }
+    return 0;
+}
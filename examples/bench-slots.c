@@ -0,0 +1,112 @@
+/* Hash slots per second for short and long keys, with a byte at a time CRC16
+ * (what redisKeySlot() did before slicing-by-8), redisKeySlot() and the
+ * batch redisKeySlots():
+ *
+ *   hiredis-bench-slots [-n keys] [-l long key length]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <hiredis.h>
+#include <cluster.h>
+
+static long long ustime(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (long long)ts.tv_sec*1000000+ts.tv_nsec/1000;
+}
+
+static unsigned short bytetab[256];
+
+static unsigned int byteSlot(const char *key, size_t len) {
+    const char *open, *close;
+    unsigned short crc = 0;
+    size_t j;
+
+    if ((open = memchr(key,'{',len)) != NULL &&
+        (close = memchr(open+1,'}',len-(open+1-key))) != NULL &&
+        close > open+1)
+    {
+        key = open+1;
+        len = close-key;
+    }
+    for (j = 0; j < len; j++)
+        crc = (crc<<8) ^ bytetab[((crc>>8) ^ (unsigned char)key[j]) & 0xff];
+    return crc & 0x3fff;
+}
+
+static void run(const char *what, const char **keys, const size_t *lens, long n) {
+    unsigned int *slots = malloc(n*sizeof(*slots)), sum = 0;
+    long long t;
+    long i;
+
+    t = ustime();
+    for (i = 0; i < n; i++)
+        sum += byteSlot(keys[i],lens[i]);
+    t = ustime()-t;
+    printf("%-6s byte at a time  %8.2f Mkeys/s\n", what, (double)n/(t ? t : 1));
+
+    t = ustime();
+    for (i = 0; i < n; i++)
+        sum += redisKeySlot(keys[i],lens[i]);
+    t = ustime()-t;
+    printf("%-6s redisKeySlot    %8.2f Mkeys/s\n", what, (double)n/(t ? t : 1));
+
+    t = ustime();
+    redisKeySlots(keys,lens,n,slots);
+    t = ustime()-t;
+    for (i = 0; i < n; i++)
+        sum += slots[i];
+    printf("%-6s redisKeySlots   %8.2f Mkeys/s\n", what, (double)n/(t ? t : 1));
+
+    if (sum == 0) printf("\n"); /* Keep the loops */
+    free(slots);
+}
+
+int main(int argc, char **argv) {
+    long n = 2000000, longlen = 200, i;
+    const char **keys;
+    size_t *lens;
+    char *buf;
+    unsigned short crc;
+    int j, k;
+
+    for (i = 1; i+1 < argc; i += 2) {
+        if (!strcmp(argv[i],"-n")) n = atol(argv[i+1]);
+        else if (!strcmp(argv[i],"-l")) longlen = atol(argv[i+1]);
+    }
+    if (n < 1) n = 1;
+    if (longlen < 16) longlen = 16;
+
+    for (j = 0; j < 256; j++) {
+        crc = j << 8;
+        for (k = 0; k < 8; k++)
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+        bytetab[j] = crc;
+    }
+
+    keys = malloc(n*sizeof(*keys));
+    lens = malloc(n*sizeof(*lens));
+    buf = malloc(n*(longlen+1));
+
+    for (i = 0; i < n; i++) {
+        keys[i] = buf+i*(longlen+1);
+        lens[i] = snprintf(buf+i*(longlen+1),longlen+1,"user:%ld",i);
+    }
+    run("short",keys,lens,n);
+
+    for (i = 0; i < n; i++) {
+        memset(buf+i*(longlen+1),'k',longlen);
+        snprintf(buf+i*(longlen+1),longlen+1,"session:%ld:",i);
+        buf[i*(longlen+1)+strlen(keys[i])] = 'k';
+        lens[i] = longlen;
+    }
+    run("long",keys,lens,n);
+
+    free(keys);
+    free(lens);
+    free(buf);
+    return 0;
+}
@@ -0,0 +1,161 @@
+/* Throughput and client CPU time of large SETs, sent with the regular copying
+ * redisBufferWrite() and with MSG_ZEROCOPY (see the zerocopy socket option).
+ * Without -p, the commands go to a minimal stand-in server that is forked on
+ * loopback and answers every SET right away. Note that the kernel copies
+ * zero copy sends to local sockets after all, so loopback only shows the
+ * overhead of the notifications; use -h/-p to measure against a real server
+ * on another host:
+ *
+ *   hiredis-bench-zerocopy [-h host] [-p port] [-n commands] [-s value size]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <hiredis.h>
+
+#define PIPELINE 8
+
+static long long ustime(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (long long)ts.tv_sec*1000000+ts.tv_nsec/1000;
+}
+
+static long long cputime(void) {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF,&ru);
+    return (long long)(ru.ru_utime.tv_sec+ru.ru_stime.tv_sec)*1000000+
+           ru.ru_utime.tv_usec+ru.ru_stime.tv_usec;
+}
+
+/* Accept connections one at a time and answer every "cmdlen" bytes with +OK:
+ * all commands sent by the benchmark have the same length. */
+static void standInServer(int lfd, long long cmdlen) {
+    static char buf[1<<20];
+    long long in, out;
+    ssize_t n;
+    int fd;
+
+    while ((fd = accept(lfd,NULL,NULL)) != -1) {
+        in = out = 0;
+        while ((n = read(fd,buf,sizeof(buf))) > 0) {
+            in += n;
+            for (; out < in/cmdlen; out++)
+                if (write(fd,"+OK\r\n",5) != 5) break;
+        }
+        close(fd);
+    }
+    exit(0);
+}
+
+static pid_t startStandIn(int *port, long long cmdlen) {
+    struct sockaddr_in sa;
+    socklen_t len = sizeof(sa);
+    pid_t pid;
+    int lfd;
+
+    lfd = socket(AF_INET,SOCK_STREAM,0);
+    memset(&sa,0,sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (lfd == -1 || bind(lfd,(struct sockaddr*)&sa,sizeof(sa)) == -1 ||
+        listen(lfd,16) == -1 || getsockname(lfd,(struct sockaddr*)&sa,&len) == -1)
+    {
+        perror("stand-in server");
+        exit(1);
+    }
+    *port = ntohs(sa.sin_port);
+
+    if ((pid = fork()) == 0)
+        standInServer(lfd,cmdlen);
+    close(lfd);
+    return pid;
+}
+
+static void run(const char *host, int port, long n, const char *val, size_t size,
+                int zerocopy)
+{
+    redisOptions options;
+    redisContext *c;
+    redisReply *reply;
+    long long t, cpu;
+    long i, j;
+
+    memset(&options,0,sizeof(options));
+    REDIS_OPTIONS_SET_TCP(&options,host,port);
+    options.sockopts.zerocopy = zerocopy;
+    c = redisConnectWithOptions(&options);
+    if (c == NULL || c->err) {
+        printf("Error: %s\n", c ? c->errstr : "can't allocate redis context");
+        exit(1);
+    }
+
+    t = ustime();
+    cpu = cputime();
+    for (i = 0; i < n; i += PIPELINE) {
+        for (j = i; j < n && j < i+PIPELINE; j++)
+            redisAppendCommand(c,"SET bench:zerocopy %b",val,size);
+        for (j = i; j < n && j < i+PIPELINE; j++) {
+            if (redisGetReply(c,(void**)&reply) != REDIS_OK) {
+                printf("Error: %s\n", c->errstr);
+                exit(1);
+            }
+            freeReplyObject(reply);
+        }
+    }
+    t = ustime()-t;
+    cpu = cputime()-cpu;
+    redisFree(c);
+
+    printf("%-9s %8.1f MB/s  %7.1f us CPU per MB\n",
+        zerocopy ? "zerocopy" : "copy",
+        (double)n*size/t, (double)cpu/((double)n*size/(1<<20)));
+}
+
+int main(int argc, char **argv) {
+    const char *host = "127.0.0.1";
+    int port = 0, i;
+    long n = 1000;
+    size_t size = 4<<20;
+    long long cmdlen;
+    char *val, *cmd;
+    pid_t pid = 0;
+
+    for (i = 1; i+1 < argc; i += 2) {
+        if (!strcmp(argv[i],"-h")) host = argv[i+1];
+        else if (!strcmp(argv[i],"-p")) port = atoi(argv[i+1]);
+        else if (!strcmp(argv[i],"-n")) n = atol(argv[i+1]);
+        else if (!strcmp(argv[i],"-s")) size = (size_t)atol(argv[i+1]);
+    }
+    if (n < 1) n = 1;
+    if (size < 1) size = 1;
+
+    val = malloc(size);
+    memset(val,'x',size);
+    cmdlen = redisFormatCommand(&cmd,"SET bench:zerocopy %b",val,size);
+    free(cmd);
+
+    signal(SIGPIPE, SIG_IGN);
+    if (port == 0) pid = startStandIn(&port,cmdlen);
+
+    printf("%ld SETs of %zu bytes to %s:%d%s\n", n, size, host, port,
+        pid ? " (stand-in)" : "");
+    run(host,port,n,val,size,0);
+    run(host,port,n,val,size,64*1024);
+    free(val);
+
+    if (pid) {
+        kill(pid,SIGTERM);
+        waitpid(pid,NULL,0);
+    }
+    return 0;
+}
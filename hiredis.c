@@ -33,11 +33,14 @@
 
 #include "fmacros.h"
 #include <string.h>
+#include <strings.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <assert.h>
 #include <errno.h>
 #include <ctype.h>
+#include <poll.h>
+#include <time.h>
 
 #include "hiredis.h"
 #include "net.h"
@@ -569,6 +572,119 @@ void redisFreeCommand(char *cmd) {
     free(cmd);
 }
 
+/* Commands that can safely be sent again when it is unknown whether the
+ * server executed them. Writes only qualify when the second run leaves the
+ * dataset as the first one did; their reply may still differ. SET and ZADD
+ * are missing because their EX/PX, NX and INCR forms don't qualify. Sorted. */
+static const struct {
+    const char *name;
+    int flags;
+} redisCommandTable[] = {
+    {"bitcount",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"bitfield_ro",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"bitpos",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"dbsize",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"del",REDIS_CMD_IDEMPOTENT},
+    {"echo",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"eval_ro",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"evalsha_ro",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"exists",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"fcall_ro",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"geodist",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"geohash",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"geopos",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"georadius_ro",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"georadiusbymember_ro",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"geosearch",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"get",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"getbit",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"getrange",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"hdel",REDIS_CMD_IDEMPOTENT},
+    {"hexists",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"hget",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"hgetall",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"hkeys",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"hlen",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"hmget",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"hmset",REDIS_CMD_IDEMPOTENT},
+    {"hrandfield",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"hscan",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"hset",REDIS_CMD_IDEMPOTENT},
+    {"hstrlen",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"hvals",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"keys",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"lindex",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"llen",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"lpos",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"lrange",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"mget",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"mset",REDIS_CMD_IDEMPOTENT},
+    {"persist",REDIS_CMD_IDEMPOTENT},
+    {"ping",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"pttl",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"sadd",REDIS_CMD_IDEMPOTENT},
+    {"scan",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"scard",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"sdiff",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"sinter",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"sintercard",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"sismember",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"smembers",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"smismember",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"sort_ro",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"srandmember",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"srem",REDIS_CMD_IDEMPOTENT},
+    {"sscan",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"strlen",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"sunion",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"ttl",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"type",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"xlen",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"xrange",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"xread",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"xrevrange",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"zcard",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"zcount",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"zdiff",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"zinter",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"zlexcount",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"zmscore",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"zrandmember",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"zrange",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"zrangebylex",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"zrangebyscore",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"zrank",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"zrem",REDIS_CMD_IDEMPOTENT},
+    {"zrevrange",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"zrevrangebylex",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"zrevrangebyscore",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"zrevrank",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"zscan",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"zscore",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT},
+    {"zunion",REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT}
+};
+
+/* Return the REDIS_CMD_* flags of the command called "name" (not necessarily
+ * nul-terminated, any case), or 0 when nothing is known about it. */
+int redisCommandFlags(const char *name, size_t len) {
+    int lo = 0, hi = sizeof(redisCommandTable)/sizeof(redisCommandTable[0])-1;
+    int mid, cmp;
+
+    while (lo <= hi) {
+        mid = (lo+hi)/2;
+        cmp = strncasecmp(name,redisCommandTable[mid].name,len);
+        if (cmp == 0 && redisCommandTable[mid].name[len] != '\0')
+            cmp = -1;
+        if (cmp == 0)
+            return redisCommandTable[mid].flags;
+        if (cmp < 0)
+            hi = mid-1;
+        else
+            lo = mid+1;
+    }
+    return 0;
+}
+
 void __redisSetError(redisContext *c, int type, const char *str) {
     size_t len;
 
@@ -604,6 +720,10 @@ static redisContext *redisContextInit(void) {
     c->tcp.source_addr = NULL;
     c->unix_sock.path = NULL;
     c->timeout = NULL;
+    c->readsize = REDIS_READ_MIN;
+    c->spin_usec = 0;
+    c->zerocopy = NULL;
+    c->files = NULL;
 
     if (c->obuf == NULL || c->reader == NULL) {
         redisFree(c);
@@ -616,8 +736,10 @@ static redisContext *redisContextInit(void) {
 void redisFree(redisContext *c) {
     if (c == NULL)
         return;
+    redisContextFreeZeroCopy(c);
     if (c->fd > 0)
         close(c->fd);
+    redisContextFreeFiles(c);
     if (c->obuf != NULL)
         sdsfree(c->obuf);
     if (c->reader != NULL)
@@ -630,11 +752,14 @@ void redisFree(redisContext *c) {
         free(c->unix_sock.path);
     if (c->timeout)
         free(c->timeout);
+    free(c->fallback);
+    redisContextFreeLookup(c);
     free(c);
 }
 
 int redisFreeKeepFd(redisContext *c) {
     int fd = c->fd;
+    redisContextFreeZeroCopy(c);
     c->fd = -1;
     redisFree(c);
     return fd;
@@ -644,10 +769,12 @@ int redisReconnect(redisContext *c) {
     c->err = 0;
     memset(c->errstr, '\0', strlen(c->errstr));
 
+    redisContextFreeZeroCopy(c);
     if (c->fd > 0) {
         close(c->fd);
     }
 
+    redisContextFreeFiles(c);
     sdsfree(c->obuf);
     redisReaderFree(c->reader);
 
@@ -668,6 +795,42 @@ int redisReconnect(redisContext *c) {
     return REDIS_ERR;
 }
 
+/* Connect as described by "options", with "flags" set on the context before
+ * connecting. Used by the async API. */
+redisContext *__redisConnectWithFlags(const redisOptions *options, int flags) {
+    redisContext *c;
+
+    c = redisContextInit();
+    if (c == NULL)
+        return NULL;
+
+    c->flags |= flags;
+    if (!(options->options & REDIS_OPT_NONBLOCK))
+        c->flags |= REDIS_BLOCK;
+    if (options->options & REDIS_OPT_REUSEADDR)
+        c->flags |= REDIS_REUSEADDR;
+    if (options->options & REDIS_OPT_FASTOPEN)
+        c->flags |= REDIS_FASTOPEN;
+    c->sockopts = options->sockopts;
+
+    if (options->type == REDIS_CONN_TCP) {
+        redisContextConnectBindTcp(c,options->endpoint.tcp.ip,
+                                   options->endpoint.tcp.port,options->timeout,
+                                   options->endpoint.tcp.source_addr);
+    } else if (options->type == REDIS_CONN_UNIX) {
+        redisContextConnectUnix(c,options->endpoint.unix_socket,
+                                options->timeout);
+    } else {
+        __redisSetError(c,REDIS_ERR_OTHER,"Invalid connection type");
+    }
+    return c;
+}
+
+/* Connect as described by "options", see the redisOptions structure. */
+redisContext *redisConnectWithOptions(const redisOptions *options) {
+    return __redisConnectWithFlags(options,0);
+}
+
 /* Connect to a Redis instance. On error the field error in the returned
  * context will be set to the return value of the error function.
  * When no set of reply functions is given, the default set will be used. */
@@ -724,6 +887,37 @@ redisContext *redisConnectBindNonBlockWithReuse(const char *ip, int port,
     return c;
 }
 
+/* Connect using TCP Fast Open (Linux 4.11+). connect(2) returns right away
+ * and whatever is written first, e.g. an AUTH and the first pipeline, is
+ * carried by the SYN when the server handed out a cookie before. Without a
+ * cookie, or when the kernel or server lacks support, this transparently
+ * becomes a regular handshake. Note that connection errors are then only
+ * reported by the first read or write. */
+redisContext *redisConnectFastOpen(const char *ip, int port) {
+    redisContext *c;
+
+    c = redisContextInit();
+    if (c == NULL)
+        return NULL;
+
+    c->flags |= REDIS_BLOCK | REDIS_FASTOPEN;
+    redisContextConnectTcp(c,ip,port,NULL);
+    return c;
+}
+
+redisContext *redisConnectFastOpenNonBlock(const char *ip, int port) {
+    redisContext *c;
+
+    c = redisContextInit();
+    if (c == NULL)
+        return NULL;
+
+    c->flags &= ~REDIS_BLOCK;
+    c->flags |= REDIS_FASTOPEN;
+    redisContextConnectTcp(c,ip,port,NULL);
+    return c;
+}
+
 redisContext *redisConnectUnix(const char *path) {
     redisContext *c;
 
@@ -786,22 +980,73 @@ int redisEnableKeepAlive(redisContext *c) {
     return REDIS_OK;
 }
 
+/* Trade CPU for latency on a blocking context: instead of sleeping in read(2),
+ * redisGetReply() retries non-blocking reads for up to "usec" microseconds
+ * before it falls back to poll(2). Pass 0 to go back to blocking reads. The
+ * timeout set with redisSetTimeout() keeps applying. */
+int redisSetSpin(redisContext *c, int usec) {
+    if (!(c->flags & REDIS_BLOCK) || usec < 0)
+        return REDIS_ERR;
+    return redisContextSetSpin(c,usec);
+}
+
+/* Read from the socket straight into the reader's buffer. The size of the
+ * read adapts to the traffic: it doubles (up to REDIS_READ_MAX) when a read
+ * fills the whole buffer and halves (down to REDIS_READ_MIN) when reads come
+ * back mostly empty. The outcome of read(2) is stored in "nreadp" when given,
+ * so callers can tell whether the socket was drained. */
+int __redisBufferRead(redisContext *c, int *nreadp) {
+    size_t size = c->readsize;
+    char *buf;
+    int nread;
+
+    /* Return early when the context has seen an error. */
+    if (c->err)
+        return REDIS_ERR;
+
+    if ((buf = redisReaderReserve(c->reader,size)) == NULL) {
+        __redisSetError(c,c->reader->err,c->reader->errstr);
+        return REDIS_ERR;
+    }
+
+    nread = read(c->fd,buf,size);
+    if (nreadp != NULL) *nreadp = nread;
+    if (c->zerocopy != NULL)
+        redisContextReapZeroCopy(c);
+    if (nread <= 0)
+        return redisBufferFeed(c,NULL,nread);
+
+    redisReaderCommit(c->reader,nread);
+    if (c->sockopts.quickack)
+        redisSetQuickAck(c);
+    if ((size_t)nread == size && size < REDIS_READ_MAX)
+        c->readsize = size*2;
+    else if ((size_t)nread < size/4 && size > REDIS_READ_MIN)
+        c->readsize = size/2;
+    return REDIS_OK;
+}
+
 /* Use this function to handle a read event on the descriptor. It will try
  * and read some bytes from the socket and feed them to the reply parser.
  *
  * After this function is called, you may use redisContextReadReply to
  * see if there is a reply available. */
 int redisBufferRead(redisContext *c) {
-    char buf[1024*16];
-    int nread;
+    return __redisBufferRead(c,NULL);
+}
 
+/* Feed the outcome of a read on the descriptor to the reply parser. This is
+ * the second half of redisBufferRead(), for callers that performed the read
+ * themselves. "nread" follows the semantics of the return value of read(2):
+ * -1 means an error is stored in errno and 0 means end of file. */
+int redisBufferFeed(redisContext *c, const char *buf, int nread) {
     /* Return early when the context has seen an error. */
     if (c->err)
         return REDIS_ERR;
 
-    nread = read(c->fd,buf,sizeof(buf));
     if (nread == -1) {
-        if ((errno == EAGAIN && !(c->flags & REDIS_BLOCK)) || (errno == EINTR)) {
+        if ((errno == EAGAIN && (c->flags & (REDIS_BLOCK|REDIS_SPIN)) != REDIS_BLOCK) ||
+            (errno == EINTR)) {
             /* Try again later */
         } else {
             __redisSetError(c,REDIS_ERR_IO,NULL);
@@ -815,6 +1060,9 @@ int redisBufferRead(redisContext *c) {
             __redisSetError(c,c->reader->err,c->reader->errstr);
             return REDIS_ERR;
         }
+        /* The kernel drops back to delayed ACKs after each read. */
+        if (c->sockopts.quickack)
+            redisSetQuickAck(c);
     }
     return REDIS_OK;
 }
@@ -830,16 +1078,34 @@ int redisBufferRead(redisContext *c) {
  */
 int redisBufferWrite(redisContext *c, int *done) {
     int nwritten;
+    long left;
 
     /* Return early when the context has seen an error. */
     if (c->err)
         return REDIS_ERR;
 
-    if (sdslen(c->obuf) > 0) {
+    /* Large outputs are not copied into the socket, see
+     * redisContextWriteZeroCopy(). What is appended meanwhile waits. */
+    if (c->sockopts.zerocopy > 0 && c->connection_type == REDIS_CONN_TCP) {
+        if ((left = redisContextWriteZeroCopy(c)) < 0)
+            return REDIS_ERR;
+        if (left > 0) {
+            if (done != NULL) *done = 0;
+            return REDIS_OK;
+        }
+    }
+
+    if (c->files != NULL) {
+        if (redisContextWriteFiles(c) == REDIS_ERR)
+            return REDIS_ERR;
+    } else if (sdslen(c->obuf) > 0) {
         nwritten = write(c->fd,c->obuf,sdslen(c->obuf));
         if (nwritten == -1) {
-            if ((errno == EAGAIN && !(c->flags & REDIS_BLOCK)) || (errno == EINTR)) {
-                /* Try again later */
+            if (((errno == EAGAIN || errno == EINPROGRESS) &&
+                 (c->flags & (REDIS_BLOCK|REDIS_SPIN)) != REDIS_BLOCK) ||
+                (errno == EINTR)) {
+                /* Try again later. EINPROGRESS means a Fast Open socket
+                 * without cookie just started its handshake. */
             } else {
                 __redisSetError(c,REDIS_ERR_IO,NULL);
                 return REDIS_ERR;
@@ -853,7 +1119,7 @@ int redisBufferWrite(redisContext *c, int *done) {
             }
         }
     }
-    if (done != NULL) *done = (sdslen(c->obuf) == 0);
+    if (done != NULL) *done = (sdslen(c->obuf) == 0 && c->files == NULL);
     return REDIS_OK;
 }
 
@@ -867,6 +1133,36 @@ int redisGetReplyFromReader(redisContext *c, void **reply) {
     return REDIS_OK;
 }
 
+static long long redisSpinUsec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return ((long long)ts.tv_sec)*1000000+ts.tv_nsec/1000;
+}
+
+/* Counterpart of redisBufferRead() for a context in spin mode: keep trying
+ * non-blocking reads until some data arrived, and only go to sleep in poll(2)
+ * when nothing showed up within the spin time. */
+static int redisBufferReadSpin(redisContext *c) {
+    long long start = 0, now;
+    int nread;
+
+    while (1) {
+        if (__redisBufferRead(c,&nread) == REDIS_ERR)
+            return REDIS_ERR;
+        if (nread > 0 || errno != EAGAIN)
+            return REDIS_OK;
+
+        now = redisSpinUsec();
+        if (start == 0) {
+            start = now;
+        } else if (now-start >= c->spin_usec) {
+            if (redisContextWaitIO(c,POLLIN) == REDIS_ERR)
+                return REDIS_ERR;
+            start = 0;
+        }
+    }
+}
+
 int redisGetReply(redisContext *c, void **reply) {
     int wdone = 0;
     void *aux = NULL;
@@ -881,12 +1177,19 @@ int redisGetReply(redisContext *c, void **reply) {
         do {
             if (redisBufferWrite(c,&wdone) == REDIS_ERR)
                 return REDIS_ERR;
+            if (!wdone && (c->flags & REDIS_SPIN) &&
+                redisContextWaitIO(c,POLLOUT) == REDIS_ERR)
+                return REDIS_ERR;
         } while (!wdone);
 
         /* Read until there is a reply */
         do {
-            if (redisBufferRead(c) == REDIS_ERR)
+            if (c->flags & REDIS_SPIN) {
+                if (redisBufferReadSpin(c) == REDIS_ERR)
+                    return REDIS_ERR;
+            } else if (redisBufferRead(c) == REDIS_ERR) {
                 return REDIS_ERR;
+            }
             if (redisGetReplyFromReader(c,&aux) == REDIS_ERR)
                 return REDIS_ERR;
         } while (aux == NULL);
@@ -977,6 +1280,44 @@ int redisAppendCommandArgv(redisContext *c, int argc, const char **argv, const s
     return REDIS_OK;
 }
 
+int redisAppendCommandArgvFromFd(redisContext *c, int argc, const char **argv,
+                                 const size_t *argvlen, int fd, off_t offset,
+                                 size_t len)
+{
+    size_t oldlen = sdslen(c->obuf);
+    sds cmd;
+    int j;
+
+    cmd = sdscatfmt(sdsempty(),"*%i\r\n",argc+1);
+    for (j = 0; j < argc && cmd != NULL; j++) {
+        size_t n = argvlen ? argvlen[j] : strlen(argv[j]);
+        if ((cmd = sdscatfmt(cmd,"$%U\r\n",(unsigned long long)n)) != NULL &&
+            (cmd = sdscatlen(cmd,argv[j],n)) != NULL)
+            cmd = sdscatlen(cmd,"\r\n",2);
+    }
+    if (cmd != NULL)
+        cmd = sdscatfmt(cmd,"$%U\r\n",(unsigned long long)len);
+    if (cmd == NULL) {
+        __redisSetError(c,REDIS_ERR_OOM,"Out of memory");
+        return REDIS_ERR;
+    }
+
+    /* The payload goes between the header and the final newline. */
+    if (__redisAppendCommand(c,cmd,sdslen(cmd)) != REDIS_OK ||
+        (len > 0 && redisContextAppendFile(c,fd,offset,len) != REDIS_OK) ||
+        __redisAppendCommand(c,"\r\n",2) != REDIS_OK)
+    {
+        redisContextDropFiles(c,oldlen);
+        sdssetlen(c->obuf,oldlen);
+        c->obuf[oldlen] = '\0';
+        sdsfree(cmd);
+        return REDIS_ERR;
+    }
+
+    sdsfree(cmd);
+    return REDIS_OK;
+}
+
 /* Helper function for the redisCommand* family of functions.
  *
  * Write a formatted command to the output buffer. If the given context is
@@ -1019,3 +1360,12 @@ void *redisCommandArgv(redisContext *c, int argc, const char **argv, const size_
         return NULL;
     return __redisBlockForReply(c);
 }
+
+void *redisCommandArgvFromFd(redisContext *c, int argc, const char **argv,
+                             const size_t *argvlen, int fd, off_t offset,
+                             size_t len)
+{
+    if (redisAppendCommandArgvFromFd(c,argc,argv,argvlen,fd,offset,len) != REDIS_OK)
+        return NULL;
+    return __redisBlockForReply(c);
+}
@@ -35,6 +35,7 @@
 #define __HIREDIS_H
 #include "read.h"
 #include <stdarg.h> /* for va_list */
+#include <sys/types.h> /* for off_t */
 #include <sys/time.h> /* for struct timeval */
 #include <stdint.h> /* uintXX_t, etc */
 #include "sds.h" /* for sds */
@@ -74,8 +75,33 @@
 /* Flag that is set when we should set SO_REUSEADDR before calling bind() */
 #define REDIS_REUSEADDR 0x80
 
+/* Flag that is set when TCP Fast Open should be used: the handshake is
+ * deferred and the first write goes out with the SYN. */
+#define REDIS_FASTOPEN 0x100
+
+/* Flag that is set when a blocking context spins on a non-blocking socket
+ * while waiting for replies, see redisSetSpin(). */
+#define REDIS_SPIN 0x200
+
+/* Flag that is set while an async context waits to reconnect after the
+ * connection dropped, see redisAsyncSetReconnect(). */
+#define REDIS_RECONNECTING 0x400
+
+/* Flag that makes the callbacks of an async context own their replies: they
+ * are not free'd when the callback returns. */
+#define REDIS_NO_AUTO_FREE_REPLIES 0x800
+
+/* Flag that lets a non-blocking TCP connect resolve the host on the resolver
+ * thread. Until the answer is in, the descriptor is a placeholder that becomes
+ * readable then, see redisContextConnectResolved(). Set by the async API. */
+#define REDIS_DEFER_LOOKUP 0x1000
+
 #define REDIS_KEEPALIVE_INTERVAL 15 /* seconds */
 
+/* Bounds of the adaptive size of socket reads */
+#define REDIS_READ_MIN (1024*16)
+#define REDIS_READ_MAX (1024*1024)
+
 /* number of times we retry to connect in the case of EADDRNOTAVAIL and
  * SO_REUSEADDR is being used. */
 #define REDIS_CONNECT_RETRIES  10
@@ -131,11 +157,35 @@ int redisFormatSdsCommandArgv(sds *target, int argc, const char ** argv, const s
 void redisFreeCommand(char *cmd);
 void redisFreeSdsCommand(sds cmd);
 
+/* Properties of a command, see redisCommandFlags(). */
+#define REDIS_CMD_READONLY 0x1 /* Doesn't modify the dataset */
+#define REDIS_CMD_IDEMPOTENT 0x2 /* Running it twice has the effect of once */
+
+int redisCommandFlags(const char *name, size_t len);
+
 enum redisConnectionType {
     REDIS_CONN_TCP,
     REDIS_CONN_UNIX
 };
 
+/* Socket options applied on every (re)connect. Zero leaves the system
+ * default in place. */
+typedef struct redisSocketOptions {
+    int rcvbuf; /* SO_RCVBUF, bytes */
+    int sndbuf; /* SO_SNDBUF, bytes */
+    int quickack; /* Keep TCP_QUICKACK enabled (re-armed after reads) */
+    int notsent_lowat; /* TCP_NOTSENT_LOWAT, bytes */
+    int busy_poll; /* SO_BUSY_POLL, usec */
+    int priority; /* SO_PRIORITY */
+    int tos; /* IP_TOS, or IPV6_TCLASS on IPv6 sockets */
+    int zerocopy; /* Send output of at least this many bytes with MSG_ZEROCOPY */
+} redisSocketOptions;
+
+struct redisZeroCopy; /* defined in net.c */
+struct redisFilePart; /* defined in net.c */
+struct redisAddressList; /* defined in net.c */
+struct redisDnsQuery; /* defined in dns.c */
+
 /* Context for a connection to Redis */
 typedef struct redisContext {
     int err; /* Error flags, 0 when there is no error */
@@ -158,8 +208,50 @@ typedef struct redisContext {
         char *path;
     } unix_sock;
 
+    redisSocketOptions sockopts;
+    size_t readsize; /* Size of the next read, see redisBufferRead() */
+    int spin_usec; /* Time to spin on reads before sleeping in poll(2) */
+    struct redisZeroCopy *zerocopy; /* Output the kernel may still read from */
+    struct redisFilePart *files; /* Bulk payloads to send from files */
+    struct redisAddressList *fallback; /* Left to try when connect(2) fails */
+    struct redisDnsQuery *lookup; /* Deferred lookup, see REDIS_DEFER_LOOKUP */
+
 } redisContext;
 
+/* Flags for redisOptions.options */
+#define REDIS_OPT_NONBLOCK 0x01
+#define REDIS_OPT_REUSEADDR 0x02
+#define REDIS_OPT_FASTOPEN 0x04
+
+typedef struct redisOptions {
+    enum redisConnectionType type;
+    int options; /* REDIS_OPT_* */
+    const struct timeval *timeout; /* Connect timeout, NULL for none */
+    union {
+        struct {
+            const char *source_addr; /* Optional local address to bind */
+            const char *ip;
+            int port;
+        } tcp;
+        const char *unix_socket;
+    } endpoint;
+    redisSocketOptions sockopts;
+} redisOptions;
+
+#define REDIS_OPTIONS_SET_TCP(opts, ip_, port_) \
+    do { (opts)->type = REDIS_CONN_TCP; \
+         (opts)->endpoint.tcp.ip = (ip_); \
+         (opts)->endpoint.tcp.port = (port_); } while (0)
+
+#define REDIS_OPTIONS_SET_UNIX(opts, path) \
+    do { (opts)->type = REDIS_CONN_UNIX; \
+         (opts)->endpoint.unix_socket = (path); } while (0)
+
+/* Connect as described by "options", which should be zeroed before it is
+ * filled in. The socket options are remembered by the context and applied
+ * again by redisReconnect(). */
+redisContext *redisConnectWithOptions(const redisOptions *options);
+
 redisContext *redisConnect(const char *ip, int port);
 redisContext *redisConnectWithTimeout(const char *ip, int port, const struct timeval tv);
 redisContext *redisConnectNonBlock(const char *ip, int port);
@@ -167,6 +259,8 @@ redisContext *redisConnectBindNonBlock(const char *ip, int port,
                                        const char *source_addr);
 redisContext *redisConnectBindNonBlockWithReuse(const char *ip, int port,
                                                 const char *source_addr);
+redisContext *redisConnectFastOpen(const char *ip, int port);
+redisContext *redisConnectFastOpenNonBlock(const char *ip, int port);
 redisContext *redisConnectUnix(const char *path);
 redisContext *redisConnectUnixWithTimeout(const char *path, const struct timeval tv);
 redisContext *redisConnectUnixNonBlock(const char *path);
@@ -185,9 +279,11 @@ int redisReconnect(redisContext *c);
 
 int redisSetTimeout(redisContext *c, const struct timeval tv);
 int redisEnableKeepAlive(redisContext *c);
+int redisSetSpin(redisContext *c, int usec);
 void redisFree(redisContext *c);
 int redisFreeKeepFd(redisContext *c);
 int redisBufferRead(redisContext *c);
+int redisBufferFeed(redisContext *c, const char *buf, int nread);
 int redisBufferWrite(redisContext *c, int *done);
 
 /* In a blocking context, this function first checks if there are unconsumed
@@ -207,6 +303,15 @@ int redisvAppendCommand(redisContext *c, const char *format, va_list ap);
 int redisAppendCommand(redisContext *c, const char *format, ...);
 int redisAppendCommandArgv(redisContext *c, int argc, const char **argv, const size_t *argvlen);
 
+/* Write a command whose last argument is "len" bytes of the file "fd" starting
+ * at "offset". The payload is sent from the page cache with sendfile(2), so it
+ * is never copied into the output buffer. The file descriptor must stay open
+ * until the command was written, which in a blocking context is when
+ * redisGetReply returns. */
+int redisAppendCommandArgvFromFd(redisContext *c, int argc, const char **argv,
+                                 const size_t *argvlen, int fd, off_t offset,
+                                 size_t len);
+
 /* Issue a command to Redis. In a blocking context, it is identical to calling
  * redisAppendCommand, followed by redisGetReply. The function will return
  * NULL if there was an error in performing the request, otherwise it will
@@ -215,6 +320,9 @@ int redisAppendCommandArgv(redisContext *c, int argc, const char **argv, const s
 void *redisvCommand(redisContext *c, const char *format, va_list ap);
 void *redisCommand(redisContext *c, const char *format, ...);
 void *redisCommandArgv(redisContext *c, int argc, const char **argv, const size_t *argvlen);
+void *redisCommandArgvFromFd(redisContext *c, int argc, const char **argv,
+                             const size_t *argvlen, int fd, off_t offset,
+                             size_t len);
 
 #ifdef __cplusplus
 }
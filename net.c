@@ -50,13 +50,31 @@
 #include <poll.h>
 #include <limits.h>
 #include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#include <linux/errqueue.h>
+#endif
 
 #include "net.h"
 #include "sds.h"
+#include "dns.h"
 
 /* Defined in hiredis.c */
 void __redisSetError(redisContext *c, int type, const char *str);
 
+/* Delay before racing the next address against the attempts in progress,
+ * the "Connection Attempt Delay" of RFC 8305. */
+#define REDIS_CONNECT_ATTEMPT_DELAY 250
+#define REDIS_CONNECT_MAX_ADDRS 32
+
+/* The addresses after the one a non-blocking connect was started to. */
+struct redisAddressList {
+    int next, count;
+    struct addrinfo addrs[];
+};
+
 static void redisContextCloseFd(redisContext *c) {
     if (c && c->fd >= 0) {
         close(c->fd);
@@ -167,6 +185,473 @@ int redisKeepAlive(redisContext *c, int interval) {
     return REDIS_OK;
 }
 
+static int redisSetSockOpt(redisContext *c, int fd, int level, int name,
+                           int value, const char *what) {
+    char buf[64];
+
+    if (setsockopt(fd,level,name,&value,sizeof(value)) == -1) {
+        snprintf(buf,sizeof(buf),"setsockopt(%s)",what);
+        __redisSetErrorFromErrno(c,REDIS_ERR_IO,buf);
+        return REDIS_ERR;
+    }
+    return REDIS_OK;
+}
+
+#if defined(__linux__) && defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+#define HAVE_ZEROCOPY
+#endif
+
+/* How long MSG_ZEROCOPY output is kept after its socket was closed */
+#define REDIS_ZEROCOPY_DRAIN_MSEC 1000
+
+#if !defined(SO_PRIORITY) || !defined(SO_BUSY_POLL) || \
+    !defined(TCP_NOTSENT_LOWAT) || !defined(IPV6_TCLASS) || !defined(HAVE_ZEROCOPY)
+static int redisOptionNotSupported(redisContext *c, const char *what) {
+    char buf[64];
+
+    errno = ENOTSUP;
+    snprintf(buf,sizeof(buf),"setsockopt(%s)",what);
+    __redisSetErrorFromErrno(c,REDIS_ERR_IO,buf);
+    return REDIS_ERR;
+}
+#endif
+
+/* Apply the socket options of the context to a new socket, before it is
+ * connected: the buffer sizes for instance determine the window scaling that
+ * is negotiated during the handshake. */
+static int redisSetSocketOptions(redisContext *c, int fd, int family) {
+    const redisSocketOptions *o = &c->sockopts;
+    int tcp = (family == AF_INET || family == AF_INET6);
+
+    if (o->rcvbuf &&
+        redisSetSockOpt(c,fd,SOL_SOCKET,SO_RCVBUF,o->rcvbuf,"SO_RCVBUF") != REDIS_OK)
+        return REDIS_ERR;
+    if (o->sndbuf &&
+        redisSetSockOpt(c,fd,SOL_SOCKET,SO_SNDBUF,o->sndbuf,"SO_SNDBUF") != REDIS_OK)
+        return REDIS_ERR;
+
+    if (tcp && o->busy_poll) {
+#ifdef SO_BUSY_POLL
+        if (redisSetSockOpt(c,fd,SOL_SOCKET,SO_BUSY_POLL,o->busy_poll,"SO_BUSY_POLL") != REDIS_OK)
+            return REDIS_ERR;
+#else
+        return redisOptionNotSupported(c,"SO_BUSY_POLL");
+#endif
+    }
+    if (tcp && o->notsent_lowat) {
+#ifdef TCP_NOTSENT_LOWAT
+        if (redisSetSockOpt(c,fd,IPPROTO_TCP,TCP_NOTSENT_LOWAT,o->notsent_lowat,
+                            "TCP_NOTSENT_LOWAT") != REDIS_OK)
+            return REDIS_ERR;
+#else
+        return redisOptionNotSupported(c,"TCP_NOTSENT_LOWAT");
+#endif
+    }
+    if (tcp && o->tos) {
+        if (family == AF_INET) {
+            if (redisSetSockOpt(c,fd,IPPROTO_IP,IP_TOS,o->tos,"IP_TOS") != REDIS_OK)
+                return REDIS_ERR;
+        } else {
+#ifdef IPV6_TCLASS
+            if (redisSetSockOpt(c,fd,IPPROTO_IPV6,IPV6_TCLASS,o->tos,"IPV6_TCLASS") != REDIS_OK)
+                return REDIS_ERR;
+#else
+            return redisOptionNotSupported(c,"IPV6_TCLASS");
+#endif
+        }
+    }
+
+    if (tcp && o->zerocopy) {
+#ifdef HAVE_ZEROCOPY
+        if (redisSetSockOpt(c,fd,SOL_SOCKET,SO_ZEROCOPY,1,"SO_ZEROCOPY") != REDIS_OK)
+            return REDIS_ERR;
+#else
+        return redisOptionNotSupported(c,"SO_ZEROCOPY");
+#endif
+    }
+
+    /* Last, because setting IP_TOS on Linux also changes the priority. */
+    if (o->priority) {
+#ifdef SO_PRIORITY
+        if (redisSetSockOpt(c,fd,SOL_SOCKET,SO_PRIORITY,o->priority,"SO_PRIORITY") != REDIS_OK)
+            return REDIS_ERR;
+#else
+        return redisOptionNotSupported(c,"SO_PRIORITY");
+#endif
+    }
+    return REDIS_OK;
+}
+
+/* TCP_QUICKACK is not permanent: the kernel leaves quick ack mode on its own,
+ * so it is enabled again after every read when asked for. */
+void redisSetQuickAck(redisContext *c) {
+#ifdef TCP_QUICKACK
+    int on = 1;
+    if (c->connection_type == REDIS_CONN_TCP)
+        setsockopt(c->fd,IPPROTO_TCP,TCP_QUICKACK,&on,sizeof(on));
+#else
+    ((void)c);
+#endif
+}
+
+/* Output that was sent with MSG_ZEROCOPY. The kernel reads from it until it
+ * reports the send calls as completed on the socket's error queue, so it can
+ * neither be changed nor free'd before. Every send call that succeeds gets the
+ * next number of a per-socket counter; TCP completes them in order. */
+typedef struct redisZeroCopyBuf {
+    sds buf;
+    unsigned int last; /* Number of the last send call that used it */
+    struct redisZeroCopyBuf *next;
+} redisZeroCopyBuf;
+
+struct redisZeroCopy {
+    redisZeroCopyBuf *head, *tail; /* The tail may still be being sent */
+    size_t off; /* Bytes of the tail that were sent */
+    int sending; /* The tail was not sent completely */
+    unsigned int calls; /* Send calls made */
+    unsigned int completed; /* Send calls the kernel is done with */
+};
+
+#ifdef HAVE_ZEROCOPY
+/* Process completion notifications and free the buffers that are done. */
+static void redisZeroCopyReap(redisContext *c) {
+    struct redisZeroCopy *zc = c->zerocopy;
+    union {
+        char buf[CMSG_SPACE(sizeof(struct sock_extended_err)+sizeof(struct sockaddr_in6))];
+        struct cmsghdr align;
+    } control;
+    struct sock_extended_err *ee;
+    struct cmsghdr *cm;
+    struct msghdr msg;
+    redisZeroCopyBuf *b;
+
+    while (zc->head != NULL && zc->completed != zc->calls) {
+        memset(&msg,0,sizeof(msg));
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+        if (recvmsg(c->fd,&msg,MSG_ERRQUEUE|MSG_DONTWAIT) == -1)
+            break;
+
+        for (cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg,cm)) {
+            if (!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) &&
+                !(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))
+                continue;
+            ee = (struct sock_extended_err*)CMSG_DATA(cm);
+            if (ee->ee_errno != 0 || ee->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+                continue;
+            /* [ee_info, ee_data] is a range of send calls. */
+            if ((int)(ee->ee_info-zc->completed) <= 0 &&
+                (int)(ee->ee_data+1-zc->completed) > 0)
+                zc->completed = ee->ee_data+1;
+        }
+    }
+
+    while ((b = zc->head) != NULL && (int)(b->last-zc->completed) < 0 &&
+           !(b == zc->tail && zc->sending))
+    {
+        zc->head = b->next;
+        if (zc->head == NULL) zc->tail = NULL;
+        sdsfree(b->buf);
+        free(b);
+    }
+}
+#endif
+
+/* Send the output buffer with MSG_ZEROCOPY when it is at least as large as
+ * the zerocopy socket option says. It is detached from the context first and
+ * kept until the kernel is done with it, while new commands are appended to a
+ * fresh buffer. Returns the number of bytes of the detached buffer that still
+ * have to be sent (the socket is full), or -1 on error. */
+long redisContextWriteZeroCopy(redisContext *c) {
+#ifdef HAVE_ZEROCOPY
+    struct redisZeroCopy *zc = c->zerocopy;
+    redisZeroCopyBuf *b;
+    ssize_t n;
+    size_t len;
+
+    if (zc == NULL) {
+        if (sdslen(c->obuf) < (size_t)c->sockopts.zerocopy)
+            return 0;
+        if ((zc = calloc(1,sizeof(*zc))) == NULL) {
+            __redisSetError(c,REDIS_ERR_OOM,"Out of memory");
+            return -1;
+        }
+        c->zerocopy = zc;
+    }
+    redisZeroCopyReap(c);
+
+    if (!zc->sending) {
+        /* File payloads are placed relative to the output buffer. */
+        if (sdslen(c->obuf) < (size_t)c->sockopts.zerocopy || c->files != NULL)
+            return 0;
+        if ((b = malloc(sizeof(*b))) == NULL) {
+            __redisSetError(c,REDIS_ERR_OOM,"Out of memory");
+            return -1;
+        }
+        b->buf = c->obuf;
+        b->last = zc->calls-1; /* Free right away when no call uses it */
+        b->next = NULL;
+        if ((c->obuf = sdsempty()) == NULL) {
+            c->obuf = b->buf;
+            free(b);
+            __redisSetError(c,REDIS_ERR_OOM,"Out of memory");
+            return -1;
+        }
+        if (zc->tail) zc->tail->next = b;
+        else zc->head = b;
+        zc->tail = b;
+        zc->off = 0;
+        zc->sending = 1;
+    }
+
+    b = zc->tail;
+    len = sdslen(b->buf);
+    while (zc->off < len) {
+        n = send(c->fd,b->buf+zc->off,len-zc->off,MSG_ZEROCOPY|MSG_NOSIGNAL);
+        if (n == -1 && errno == ENOBUFS) {
+            /* Out of locked memory: this part is copied after all. */
+            n = send(c->fd,b->buf+zc->off,len-zc->off,MSG_NOSIGNAL);
+        } else if (n >= 0) {
+            b->last = zc->calls++;
+        }
+        if (n == -1) {
+            if ((errno == EAGAIN && (c->flags & (REDIS_BLOCK|REDIS_SPIN)) != REDIS_BLOCK) ||
+                errno == EINTR)
+                return (long)(len-zc->off);
+            __redisSetError(c,REDIS_ERR_IO,NULL);
+            return -1;
+        }
+        zc->off += n;
+    }
+    zc->sending = 0;
+    redisZeroCopyReap(c);
+    if (sdslen(c->obuf) >= (size_t)c->sockopts.zerocopy)
+        return redisContextWriteZeroCopy(c);
+    return 0;
+#else
+    ((void)c);
+    return 0;
+#endif
+}
+
+/* Bytes that were taken out of the output buffer for a zero copy send but
+ * did not reach the socket yet. */
+size_t redisContextZeroCopyPending(redisContext *c) {
+    struct redisZeroCopy *zc = c->zerocopy;
+
+    if (zc == NULL || !zc->sending)
+        return 0;
+    return sdslen(zc->tail->buf)-zc->off;
+}
+
+/* Pending notifications make the socket report an error condition, which
+ * level-triggered event loops keep signaling until they are read. */
+void redisContextReapZeroCopy(redisContext *c) {
+#ifdef HAVE_ZEROCOPY
+    if (c->zerocopy != NULL)
+        redisZeroCopyReap(c);
+#else
+    ((void)c);
+#endif
+}
+
+static void redisZeroCopyFreeBufs(redisZeroCopyBuf *b) {
+    redisZeroCopyBuf *next;
+
+    for (; b != NULL; b = next) {
+        next = b->next;
+        sdsfree(b->buf);
+        free(b);
+    }
+}
+
+#ifdef HAVE_ZEROCOPY
+/* Output of closed sockets the kernel may still be sending from, kept until
+ * it expires. Shared by all contexts, which can live in different threads. */
+typedef struct redisZeroCopyOrphan {
+    redisZeroCopyBuf *head;
+    long long expires; /* Monotonic msec */
+    struct redisZeroCopyOrphan *next;
+} redisZeroCopyOrphan;
+
+static pthread_mutex_t zerocopyLock = PTHREAD_MUTEX_INITIALIZER;
+static redisZeroCopyOrphan *zerocopyOrphans = NULL;
+
+static long long redisZeroCopyMsec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (long long)ts.tv_sec*1000+ts.tv_nsec/1000000;
+}
+
+static void redisZeroCopyFreeOrphans(void) {
+    redisZeroCopyOrphan *o, **po, *expired = NULL;
+    long long now = redisZeroCopyMsec();
+
+    pthread_mutex_lock(&zerocopyLock);
+    for (po = &zerocopyOrphans; (o = *po) != NULL; ) {
+        if (o->expires <= now) {
+            *po = o->next;
+            o->next = expired;
+            expired = o;
+        } else {
+            po = &o->next;
+        }
+    }
+    pthread_mutex_unlock(&zerocopyLock);
+
+    while ((o = expired) != NULL) {
+        expired = o->next;
+        redisZeroCopyFreeBufs(o->head);
+        free(o);
+    }
+}
+#endif
+
+/* Free the output sent with MSG_ZEROCOPY. Called before the socket is closed,
+ * but queued data is still sent after close(2): what the kernel did not report
+ * as completed yet is kept for REDIS_ZEROCOPY_DRAIN_MSEC and freed by a later
+ * call, so that closing never has to wait for the network. */
+void redisContextFreeZeroCopy(redisContext *c) {
+    struct redisZeroCopy *zc = c->zerocopy;
+#ifdef HAVE_ZEROCOPY
+    redisZeroCopyOrphan *o;
+
+    redisZeroCopyFreeOrphans();
+    if (zc != NULL && c->fd >= 0) {
+        zc->sending = 0;
+        redisZeroCopyReap(c);
+    }
+    if (zc != NULL && zc->head != NULL && (o = malloc(sizeof(*o))) != NULL) {
+        o->head = zc->head;
+        o->expires = redisZeroCopyMsec()+REDIS_ZEROCOPY_DRAIN_MSEC;
+        pthread_mutex_lock(&zerocopyLock);
+        o->next = zerocopyOrphans;
+        zerocopyOrphans = o;
+        pthread_mutex_unlock(&zerocopyLock);
+        zc->head = NULL;
+    }
+#endif
+    if (zc == NULL)
+        return;
+    redisZeroCopyFreeBufs(zc->head);
+    free(zc);
+    c->zerocopy = NULL;
+}
+
+/* Number of send calls made with MSG_ZEROCOPY on the current socket. */
+unsigned int redisContextZeroCopySends(redisContext *c) {
+    return c->zerocopy != NULL ? c->zerocopy->calls : 0;
+}
+
+/* A bulk payload that is sent from a file instead of the output buffer. It
+ * goes on the wire after the first "pos" bytes of the output buffer, which
+ * hold the header of its command. */
+struct redisFilePart {
+    size_t pos;
+    int fd;
+    off_t offset;
+    size_t len; /* Bytes still to be sent */
+    struct redisFilePart *next;
+};
+
+/* Queue "len" bytes of "fd" starting at "offset" to be sent after what the
+ * output buffer holds right now. The file descriptor is not owned. */
+int redisContextAppendFile(redisContext *c, int fd, off_t offset, size_t len) {
+    struct redisFilePart *p, **tail = &c->files;
+
+    if ((p = malloc(sizeof(*p))) == NULL) {
+        __redisSetError(c,REDIS_ERR_OOM,"Out of memory");
+        return REDIS_ERR;
+    }
+    p->pos = sdslen(c->obuf);
+    p->fd = fd;
+    p->offset = offset;
+    p->len = len;
+    p->next = NULL;
+    while (*tail != NULL)
+        tail = &(*tail)->next;
+    *tail = p;
+    return REDIS_OK;
+}
+
+/* Forget the file parts queued after the first "pos" bytes of the output
+ * buffer, when the command they belong to is taken back. */
+void redisContextDropFiles(redisContext *c, size_t pos) {
+    struct redisFilePart *p, **tail = &c->files;
+
+    while (*tail != NULL && (*tail)->pos < pos)
+        tail = &(*tail)->next;
+    while ((p = *tail) != NULL) {
+        *tail = p->next;
+        free(p);
+    }
+}
+
+/* Send up to "len" bytes of the file straight from the page cache. */
+static ssize_t redisSendFile(redisContext *c, struct redisFilePart *p) {
+#ifdef __linux__
+    size_t len = p->len < (size_t)1<<30 ? p->len : (size_t)1<<30;
+    ssize_t n = sendfile(c->fd,p->fd,&p->offset,len);
+#else
+    char buf[16*1024];
+    size_t len = p->len < sizeof(buf) ? p->len : sizeof(buf);
+    ssize_t n = pread(p->fd,buf,len,p->offset);
+
+    if (n > 0 && (n = write(c->fd,buf,n)) > 0)
+        p->offset += n;
+#endif
+    if (n == 0) {
+        __redisSetError(c,REDIS_ERR_OTHER,"File ended before its payload was sent");
+        return -1;
+    }
+    return n;
+}
+
+/* Write the output buffer and the queued file payloads in order, until all
+ * of it was sent or the socket is full. */
+int redisContextWriteFiles(redisContext *c) {
+    struct redisFilePart *p;
+    ssize_t n;
+    size_t len;
+
+    while (c->files != NULL || sdslen(c->obuf) > 0) {
+        p = c->files;
+        len = p != NULL ? p->pos : sdslen(c->obuf);
+        if (len > 0) {
+            n = write(c->fd,c->obuf,len);
+            if (n > 0) {
+                sdsrange(c->obuf,n,-1);
+                for (; p != NULL; p = p->next) p->pos -= n;
+            }
+        } else {
+            if ((n = redisSendFile(c,p)) == -1 && c->err)
+                return REDIS_ERR;
+            if (n > 0 && (p->len -= n) == 0) {
+                c->files = p->next;
+                free(p);
+            }
+        }
+        if (n == -1) {
+            if (((errno == EAGAIN || errno == EINPROGRESS) &&
+                 (c->flags & (REDIS_BLOCK|REDIS_SPIN)) != REDIS_BLOCK) ||
+                (errno == EINTR))
+                break;
+            __redisSetError(c,REDIS_ERR_IO,NULL);
+            return REDIS_ERR;
+        }
+    }
+    return REDIS_OK;
+}
+
+void redisContextFreeFiles(redisContext *c) {
+    struct redisFilePart *p;
+
+    while ((p = c->files) != NULL) {
+        c->files = p->next;
+        free(p);
+    }
+}
+
 static int redisSetTcpNoDelay(redisContext *c) {
     int yes = 1;
     if (setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes)) == -1) {
@@ -263,18 +748,308 @@ int redisContextSetTimeout(redisContext *c, const struct timeval tv) {
     return REDIS_OK;
 }
 
+/* Switch a blocking context in and out of spin mode. The socket is made
+ * non-blocking so that redisGetReply() can poll it without sleeping; it stays
+ * that way across reconnects as long as REDIS_SPIN is set. */
+int redisContextSetSpin(redisContext *c, int usec) {
+    if (redisSetBlocking(c,usec == 0) != REDIS_OK)
+        return REDIS_ERR;
+    if (usec > 0) {
+        c->flags |= REDIS_SPIN;
+        c->spin_usec = usec;
+    } else {
+        c->flags &= ~REDIS_SPIN;
+        c->spin_usec = 0;
+    }
+    return REDIS_OK;
+}
+
+/* Wait for a spinning context to become readable (POLLIN) or writable
+ * (POLLOUT). The wait is bounded by the timeout set with redisSetTimeout(),
+ * which a non-blocking socket would otherwise ignore. A timeout is reported
+ * like it is for a blocking socket: an I/O error with errno set to EAGAIN. */
+int redisContextWaitIO(redisContext *c, int events) {
+    struct pollfd pfd;
+    struct timeval tv;
+    socklen_t len = sizeof(tv);
+    long msec = -1;
+    int res;
+
+    if (getsockopt(c->fd,SOL_SOCKET,events == POLLIN ? SO_RCVTIMEO : SO_SNDTIMEO,
+                   &tv,&len) == 0 && (tv.tv_sec || tv.tv_usec))
+    {
+        if (tv.tv_sec > __MAX_MSEC)
+            msec = INT_MAX;
+        else
+            msec = (tv.tv_sec * 1000) + ((tv.tv_usec + 999) / 1000);
+        if (msec > INT_MAX)
+            msec = INT_MAX;
+    }
+
+    pfd.fd = c->fd;
+    pfd.events = events;
+    do {
+        res = poll(&pfd,1,msec);
+    } while (res == -1 && errno == EINTR);
+
+    if (res == -1) {
+        __redisSetErrorFromErrno(c,REDIS_ERR_IO,"poll(2)");
+        return REDIS_ERR;
+    } else if (res == 0) {
+        errno = EAGAIN;
+        __redisSetError(c,REDIS_ERR_IO,NULL);
+        return REDIS_ERR;
+    }
+    return REDIS_OK;
+}
+
+/* Order the resolved addresses like RFC 8305 does: the first address keeps
+ * the resolver's preference, then the address families alternate. Returns the
+ * number of addresses stored in "addrs". */
+static int redisSortAddresses(struct addrinfo *servinfo, struct addrinfo **addrs) {
+    struct addrinfo *first = servinfo, *other = servinfo;
+    int n = 0, turn = 0;
+
+    while ((first != NULL || other != NULL) && n < REDIS_CONNECT_MAX_ADDRS) {
+        if (turn == 0) {
+            while (first != NULL && first->ai_family != servinfo->ai_family)
+                first = first->ai_next;
+            if (first != NULL) {
+                addrs[n++] = first;
+                first = first->ai_next;
+            }
+        } else {
+            while (other != NULL && other->ai_family == servinfo->ai_family)
+                other = other->ai_next;
+            if (other != NULL) {
+                addrs[n++] = other;
+                other = other->ai_next;
+            }
+        }
+        turn = !turn;
+    }
+    return n;
+}
+
+/* Keep copies of "addrs" for redisContextConnectNext(), in one allocation. */
+static void redisKeepFallback(redisContext *c, struct addrinfo **addrs, int n) {
+    struct redisAddressList *l;
+    struct sockaddr_storage *sa;
+    int i;
+
+    free(c->fallback);
+    c->fallback = NULL;
+    if (n <= 0)
+        return;
+    l = malloc(sizeof(*l)+n*(sizeof(struct addrinfo)+sizeof(*sa)));
+    if (l == NULL)
+        return;
+    sa = (struct sockaddr_storage*)(l->addrs+n);
+    for (i = 0; i < n; i++) {
+        l->addrs[i] = *addrs[i];
+        memcpy(&sa[i],addrs[i]->ai_addr,addrs[i]->ai_addrlen);
+        l->addrs[i].ai_addr = (struct sockaddr*)&sa[i];
+        l->addrs[i].ai_canonname = NULL;
+        l->addrs[i].ai_next = NULL;
+    }
+    l->next = 0;
+    l->count = n;
+    c->fallback = l;
+}
+
+static int redisBindSourceAddr(redisContext *c, int s, int family) {
+    struct addrinfo hints, *bservinfo, *b;
+    int rv, on = 1;
+    char buf[128];
+
+    memset(&hints,0,sizeof(hints));
+    hints.ai_family = family;
+    hints.ai_socktype = SOCK_STREAM;
+
+    /* Using getaddrinfo saves us from self-determining IPv4 vs IPv6 */
+    if ((rv = getaddrinfo(c->tcp.source_addr, NULL, &hints, &bservinfo)) != 0) {
+        snprintf(buf,sizeof(buf),"Can't get addr: %s",gai_strerror(rv));
+        __redisSetError(c,REDIS_ERR_OTHER,buf);
+        return REDIS_ERR;
+    }
+
+    if (c->flags & REDIS_REUSEADDR) {
+        if (setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (char*) &on,
+                       sizeof(on)) < 0) {
+            freeaddrinfo(bservinfo);
+            __redisSetErrorFromErrno(c,REDIS_ERR_IO,"setsockopt(SO_REUSEADDR)");
+            return REDIS_ERR;
+        }
+    }
+
+    for (b = bservinfo; b != NULL; b = b->ai_next) {
+        if (bind(s,b->ai_addr,b->ai_addrlen) != -1) {
+            freeaddrinfo(bservinfo);
+            return REDIS_OK;
+        }
+    }
+    freeaddrinfo(bservinfo);
+    snprintf(buf,sizeof(buf),"Can't bind socket: %s",strerror(errno));
+    __redisSetError(c,REDIS_ERR_OTHER,buf);
+    return REDIS_ERR;
+}
+
+/* Create a non-blocking socket and start connecting it to "p". Returns the
+ * socket, -1 when this address can't be used (the error is stored in the
+ * context so the last failure is reported when no address works), or -2 when
+ * the whole connect should be aborted. "connected" is set when the connection
+ * was established right away. */
+static int redisConnectAddress(redisContext *c, const struct addrinfo *p,
+                               int *connected) {
+    int s, reuses = 0;
+    char buf[128];
+
+    *connected = 0;
+addrretry:
+    if ((s = socket(p->ai_family,p->ai_socktype,p->ai_protocol)) == -1) {
+        snprintf(buf,sizeof(buf),"Can't create socket: %s",strerror(errno));
+        __redisSetError(c,REDIS_ERR_OTHER,buf);
+        return -1;
+    }
+
+    c->fd = s;
+    if (redisSetBlocking(c,0) != REDIS_OK)
+        return -2;
+    c->fd = -1;
+
+    if (redisSetSocketOptions(c,s,p->ai_family) != REDIS_OK) {
+        close(s);
+        return -1;
+    }
+
+#ifdef TCP_FASTOPEN_CONNECT
+    if (c->flags & REDIS_FASTOPEN) {
+        /* Makes connect(2) return right away: the SYN leaves with the first
+         * write. When this fails we just do a regular connect. */
+        int on = 1;
+        setsockopt(s,IPPROTO_TCP,TCP_FASTOPEN_CONNECT,&on,sizeof(on));
+    }
+#endif
+
+    if (c->tcp.source_addr && redisBindSourceAddr(c,s,p->ai_family) != REDIS_OK) {
+        close(s);
+        return -1;
+    }
+
+    if (connect(s,p->ai_addr,p->ai_addrlen) == -1) {
+        if (errno == EINPROGRESS)
+            return s;
+        if (errno == EADDRNOTAVAIL && (c->flags & REDIS_REUSEADDR) &&
+            ++reuses < REDIS_CONNECT_RETRIES) {
+            close(s);
+            goto addrretry;
+        }
+        __redisSetErrorFromErrno(c,REDIS_ERR_IO,NULL);
+        close(s);
+        return -1;
+    }
+    *connected = 1;
+    return s;
+}
+
+static long long redisMonotonicMsec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (long long)ts.tv_sec*1000+ts.tv_nsec/1000000;
+}
+
+/* Connect to the first of "addrs" that accepts the connection, RFC 8305
+ * style: a new attempt is started every REDIS_CONNECT_ATTEMPT_DELAY msec or as
+ * soon as an attempt fails, while earlier attempts keep running. The timeout
+ * applies to the whole operation. Returns the connected socket or -1. */
+static int redisConnectParallel(redisContext *c, struct addrinfo **addrs, int n,
+                                long msec) {
+    struct pollfd pfd[REDIS_CONNECT_MAX_ADDRS];
+    long long now, deadline, next_attempt;
+    int inflight = 0, next = 0, winner = -1, connected, res, i, s, err;
+    socklen_t errlen;
+    long wait;
+
+    now = redisMonotonicMsec();
+    deadline = msec >= 0 ? now+msec : -1;
+    next_attempt = now;
+
+    while (winner == -1) {
+        now = redisMonotonicMsec();
+        if (inflight > 0 && deadline >= 0 && now >= deadline) {
+            errno = ETIMEDOUT;
+            __redisSetErrorFromErrno(c,REDIS_ERR_IO,NULL);
+            break;
+        }
+        if (next < n && (inflight == 0 || now >= next_attempt)) {
+            s = redisConnectAddress(c,addrs[next++],&connected);
+            if (s == -2)
+                break;
+            if (s >= 0 && connected) {
+                winner = s;
+            } else if (s >= 0) {
+                pfd[inflight].fd = s;
+                pfd[inflight].events = POLLOUT;
+                pfd[inflight].revents = 0;
+                inflight++;
+                next_attempt = now+REDIS_CONNECT_ATTEMPT_DELAY;
+            }
+            continue;
+        }
+        if (inflight == 0)
+            break; /* Every address failed */
+
+        wait = deadline >= 0 ? (long)(deadline-now) : -1;
+        if (next < n && (wait < 0 || next_attempt-now < wait))
+            wait = (long)(next_attempt-now);
+        if ((res = poll(pfd,inflight,wait)) == -1) {
+            if (errno == EINTR)
+                continue;
+            __redisSetErrorFromErrno(c,REDIS_ERR_IO,"poll(2)");
+            break;
+        }
+
+        for (i = 0; i < inflight && res > 0; ) {
+            if (pfd[i].revents == 0) {
+                i++;
+                continue;
+            }
+            res--;
+            err = 0;
+            errlen = sizeof(err);
+            if (getsockopt(pfd[i].fd,SOL_SOCKET,SO_ERROR,&err,&errlen) == -1)
+                err = errno;
+            if (err == 0) {
+                winner = pfd[i].fd;
+                pfd[i] = pfd[--inflight];
+                break;
+            }
+            /* This attempt failed: start the next one right away. */
+            errno = err;
+            __redisSetErrorFromErrno(c,REDIS_ERR_IO,NULL);
+            close(pfd[i].fd);
+            pfd[i] = pfd[--inflight];
+            next_attempt = now;
+        }
+    }
+
+    for (i = 0; i < inflight; i++)
+        close(pfd[i].fd);
+    return winner;
+}
+
 static int _redisContextConnectTcp(redisContext *c, const char *addr, int port,
                                    const struct timeval *timeout,
                                    const char *source_addr) {
-    int s, rv, n;
-    char _port[6];  /* strlen("65535"); */
-    struct addrinfo hints, *servinfo, *bservinfo, *p, *b;
+    int s, rv, i, n, connected;
+    struct addrinfo *servinfo, *addrs[REDIS_CONNECT_MAX_ADDRS];
     int blocking = (c->flags & REDIS_BLOCK);
-    int reuseaddr = (c->flags & REDIS_REUSEADDR);
-    int reuses = 0;
     long timeout_msec = -1;
 
     servinfo = NULL;
+    redisContextFreeZeroCopy(c);
+    redisContextFreeLookup(c);
+    redisKeepFallback(c,NULL,0);
     c->connection_type = REDIS_CONN_TCP;
     c->tcp.port = port;
 
@@ -318,104 +1093,126 @@ static int _redisContextConnectTcp(redisContext *c, const char *addr, int port,
         c->tcp.source_addr = strdup(source_addr);
     }
 
-    snprintf(_port, 6, "%d", port);
-    memset(&hints,0,sizeof(hints));
-    hints.ai_family = AF_INET;
-    hints.ai_socktype = SOCK_STREAM;
-
-    /* Try with IPv6 if no IPv4 address was found. We do it in this order since
-     * in a Redis client you can't afford to test if you have IPv6 connectivity
-     * as this would add latency to every connect. Otherwise a more sensible
-     * route could be: Use IPv6 if both addresses are available and there is IPv6
-     * connectivity. */
-    if ((rv = getaddrinfo(c->tcp.host,_port,&hints,&servinfo)) != 0) {
-         hints.ai_family = AF_INET6;
-         if ((rv = getaddrinfo(addr,_port,&hints,&servinfo)) != 0) {
-            __redisSetError(c,REDIS_ERR_OTHER,gai_strerror(rv));
-            return REDIS_ERR;
-        }
-    }
-    for (p = servinfo; p != NULL; p = p->ai_next) {
-addrretry:
-        if ((s = socket(p->ai_family,p->ai_socktype,p->ai_protocol)) == -1)
-            continue;
-
+    /* A non-blocking connect of the async API doesn't wait for the resolver:
+     * unless the answer is at hand, the resolver thread looks the host up
+     * and redisContextConnectResolved() carries on from there. */
+    if (!blocking && (c->flags & REDIS_DEFER_LOOKUP) &&
+        (c->lookup = redisDnsLookupStart(c->tcp.host,&s)) != NULL)
+    {
         c->fd = s;
-        if (redisSetBlocking(c,0) != REDIS_OK)
-            goto error;
-        if (c->tcp.source_addr) {
-            int bound = 0;
-            /* Using getaddrinfo saves us from self-determining IPv4 vs IPv6 */
-            if ((rv = getaddrinfo(c->tcp.source_addr, NULL, &hints, &bservinfo)) != 0) {
-                char buf[128];
-                snprintf(buf,sizeof(buf),"Can't get addr: %s",gai_strerror(rv));
-                __redisSetError(c,REDIS_ERR_OTHER,buf);
-                goto error;
-            }
-
-            if (reuseaddr) {
-                n = 1;
-                if (setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (char*) &n,
-                               sizeof(n)) < 0) {
-                    goto error;
-                }
-            }
+        c->flags |= REDIS_CONNECTED;
+        return REDIS_OK;
+    }
 
-            for (b = bservinfo; b != NULL; b = b->ai_next) {
-                if (bind(s,b->ai_addr,b->ai_addrlen) != -1) {
-                    bound = 1;
-                    break;
-                }
-            }
-            freeaddrinfo(bservinfo);
-            if (!bound) {
-                char buf[128];
-                snprintf(buf,sizeof(buf),"Can't bind socket: %s",strerror(errno));
-                __redisSetError(c,REDIS_ERR_OTHER,buf);
-                goto error;
-            }
-        }
-        if (connect(s,p->ai_addr,p->ai_addrlen) == -1) {
-            if (errno == EHOSTUNREACH) {
-                redisContextCloseFd(c);
-                continue;
-            } else if (errno == EINPROGRESS && !blocking) {
-                /* This is ok. */
-            } else if (errno == EADDRNOTAVAIL && reuseaddr) {
-                if (++reuses >= REDIS_CONNECT_RETRIES) {
-                    goto error;
-                } else {
-                    redisContextCloseFd(c);
-                    goto addrretry;
-                }
-            } else {
-                if (redisContextWaitReady(c,timeout_msec) != REDIS_OK)
-                    goto error;
-            }
-        }
-        if (blocking && redisSetBlocking(c,1) != REDIS_OK)
-            goto error;
-        if (redisSetTcpNoDelay(c) != REDIS_OK)
-            goto error;
+    /* Resolve every address family: the connect below races the addresses
+     * instead of trying them one at a time, so a family without connectivity
+     * only costs the attempt delay. Lookups go through the DNS cache when it
+     * is on. */
+    if ((rv = redisDnsLookup(c->tcp.host,port,&servinfo)) != 0) {
+        __redisSetError(c,REDIS_ERR_OTHER,gai_strerror(rv));
+        return REDIS_ERR;
+    }
+    n = redisSortAddresses(servinfo,addrs);
 
-        c->flags |= REDIS_CONNECTED;
-        rv = REDIS_OK;
-        goto end;
+    if (blocking) {
+        s = redisConnectParallel(c,addrs,n,timeout_msec);
+    } else {
+        /* Without an event loop there is no way to wait for several attempts:
+         * use the first address a connect can be started to, and keep the
+         * others in case it fails. */
+        for (s = -1, i = 0; i < n && s == -1; i++)
+            s = redisConnectAddress(c,addrs[i],&connected);
+        redisKeepFallback(c,addrs+i,s >= 0 ? n-i : 0);
     }
-    if (p == NULL) {
-        char buf[128];
-        snprintf(buf,sizeof(buf),"Can't create socket: %s",strerror(errno));
-        __redisSetError(c,REDIS_ERR_OTHER,buf);
+    if (s < 0)
         goto error;
-    }
+
+    /* An address that failed before the winning one left its error behind. */
+    c->err = 0;
+    c->errstr[0] = '\0';
+    c->fd = s;
+    if (blocking && !(c->flags & REDIS_SPIN) && redisSetBlocking(c,1) != REDIS_OK)
+        goto error;
+    if (redisSetTcpNoDelay(c) != REDIS_OK)
+        goto error;
+    if (c->sockopts.quickack)
+        redisSetQuickAck(c);
+
+    c->flags |= REDIS_CONNECTED;
+    rv = REDIS_OK;
+    goto end;
 
 error:
     rv = REDIS_ERR;
 end:
-    freeaddrinfo(servinfo);
+    redisDnsFreeAddrinfo(servinfo);
     return rv;  // Need to return REDIS_OK if alright
 }
 
+/* Start a connect to the next address a non-blocking TCP connect kept, after
+ * the current attempt failed. The new socket takes over the descriptor number
+ * so event libraries keep watching the same one. Returns REDIS_ERR when no
+ * address is left. */
+int redisContextConnectNext(redisContext *c) {
+    struct redisAddressList *l = c->fallback;
+    int s = -1, fd = c->fd, connected;
+
+    while (l != NULL && s < 0 && l->next < l->count) {
+        s = redisConnectAddress(c,&l->addrs[l->next++],&connected);
+        c->fd = fd;
+        if (s == -2)
+            return REDIS_ERR;
+    }
+    if (s < 0)
+        return REDIS_ERR;
+
+    if (dup2(s,fd) == -1) {
+        __redisSetErrorFromErrno(c,REDIS_ERR_IO,NULL);
+        close(s);
+        return REDIS_ERR;
+    }
+    close(s);
+    c->err = 0;
+    c->errstr[0] = '\0';
+    if (redisSetTcpNoDelay(c) != REDIS_OK)
+        return REDIS_ERR;
+    if (c->sockopts.quickack)
+        redisSetQuickAck(c);
+    return REDIS_OK;
+}
+
+/* Carry on with a connect whose lookup was deferred, see REDIS_DEFER_LOOKUP.
+ * Once the answer is in, a connect to the first of the resolved addresses is
+ * started on a socket that takes over the placeholder descriptor, keeping the
+ * others for redisContextConnectNext(). Returns REDIS_OK while the lookup is
+ * still running, with c->lookup set, or when the connect was started. */
+int redisContextConnectResolved(redisContext *c) {
+    struct addrinfo *servinfo, *addrs[REDIS_CONNECT_MAX_ADDRS];
+    int rv, n;
+
+    if (!redisDnsLookupDone(c->lookup))
+        return REDIS_OK;
+    rv = redisDnsLookupResult(c->lookup,c->tcp.port,&servinfo);
+    redisContextFreeLookup(c);
+    if (rv != 0) {
+        __redisSetError(c,REDIS_ERR_OTHER,gai_strerror(rv));
+        return REDIS_ERR;
+    }
+    n = redisSortAddresses(servinfo,addrs);
+    redisKeepFallback(c,addrs,n);
+    redisDnsFreeAddrinfo(servinfo);
+    if (c->fallback == NULL) {
+        __redisSetError(c,REDIS_ERR_OOM,"Out of memory");
+        return REDIS_ERR;
+    }
+    return redisContextConnectNext(c);
+}
+
+void redisContextFreeLookup(redisContext *c) {
+    redisDnsLookupRelease(c->lookup);
+    c->lookup = NULL;
+}
+
 int redisContextConnectTcp(redisContext *c, const char *addr, int port,
                            const struct timeval *timeout) {
     return _redisContextConnectTcp(c, addr, port, timeout, NULL);
@@ -432,8 +1229,13 @@ int redisContextConnectUnix(redisContext *c, const char *path, const struct time
     struct sockaddr_un sa;
     long timeout_msec = -1;
 
+    redisContextFreeZeroCopy(c);
     if (redisCreateSocket(c,AF_LOCAL) < 0)
         return REDIS_ERR;
+    if (redisSetSocketOptions(c,c->fd,AF_LOCAL) != REDIS_OK) {
+        redisContextCloseFd(c);
+        return REDIS_ERR;
+    }
     if (redisSetBlocking(c,0) != REDIS_OK)
         return REDIS_ERR;
 
@@ -469,7 +1271,7 @@ int redisContextConnectUnix(redisContext *c, const char *path, const struct time
     }
 
     /* Reset socket to be blocking after connect(2). */
-    if (blocking && redisSetBlocking(c,1) != REDIS_OK)
+    if (blocking && !(c->flags & REDIS_SPIN) && redisSetBlocking(c,1) != REDIS_OK)
         return REDIS_ERR;
 
     c->flags |= REDIS_CONNECTED;
@@ -43,11 +43,26 @@
 
 int redisCheckSocketError(redisContext *c);
 int redisContextSetTimeout(redisContext *c, const struct timeval tv);
+int redisContextSetSpin(redisContext *c, int usec);
+int redisContextWaitIO(redisContext *c, int events);
 int redisContextConnectTcp(redisContext *c, const char *addr, int port, const struct timeval *timeout);
 int redisContextConnectBindTcp(redisContext *c, const char *addr, int port,
                                const struct timeval *timeout,
                                const char *source_addr);
 int redisContextConnectUnix(redisContext *c, const char *path, const struct timeval *timeout);
+int redisContextConnectNext(redisContext *c);
+int redisContextConnectResolved(redisContext *c);
+void redisContextFreeLookup(redisContext *c);
 int redisKeepAlive(redisContext *c, int interval);
+void redisSetQuickAck(redisContext *c);
+long redisContextWriteZeroCopy(redisContext *c);
+void redisContextReapZeroCopy(redisContext *c);
+size_t redisContextZeroCopyPending(redisContext *c);
+unsigned int redisContextZeroCopySends(redisContext *c);
+void redisContextFreeZeroCopy(redisContext *c);
+int redisContextAppendFile(redisContext *c, int fd, off_t offset, size_t len);
+void redisContextDropFiles(redisContext *c, size_t pos);
+int redisContextWriteFiles(redisContext *c);
+void redisContextFreeFiles(redisContext *c);
 
 #endif
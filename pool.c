@@ -0,0 +1,500 @@
+/*
+ * Copyright (c) 2009-2011, Salvatore Sanfilippo <antirez at gmail dot com>
+ * Copyright (c) 2010-2011, Pieter Noordhuis <pcnoordhuis at gmail dot com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "fmacros.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <sched.h>
+#include "pool.h"
+
+#define _ATOMIC_LOAD(p) __atomic_load_n((p),__ATOMIC_ACQUIRE)
+#define _ATOMIC_STORE(p,v) __atomic_store_n((p),(v),__ATOMIC_RELEASE)
+#define _ATOMIC_INCR(p,v) __atomic_fetch_add((p),(v),__ATOMIC_RELAXED)
+#define _ATOMIC_DECR(p,v) __atomic_fetch_sub((p),(v),__ATOMIC_RELAXED)
+#define _ATOMIC_XCHG(p,v) __atomic_exchange_n((p),(v),__ATOMIC_ACQ_REL)
+#define _ATOMIC_CAS(p,o,n) __atomic_compare_exchange_n((p),(o),(n),0, \
+        __ATOMIC_ACQ_REL,__ATOMIC_ACQUIRE)
+
+/* Every thread gets its own address here, which is used to pick the cache
+ * slot it prefers. */
+static __thread char poolThreadKey;
+
+static long long poolMonotonicUsec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return ((long long)ts.tv_sec)*1000000+ts.tv_nsec/1000;
+}
+
+static unsigned int poolThreadSlot(void) {
+    uintptr_t key = (uintptr_t)&poolThreadKey;
+    key ^= key >> 12;
+    key ^= key >> 7;
+    return (unsigned int)(key % REDIS_POOL_CACHE_SLOTS);
+}
+
+/* Errors are reported to the calling thread only, as other threads use the
+ * pool at the same time. */
+static void poolSetError(redisPoolError *e, int type, const char *str) {
+    size_t len;
+
+    if (e == NULL)
+        return;
+    len = strlen(str);
+    len = len < (sizeof(e->errstr)-1) ? len : (sizeof(e->errstr)-1);
+    memcpy(e->errstr,str,len);
+    e->errstr[len] = '\0';
+    e->err = type;
+}
+
+/* Treiber stack of connection indexes. The head carries a tag that is bumped
+ * on every update so a pop can't be fooled by an index that was popped and
+ * pushed again in between (ABA). */
+static void poolPushFree(redisPool *pool, int idx) {
+    unsigned long long old, new;
+
+    old = _ATOMIC_LOAD(&pool->freelist);
+    do {
+        _ATOMIC_STORE(&pool->next[idx],(int)(old & 0xffffffff));
+        new = (((old >> 32)+1) << 32) | (unsigned long long)(idx+1);
+    } while (!_ATOMIC_CAS(&pool->freelist,&old,new));
+}
+
+static int poolPopFree(redisPool *pool) {
+    unsigned long long old, new;
+    int idx;
+
+    old = _ATOMIC_LOAD(&pool->freelist);
+    do {
+        if ((old & 0xffffffff) == 0)
+            return -1;
+        idx = (int)(old & 0xffffffff)-1;
+        new = (((old >> 32)+1) << 32) |
+              (unsigned long long)(unsigned int)_ATOMIC_LOAD(&pool->next[idx]);
+    } while (!_ATOMIC_CAS(&pool->freelist,&old,new));
+    return idx;
+}
+
+/* Take an idle connection, preferring the slot of the calling thread, then
+ * the shared free list and finally the slots of other threads. */
+static redisPoolConnection *poolTakeIdle(redisPool *pool) {
+    redisPoolConnection *conn;
+    unsigned int slot = poolThreadSlot();
+    int i, idx;
+
+    conn = _ATOMIC_XCHG(&pool->cache[slot],NULL);
+    if (conn != NULL)
+        return conn;
+    if ((idx = poolPopFree(pool)) >= 0)
+        return &pool->conns[idx];
+    for (i = 1; i < REDIS_POOL_CACHE_SLOTS; i++) {
+        slot = (slot+1) % REDIS_POOL_CACHE_SLOTS;
+        if (_ATOMIC_LOAD(&pool->cache[slot]) == NULL)
+            continue;
+        if ((conn = _ATOMIC_XCHG(&pool->cache[slot],NULL)) != NULL)
+            return conn;
+    }
+    return NULL;
+}
+
+/* Keep the connection in the slot of the calling thread, unless other threads
+ * are waiting: then it goes to the shared free list so a thread that keeps
+ * checking out and returning can't starve them. */
+static void poolReleaseIdle(redisPool *pool, redisPoolConnection *conn) {
+    redisPoolConnection *expected = NULL;
+
+    if (_ATOMIC_LOAD(&pool->waiters) > 0 ||
+        !_ATOMIC_CAS(&pool->cache[poolThreadSlot()],&expected,conn))
+    {
+        poolPushFree(pool,conn->idx);
+    }
+}
+
+static void poolCloseConnection(redisPool *pool, redisPoolConnection *conn) {
+    if (conn->c != NULL) {
+        redisFree(conn->c);
+        conn->c = NULL;
+        _ATOMIC_DECR(&pool->stats.open,1);
+    }
+}
+
+/* Make sure the connection is usable. Connections that were never opened,
+ * or that were closed by idle eviction, are connected. Connections that were
+ * returned with an error are reconnected and verified with a PING. */
+static int poolPrepareConnection(redisPool *pool, redisPoolConnection *conn,
+                                 redisPoolError *err)
+{
+    redisPoolAddress *addr = _ATOMIC_LOAD(&pool->address);
+    unsigned int generation = addr ? addr->generation : 0;
+    redisReply *reply;
+    int check = conn->unhealthy;
+
+    /* Made before the pool was moved to another address */
+    if (conn->c != NULL && conn->generation != generation) {
+        poolCloseConnection(pool,conn);
+        check = 0;
+    }
+
+    if (conn->c == NULL) {
+        if (pool->connection_type == REDIS_CONN_TCP) {
+            const char *host = addr ? addr->host : pool->host;
+            int port = addr ? addr->port : pool->port;
+            conn->c = pool->timeout ?
+                redisConnectWithTimeout(host,port,*pool->timeout) :
+                redisConnect(host,port);
+        } else {
+            conn->c = pool->timeout ?
+                redisConnectUnixWithTimeout(pool->path,*pool->timeout) :
+                redisConnectUnix(pool->path);
+        }
+        if (conn->c == NULL) {
+            poolSetError(err,REDIS_ERR_OOM,"Out of memory");
+            return REDIS_ERR;
+        }
+        conn->generation = generation;
+        _ATOMIC_INCR(&pool->stats.open,1);
+        _ATOMIC_INCR(&pool->stats.reconnects,1);
+    } else if (conn->c->err || conn->unhealthy) {
+        _ATOMIC_INCR(&pool->stats.reconnects,1);
+        redisReconnect(conn->c);
+    }
+
+    if (conn->c->err == 0 && pool->timeout)
+        redisSetTimeout(conn->c,*pool->timeout);
+
+    if (conn->c->err == 0 && check) {
+        reply = redisCommand(conn->c,"PING");
+        if (reply == NULL || reply->type == REDIS_REPLY_ERROR) {
+            if (reply != NULL)
+                poolSetError(err,REDIS_ERR_OTHER,reply->str);
+            else
+                poolSetError(err,conn->c->err,conn->c->errstr);
+            freeReplyObject(reply);
+            _ATOMIC_INCR(&pool->stats.health_failures,1);
+            return REDIS_ERR;
+        }
+        freeReplyObject(reply);
+    }
+
+    if (conn->c->err) {
+        poolSetError(err,conn->c->err,conn->c->errstr);
+        _ATOMIC_INCR(&pool->stats.health_failures,1);
+        conn->unhealthy = 1;
+        return REDIS_ERR;
+    }
+
+    conn->unhealthy = 0;
+    return REDIS_OK;
+}
+
+static redisPool *poolCreate(int min_size, int max_size,
+                             const struct timeval *timeout) {
+    redisPool *pool;
+
+    if (max_size <= 0 || min_size < 0 || min_size > max_size)
+        return NULL;
+
+    pool = calloc(1,sizeof(*pool));
+    if (pool == NULL)
+        return NULL;
+
+    pool->min_size = min_size;
+    pool->max_size = max_size;
+    pool->stats.max_size = max_size;
+    pool->conns = calloc(max_size,sizeof(*pool->conns));
+    pool->next = calloc(max_size,sizeof(*pool->next));
+    if (timeout) {
+        pool->timeout = malloc(sizeof(struct timeval));
+        if (pool->timeout)
+            memcpy(pool->timeout,timeout,sizeof(struct timeval));
+    }
+
+    if (pool->conns == NULL || pool->next == NULL ||
+        (timeout && pool->timeout == NULL))
+    {
+        redisPoolFree(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+/* Open the first min_size connections. Failures are recorded in the pool's
+ * error fields, but the pool stays usable: the connections are retried when
+ * they are checked out. No other thread has the pool yet. */
+static redisPool *poolFill(redisPool *pool) {
+    redisPoolConnection *conn;
+    redisPoolError err;
+    int i;
+
+    for (i = 0; i < pool->min_size; i++) {
+        conn = &pool->conns[i];
+        conn->pool = pool;
+        conn->idx = i;
+        conn->last_used = poolMonotonicUsec();
+        if (poolPrepareConnection(pool,conn,&err) != REDIS_OK) {
+            pool->err = err.err;
+            memcpy(pool->errstr,err.errstr,sizeof(pool->errstr));
+        }
+    }
+    pool->created = pool->min_size;
+
+    /* Push in reverse so the first connection is handed out first. */
+    for (i = pool->min_size-1; i >= 0; i--)
+        poolPushFree(pool,i);
+    return pool;
+}
+
+redisPool *redisPoolCreate(const char *ip, int port, int min_size, int max_size,
+                           const struct timeval *timeout) {
+    redisPool *pool = poolCreate(min_size,max_size,timeout);
+    if (pool == NULL)
+        return NULL;
+
+    pool->connection_type = REDIS_CONN_TCP;
+    pool->port = port;
+    if ((pool->host = strdup(ip)) == NULL) {
+        redisPoolFree(pool);
+        return NULL;
+    }
+    return poolFill(pool);
+}
+
+redisPool *redisPoolCreateUnix(const char *path, int min_size, int max_size,
+                               const struct timeval *timeout) {
+    redisPool *pool = poolCreate(min_size,max_size,timeout);
+    if (pool == NULL)
+        return NULL;
+
+    pool->connection_type = REDIS_CONN_UNIX;
+    if ((pool->path = strdup(path)) == NULL) {
+        redisPoolFree(pool);
+        return NULL;
+    }
+    return poolFill(pool);
+}
+
+void redisPoolSetIdleTimeout(redisPool *pool, const struct timeval tv) {
+    pool->idle_usec = ((long long)tv.tv_sec)*1000000+tv.tv_usec;
+}
+
+int redisPoolSetAddress(redisPool *pool, const char *ip, int port) {
+    redisPoolAddress *addr, *old;
+
+    if (pool->connection_type != REDIS_CONN_TCP)
+        return REDIS_ERR;
+    if ((addr = calloc(1,sizeof(*addr))) == NULL ||
+        (addr->host = strdup(ip)) == NULL)
+    {
+        free(addr);
+        return REDIS_ERR;
+    }
+    addr->port = port;
+
+    old = _ATOMIC_LOAD(&pool->address);
+    do {
+        addr->prev = old;
+        addr->generation = old ? old->generation+1 : 1;
+    } while (!_ATOMIC_CAS(&pool->address,&old,addr));
+    return REDIS_OK;
+}
+
+/* Free the pool and every connection in it. Connections must not be checked
+ * out when this function is called. */
+void redisPoolFree(redisPool *pool) {
+    redisPoolAddress *addr;
+    int i;
+
+    if (pool == NULL)
+        return;
+    if (pool->conns) {
+        for (i = 0; i < pool->created; i++)
+            redisFree(pool->conns[i].c);
+    }
+    while ((addr = pool->address) != NULL) {
+        pool->address = addr->prev;
+        free(addr->host);
+        free(addr);
+    }
+    free(pool->conns);
+    free(pool->next);
+    free(pool->host);
+    free(pool->path);
+    free(pool->timeout);
+    free(pool);
+}
+
+static void poolRecordWait(redisPool *pool, long long elapsed) {
+    unsigned long long max_wait;
+
+    _ATOMIC_INCR(&pool->stats.wait_usec,(unsigned long long)elapsed);
+    max_wait = _ATOMIC_LOAD(&pool->stats.max_wait_usec);
+    while ((unsigned long long)elapsed > max_wait &&
+           !_ATOMIC_CAS(&pool->stats.max_wait_usec,&max_wait,
+                        (unsigned long long)elapsed));
+}
+
+redisPoolConnection *redisPoolGet(redisPool *pool, const struct timeval *wait,
+                                  redisPoolError *err)
+{
+    redisPoolConnection *conn = NULL;
+    long long start, now, deadline = 0;
+    struct timespec pause;
+    int spins = 0, waiting = 0, n;
+
+    start = poolMonotonicUsec();
+    if (wait != NULL)
+        deadline = start+((long long)wait->tv_sec)*1000000+wait->tv_usec;
+
+    while (1) {
+        if ((conn = poolTakeIdle(pool)) != NULL)
+            break;
+
+        /* Grow the pool when it is not at its maximum size yet. */
+        n = _ATOMIC_LOAD(&pool->created);
+        if (n < pool->max_size) {
+            if (_ATOMIC_CAS(&pool->created,&n,n+1)) {
+                conn = &pool->conns[n];
+                conn->pool = pool;
+                conn->idx = n;
+                break;
+            }
+            continue;
+        }
+
+        now = poolMonotonicUsec();
+        if (wait == NULL || now >= deadline) {
+            if (waiting)
+                _ATOMIC_DECR(&pool->waiters,1);
+            _ATOMIC_INCR(&pool->stats.timeouts,1);
+            poolRecordWait(pool,now-start);
+            poolSetError(err,REDIS_ERR_OTHER,"Timeout waiting for a pooled connection");
+            return NULL;
+        }
+
+        if (!waiting) {
+            waiting = 1;
+            _ATOMIC_INCR(&pool->waiters,1);
+        }
+
+        /* Back off: spin a little, then yield, then sleep up to 1ms. */
+        if (spins < 64) {
+            spins++;
+        } else if (spins < 128) {
+            spins++;
+            sched_yield();
+        } else {
+            pause.tv_sec = 0;
+            pause.tv_nsec = 1000L*(deadline-now < 1000 ? deadline-now : 1000);
+            nanosleep(&pause,NULL);
+        }
+    }
+
+    if (waiting)
+        _ATOMIC_DECR(&pool->waiters,1);
+
+    if (poolPrepareConnection(pool,conn,err) != REDIS_OK) {
+        poolReleaseIdle(pool,conn);
+        return NULL;
+    }
+
+    _ATOMIC_INCR(&pool->stats.checkouts,1);
+    _ATOMIC_INCR(&pool->stats.in_use,1);
+    poolRecordWait(pool,poolMonotonicUsec()-start);
+    return conn;
+}
+
+void redisPoolPut(redisPoolConnection *conn) {
+    redisPool *pool = conn->pool;
+    redisPoolAddress *addr = _ATOMIC_LOAD(&pool->address);
+
+    /* Don't hand out a connection that saw an error: it will be reconnected
+     * and health checked on the next checkout. */
+    if (conn->c == NULL || conn->c->err)
+        conn->unhealthy = 1;
+    /* Nor one to an address the pool has left, such as a demoted master */
+    if (conn->generation != (addr ? addr->generation : 0)) {
+        poolCloseConnection(pool,conn);
+        conn->unhealthy = 0;
+    }
+    conn->last_used = poolMonotonicUsec();
+    _ATOMIC_DECR(&pool->stats.in_use,1);
+    poolReleaseIdle(pool,conn);
+}
+
+int redisPoolEvictIdle(redisPool *pool) {
+    redisPoolConnection **idle, *conn;
+    long long now = poolMonotonicUsec();
+    int i, n = 0, evicted = 0;
+
+    if (pool->idle_usec <= 0)
+        return 0;
+
+    idle = malloc(sizeof(*idle)*pool->max_size);
+    if (idle == NULL)
+        return 0;
+
+    /* Claim every idle connection so no other thread can touch them. */
+    for (i = 0; i < REDIS_POOL_CACHE_SLOTS; i++) {
+        if ((conn = _ATOMIC_XCHG(&pool->cache[i],NULL)) != NULL)
+            idle[n++] = conn;
+    }
+    while (n < pool->max_size && (i = poolPopFree(pool)) >= 0)
+        idle[n++] = &pool->conns[i];
+
+    for (i = 0; i < n; i++) {
+        conn = idle[i];
+        if (conn->c != NULL && now-conn->last_used >= pool->idle_usec &&
+            _ATOMIC_LOAD(&pool->stats.open) > pool->min_size)
+        {
+            poolCloseConnection(pool,conn);
+            evicted++;
+        }
+        poolPushFree(pool,conn->idx);
+    }
+    free(idle);
+
+    _ATOMIC_INCR(&pool->stats.evictions,(unsigned long long)evicted);
+    return evicted;
+}
+
+void redisPoolGetStats(redisPool *pool, redisPoolStats *stats) {
+    stats->checkouts = _ATOMIC_LOAD(&pool->stats.checkouts);
+    stats->timeouts = _ATOMIC_LOAD(&pool->stats.timeouts);
+    stats->wait_usec = _ATOMIC_LOAD(&pool->stats.wait_usec);
+    stats->max_wait_usec = _ATOMIC_LOAD(&pool->stats.max_wait_usec);
+    stats->reconnects = _ATOMIC_LOAD(&pool->stats.reconnects);
+    stats->evictions = _ATOMIC_LOAD(&pool->stats.evictions);
+    stats->health_failures = _ATOMIC_LOAD(&pool->stats.health_failures);
+    stats->open = _ATOMIC_LOAD(&pool->stats.open);
+    stats->in_use = _ATOMIC_LOAD(&pool->stats.in_use);
+    stats->max_size = pool->max_size;
+}
@@ -0,0 +1,154 @@
+/*
+ * Copyright (c) 2009-2011, Salvatore Sanfilippo <antirez at gmail dot com>
+ * Copyright (c) 2010-2011, Pieter Noordhuis <pcnoordhuis at gmail dot com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __HIREDIS_POOL_H
+#define __HIREDIS_POOL_H
+#include "hiredis.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Number of idle connection slots that threads hash into before falling back
+ * to the shared free list. */
+#define REDIS_POOL_CACHE_SLOTS 16
+
+struct redisPool; /* need forward declaration of redisPool */
+
+/* A pooled connection. The context is owned by the pool: use it between
+ * redisPoolGet() and redisPoolPut(), but never free it. */
+typedef struct redisPoolConnection {
+    redisContext *c;
+
+    /* Private to the pool */
+    struct redisPool *pool;
+    int idx; /* index in the pool's connection array */
+    int unhealthy; /* set when the connection was returned with an error */
+    long long last_used; /* monotonic usec of the last redisPoolPut() */
+    unsigned int generation; /* of the address it is connected to */
+} redisPoolConnection;
+
+/* An address the pool was moved to. Earlier ones are kept until the pool is
+ * free'd, as other threads may still be connecting to them. */
+typedef struct redisPoolAddress {
+    char *host;
+    int port;
+    unsigned int generation;
+    struct redisPoolAddress *prev;
+} redisPoolAddress;
+
+/* Why a call failed. Filled in for the calling thread only. */
+typedef struct redisPoolError {
+    int err; /* Error flags, 0 when there is no error */
+    char errstr[128]; /* String representation of error when applicable */
+} redisPoolError;
+
+typedef struct redisPoolStats {
+    unsigned long long checkouts; /* Successful redisPoolGet() calls */
+    unsigned long long timeouts; /* redisPoolGet() calls that gave up waiting */
+    unsigned long long wait_usec; /* Total time spent inside redisPoolGet() */
+    unsigned long long max_wait_usec; /* Longest single redisPoolGet() */
+    unsigned long long reconnects; /* Lazy (re)connects performed on checkout */
+    unsigned long long evictions; /* Connections closed for being idle */
+    unsigned long long health_failures; /* Failed (re)connects and health checks */
+    int open; /* Connections currently connected */
+    int in_use; /* Connections currently checked out */
+    int max_size;
+} redisPoolStats;
+
+/* Pool of blocking contexts to a single Redis instance. Checkout and return
+ * never take a lock: idle connections are kept in a small array of slots
+ * that threads hash into and in a shared lock-free free list. */
+typedef struct redisPool {
+    /* Errors of the connections opened on create. Later errors are returned
+     * by redisPoolGet(), as other threads use the pool meanwhile. */
+    int err; /* Error flags, 0 when there is no error */
+    char errstr[128]; /* String representation of error when applicable */
+
+    enum redisConnectionType connection_type;
+    char *host;
+    int port;
+    char *path;
+    redisPoolAddress *address; /* Replaces host and port when set */
+    struct timeval *timeout;
+    long long idle_usec; /* Close idle connections after this long, 0 = never */
+
+    int min_size, max_size;
+    redisPoolConnection *conns; /* max_size entries, created lazily */
+    int *next; /* free list links, indexed like conns */
+    unsigned long long freelist; /* (tag << 32) | (idx + 1), 0 when empty */
+    redisPoolConnection *cache[REDIS_POOL_CACHE_SLOTS];
+    int created; /* Number of entries in conns that were initialized */
+    int waiters; /* Threads waiting in redisPoolGet() */
+
+    redisPoolStats stats;
+} redisPool;
+
+redisPool *redisPoolCreate(const char *ip, int port, int min_size, int max_size,
+                           const struct timeval *timeout);
+redisPool *redisPoolCreateUnix(const char *path, int min_size, int max_size,
+                               const struct timeval *timeout);
+void redisPoolSetIdleTimeout(redisPool *pool, const struct timeval tv);
+
+/* Connect to another address from now on, such as the new master after a
+ * failover. Idle connections to the old address are closed when they are
+ * checked out next, connections in use when they are returned. Until then a
+ * checked out connection keeps talking to the old address, so hold them for
+ * short stretches. TCP pools only: returns REDIS_ERR for other pools and when
+ * out of memory. */
+int redisPoolSetAddress(redisPool *pool, const char *ip, int port);
+void redisPoolFree(redisPool *pool);
+
+/* Check out a connection. When all max_size connections are in use, wait up
+ * to "wait" for one to be returned (NULL means don't wait). Returns NULL on
+ * timeout or when the connection could not be (re)established, in which case
+ * "err" describes the failure when it is not NULL. */
+redisPoolConnection *redisPoolGet(redisPool *pool, const struct timeval *wait,
+                                  redisPoolError *err);
+
+/* Return a connection to the pool. A connection that is returned with its
+ * context in an error state is reconnected and health checked before it is
+ * handed out again. One to an address the pool was moved away from is
+ * closed. */
+void redisPoolPut(redisPoolConnection *conn);
+
+/* Close idle connections that have not been used for the idle timeout, while
+ * keeping at least min_size connections open. Returns the number of closed
+ * connections. Safe to call concurrently with redisPoolGet/Put. */
+int redisPoolEvictIdle(redisPool *pool);
+
+void redisPoolGetStats(redisPool *pool, redisPoolStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -474,6 +474,44 @@ int redisReaderFeed(redisReader *r, const char *buf, size_t len) {
     return REDIS_OK;
 }
 
+/* Make room for "len" more bytes at the end of the buffer and return a
+ * pointer to it, so the caller can read from the socket straight into the
+ * reader instead of having the data copied by redisReaderFeed(). The bytes
+ * that were actually written are accounted with redisReaderCommit(). */
+char *redisReaderReserve(redisReader *r, size_t len) {
+    sds newbuf;
+
+    /* Return early when this reader is in an erroneous state. */
+    if (r->err)
+        return NULL;
+
+    /* Destroy internal buffer when it is empty and much larger than needed. */
+    if (r->len == 0 && r->maxbuf != 0 && sdsavail(r->buf) > r->maxbuf &&
+        sdsavail(r->buf)/2 >= len)
+    {
+        sdsfree(r->buf);
+        r->buf = sdsempty();
+        r->pos = 0;
+
+        /* r->buf should not be NULL since we just free'd a larger one. */
+        assert(r->buf != NULL);
+    }
+
+    newbuf = sdsMakeRoomFor(r->buf,len);
+    if (newbuf == NULL) {
+        __redisReaderSetErrorOOM(r);
+        return NULL;
+    }
+
+    r->buf = newbuf;
+    return r->buf+r->len;
+}
+
+void redisReaderCommit(redisReader *r, size_t len) {
+    sdsIncrLen(r->buf,(int)len);
+    r->len = sdslen(r->buf);
+}
+
 int redisReaderGetReply(redisReader *r, void **reply) {
     /* Default target pointer to NULL. */
     if (reply != NULL)
@@ -46,6 +46,7 @@
 #define REDIS_ERR_PROTOCOL 4 /* Protocol error */
 #define REDIS_ERR_OOM 5 /* Out of memory */
 #define REDIS_ERR_OTHER 2 /* Everything else... */
+#define REDIS_ERR_TIMEOUT 6 /* Connect or command deadline expired */
 
 #define REDIS_REPLY_STRING 1
 #define REDIS_REPLY_ARRAY 2
@@ -98,6 +99,8 @@ typedef struct redisReader {
 redisReader *redisReaderCreateWithFunctions(redisReplyObjectFunctions *fn);
 void redisReaderFree(redisReader *r);
 int redisReaderFeed(redisReader *r, const char *buf, size_t len);
+char *redisReaderReserve(redisReader *r, size_t len);
+void redisReaderCommit(redisReader *r, size_t len);
 int redisReaderGetReply(redisReader *r, void **reply);
 
 #define redisReaderSetPrivdata(_r, _p) (int)(((redisReader*)(_r))->privdata = (_p))
@@ -0,0 +1,643 @@
+/*
+ * Copyright (c) 2009-2011, Salvatore Sanfilippo <antirez at gmail dot com>
+ * Copyright (c) 2010-2011, Pieter Noordhuis <pcnoordhuis at gmail dot com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "fmacros.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "ring.h"
+
+static void ringSetError(redisRingContext *rc, int type, const char *str) {
+    size_t len = strlen(str);
+    len = len < (sizeof(rc->errstr)-1) ? len : (sizeof(rc->errstr)-1);
+    memcpy(rc->errstr,str,len);
+    rc->errstr[len] = '\0';
+    rc->err = type;
+}
+
+static long long ringMonotonicMsec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (long long)ts.tv_sec*1000+ts.tv_nsec/1000000;
+}
+
+/* MD5 (RFC 1321), which ketama uses to place the servers on the ring. */
+static const uint32_t md5K[64] = {
+    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a,
+    0xa8304613, 0xfd469501, 0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+    0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821, 0xf61e2562, 0xc040b340,
+    0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+    0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8,
+    0x676f02d9, 0x8d2a4c8a, 0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+    0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70, 0x289b7ec6, 0xeaa127fa,
+    0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+    0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92,
+    0xffeff47d, 0x85845dd1, 0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+    0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+};
+
+static const unsigned char md5R[64] = {
+    7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+    5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20,
+    4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+    6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21
+};
+
+static void md5Block(uint32_t h[4], const unsigned char *p) {
+    uint32_t m[16], a = h[0], b = h[1], c = h[2], d = h[3], f, t;
+    int i, g;
+
+    for (i = 0; i < 16; i++)
+        m[i] = (uint32_t)p[i*4] | (uint32_t)p[i*4+1] << 8 |
+               (uint32_t)p[i*4+2] << 16 | (uint32_t)p[i*4+3] << 24;
+    for (i = 0; i < 64; i++) {
+        if (i < 16) {
+            f = (b & c) | (~b & d);
+            g = i;
+        } else if (i < 32) {
+            f = (d & b) | (~d & c);
+            g = (5*i+1) & 15;
+        } else if (i < 48) {
+            f = b ^ c ^ d;
+            g = (3*i+5) & 15;
+        } else {
+            f = c ^ (b | ~d);
+            g = (7*i) & 15;
+        }
+        t = d;
+        d = c;
+        c = b;
+        f += a+md5K[i]+m[g];
+        b += (f << md5R[i]) | (f >> (32-md5R[i]));
+        a = t;
+    }
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+}
+
+static void md5(const char *data, size_t len, unsigned char digest[16]) {
+    uint32_t h[4] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476};
+    unsigned char tail[128];
+    uint64_t bits = (uint64_t)len*8;
+    size_t j, rest, tlen;
+
+    for (j = 0; j+64 <= len; j += 64)
+        md5Block(h,(const unsigned char*)data+j);
+    rest = len-j;
+    memcpy(tail,data+j,rest);
+    tail[rest] = 0x80;
+    tlen = (rest < 56) ? 64 : 128;
+    memset(tail+rest+1,0,tlen-rest-1);
+    for (j = 0; j < 8; j++)
+        tail[tlen-8+j] = (unsigned char)(bits >> (8*j));
+    md5Block(h,tail);
+    if (tlen == 128)
+        md5Block(h,tail+64);
+    for (j = 0; j < 16; j++)
+        digest[j] = (unsigned char)(h[j/4] >> (8*(j%4)));
+}
+
+static int ringComparePoints(const void *a, const void *b) {
+    const redisRingPoint *x = a, *y = b;
+    if (x->hash != y->hash)
+        return (x->hash > y->hash) - (x->hash < y->hash);
+    return x->server-y->server;
+}
+
+/* Place the servers that are not ejected on the ring: "name-N" is hashed for
+ * every fourth point, and each of its MD5 words is a point. The number of
+ * points follows the weight and is computed like libketama and twemproxy do,
+ * so the same servers end up with the same ring. */
+static int ringBuild(redisRingContext *rc) {
+    redisRingPoint *points = NULL;
+    redisRingServer *s;
+    unsigned char digest[16];
+    char name[256];
+    unsigned long total = 0;
+    size_t npoints = 0, cap = 0;
+    int i, live = 0, n, namelen;
+    unsigned int k, perServer, x;
+    float pct;
+
+    for (i = 0; i < rc->nservers; i++) {
+        if (rc->servers[i].ejected) continue;
+        total += rc->servers[i].weight;
+        live++;
+    }
+    for (i = 0; i < rc->nservers; i++) {
+        s = &rc->servers[i];
+        if (s->ejected) continue;
+        pct = (float)s->weight/(float)total;
+        perServer = (unsigned int)(pct*REDIS_RING_POINTS_PER_SERVER/4*(float)live+
+                                   0.0000000001)*4;
+        if (npoints+perServer > cap) {
+            redisRingPoint *grown;
+            cap = (npoints+perServer)*2;
+            if ((grown = realloc(points,cap*sizeof(*points))) == NULL) {
+                free(points);
+                ringSetError(rc,REDIS_ERR_OOM,"Out of memory");
+                return REDIS_ERR;
+            }
+            points = grown;
+        }
+        for (k = 0; k < perServer/4; k++) {
+            n = snprintf(name,sizeof(name),"%s-%u",s->name,k);
+            namelen = n < (int)sizeof(name) ? n : (int)sizeof(name)-1;
+            md5(name,(size_t)namelen,digest);
+            for (x = 0; x < 4; x++) {
+                points[npoints].hash = (uint32_t)digest[x*4+3] << 24 |
+                                       (uint32_t)digest[x*4+2] << 16 |
+                                       (uint32_t)digest[x*4+1] << 8 |
+                                       (uint32_t)digest[x*4];
+                points[npoints++].server = i;
+            }
+        }
+    }
+    qsort(points,npoints,sizeof(*points),ringComparePoints);
+
+    free(rc->points);
+    rc->points = points;
+    rc->npoints = npoints;
+    return REDIS_OK;
+}
+
+/* Servers whose retry timeout passed are back in the ring. */
+static void ringRetryEjected(redisRingContext *rc) {
+    long long now;
+    int i;
+
+    if (rc->retryAt == 0 || (now = ringMonotonicMsec()) < rc->retryAt)
+        return;
+    rc->retryAt = 0;
+    for (i = 0; i < rc->nservers; i++) {
+        if (!rc->servers[i].ejected)
+            continue;
+        if (rc->servers[i].retryAt <= now)
+            rc->servers[i].ejected = 0;
+        else if (rc->retryAt == 0 || rc->servers[i].retryAt < rc->retryAt)
+            rc->retryAt = rc->servers[i].retryAt;
+    }
+    ringBuild(rc);
+}
+
+/* Every reply that "s" still owes fails, and the server leaves the ring once
+ * it failed too often. */
+static void ringFail(redisRingContext *rc, redisRingServer *s, int err, const char *errstr) {
+    size_t len = strlen(errstr);
+
+    len = len < (sizeof(s->errstr)-1) ? len : (sizeof(s->errstr)-1);
+    memcpy(s->errstr,errstr,len);
+    s->errstr[len] = '\0';
+    s->err = err;
+
+    for (; s->head < s->len; s->head++)
+        rc->cmds[s->waiting[s->head]].failed = 1;
+    s->head = s->len = 0;
+    if (s->c != NULL) {
+        redisFree(s->c);
+        s->c = NULL;
+    }
+
+    if (rc->failureLimit > 0 && ++s->failures >= rc->failureLimit) {
+        s->ejected = 1;
+        s->failures = 0;
+        s->retryAt = ringMonotonicMsec()+rc->retryTimeout;
+        if (rc->retryAt == 0 || s->retryAt < rc->retryAt)
+            rc->retryAt = s->retryAt;
+        ringBuild(rc);
+    }
+}
+
+static int ringConnect(redisRingContext *rc, redisRingServer *s) {
+    if (s->c != NULL && s->c->err == 0)
+        return REDIS_OK;
+    if (s->c != NULL)
+        redisFree(s->c);
+
+    if (rc->timeout)
+        s->c = redisConnectWithTimeout(s->host,s->port,*rc->timeout);
+    else
+        s->c = redisConnect(s->host,s->port);
+    if (s->c == NULL) {
+        ringSetError(rc,REDIS_ERR_OOM,"Out of memory");
+        return REDIS_ERR;
+    }
+    if (s->c->err) {
+        ringFail(rc,s,s->c->err,s->c->errstr);
+        return REDIS_ERR;
+    }
+    return REDIS_OK;
+}
+
+redisRingContext *redisRingCreate(const struct timeval *timeout) {
+    redisRingContext *rc;
+
+    if ((rc = calloc(1,sizeof(*rc))) == NULL)
+        return NULL;
+    if (timeout) {
+        if ((rc->timeout = malloc(sizeof(*rc->timeout))) == NULL) {
+            free(rc);
+            return NULL;
+        }
+        memcpy(rc->timeout,timeout,sizeof(*timeout));
+    }
+    rc->failureLimit = REDIS_RING_DEFAULT_FAILURE_LIMIT;
+    rc->retryTimeout = REDIS_RING_DEFAULT_RETRY_TIMEOUT;
+    rc->hash = redisRingHashMd5;
+    return rc;
+}
+
+/* Forget the commands of the pipeline. Connections that still owe replies
+ * are closed, as there is no telling where their replies start. */
+static void ringResetPipeline(redisRingContext *rc) {
+    redisRingServer *s;
+    size_t j;
+    int i;
+
+    for (i = 0; i < rc->nservers; i++) {
+        s = &rc->servers[i];
+        if (s->len > s->head && s->c != NULL) {
+            redisFree(s->c);
+            s->c = NULL;
+        }
+        s->head = s->len = 0;
+    }
+    for (j = 0; j < rc->ncmds; j++) {
+        free(rc->cmds[j].cmd);
+        if (rc->cmds[j].reply) freeReplyObject(rc->cmds[j].reply);
+    }
+    rc->ncmds = rc->sent = rc->next = 0;
+}
+
+void redisRingFree(redisRingContext *rc) {
+    int i;
+
+    if (rc == NULL)
+        return;
+    ringResetPipeline(rc);
+    for (i = 0; i < rc->nservers; i++) {
+        if (rc->servers[i].c) redisFree(rc->servers[i].c);
+        free(rc->servers[i].waiting);
+        free(rc->servers[i].host);
+        free(rc->servers[i].name);
+    }
+    free(rc->servers);
+    free(rc->points);
+    free(rc->cmds);
+    free(rc->timeout);
+    free(rc);
+}
+
+int redisRingAddServer(redisRingContext *rc, const char *host, int port,
+                       unsigned int weight, const char *name)
+{
+    redisRingServer *servers, *s;
+    char buf[256];
+
+    if (weight < 1) {
+        ringSetError(rc,REDIS_ERR_OTHER,"Server weight must be at least 1");
+        return REDIS_ERR;
+    }
+    if (name == NULL) {
+        snprintf(buf,sizeof(buf),"%s:%d",host,port);
+        name = buf;
+    }
+    if ((servers = realloc(rc->servers,(rc->nservers+1)*sizeof(*servers))) == NULL) {
+        ringSetError(rc,REDIS_ERR_OOM,"Out of memory");
+        return REDIS_ERR;
+    }
+    rc->servers = servers;
+    s = &rc->servers[rc->nservers];
+    memset(s,0,sizeof(*s));
+    s->port = port;
+    s->weight = weight;
+    if ((s->host = strdup(host)) == NULL || (s->name = strdup(name)) == NULL) {
+        free(s->host);
+        ringSetError(rc,REDIS_ERR_OOM,"Out of memory");
+        return REDIS_ERR;
+    }
+    rc->nservers++;
+    return ringBuild(rc);
+}
+
+void redisRingSetEjection(redisRingContext *rc, int limit, long long retryTimeout) {
+    rc->failureLimit = limit;
+    rc->retryTimeout = retryTimeout;
+}
+
+/* The first word of the MD5, like libketama hashes keys. */
+uint32_t redisRingHashMd5(const char *key, size_t len) {
+    unsigned char digest[16];
+
+    md5(key,len,digest);
+    return (uint32_t)digest[3] << 24 | (uint32_t)digest[2] << 16 |
+           (uint32_t)digest[1] << 8 | (uint32_t)digest[0];
+}
+
+/* FNV-1a 64 cut to 32 bits, like twemproxy's fnv1a_64. */
+uint32_t redisRingHashFnv1a64(const char *key, size_t len) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    size_t j;
+
+    for (j = 0; j < len; j++) {
+        h ^= (unsigned char)key[j];
+        h *= 0x100000001b3ULL;
+    }
+    return (uint32_t)h;
+}
+
+void redisRingSetHash(redisRingContext *rc, redisRingHashFn *fn) {
+    rc->hash = fn;
+}
+
+void redisRingSetHashTags(redisRingContext *rc, int on) {
+    rc->hashTags = on;
+}
+
+int redisRingKeyServer(redisRingContext *rc, const char *key, size_t len) {
+    const char *open, *close;
+    uint32_t hash;
+    size_t lo, hi, mid;
+
+    ringRetryEjected(rc);
+    if (rc->npoints == 0)
+        return -1;
+
+    if (rc->hashTags && (open = memchr(key,'{',len)) != NULL &&
+        (close = memchr(open+1,'}',len-(open+1-key))) != NULL &&
+        close > open+1)
+    {
+        key = open+1;
+        len = close-key;
+    }
+    hash = rc->hash(key,len);
+
+    /* First point at or after the hash, wrapping around */
+    lo = 0;
+    hi = rc->npoints;
+    while (lo < hi) {
+        mid = lo+(hi-lo)/2;
+        if (rc->points[mid].hash < hash)
+            lo = mid+1;
+        else
+            hi = mid;
+    }
+    return rc->points[lo == rc->npoints ? 0 : lo].server;
+}
+
+/* Server of a formatted command, by its first argument after the command
+ * name. Commands without one hash an empty key. */
+static int ringCommandServer(redisRingContext *rc, const char *cmd, size_t len) {
+    const char *p, *end = cmd+len;
+    long alen;
+
+    if ((p = memchr(cmd,'$',len)) == NULL)
+        return redisRingKeyServer(rc,"",0);
+    alen = strtol(p+1,NULL,10);
+    if ((p = memchr(p,'\n',end-p)) == NULL || end-(p+1) < alen+2)
+        return redisRingKeyServer(rc,"",0);
+    p += 1+alen+2;
+    if (p >= end || *p != '$')
+        return redisRingKeyServer(rc,"",0);
+    alen = strtol(p+1,NULL,10);
+    if (alen < 0 || (p = memchr(p,'\n',end-p)) == NULL || end-(p+1) < alen)
+        return redisRingKeyServer(rc,"",0);
+    return redisRingKeyServer(rc,p+1,(size_t)alen);
+}
+
+/* Takes ownership of "cmd". */
+static int ringAppend(redisRingContext *rc, char *cmd, size_t len) {
+    redisRingRequest *cmds;
+    size_t cap;
+    int server;
+
+    /* A new pipeline starts once all replies of the last one were read. */
+    if (rc->next == rc->ncmds) {
+        ringResetPipeline(rc);
+        rc->err = 0;
+        rc->errstr[0] = '\0';
+    }
+    if ((server = ringCommandServer(rc,cmd,len)) < 0) {
+        free(cmd);
+        ringSetError(rc,REDIS_ERR_OTHER,"No server in the ring");
+        return REDIS_ERR;
+    }
+    if (rc->ncmds == rc->cap) {
+        cap = rc->cap ? rc->cap*2 : 16;
+        if ((cmds = realloc(rc->cmds,cap*sizeof(*cmds))) == NULL) {
+            free(cmd);
+            ringSetError(rc,REDIS_ERR_OOM,"Out of memory");
+            return REDIS_ERR;
+        }
+        rc->cmds = cmds;
+        rc->cap = cap;
+    }
+    cmds = &rc->cmds[rc->ncmds++];
+    cmds->cmd = cmd;
+    cmds->len = len;
+    cmds->server = server;
+    cmds->failed = 0;
+    cmds->reply = NULL;
+    return REDIS_OK;
+}
+
+int redisvRingAppendCommand(redisRingContext *rc, const char *format, va_list ap) {
+    char *cmd;
+    int len;
+
+    if ((len = redisvFormatCommand(&cmd,format,ap)) == -1) {
+        ringSetError(rc,REDIS_ERR_OOM,"Out of memory");
+        return REDIS_ERR;
+    } else if (len == -2) {
+        ringSetError(rc,REDIS_ERR_OTHER,"Invalid format string");
+        return REDIS_ERR;
+    }
+    return ringAppend(rc,cmd,len);
+}
+
+int redisRingAppendCommand(redisRingContext *rc, const char *format, ...) {
+    va_list ap;
+    int ret;
+
+    va_start(ap,format);
+    ret = redisvRingAppendCommand(rc,format,ap);
+    va_end(ap);
+    return ret;
+}
+
+int redisRingAppendCommandArgv(redisRingContext *rc, int argc, const char **argv,
+                               const size_t *argvlen)
+{
+    char *cmd;
+    long long len;
+
+    if ((len = redisFormatCommandArgv(&cmd,argc,argv,argvlen)) == -1) {
+        ringSetError(rc,REDIS_ERR_OOM,"Out of memory");
+        return REDIS_ERR;
+    }
+    return ringAppend(rc,cmd,(size_t)len);
+}
+
+static int ringWait(redisRingServer *s, size_t idx) {
+    size_t *waiting, cap;
+
+    if (s->len == s->cap) {
+        if (s->head > 0) {
+            memmove(s->waiting,s->waiting+s->head,(s->len-s->head)*sizeof(*waiting));
+            s->len -= s->head;
+            s->head = 0;
+        } else {
+            cap = s->cap ? s->cap*2 : 16;
+            if ((waiting = realloc(s->waiting,cap*sizeof(*waiting))) == NULL)
+                return REDIS_ERR;
+            s->waiting = waiting;
+            s->cap = cap;
+        }
+    }
+    s->waiting[s->len++] = idx;
+    return REDIS_OK;
+}
+
+/* Hand the commands that were appended since the last call to their servers,
+ * then write every server's share before any reply is read. Commands of
+ * servers that can't be reached fail right away: a server is connected to at
+ * most once per call, so a dead one costs a single connect timeout and counts
+ * as a single failure, however many of the commands are its own. */
+static int ringFlush(redisRingContext *rc) {
+    redisRingRequest *cmd;
+    redisRingServer *s;
+    int i, done;
+
+    for (i = 0; i < rc->nservers; i++)
+        rc->servers[i].down = 0;
+    for (; rc->sent < rc->ncmds; rc->sent++) {
+        cmd = &rc->cmds[rc->sent];
+        s = &rc->servers[cmd->server];
+        if (s->ejected || s->down || ringConnect(rc,s) != REDIS_OK) {
+            if (rc->err == REDIS_ERR_OOM)
+                return REDIS_ERR;
+            s->down = 1;
+            cmd->failed = 1;
+            continue;
+        }
+        if (redisAppendFormattedCommand(s->c,cmd->cmd,cmd->len) != REDIS_OK ||
+            ringWait(s,rc->sent) != REDIS_OK)
+        {
+            ringSetError(rc,REDIS_ERR_OOM,"Out of memory");
+            return REDIS_ERR;
+        }
+    }
+
+    for (i = 0; i < rc->nservers; i++) {
+        s = &rc->servers[i];
+        if (s->c == NULL || sdslen(s->c->obuf) == 0)
+            continue;
+        do {
+            if (redisBufferWrite(s->c,&done) != REDIS_OK) {
+                ringFail(rc,s,s->c->err,s->c->errstr);
+                break;
+            }
+        } while (!done);
+    }
+    return REDIS_OK;
+}
+
+int redisRingGetReply(redisRingContext *rc, void **reply) {
+    redisRingRequest *cmd;
+    redisRingServer *s;
+    void *r;
+
+    if (rc->next == rc->ncmds) {
+        ringSetError(rc,REDIS_ERR_OTHER,"No pending replies");
+        return REDIS_ERR;
+    }
+    if (rc->sent < rc->ncmds && ringFlush(rc) != REDIS_OK) {
+        ringResetPipeline(rc);
+        return REDIS_ERR;
+    }
+
+    cmd = &rc->cmds[rc->next];
+    s = &rc->servers[cmd->server];
+    while (cmd->reply == NULL && !cmd->failed) {
+        if (redisGetReply(s->c,&r) != REDIS_OK) {
+            ringFail(rc,s,s->c->err,s->c->errstr);
+            break;
+        }
+        rc->cmds[s->waiting[s->head++]].reply = r;
+        s->failures = 0;
+    }
+    rc->next++;
+
+    if (cmd->failed) {
+        ringSetError(rc,s->err,s->errstr);
+        return REDIS_ERR;
+    }
+    if (reply != NULL)
+        *reply = cmd->reply;
+    else
+        freeReplyObject(cmd->reply);
+    cmd->reply = NULL;
+    return REDIS_OK;
+}
+
+void *redisvRingCommand(redisRingContext *rc, const char *format, va_list ap) {
+    void *reply;
+
+    if (redisvRingAppendCommand(rc,format,ap) != REDIS_OK ||
+        redisRingGetReply(rc,&reply) != REDIS_OK)
+        return NULL;
+    return reply;
+}
+
+void *redisRingCommand(redisRingContext *rc, const char *format, ...) {
+    va_list ap;
+    void *reply;
+
+    va_start(ap,format);
+    reply = redisvRingCommand(rc,format,ap);
+    va_end(ap);
+    return reply;
+}
+
+void *redisRingCommandArgv(redisRingContext *rc, int argc, const char **argv,
+                           const size_t *argvlen)
+{
+    void *reply;
+
+    if (redisRingAppendCommandArgv(rc,argc,argv,argvlen) != REDIS_OK ||
+        redisRingGetReply(rc,&reply) != REDIS_OK)
+        return NULL;
+    return reply;
+}
@@ -0,0 +1,161 @@
+/*
+ * Copyright (c) 2009-2011, Salvatore Sanfilippo <antirez at gmail dot com>
+ * Copyright (c) 2010-2011, Pieter Noordhuis <pcnoordhuis at gmail dot com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __HIREDIS_RING_H
+#define __HIREDIS_RING_H
+#include "hiredis.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Points on the ring per server of average weight */
+#define REDIS_RING_POINTS_PER_SERVER 160
+
+/* A server is ejected from the ring after this many failures in a row, and
+ * tried again after the retry timeout (msec). */
+#define REDIS_RING_DEFAULT_FAILURE_LIMIT 2
+#define REDIS_RING_DEFAULT_RETRY_TIMEOUT 30000
+
+/* Hash of a key, to find its place on the ring */
+typedef uint32_t (redisRingHashFn)(const char *key, size_t len);
+
+typedef struct redisRingServer {
+    char *host;
+    int port;
+    char *name; /* Hashed to place the server on the ring */
+    unsigned int weight;
+    redisContext *c;
+
+    int failures; /* In a row */
+    int ejected;
+    long long retryAt; /* Monotonic msec, when ejected */
+    int err; /* Last failure */
+    char errstr[128];
+
+    /* Private to the ring context: commands waiting for a reply */
+    size_t *waiting;
+    size_t head, len, cap;
+    int down; /* Could not be reached while sending the last commands */
+} redisRingServer;
+
+typedef struct redisRingPoint {
+    uint32_t hash;
+    int server;
+} redisRingPoint;
+
+/* A command of the pipeline */
+typedef struct redisRingRequest {
+    char *cmd;
+    size_t len;
+    int server;
+    int failed; /* Its server failed before the reply arrived */
+    redisReply *reply; /* Read ahead of the commands before it */
+} redisRingRequest;
+
+/* Blocking client of independent servers that are sharded by consistent
+ * hashing of the keys, like ketama does: every server owns points on a ring
+ * in proportion to its weight, and a key belongs to the first point at or
+ * after its hash. A server that fails too often leaves the ring, so only its
+ * keys move elsewhere, and comes back after the retry timeout. */
+typedef struct redisRingContext {
+    int err; /* Error flags, 0 when there is no error */
+    char errstr[128]; /* String representation of error when applicable */
+
+    struct timeval *timeout;
+    redisRingServer *servers;
+    int nservers;
+    redisRingPoint *points; /* Sorted, for the servers in the ring */
+    size_t npoints;
+    int failureLimit; /* 0 to never eject */
+    long long retryTimeout;
+    long long retryAt; /* Earliest retry of an ejected server, 0 if none */
+    redisRingHashFn *hash;
+    int hashTags; /* Hash only the {tag} of keys that have one */
+
+    /* Pipeline */
+    redisRingRequest *cmds;
+    size_t ncmds, cap;
+    size_t sent; /* Commands that were handed to their server */
+    size_t next; /* Next reply to return */
+} redisRingContext;
+
+/* "timeout" may be NULL. Returns NULL when out of memory. */
+redisRingContext *redisRingCreate(const struct timeval *timeout);
+void redisRingFree(redisRingContext *rc);
+
+/* Add a server with a weight of at least 1. The ring hashes "name", which
+ * defaults to "host:port" when NULL; give servers the names they have in the
+ * configuration of other ketama clients to share their key distribution. */
+int redisRingAddServer(redisRingContext *rc, const char *host, int port,
+                       unsigned int weight, const char *name);
+
+/* Eject servers after "limit" failures in a row, 0 to keep them in the ring,
+ * and try them again after "retryTimeout" msec. */
+void redisRingSetEjection(redisRingContext *rc, int limit, long long retryTimeout);
+
+/* Keys are hashed with MD5 by default, like libketama does. FNV-1a is much
+ * faster and matches twemproxy's fnv1a_64, but spreads keys that only differ
+ * in their last bytes poorly. */
+uint32_t redisRingHashMd5(const char *key, size_t len);
+uint32_t redisRingHashFnv1a64(const char *key, size_t len);
+void redisRingSetHash(redisRingContext *rc, redisRingHashFn *fn);
+
+/* Hash only the part of a key between the first '{' and the next '}' when it
+ * is not empty, like Redis Cluster does. Off by default, as other ketama
+ * clients hash whole keys and would disagree on where tagged keys live. */
+void redisRingSetHashTags(redisRingContext *rc, int on);
+
+/* Index in "servers" of the server of a key, -1 when the ring is empty.
+ * Useful to pick among asynchronous connections to the same servers. */
+int redisRingKeyServer(redisRingContext *rc, const char *key, size_t len);
+
+/* Pipelining works like it does for a single context. Commands go to the
+ * server of their first argument after the command name. When a server fails,
+ * every reply it still owed is REDIS_ERR with err set, and the pipeline goes
+ * on with the next command. A server that can't be reached is only tried once
+ * per batch of commands: the rest of its share fails without a new attempt. */
+int redisvRingAppendCommand(redisRingContext *rc, const char *format, va_list ap);
+int redisRingAppendCommand(redisRingContext *rc, const char *format, ...);
+int redisRingAppendCommandArgv(redisRingContext *rc, int argc, const char **argv,
+                               const size_t *argvlen);
+int redisRingGetReply(redisRingContext *rc, void **reply);
+
+void *redisvRingCommand(redisRingContext *rc, const char *format, va_list ap);
+void *redisRingCommand(redisRingContext *rc, const char *format, ...);
+void *redisRingCommandArgv(redisRingContext *rc, int argc, const char **argv,
+                           const size_t *argvlen);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,551 @@
+/*
+ * Copyright (c) 2009-2011, Salvatore Sanfilippo <antirez at gmail dot com>
+ * Copyright (c) 2010-2011, Pieter Noordhuis <pcnoordhuis at gmail dot com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "fmacros.h"
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <time.h>
+#include "router.h"
+
+/* Weight of the latest reply time in the moving average */
+#define ROUTER_EWMA_ALPHA 0.2
+
+/* Commands that change the state of a connection, see routerStateIndex() */
+#define ROUTER_STATE_COMMANDS 4
+
+/* A read in flight, to time it on the node that serves it. */
+typedef struct routerRead {
+    redisRouterNode *node;
+    long long start;
+    redisCallbackFn *fn;
+    void *privdata;
+} routerRead;
+
+static void routerSetError(redisRouter *rt, int type, const char *str) {
+    size_t len = strlen(str);
+    len = len < (sizeof(rt->errstr)-1) ? len : (sizeof(rt->errstr)-1);
+    memcpy(rt->errstr,str,len);
+    rt->errstr[len] = '\0';
+    rt->err = type;
+}
+
+static long long routerMonotonicUsec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (long long)ts.tv_sec*1000000+ts.tv_nsec/1000;
+}
+
+static void routerRelease(redisRouter *rt) {
+    int i;
+
+    for (i = 0; i < rt->n; i++) {
+        free(rt->nodes[i]->host);
+        free(rt->nodes[i]);
+    }
+    for (i = 0; i < ROUTER_STATE_COMMANDS; i++)
+        sdsfree(rt->state[i]);
+    free(rt->nodes);
+    free(rt);
+}
+
+static void routerDisconnected(const redisAsyncContext *ac, int status) {
+    redisRouter *rt = ac->data;
+    int i, left = 0;
+
+    for (i = 0; i < rt->n; i++) {
+        if (rt->nodes[i]->ac == ac) {
+            rt->nodes[i]->ac = NULL;
+            if (rt->onDisconnect) rt->onDisconnect(rt,rt->nodes[i],status);
+        }
+        if (rt->nodes[i]->ac != NULL) left++;
+    }
+    if (left == 0 && rt->disconnecting == 2)
+        routerRelease(rt);
+}
+
+/* A connection that never came up is free'd without a disconnect callback. */
+static void routerConnected(const redisAsyncContext *ac, int status) {
+    if (status != REDIS_OK)
+        routerDisconnected(ac,status);
+}
+
+static int routerConnectNode(redisRouter *rt, redisRouterNode *node, const redisOptions *options) {
+    redisAsyncContext *ac;
+    int i;
+
+    if ((ac = redisAsyncConnectWithOptions(options)) == NULL) {
+        routerSetError(rt,REDIS_ERR_OOM,"Out of memory");
+        return REDIS_ERR;
+    }
+    if (ac->err) {
+        routerSetError(rt,ac->err,ac->errstr);
+        redisAsyncFree(ac);
+        return REDIS_ERR;
+    }
+    if (rt->attach(ac,rt->attach_privdata) != REDIS_OK) {
+        routerSetError(rt,REDIS_ERR_OTHER,"Can't attach to the event loop");
+        redisAsyncFree(ac);
+        return REDIS_ERR;
+    }
+    ac->data = rt;
+    redisAsyncSetConnectCallback(ac,routerConnected);
+    redisAsyncSetDisconnectCallback(ac,routerDisconnected);
+    node->ac = ac;
+    node->latency = 0;
+    node->updated = 0;
+    node->outstanding = 0;
+
+    /* Goes out before any read that is routed here */
+    if (node != rt->nodes[0]) {
+        for (i = 0; i < ROUTER_STATE_COMMANDS; i++)
+            if (rt->state[i] != NULL)
+                redisAsyncFormattedCommand(ac,NULL,NULL,rt->state[i],sdslen(rt->state[i]));
+        if (rt->readonly)
+            redisAsyncCommand(ac,NULL,NULL,"READONLY");
+    }
+    return REDIS_OK;
+}
+
+static redisRouterNode *routerAddNode(redisRouter *rt, const char *host, int port) {
+    redisRouterNode **nodes, *node;
+
+    if ((nodes = realloc(rt->nodes,(rt->n+1)*sizeof(*nodes))) == NULL)
+        return NULL;
+    rt->nodes = nodes;
+    if ((node = calloc(1,sizeof(*node))) == NULL)
+        return NULL;
+    if (host != NULL && (node->host = strdup(host)) == NULL) {
+        free(node);
+        return NULL;
+    }
+    node->port = port;
+    rt->nodes[rt->n++] = node;
+    return node;
+}
+
+redisRouter *redisRouterConnect(const redisOptions *options, redisRouterAttachFn *attach,
+                                void *privdata)
+{
+    redisRouter *rt;
+    redisRouterNode *primary;
+
+    if ((rt = calloc(1,sizeof(*rt))) == NULL)
+        return NULL;
+    rt->attach = attach;
+    rt->attach_privdata = privdata;
+    rt->options = *options;
+    memset(&rt->options.endpoint,0,sizeof(rt->options.endpoint));
+    if (options->timeout) {
+        rt->timeout = *options->timeout;
+        rt->options.timeout = &rt->timeout;
+    }
+
+    if ((primary = routerAddNode(rt,NULL,0)) == NULL) {
+        routerRelease(rt);
+        return NULL;
+    }
+    if (options->type == REDIS_CONN_TCP)
+        primary->port = options->endpoint.tcp.port;
+    routerConnectNode(rt,primary,options);
+    return rt;
+}
+
+void redisRouterSetDisconnectCallback(redisRouter *rt, redisRouterDisconnectCallback *fn) {
+    rt->onDisconnect = fn;
+}
+
+int redisRouterAddReplica(redisRouter *rt, const char *host, int port) {
+    redisRouterNode *node = NULL;
+    redisOptions options;
+    int i;
+
+    if (rt->disconnecting)
+        return REDIS_ERR;
+    for (i = 1; i < rt->n && node == NULL; i++)
+        if (rt->nodes[i]->port == port && strcmp(rt->nodes[i]->host,host) == 0)
+            node = rt->nodes[i];
+    if (node != NULL && node->ac != NULL)
+        return REDIS_OK;
+    if (node == NULL && (node = routerAddNode(rt,host,port)) == NULL) {
+        routerSetError(rt,REDIS_ERR_OOM,"Out of memory");
+        return REDIS_ERR;
+    }
+
+    options = rt->options;
+    REDIS_OPTIONS_SET_TCP(&options,host,port);
+    return routerConnectNode(rt,node,&options);
+}
+
+/* The replicas are listed as "slave0:ip=...,port=...,state=online,...". */
+static void routerInfoReply(redisAsyncContext *ac, void *r, void *privdata) {
+    redisRouter *rt = ac->data;
+    redisReply *reply = r;
+    const char *p, *eol, *f, *comma, *end, *ip;
+    char host[256];
+    size_t iplen, flen;
+    int port, online, status = REDIS_OK;
+    ((void) privdata);
+
+    if (rt == NULL)
+        return;
+    if (reply == NULL || reply->type != REDIS_REPLY_STRING) {
+        routerSetError(rt,REDIS_ERR_OTHER,reply && reply->type == REDIS_REPLY_ERROR ?
+                       reply->str : "Can't read the replicas of the primary");
+        if (rt->onDiscover) rt->onDiscover(rt,REDIS_ERR);
+        return;
+    }
+
+    end = reply->str+reply->len;
+    for (p = reply->str; p < end; p = eol+1) {
+        if ((eol = memchr(p,'\n',end-p)) == NULL)
+            eol = end;
+        if (eol-p < 7 || strncmp(p,"slave",5) != 0 || !isdigit((unsigned char)p[5]) ||
+            (f = memchr(p,':',eol-p)) == NULL)
+            continue;
+        ip = NULL;
+        iplen = 0;
+        port = online = 0;
+        for (f++; f < eol; f = comma+1) {
+            if ((comma = memchr(f,',',eol-f)) == NULL)
+                comma = eol;
+            flen = comma-f;
+            if (flen > 0 && f[flen-1] == '\r')
+                flen--;
+            if (flen > 3 && strncmp(f,"ip=",3) == 0) {
+                ip = f+3;
+                iplen = flen-3;
+            } else if (flen > 5 && strncmp(f,"port=",5) == 0) {
+                port = atoi(f+5);
+            } else if (flen == 12 && strncmp(f,"state=online",12) == 0) {
+                online = 1;
+            }
+        }
+        if (ip == NULL || iplen >= sizeof(host) || port <= 0 || !online)
+            continue;
+        memcpy(host,ip,iplen);
+        host[iplen] = '\0';
+        if (redisRouterAddReplica(rt,host,port) != REDIS_OK)
+            status = REDIS_ERR;
+    }
+    if (rt->onDiscover) rt->onDiscover(rt,status);
+}
+
+int redisRouterDiscover(redisRouter *rt, redisRouterCallback *fn) {
+    redisAsyncContext *ac = rt->nodes[0]->ac;
+
+    if (ac == NULL || rt->disconnecting) {
+        routerSetError(rt,REDIS_ERR_OTHER,"Not connected to the primary");
+        return REDIS_ERR;
+    }
+    rt->onDiscover = fn;
+    return redisAsyncCommand(ac,routerInfoReply,NULL,"INFO replication");
+}
+
+int redisRouterSetReadOnly(redisRouter *rt, int on) {
+    int i, status = REDIS_OK;
+
+    rt->readonly = on;
+    for (i = 1; i < rt->n; i++) {
+        if (rt->nodes[i]->ac != NULL &&
+            redisAsyncCommand(rt->nodes[i]->ac,NULL,NULL,on ? "READONLY" : "READWRITE") != REDIS_OK)
+            status = REDIS_ERR;
+    }
+    return status;
+}
+
+/* The replica with the lowest expected wait: its average reply time for every
+ * read in its queue plus this one. Replicas that did not answer yet count as
+ * fast as the fastest one, so they get tried. A replica that was slow once
+ * would never be picked again to show that it got faster, so one that did not
+ * answer for REDIS_ROUTER_PROBE_INTERVAL gets the read when it is idle. */
+static redisRouterNode *routerPick(redisRouter *rt) {
+    redisRouterNode *node, *best = NULL;
+    double fastest = 0, cost, bestcost = 0;
+    long long now = routerMonotonicUsec();
+    int i, replicas = rt->n-1;
+
+    for (i = 1; i < rt->n; i++) {
+        node = rt->nodes[i];
+        if (node->latency > 0 && (fastest == 0 || node->latency < fastest))
+            fastest = node->latency;
+    }
+    for (i = 0; i < replicas; i++) {
+        node = rt->nodes[1+(rt->next+i)%replicas];
+        if (node->ac == NULL || node->ac->err)
+            continue;
+        if (node->latency > 0 && node->outstanding == 0 &&
+            now-node->updated >= REDIS_ROUTER_PROBE_INTERVAL)
+        {
+            best = node;
+            break;
+        }
+        cost = (node->latency > 0 ? node->latency : fastest+1)*(node->outstanding+1);
+        if (best == NULL || cost < bestcost) {
+            best = node;
+            bestcost = cost;
+        }
+    }
+    if (replicas > 0)
+        rt->next = (rt->next+1) % replicas;
+    return best ? best : rt->nodes[0];
+}
+
+/* A timeout counts with the time it took. The first reply after a long quiet
+ * spell replaces the average, which may be stale. Nothing is left to update
+ * when the router was free'd. */
+static void routerReadReply(redisAsyncContext *ac, void *r, void *privdata) {
+    routerRead *rd = privdata;
+    redisRouterNode *node = rd->node;
+    long long now;
+    double usec;
+
+    if (ac->data != NULL) {
+        node->outstanding--;
+        now = routerMonotonicUsec();
+        usec = (double)(now-rd->start);
+        if (usec < 1) usec = 1;
+        if (node->latency == 0 || rd->start-node->updated >= REDIS_ROUTER_PROBE_INTERVAL)
+            node->latency = usec;
+        else
+            node->latency += ROUTER_EWMA_ALPHA*(usec-node->latency);
+        node->updated = now;
+    }
+    if (rd->fn) rd->fn(ac,r,rd->privdata);
+    free(rd);
+}
+
+/* Argument "n" of a formatted command, 0 being the command name. */
+static const char *routerArgument(const char *cmd, size_t len, int n, size_t *alen) {
+    const char *p = cmd, *end = cmd+len;
+    long l;
+    int i;
+
+    for (i = 0; i <= n; i++) {
+        if (p >= end || (p = memchr(p,'$',end-p)) == NULL)
+            return NULL;
+        l = strtol(p+1,NULL,10);
+        if ((p = memchr(p,'\n',end-p)) == NULL || l < 0 || end-(p+1) < l)
+            return NULL;
+        p++;
+        if (i == n) {
+            *alen = (size_t)l;
+            return p;
+        }
+        p += l+2;
+    }
+    return NULL;
+}
+
+/* Slot in "state" of a command that changes the state of the connection, in
+ * the order they are sent to new replicas, or -1 for other commands. */
+static int routerStateIndex(const char *cmd, size_t len) {
+    static const char *cmds[] = {"auth","hello","select"};
+    const char *name, *arg;
+    size_t namelen, arglen;
+    int j;
+
+    if ((name = routerArgument(cmd,len,0,&namelen)) == NULL)
+        return -1;
+    for (j = 0; j < (int)(sizeof(cmds)/sizeof(cmds[0])); j++)
+        if (strlen(cmds[j]) == namelen && strncasecmp(cmds[j],name,namelen) == 0)
+            return j;
+    if (namelen == 6 && strncasecmp(name,"client",6) == 0 &&
+        (arg = routerArgument(cmd,len,1,&arglen)) != NULL &&
+        arglen == 7 && strncasecmp(arg,"setname",7) == 0)
+        return 3;
+    return -1;
+}
+
+/* Send a connection state command to every node, and keep it for the
+ * replicas that connect later. Only the primary's reply reaches "fn". */
+static int routerSetState(redisRouter *rt, int idx, redisCallbackFn *fn, void *privdata,
+                          const char *cmd, size_t len)
+{
+    sds copy;
+    int i;
+
+    if (rt->multi) {
+        routerSetError(rt,REDIS_ERR_OTHER,"Connection state can't change inside MULTI");
+        return REDIS_ERR;
+    }
+    if (rt->nodes[0]->ac == NULL)
+        return REDIS_ERR;
+    if ((copy = sdsnewlen(cmd,len)) == NULL) {
+        routerSetError(rt,REDIS_ERR_OOM,"Out of memory");
+        return REDIS_ERR;
+    }
+    if (redisAsyncFormattedCommand(rt->nodes[0]->ac,fn,privdata,cmd,len) != REDIS_OK) {
+        sdsfree(copy);
+        return REDIS_ERR;
+    }
+    sdsfree(rt->state[idx]);
+    rt->state[idx] = copy;
+    for (i = 1; i < rt->n; i++)
+        if (rt->nodes[i]->ac != NULL)
+            redisAsyncFormattedCommand(rt->nodes[i]->ac,NULL,NULL,cmd,len);
+    return REDIS_OK;
+}
+
+static int routerCommand(redisRouter *rt, redisCallbackFn *fn, void *privdata,
+                         const char *cmd, size_t len)
+{
+    redisRouterNode *node;
+    routerRead *rd;
+    const char *name = NULL, *p;
+    long namelen = 0;
+    int status, idx;
+
+    if (rt->disconnecting)
+        return REDIS_ERR;
+    if ((idx = routerStateIndex(cmd,len)) >= 0)
+        return routerSetState(rt,idx,fn,privdata,cmd,len);
+
+    /* Name of the command, the first bulk string */
+    if ((p = memchr(cmd,'$',len)) != NULL) {
+        namelen = strtol(p+1,NULL,10);
+        if ((p = memchr(p,'\n',cmd+len-p)) != NULL && cmd+len-(p+1) >= namelen)
+            name = p+1;
+    }
+
+    if (name == NULL || rt->multi ||
+        !(redisCommandFlags(name,(size_t)namelen) & REDIS_CMD_READONLY))
+    {
+        if (rt->nodes[0]->ac == NULL)
+            return REDIS_ERR;
+        status = redisAsyncFormattedCommand(rt->nodes[0]->ac,fn,privdata,cmd,len);
+        if (status == REDIS_OK && name != NULL) {
+            if (namelen == 5 && strncasecmp(name,"multi",5) == 0)
+                rt->multi = 1;
+            else if ((namelen == 4 && strncasecmp(name,"exec",4) == 0) ||
+                     (namelen == 7 && strncasecmp(name,"discard",7) == 0))
+                rt->multi = 0;
+        }
+        return status;
+    }
+
+    if ((node = routerPick(rt))->ac == NULL)
+        return REDIS_ERR;
+    if ((rd = malloc(sizeof(*rd))) == NULL)
+        return REDIS_ERR;
+    rd->node = node;
+    rd->start = routerMonotonicUsec();
+    rd->fn = fn;
+    rd->privdata = privdata;
+    node->outstanding++;
+    if (redisAsyncFormattedCommand(node->ac,routerReadReply,rd,cmd,len) != REDIS_OK) {
+        node->outstanding--;
+        free(rd);
+        return REDIS_ERR;
+    }
+    return REDIS_OK;
+}
+
+int redisvRouterCommand(redisRouter *rt, redisCallbackFn *fn, void *privdata,
+                        const char *format, va_list ap)
+{
+    char *cmd;
+    int len, status;
+
+    if ((len = redisvFormatCommand(&cmd,format,ap)) < 0)
+        return REDIS_ERR;
+    status = routerCommand(rt,fn,privdata,cmd,len);
+    free(cmd);
+    return status;
+}
+
+int redisRouterCommand(redisRouter *rt, redisCallbackFn *fn, void *privdata,
+                       const char *format, ...)
+{
+    va_list ap;
+    int status;
+    va_start(ap,format);
+    status = redisvRouterCommand(rt,fn,privdata,format,ap);
+    va_end(ap);
+    return status;
+}
+
+int redisRouterCommandArgv(redisRouter *rt, redisCallbackFn *fn, void *privdata,
+                           int argc, const char **argv, const size_t *argvlen)
+{
+    sds cmd;
+    long long len;
+    int status;
+
+    if ((len = redisFormatSdsCommandArgv(&cmd,argc,argv,argvlen)) < 0)
+        return REDIS_ERR;
+    status = routerCommand(rt,fn,privdata,cmd,len);
+    sdsfree(cmd);
+    return status;
+}
+
+void redisRouterDisconnect(redisRouter *rt) {
+    redisAsyncContext *ac;
+    int i;
+
+    /* Connections that go away right here must not free the router while
+     * this loop runs. */
+    rt->disconnecting = 1;
+    for (i = 0; i < rt->n; i++) {
+        if ((ac = rt->nodes[i]->ac) == NULL)
+            continue;
+        if (!(ac->c.flags & REDIS_CONNECTED) && ac->replies.len == 0) {
+            /* Would be free'd without any callback */
+            rt->nodes[i]->ac = NULL;
+            ac->onConnect = NULL;
+            ac->onDisconnect = NULL;
+        }
+        redisAsyncDisconnect(ac);
+    }
+
+    rt->disconnecting = 2;
+    for (i = 0; i < rt->n; i++)
+        if (rt->nodes[i]->ac != NULL) return;
+    routerRelease(rt);
+}
+
+void redisRouterFree(redisRouter *rt) {
+    redisAsyncContext *ac;
+    int i;
+
+    for (i = 0; i < rt->n; i++) {
+        if ((ac = rt->nodes[i]->ac) != NULL) {
+            /* Pending callbacks still run, but the router is gone. */
+            ac->onConnect = NULL;
+            ac->onDisconnect = NULL;
+            ac->data = NULL;
+            rt->nodes[i]->ac = NULL;
+            redisAsyncFree(ac);
+        }
+    }
+    routerRelease(rt);
+}
@@ -0,0 +1,140 @@
+/*
+ * Copyright (c) 2009-2011, Salvatore Sanfilippo <antirez at gmail dot com>
+ * Copyright (c) 2010-2011, Pieter Noordhuis <pcnoordhuis at gmail dot com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __HIREDIS_ROUTER_H
+#define __HIREDIS_ROUTER_H
+#include "async.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* A replica that did not answer for this long (usec) gets the next read while
+ * it has none in flight, and its average starts over from that reply. */
+#define REDIS_ROUTER_PROBE_INTERVAL 1000000
+
+struct redisRouter; /* need forward declaration of redisRouter */
+
+/* A server behind a router, the primary or one of its replicas. */
+typedef struct redisRouterNode {
+    char *host; /* NULL for the primary */
+    int port;
+    redisAsyncContext *ac; /* NULL once the connection is gone */
+    double latency; /* Moving average of the reply time in usec, 0 until known */
+    long long updated; /* Monotonic usec of the last reply to a read */
+    int outstanding; /* Reads sent that were not answered yet */
+} redisRouterNode;
+
+/* Attach a new connection to the event loop of the caller, such as
+ * redisLibevAttach() does. */
+typedef int (redisRouterAttachFn)(redisAsyncContext *ac, void *privdata);
+
+/* Called when the connection of a node is gone. Its commands fail from then
+ * on, until the node is added again. */
+typedef void (redisRouterDisconnectCallback)(struct redisRouter *rt, redisRouterNode *node,
+                                             int status);
+
+/* Called when the replicas reported by the primary were added. */
+typedef void (redisRouterCallback)(struct redisRouter *rt, int status);
+
+/* Asynchronous connections to a primary and its replicas. Commands that only
+ * read go to the replica that is expected to answer first, by the moving
+ * average of its reply times and the reads it still has to answer. All other
+ * commands, and the reads of a MULTI block, go to the primary, as do reads
+ * while no replica is connected. A replica may lag behind the primary, so a
+ * read that must see a write should be sent to the primary with
+ * redisAsyncCommand(rt->nodes[0]->ac,...). AUTH, HELLO, SELECT and CLIENT
+ * SETNAME go to every node, and to the replicas that are added later, but are
+ * refused inside MULTI. The "data" field and the connect and disconnect
+ * callbacks of the contexts belong to the router. */
+typedef struct redisRouter {
+    int err; /* Error flags, 0 when there is no error */
+    char errstr[128]; /* String representation of error when applicable */
+
+    redisRouterNode **nodes; /* The primary first */
+    int n;
+    int next; /* Replica to look at first, so equal ones take turns */
+    int multi; /* Inside MULTI */
+    int readonly; /* Send READONLY to the replicas */
+    sds state[4]; /* The last AUTH, HELLO, SELECT and CLIENT SETNAME, in order */
+
+    /* Replicas are connected with the timeout and socket options of the
+     * primary */
+    redisOptions options;
+    struct timeval timeout;
+    redisRouterAttachFn *attach;
+    void *attach_privdata;
+
+    redisRouterDisconnectCallback *onDisconnect;
+    redisRouterCallback *onDiscover;
+    int disconnecting; /* 2 = free once the last connection is gone */
+
+    /* Not used by hiredis */
+    void *data;
+} redisRouter;
+
+/* Connect to the primary and attach the connection. Returns NULL when out of
+ * memory; check err for other errors. */
+redisRouter *redisRouterConnect(const redisOptions *options, redisRouterAttachFn *attach,
+                                void *privdata);
+void redisRouterSetDisconnectCallback(redisRouter *rt, redisRouterDisconnectCallback *fn);
+
+/* Add a replica, or connect a replica again whose connection is gone. */
+int redisRouterAddReplica(redisRouter *rt, const char *host, int port);
+
+/* Add the online replicas that INFO replication of the primary lists. "fn"
+ * is called with REDIS_OK once they were added, and may be NULL. */
+int redisRouterDiscover(redisRouter *rt, redisRouterCallback *fn);
+
+/* Send READONLY to the replicas, now and when they are added, as replicas of
+ * a Redis Cluster only serve reads after it. READWRITE is sent when "on" is
+ * 0. */
+int redisRouterSetReadOnly(redisRouter *rt, int on);
+
+/* Issue a command on the primary, or on a replica when redisCommandFlags()
+ * says that it only reads. */
+int redisvRouterCommand(redisRouter *rt, redisCallbackFn *fn, void *privdata,
+                        const char *format, va_list ap);
+int redisRouterCommand(redisRouter *rt, redisCallbackFn *fn, void *privdata,
+                       const char *format, ...);
+int redisRouterCommandArgv(redisRouter *rt, redisCallbackFn *fn, void *privdata,
+                           int argc, const char **argv, const size_t *argvlen);
+
+/* Disconnect every node once its pending replies arrived. The router is
+ * free'd with the last connection. */
+void redisRouterDisconnect(redisRouter *rt);
+void redisRouterFree(redisRouter *rt);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
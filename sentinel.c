@@ -0,0 +1,462 @@
+/*
+ * Copyright (c) 2009-2011, Salvatore Sanfilippo <antirez at gmail dot com>
+ * Copyright (c) 2010-2011, Pieter Noordhuis <pcnoordhuis at gmail dot com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "fmacros.h"
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "sentinel.h"
+
+#define SENTINEL_CHANNEL "+switch-master"
+
+static void sentinelSetError(redisSentinel *st, int type, const char *str) {
+    size_t len = strlen(str);
+    len = len < (sizeof(st->errstr)-1) ? len : (sizeof(st->errstr)-1);
+    memcpy(st->errstr,str,len);
+    st->errstr[len] = '\0';
+    st->err = type;
+}
+
+static int sentinelAddAddress(redisSentinel *st, const char *host, size_t hostlen, int port) {
+    char **hosts;
+    int *ports;
+
+    if ((hosts = realloc(st->hosts,(st->n+1)*sizeof(*hosts))) == NULL)
+        return REDIS_ERR;
+    st->hosts = hosts;
+    if ((ports = realloc(st->ports,(st->n+1)*sizeof(*ports))) == NULL)
+        return REDIS_ERR;
+    st->ports = ports;
+    if ((st->hosts[st->n] = malloc(hostlen+1)) == NULL)
+        return REDIS_ERR;
+    memcpy(st->hosts[st->n],host,hostlen);
+    st->hosts[st->n][hostlen] = '\0';
+    st->ports[st->n++] = port;
+    return REDIS_OK;
+}
+
+redisSentinel *redisSentinelCreate(const char *addrs, const char *name,
+                                   const struct timeval *timeout)
+{
+    redisSentinel *st;
+    const char *p, *end, *colon;
+
+    if ((st = calloc(1,sizeof(*st))) == NULL)
+        return NULL;
+    if ((st->name = strdup(name)) == NULL) {
+        free(st);
+        return NULL;
+    }
+    if (timeout) {
+        if ((st->timeout = malloc(sizeof(*st->timeout))) == NULL) {
+            redisSentinelFree(st);
+            return NULL;
+        }
+        memcpy(st->timeout,timeout,sizeof(*timeout));
+    }
+    st->retry_delay = REDIS_SENTINEL_RETRY_MIN_DELAY;
+    st->ping_interval = REDIS_SENTINEL_PING_INTERVAL;
+
+    for (p = addrs; *p != '\0'; p = (*end == ',') ? end+1 : end) {
+        if ((end = strchr(p,',')) == NULL)
+            end = p+strlen(p);
+        for (colon = end; colon > p && *colon != ':'; colon--);
+        if (colon == p)
+            continue;
+        if (sentinelAddAddress(st,p,colon-p,atoi(colon+1)) != REDIS_OK) {
+            redisSentinelFree(st);
+            return NULL;
+        }
+    }
+    if (st->n == 0)
+        sentinelSetError(st,REDIS_ERR_OTHER,"No sentinel address");
+    return st;
+}
+
+void redisSentinelFree(redisSentinel *st) {
+    redisAsyncContext *ac;
+    int i;
+
+    if (st == NULL)
+        return;
+    if ((ac = st->ac) != NULL) {
+        /* Pending callbacks still run, but the sentinel is gone. */
+        st->ac = NULL;
+        ac->onConnect = NULL;
+        ac->onDisconnect = NULL;
+        ac->data = NULL;
+        redisAsyncFree(ac);
+    }
+    for (i = 0; i < st->n; i++)
+        free(st->hosts[i]);
+    free(st->hosts);
+    free(st->ports);
+    free(st->pools);
+    free(st->contexts);
+    free(st->master_host);
+    free(st->timeout);
+    free(st->name);
+    free(st);
+}
+
+/* The master changed: move the connections that follow it. The first master
+ * that becomes known moves nothing. */
+static int sentinelSetMaster(redisSentinel *st, const char *host, size_t hostlen, int port) {
+    char *copy;
+    int i, known = (st->master_host != NULL);
+
+    if (known && st->master_port == port && strlen(st->master_host) == hostlen &&
+        memcmp(st->master_host,host,hostlen) == 0)
+        return 0;
+    if ((copy = malloc(hostlen+1)) == NULL) {
+        sentinelSetError(st,REDIS_ERR_OOM,"Out of memory");
+        return -1;
+    }
+    memcpy(copy,host,hostlen);
+    copy[hostlen] = '\0';
+    free(st->master_host);
+    st->master_host = copy;
+    st->master_port = port;
+    if (!known)
+        return 0;
+
+    for (i = 0; i < st->npools; i++)
+        redisPoolSetAddress(st->pools[i],copy,port);
+    for (i = 0; i < st->ncontexts; i++)
+        redisAsyncRedirect(st->contexts[i],copy,port);
+    return 1;
+}
+
+/* The reply of SENTINEL get-master-addr-by-name, which is nil for an
+ * unknown master. */
+static int sentinelMasterReply(redisSentinel *st, redisReply *reply) {
+    if (reply->type == REDIS_REPLY_ERROR) {
+        sentinelSetError(st,REDIS_ERR_OTHER,reply->str);
+        return -1;
+    }
+    if (reply->type != REDIS_REPLY_ARRAY || reply->elements != 2 ||
+        reply->element[0]->type != REDIS_REPLY_STRING ||
+        reply->element[1]->type != REDIS_REPLY_STRING)
+    {
+        sentinelSetError(st,REDIS_ERR_OTHER,"Unknown master");
+        return -1;
+    }
+    return sentinelSetMaster(st,reply->element[0]->str,reply->element[0]->len,
+                             atoi(reply->element[1]->str));
+}
+
+/* Sentinel "i" answered: ask it first from now on. */
+static void sentinelPromote(redisSentinel *st, int i) {
+    char *host = st->hosts[i];
+    int port = st->ports[i];
+
+    memmove(st->hosts+1,st->hosts,i*sizeof(*st->hosts));
+    memmove(st->ports+1,st->ports,i*sizeof(*st->ports));
+    st->hosts[0] = host;
+    st->ports[0] = port;
+}
+
+int redisSentinelGetMaster(redisSentinel *st) {
+    redisContext *c;
+    redisReply *reply;
+    int i, ret;
+
+    if (st->n == 0) {
+        sentinelSetError(st,REDIS_ERR_OTHER,"No sentinel address");
+        return REDIS_ERR;
+    }
+    for (i = 0; i < st->n; i++) {
+        if (st->timeout)
+            c = redisConnectWithTimeout(st->hosts[i],st->ports[i],*st->timeout);
+        else
+            c = redisConnect(st->hosts[i],st->ports[i]);
+        if (c == NULL) {
+            sentinelSetError(st,REDIS_ERR_OOM,"Out of memory");
+            return REDIS_ERR;
+        }
+        if (c->err) {
+            sentinelSetError(st,c->err,c->errstr);
+            redisFree(c);
+            continue;
+        }
+        reply = redisCommand(c,"SENTINEL get-master-addr-by-name %s",st->name);
+        if (reply == NULL) {
+            sentinelSetError(st,c->err,c->errstr);
+            redisFree(c);
+            continue;
+        }
+        ret = sentinelMasterReply(st,reply);
+        freeReplyObject(reply);
+        redisFree(c);
+        if (ret >= 0) {
+            /* The watch keeps its index right */
+            if (st->ac != NULL && st->current < i)
+                st->current++;
+            else if (st->ac != NULL && st->current == i)
+                st->current = 0;
+            sentinelPromote(st,i);
+            st->err = 0;
+            st->errstr[0] = '\0';
+            return REDIS_OK;
+        }
+    }
+    return REDIS_ERR;
+}
+
+redisContext *redisSentinelConnect(redisSentinel *st) {
+    redisContext *c;
+    redisReply *reply;
+
+    if (redisSentinelGetMaster(st) != REDIS_OK)
+        return NULL;
+    if (st->timeout)
+        c = redisConnectWithTimeout(st->master_host,st->master_port,*st->timeout);
+    else
+        c = redisConnect(st->master_host,st->master_port);
+    if (c == NULL) {
+        sentinelSetError(st,REDIS_ERR_OOM,"Out of memory");
+        return NULL;
+    }
+    if (c->err) {
+        sentinelSetError(st,c->err,c->errstr);
+        redisFree(c);
+        return NULL;
+    }
+
+    /* A master that was demoted a moment ago is a replica now */
+    if ((reply = redisCommand(c,"ROLE")) == NULL) {
+        sentinelSetError(st,c->err,c->errstr);
+        redisFree(c);
+        return NULL;
+    }
+    if (reply->type != REDIS_REPLY_ARRAY || reply->elements < 1 ||
+        reply->element[0]->type != REDIS_REPLY_STRING ||
+        strcmp(reply->element[0]->str,"master") != 0)
+    {
+        sentinelSetError(st,REDIS_ERR_OTHER,"Not a master");
+        freeReplyObject(reply);
+        redisFree(c);
+        return NULL;
+    }
+    freeReplyObject(reply);
+    return c;
+}
+
+int redisSentinelAddPool(redisSentinel *st, redisPool *pool) {
+    redisPool **pools;
+
+    if ((pools = realloc(st->pools,(st->npools+1)*sizeof(*pools))) == NULL) {
+        sentinelSetError(st,REDIS_ERR_OOM,"Out of memory");
+        return REDIS_ERR;
+    }
+    st->pools = pools;
+    st->pools[st->npools++] = pool;
+    return REDIS_OK;
+}
+
+int redisSentinelAddAsync(redisSentinel *st, redisAsyncContext *ac) {
+    redisAsyncContext **contexts;
+
+    if ((contexts = realloc(st->contexts,(st->ncontexts+1)*sizeof(*contexts))) == NULL) {
+        sentinelSetError(st,REDIS_ERR_OOM,"Out of memory");
+        return REDIS_ERR;
+    }
+    st->contexts = contexts;
+    st->contexts[st->ncontexts++] = ac;
+    return REDIS_OK;
+}
+
+void redisSentinelRemoveAsync(redisSentinel *st, redisAsyncContext *ac) {
+    int i;
+
+    for (i = 0; i < st->ncontexts; i++) {
+        if (st->contexts[i] == ac) {
+            st->contexts[i] = st->contexts[--st->ncontexts];
+            return;
+        }
+    }
+}
+
+static int sentinelWatchNext(redisSentinel *st);
+
+static void sentinelWatchMaster(redisAsyncContext *ac, void *r, void *privdata) {
+    redisSentinel *st = privdata;
+    ((void) ac);
+
+    if (r == NULL || ac->data == NULL)
+        return;
+    if (sentinelMasterReply(st,r) == 1 && st->fn)
+        st->fn(st,REDIS_OK);
+}
+
+/* "<name> <old host> <old port> <new host> <new port>" */
+static void sentinelWatchMessage(redisAsyncContext *ac, void *r, void *privdata) {
+    redisSentinel *st = privdata;
+    redisReply *reply = r, *msg;
+    const char *p, *end, *field[5];
+    size_t len[5];
+    int i;
+
+    if (reply == NULL || ac->data == NULL || reply->type != REDIS_REPLY_ARRAY ||
+        reply->elements != 3 || reply->element[0]->type != REDIS_REPLY_STRING)
+        return;
+    if (strcasecmp(reply->element[0]->str,"subscribe") == 0) {
+        /* This sentinel works */
+        st->tried = 0;
+        st->retry_delay = REDIS_SENTINEL_RETRY_MIN_DELAY;
+        return;
+    }
+    msg = reply->element[2];
+    if (strcasecmp(reply->element[0]->str,"message") != 0 || msg->type != REDIS_REPLY_STRING)
+        return;
+
+    p = msg->str;
+    end = msg->str+msg->len;
+    for (i = 0; i < 5; i++) {
+        field[i] = p;
+        while (p < end && *p != ' ') p++;
+        len[i] = p-field[i];
+        if (p < end) p++;
+    }
+    if (len[0] != strlen(st->name) || memcmp(field[0],st->name,len[0]) != 0 || len[3] == 0)
+        return;
+    if (sentinelSetMaster(st,field[3],len[3],atoi(field[4])) == 1 && st->fn)
+        st->fn(st,REDIS_OK);
+}
+
+/* The connection to a sentinel is gone, or never came up, and the retry
+ * failed too: use the next one. Once all of them failed in a row, the
+ * callback hears of it and the next round waits longer. */
+static void sentinelWatchLost(const redisAsyncContext *ac, int status) {
+    redisSentinel *st = ac->data;
+    ((void) status);
+
+    if (st == NULL || st->ac != ac)
+        return;
+    st->ac = NULL;
+    if (++st->tried >= st->n) {
+        st->tried = 0;
+        st->retry_delay *= 2;
+        if (st->retry_delay > REDIS_SENTINEL_RETRY_MAX_DELAY)
+            st->retry_delay = REDIS_SENTINEL_RETRY_MAX_DELAY;
+        sentinelSetError(st,REDIS_ERR_OTHER,"No sentinel can be reached");
+        if (st->fn) st->fn(st,REDIS_ERR);
+    }
+    st->current = (st->current+1) % st->n;
+    if (sentinelWatchNext(st) != REDIS_OK && st->fn)
+        st->fn(st,REDIS_ERR);
+}
+
+static void sentinelWatchConnected(const redisAsyncContext *ac, int status) {
+    if (status != REDIS_OK)
+        sentinelWatchLost(ac,status);
+}
+
+/* Back on the same sentinel: subscriptions are restored on their own */
+static void sentinelWatchReconnected(redisAsyncContext *ac) {
+    redisSentinel *st = ac->data;
+
+    if (st != NULL)
+        redisAsyncCommand(ac,sentinelWatchMaster,st,"SENTINEL get-master-addr-by-name %s",
+                          st->name);
+}
+
+static void sentinelMsecToTimeval(long long msec, struct timeval *tv) {
+    tv->tv_sec = msec/1000;
+    tv->tv_usec = (msec%1000)*1000;
+}
+
+/* Connect to the current sentinel, or to the first after it that doesn't
+ * fail right away. */
+static int sentinelWatchNext(redisSentinel *st) {
+    redisReconnectPolicy policy;
+    redisAsyncContext *ac;
+    struct timeval ping;
+    int i;
+
+    memset(&policy,0,sizeof(policy));
+    sentinelMsecToTimeval(st->retry_delay,&policy.min_delay);
+    policy.max_delay = policy.min_delay;
+    policy.max_attempts = 1;
+    policy.retry_connect = 1;
+    sentinelMsecToTimeval(st->ping_interval,&ping);
+
+    for (i = 0; i < st->n; i++, st->current = (st->current+1) % st->n) {
+        if ((ac = redisAsyncConnect(st->hosts[st->current],st->ports[st->current])) == NULL) {
+            sentinelSetError(st,REDIS_ERR_OOM,"Out of memory");
+            break;
+        }
+        if (ac->err) {
+            sentinelSetError(st,ac->err,ac->errstr);
+            redisAsyncFree(ac);
+            continue;
+        }
+        if (st->attach(ac,st->attach_privdata) != REDIS_OK) {
+            sentinelSetError(st,REDIS_ERR_OTHER,"Can't attach to the event loop");
+            redisAsyncFree(ac);
+            break;
+        }
+        ac->data = st;
+        redisAsyncSetConnectCallback(ac,sentinelWatchConnected);
+        redisAsyncSetDisconnectCallback(ac,sentinelWatchLost);
+        redisAsyncSetReconnect(ac,&policy);
+        redisAsyncSetReconnectCallback(ac,sentinelWatchReconnected);
+        if (st->timeout) {
+            redisAsyncSetConnectTimeout(ac,*st->timeout);
+            redisAsyncSetTimeout(ac,*st->timeout);
+        } else {
+            redisAsyncSetTimeout(ac,ping);
+        }
+        redisAsyncSetPingInterval(ac,ping);
+        st->ac = ac;
+
+        /* Ask before subscribing, as the connection can't ask afterwards */
+        redisAsyncCommand(ac,sentinelWatchMaster,st,"SENTINEL get-master-addr-by-name %s",
+                          st->name);
+        redisAsyncCommand(ac,sentinelWatchMessage,st,"SUBSCRIBE " SENTINEL_CHANNEL);
+        return REDIS_OK;
+    }
+    return REDIS_ERR;
+}
+
+int redisSentinelWatch(redisSentinel *st, redisSentinelAttachFn *attach, void *privdata,
+                       redisSentinelCallback *fn)
+{
+    if (st->ac != NULL || st->n == 0) {
+        sentinelSetError(st,REDIS_ERR_OTHER,st->n ? "Already watching" : "No sentinel address");
+        return REDIS_ERR;
+    }
+    st->attach = attach;
+    st->attach_privdata = privdata;
+    st->fn = fn;
+    st->current = st->tried = 0;
+    return sentinelWatchNext(st);
+}
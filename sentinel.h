@@ -0,0 +1,130 @@
+/*
+ * Copyright (c) 2009-2011, Salvatore Sanfilippo <antirez at gmail dot com>
+ * Copyright (c) 2010-2011, Pieter Noordhuis <pcnoordhuis at gmail dot com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __HIREDIS_SENTINEL_H
+#define __HIREDIS_SENTINEL_H
+#include "hiredis.h"
+#include "async.h"
+#include "pool.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The watch PINGs its sentinel this often (msec), and waits between half of
+ * and the full retry delay before it connects to a sentinel again. The delay
+ * doubles every time none of the sentinels could be reached. */
+#define REDIS_SENTINEL_PING_INTERVAL 1000
+#define REDIS_SENTINEL_RETRY_MIN_DELAY 100
+#define REDIS_SENTINEL_RETRY_MAX_DELAY 10000
+
+struct redisSentinel; /* need forward declaration of redisSentinel */
+
+/* Called with REDIS_OK when the master changed, after the connections that
+ * follow it were moved, and with REDIS_ERR every time none of the sentinels
+ * could be reached. The watch goes on trying them unless it can't make new
+ * connections at all, such as when out of memory. */
+typedef void (redisSentinelCallback)(struct redisSentinel *st, int status);
+
+/* Attach a new connection to a sentinel to the event loop of the caller,
+ * such as redisLibevAttach() does. */
+typedef int (redisSentinelAttachFn)(redisAsyncContext *ac, void *privdata);
+
+/* The master of a set of servers that are monitored by Redis Sentinel. */
+typedef struct redisSentinel {
+    int err; /* Error flags, 0 when there is no error */
+    char errstr[128]; /* String representation of error when applicable */
+
+    char *name;
+    char **hosts; /* Sentinels, the one that answered last first */
+    int *ports;
+    int n;
+    struct timeval *timeout;
+
+    char *master_host; /* NULL until known */
+    int master_port;
+
+    /* Connections that follow the master */
+    redisPool **pools;
+    int npools;
+    redisAsyncContext **contexts;
+    int ncontexts;
+
+    /* Watch of a sentinel, see redisSentinelWatch() */
+    redisAsyncContext *ac;
+    int current; /* Index of its sentinel */
+    int tried; /* Sentinels tried since one answered */
+    long long retry_delay; /* msec */
+    long long ping_interval; /* msec */
+    redisSentinelAttachFn *attach;
+    void *attach_privdata;
+    redisSentinelCallback *fn;
+
+    /* Not used by hiredis */
+    void *data;
+} redisSentinel;
+
+/* "addrs" is a comma separated list of "host:port" of sentinels, "name" the
+ * name of the master they monitor. "timeout" may be NULL. Returns NULL when
+ * out of memory; check err for other errors. */
+redisSentinel *redisSentinelCreate(const char *addrs, const char *name,
+                                   const struct timeval *timeout);
+void redisSentinelFree(redisSentinel *st);
+
+/* Ask the sentinels in turn for the address of the master. */
+int redisSentinelGetMaster(redisSentinel *st);
+
+/* Connect to the master, checking with ROLE that it really is one. Returns
+ * NULL on errors, with err set. */
+redisContext *redisSentinelConnect(redisSentinel *st);
+
+/* Connections that are moved to the new master on a switch, see
+ * redisPoolSetAddress() and redisAsyncRedirect(). Asynchronous contexts need
+ * reconnecting enabled, and must be removed before they are free'd. */
+int redisSentinelAddPool(redisSentinel *st, redisPool *pool);
+int redisSentinelAddAsync(redisSentinel *st, redisAsyncContext *ac);
+void redisSentinelRemoveAsync(redisSentinel *st, redisAsyncContext *ac);
+
+/* Subscribe to +switch-master on a sentinel, so connections move as soon as
+ * the sentinels fail over rather than when their commands time out. The
+ * master is asked for again on every connection to a sentinel, in case a
+ * switch was missed. The connection is PINGed and gives up on the timeout
+ * given to redisSentinelCreate(), or on the PING interval without one; it is
+ * tried once more after the retry delay and then the next sentinel is used.
+ * The event loop needs timers. */
+int redisSentinelWatch(redisSentinel *st, redisSentinelAttachFn *attach, void *privdata,
+                       redisSentinelCallback *fn);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
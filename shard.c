@@ -0,0 +1,286 @@
+/*
+ * Copyright (c) 2009-2011, Salvatore Sanfilippo <antirez at gmail dot com>
+ * Copyright (c) 2010-2011, Pieter Noordhuis <pcnoordhuis at gmail dot com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "fmacros.h"
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include "shard.h"
+
+static void shardSetError(redisShardedContext *sc, int type, const char *str) {
+    size_t len = strlen(str);
+    len = len < (sizeof(sc->errstr)-1) ? len : (sizeof(sc->errstr)-1);
+    memcpy(sc->errstr,str,len);
+    sc->errstr[len] = '\0';
+    sc->err = type;
+}
+
+static void shardRelease(redisShardedContext *sc) {
+    free(sc->shards);
+    free(sc);
+}
+
+static void shardDisconnected(const redisAsyncContext *ac, int status) {
+    redisShardedContext *sc = ac->data;
+    int i, left = 0;
+
+    for (i = 0; i < sc->n; i++) {
+        if (sc->shards[i] == ac) {
+            sc->shards[i] = NULL;
+            if (sc->onDisconnect) sc->onDisconnect(sc,i,status);
+        }
+        if (sc->shards[i] != NULL) left++;
+    }
+    if (left == 0 && sc->disconnecting == 2)
+        shardRelease(sc);
+}
+
+/* A connection that never came up is free'd without a disconnect callback. */
+static void shardConnected(const redisAsyncContext *ac, int status) {
+    if (status != REDIS_OK)
+        shardDisconnected(ac,status);
+}
+
+redisShardedContext *redisShardedConnect(const redisOptions *options, int n) {
+    redisShardedContext *sc;
+    redisAsyncContext *ac;
+    int i;
+
+    if (n < 1) n = 1;
+    if ((sc = calloc(1,sizeof(*sc))) == NULL)
+        return NULL;
+    if ((sc->shards = calloc(n,sizeof(*sc->shards))) == NULL) {
+        free(sc);
+        return NULL;
+    }
+    sc->n = n;
+
+    for (i = 0; i < n; i++) {
+        if ((ac = redisAsyncConnectWithOptions(options)) == NULL) {
+            redisShardedFree(sc);
+            return NULL;
+        }
+        if (ac->err) {
+            shardSetError(sc,ac->err,ac->errstr);
+            redisAsyncFree(ac);
+            break;
+        }
+        ac->data = sc;
+        redisAsyncSetConnectCallback(ac,shardConnected);
+        redisAsyncSetDisconnectCallback(ac,shardDisconnected);
+        sc->shards[i] = ac;
+    }
+
+    /* All or nothing */
+    if (sc->err) {
+        while (i-- > 0) {
+            sc->shards[i]->onConnect = NULL;
+            sc->shards[i]->onDisconnect = NULL;
+            redisAsyncFree(sc->shards[i]);
+            sc->shards[i] = NULL;
+        }
+    }
+    return sc;
+}
+
+void redisShardedSetDisconnectCallback(redisShardedContext *sc, redisShardDisconnectCallback *fn) {
+    sc->onDisconnect = fn;
+}
+
+/* FNV-1a of the hash tag, mapped to [0,n) with a multiply instead of a
+ * division. That takes the high bits, which FNV barely mixes for keys that
+ * only differ at the end, hence the final avalanche. */
+int redisShardedKeyIndex(redisShardedContext *sc, const char *key, size_t len) {
+    const char *open, *close;
+    uint32_t h = 2166136261u;
+    size_t j;
+
+    if ((open = memchr(key,'{',len)) != NULL &&
+        (close = memchr(open+1,'}',len-(open+1-key))) != NULL &&
+        close > open+1)
+    {
+        key = open+1;
+        len = close-key;
+    }
+    for (j = 0; j < len; j++) {
+        h ^= (unsigned char)key[j];
+        h *= 16777619u;
+    }
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    return (int)(((uint64_t)h*(uint64_t)sc->n) >> 32);
+}
+
+/* Commands that set up the one connection they are sent on, or only work
+ * together with the commands that follow them on it. A sharded context can't
+ * honor them: the next command may well use another connection. */
+static int shardIsConnectionCommand(const char *name, size_t len) {
+    static const char *cmds[] = {"auth","discard","exec","multi","select",
+                                 "unwatch","watch"};
+    size_t j;
+
+    for (j = 0; j < sizeof(cmds)/sizeof(cmds[0]); j++)
+        if (strlen(cmds[j]) == len && strncasecmp(cmds[j],name,len) == 0)
+            return 1;
+    return 0;
+}
+
+/* Argument "n" of a formatted command, 0 being the command name. */
+static const char *shardArgument(const char *cmd, size_t len, int n, size_t *alen) {
+    const char *p = cmd, *end = cmd+len;
+    long l;
+    int i;
+
+    for (i = 0; i <= n; i++) {
+        if (p >= end || (p = memchr(p,'$',end-p)) == NULL)
+            return NULL;
+        l = strtol(p+1,NULL,10);
+        if ((p = memchr(p,'\n',end-p)) == NULL || l < 0 || end-(p+1) < l)
+            return NULL;
+        p++;
+        if (i == n) {
+            *alen = (size_t)l;
+            return p;
+        }
+        p += l+2;
+    }
+    return NULL;
+}
+
+static int shardCommand(redisShardedContext *sc, redisCallbackFn *fn, void *privdata,
+                        const char *cmd, size_t len)
+{
+    redisAsyncContext *ac;
+    const char *arg;
+    size_t alen;
+    int i = 0;
+
+    if ((arg = shardArgument(cmd,len,0,&alen)) != NULL &&
+        shardIsConnectionCommand(arg,alen))
+        return REDIS_ERR;
+    /* Shard by the second argument */
+    if ((arg = shardArgument(cmd,len,1,&alen)) != NULL)
+        i = redisShardedKeyIndex(sc,arg,alen);
+    if ((ac = sc->shards[i]) == NULL || sc->disconnecting)
+        return REDIS_ERR;
+    return redisAsyncFormattedCommand(ac,fn,privdata,cmd,len);
+}
+
+int redisvShardedCommand(redisShardedContext *sc, redisCallbackFn *fn, void *privdata,
+                         const char *format, va_list ap)
+{
+    char *cmd;
+    int len, status;
+
+    if ((len = redisvFormatCommand(&cmd,format,ap)) < 0)
+        return REDIS_ERR;
+    status = shardCommand(sc,fn,privdata,cmd,len);
+    free(cmd);
+    return status;
+}
+
+int redisShardedCommand(redisShardedContext *sc, redisCallbackFn *fn, void *privdata,
+                        const char *format, ...)
+{
+    va_list ap;
+    int status;
+    va_start(ap,format);
+    status = redisvShardedCommand(sc,fn,privdata,format,ap);
+    va_end(ap);
+    return status;
+}
+
+int redisShardedCommandArgv(redisShardedContext *sc, redisCallbackFn *fn, void *privdata,
+                            int argc, const char **argv, const size_t *argvlen)
+{
+    redisAsyncContext *ac;
+    int i = 0;
+    sds cmd;
+    long long len;
+    int status;
+
+    if (argc < 1 ||
+        shardIsConnectionCommand(argv[0],argvlen ? argvlen[0] : strlen(argv[0])))
+        return REDIS_ERR;
+    if (argc > 1)
+        i = redisShardedKeyIndex(sc,argv[1],argvlen ? argvlen[1] : strlen(argv[1]));
+    if ((ac = sc->shards[i]) == NULL || sc->disconnecting)
+        return REDIS_ERR;
+    if ((len = redisFormatSdsCommandArgv(&cmd,argc,argv,argvlen)) < 0)
+        return REDIS_ERR;
+    status = redisAsyncFormattedCommand(ac,fn,privdata,cmd,len);
+    sdsfree(cmd);
+    return status;
+}
+
+void redisShardedDisconnect(redisShardedContext *sc) {
+    redisAsyncContext *ac;
+    int i;
+
+    /* Connections that go away right here must not free the sharded context
+     * while this loop runs. */
+    sc->disconnecting = 1;
+    for (i = 0; i < sc->n; i++) {
+        if ((ac = sc->shards[i]) == NULL)
+            continue;
+        if (!(ac->c.flags & REDIS_CONNECTED) && ac->replies.len == 0) {
+            /* Would be free'd without any callback */
+            sc->shards[i] = NULL;
+            ac->onConnect = NULL;
+            ac->onDisconnect = NULL;
+        }
+        redisAsyncDisconnect(ac);
+    }
+
+    sc->disconnecting = 2;
+    for (i = 0; i < sc->n; i++)
+        if (sc->shards[i] != NULL) return;
+    shardRelease(sc);
+}
+
+void redisShardedFree(redisShardedContext *sc) {
+    redisAsyncContext *ac;
+    int i;
+
+    for (i = 0; i < sc->n; i++) {
+        if ((ac = sc->shards[i]) != NULL) {
+            /* Pending callbacks still run, but the sharded context is gone. */
+            ac->onConnect = NULL;
+            ac->onDisconnect = NULL;
+            ac->data = NULL;
+            sc->shards[i] = NULL;
+            redisAsyncFree(ac);
+        }
+    }
+    shardRelease(sc);
+}
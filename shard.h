@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2009-2011, Salvatore Sanfilippo <antirez at gmail dot com>
+ * Copyright (c) 2010-2011, Pieter Noordhuis <pcnoordhuis at gmail dot com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __HIREDIS_SHARD_H
+#define __HIREDIS_SHARD_H
+#include "async.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct redisShardedContext; /* need forward declaration of redisShardedContext */
+
+/* Called when the connection of shard "i" is gone for good. Its commands fail
+ * from then on. */
+typedef void (redisShardDisconnectCallback)(struct redisShardedContext*, int i, int status);
+
+/* N asynchronous connections to one server. Every command goes to the
+ * connection picked by the hash of its first key, so commands on the same key
+ * keep their order while the parsing and syscalls are spread over the
+ * connections. The "data" field and the connect and disconnect callbacks of
+ * the contexts belong to the sharded context. */
+typedef struct redisShardedContext {
+    int err; /* Error flags, 0 when there is no error */
+    char errstr[128]; /* String representation of error when applicable */
+
+    int n;
+    redisAsyncContext **shards; /* NULL once a connection is gone */
+    redisShardDisconnectCallback *onDisconnect;
+    int disconnecting; /* 2 = free once the last connection is gone */
+
+    /* Not used by hiredis */
+    void *data;
+} redisShardedContext;
+
+/* Open "n" connections with the same options. Returns NULL when out of memory;
+ * check err for connection errors. */
+redisShardedContext *redisShardedConnect(const redisOptions *options, int n);
+void redisShardedSetDisconnectCallback(redisShardedContext *sc, redisShardDisconnectCallback *fn);
+
+/* Index of the shard that serves "key". Only the part between the first '{'
+ * and the next '}' is hashed when it is not empty, so keys with the same
+ * {tag} share a connection. */
+int redisShardedKeyIndex(redisShardedContext *sc, const char *key, size_t len);
+
+/* Issue a command on the shard of its first argument after the command name.
+ * Commands without arguments go to the first shard. SELECT, AUTH, MULTI,
+ * EXEC, DISCARD, WATCH and UNWATCH are refused with REDIS_ERR: send them to
+ * every context in "shards" instead, or use a plain context. */
+int redisvShardedCommand(redisShardedContext *sc, redisCallbackFn *fn, void *privdata,
+                         const char *format, va_list ap);
+int redisShardedCommand(redisShardedContext *sc, redisCallbackFn *fn, void *privdata,
+                        const char *format, ...);
+int redisShardedCommandArgv(redisShardedContext *sc, redisCallbackFn *fn, void *privdata,
+                            int argc, const char **argv, const size_t *argvlen);
+
+/* Disconnect every shard once its pending replies arrived. The sharded
+ * context is free'd with the last connection. */
+void redisShardedDisconnect(redisShardedContext *sc);
+void redisShardedFree(redisShardedContext *sc);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
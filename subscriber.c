@@ -0,0 +1,331 @@
+/*
+ * Copyright (c) 2009-2011, Salvatore Sanfilippo <antirez at gmail dot com>
+ * Copyright (c) 2010-2011, Pieter Noordhuis <pcnoordhuis at gmail dot com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "fmacros.h"
+#include <stdlib.h>
+#include <string.h>
+#include "subscriber.h"
+#include "dict.c"
+#include "sds.h"
+
+/* Subscriptions by channel or pattern name. The dictionary owns both the sds
+ * key and the subscription. */
+static unsigned int subscriptionHash(const void *key) {
+    return dictGenHashFunction((const unsigned char *)key,
+                               sdslen((const sds)key));
+}
+
+static unsigned int subscriptionBufferHash(const void *buf, size_t len) {
+    return dictGenHashFunction((const unsigned char *)buf,(int)len);
+}
+
+static int subscriptionKeyCompare(void *privdata, const void *key1, const void *key2) {
+    ((void) privdata);
+    return sdslen((const sds)key1) == sdslen((const sds)key2) &&
+           memcmp(key1,key2,sdslen((const sds)key1)) == 0;
+}
+
+static int subscriptionKeyBufferCompare(const void *key, const void *buf, size_t len) {
+    return sdslen((const sds)key) == len && memcmp(key,buf,len) == 0;
+}
+
+static void subscriptionValDestructor(void *privdata, void *val) {
+    redisSubscription *sub = val;
+    redisListener *l, *next;
+    ((void) privdata);
+
+    for (l = sub->listeners; l != NULL; l = next) {
+        next = l->next;
+        free(l);
+    }
+    sdsfree(sub->name);
+    free(sub);
+}
+
+static dictType subscriptionDict = {
+    subscriptionHash,
+    NULL,
+    NULL,
+    subscriptionKeyCompare,
+    NULL, /* The key is the name of the subscription */
+    subscriptionValDestructor,
+    subscriptionBufferHash,
+    subscriptionKeyBufferCompare
+};
+
+static void __redisSubscriberCallback(redisAsyncContext *ac, void *r, void *privdata);
+
+static int __redisSubscriberSend(redisSubscriber *s, redisSubscription *sub, int subscribe) {
+    const char *argv[2];
+    size_t argvlen[2];
+
+    if (subscribe)
+        argv[0] = sub->pattern ? "PSUBSCRIBE" : "SUBSCRIBE";
+    else
+        argv[0] = sub->pattern ? "PUNSUBSCRIBE" : "UNSUBSCRIBE";
+    argvlen[0] = strlen(argv[0]);
+    argv[1] = sub->name;
+    argvlen[1] = sdslen(sub->name);
+    return redisAsyncCommandArgv(s->ac,__redisSubscriberCallback,s,2,argv,argvlen);
+}
+
+/* Drop the listeners that were removed while messages were dispatched. */
+static void __redisSubscriberSweep(redisSubscription *sub) {
+    redisListener **pl = &sub->listeners, *l;
+
+    while ((l = *pl) != NULL) {
+        if (l->fn == NULL) {
+            *pl = l->next;
+            free(l);
+        } else {
+            pl = &l->next;
+        }
+    }
+}
+
+static void __redisSubscriberDispatch(redisSubscriber *s, redisSubscription *sub,
+                                      redisReply *reply, int pmessage)
+{
+    redisMessage *msg;
+    redisListener *l;
+
+    if ((msg = malloc(sizeof(*msg))) == NULL) {
+        s->ac->c.reader->fn->freeObject(reply);
+        return;
+    }
+    msg->reply = reply;
+    msg->channel = reply->element[1+pmessage];
+    msg->payload = reply->element[2+pmessage];
+    msg->refcount = 1;
+    msg->freeObject = s->ac->c.reader->fn->freeObject;
+
+    /* Listeners may add or remove listeners of this subscription. New ones
+     * are put in front of the list, so they don't see this message. */
+    s->dispatching = sub;
+    for (l = sub->listeners; l != NULL; l = l->next)
+        if (l->fn != NULL) l->fn(s,msg,l->privdata);
+    s->dispatching = NULL;
+    if (s->removed) {
+        s->removed = 0;
+        __redisSubscriberSweep(sub);
+    }
+    redisMessageRelease(msg);
+}
+
+static void __redisSubscriberCallback(redisAsyncContext *ac, void *r, void *privdata) {
+    redisSubscriber *s = privdata;
+    redisReply *reply = r, *type;
+    redisSubscription *sub;
+    dictEntry *de;
+    int pvariant;
+    dict *d;
+
+    /* The context is going away. */
+    if (reply == NULL) {
+        s->ac = NULL;
+        return;
+    }
+
+    /* Only pub/sub arrays are passed to subscription callbacks */
+    type = reply->element[0];
+    pvariant = (type->str[0] == 'p') ? 1 : 0;
+    d = pvariant ? s->patterns : s->channels;
+    de = dictFindBuffer(d,reply->element[1]->str,reply->element[1]->len);
+    if (de == NULL) {
+        ac->c.reader->fn->freeObject(reply);
+        return;
+    }
+    sub = dictGetEntryVal(de);
+
+    if (type->len == (size_t)pvariant+7) {
+        /* (p)message */
+        __redisSubscriberDispatch(s,sub,reply,pvariant);
+        return;
+    }
+
+    if (type->str[pvariant] == 'u') {
+        /* The server dropped the subscription. Listeners that arrived since
+         * the unsubscribe was sent need it back. */
+        if (sub->listeners != NULL) {
+            sub->state = REDIS_SUBSCRIPTION_PENDING;
+            if (__redisSubscriberSend(s,sub,1) != REDIS_OK)
+                dictDelete(d,dictGetEntryKey(de));
+        } else {
+            dictDelete(d,dictGetEntryKey(de));
+        }
+    } else if (sub->state == REDIS_SUBSCRIPTION_PENDING) {
+        sub->state = REDIS_SUBSCRIPTION_ACTIVE;
+    }
+    ac->c.reader->fn->freeObject(reply);
+}
+
+redisSubscriber *redisSubscriberCreate(redisAsyncContext *ac) {
+    redisSubscriber *s;
+
+    if ((s = calloc(1,sizeof(*s))) == NULL)
+        return NULL;
+    s->channels = dictCreate(&subscriptionDict,NULL);
+    s->patterns = dictCreate(&subscriptionDict,NULL);
+    if (s->channels == NULL || s->patterns == NULL) {
+        if (s->channels) dictRelease(s->channels);
+        if (s->patterns) dictRelease(s->patterns);
+        free(s);
+        return NULL;
+    }
+    s->ac = ac;
+    ac->c.flags |= REDIS_NO_AUTO_FREE_REPLIES;
+    return s;
+}
+
+/* Point the callbacks of the context away from the subscriber, so it can be
+ * free'd before the context runs them one last time. */
+static void __redisSubscriberDetach(redisSubscriber *s) {
+    dict *subs[2] = {s->ac->sub.channels, s->ac->sub.patterns};
+    redisCallback *cb;
+    dictIterator *it;
+    dictEntry *de;
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        it = dictGetIterator(subs[i]);
+        while ((de = dictNext(it)) != NULL) {
+            cb = dictGetEntryVal(de);
+            if (cb->privdata == s) cb->fn = NULL;
+        }
+        dictReleaseIterator(it);
+    }
+    s->ac->c.flags &= ~REDIS_NO_AUTO_FREE_REPLIES;
+}
+
+void redisSubscriberFree(redisSubscriber *s) {
+    if (s->ac != NULL) {
+        __redisSubscriberDetach(s);
+        redisAsyncFree(s->ac);
+    }
+    dictRelease(s->channels);
+    dictRelease(s->patterns);
+    free(s);
+}
+
+static redisListener *__redisSubscriberListen(redisSubscriber *s, const char *name,
+                                              int pattern, redisListenerFn *fn,
+                                              void *privdata)
+{
+    dict *d = pattern ? s->patterns : s->channels;
+    redisSubscription *sub;
+    redisListener *l;
+    dictEntry *de;
+
+    if (s->ac == NULL)
+        return NULL;
+    if ((l = malloc(sizeof(*l))) == NULL)
+        return NULL;
+    l->fn = fn;
+    l->privdata = privdata;
+
+    de = dictFindBuffer(d,name,strlen(name));
+    if (de != NULL) {
+        /* A pending unsubscribe is undone when it is confirmed. */
+        sub = dictGetEntryVal(de);
+    } else {
+        if ((sub = calloc(1,sizeof(*sub))) == NULL ||
+            (sub->name = sdsnew(name)) == NULL)
+        {
+            free(sub);
+            free(l);
+            return NULL;
+        }
+        sub->pattern = pattern;
+        sub->state = REDIS_SUBSCRIPTION_PENDING;
+        if (dictReserve(d,1) != DICT_OK ||
+            __redisSubscriberSend(s,sub,1) != REDIS_OK ||
+            dictAdd(d,sub->name,sub) != DICT_OK)
+        {
+            sdsfree(sub->name);
+            free(sub);
+            free(l);
+            return NULL;
+        }
+    }
+
+    l->sub = sub;
+    l->next = sub->listeners;
+    sub->listeners = l;
+    return l;
+}
+
+redisListener *redisSubscriberListen(redisSubscriber *s, const char *channel,
+                                     redisListenerFn *fn, void *privdata)
+{
+    return __redisSubscriberListen(s,channel,0,fn,privdata);
+}
+
+redisListener *redisSubscriberListenPattern(redisSubscriber *s, const char *pattern,
+                                            redisListenerFn *fn, void *privdata)
+{
+    return __redisSubscriberListen(s,pattern,1,fn,privdata);
+}
+
+void redisSubscriberUnlisten(redisSubscriber *s, redisListener *l) {
+    redisSubscription *sub = l->sub;
+    redisListener **pl;
+
+    if (s->dispatching == sub) {
+        /* The dispatch loop may hold a pointer to it */
+        l->fn = NULL;
+        s->removed = 1;
+    } else {
+        for (pl = &sub->listeners; *pl != l; pl = &(*pl)->next);
+        *pl = l->next;
+        free(l);
+    }
+
+    for (l = sub->listeners; l != NULL; l = l->next)
+        if (l->fn != NULL) return;
+
+    /* This was the last listener. The subscription stays around until the
+     * server confirms, so a new listener doesn't subscribe twice. */
+    if (sub->state != REDIS_SUBSCRIPTION_LEAVING && s->ac != NULL) {
+        sub->state = REDIS_SUBSCRIPTION_LEAVING;
+        __redisSubscriberSend(s,sub,0);
+    }
+}
+
+void redisMessageRetain(redisMessage *msg) {
+    msg->refcount++;
+}
+
+void redisMessageRelease(redisMessage *msg) {
+    if (--msg->refcount > 0)
+        return;
+    msg->freeObject(msg->reply);
+    free(msg);
+}
@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) 2009-2011, Salvatore Sanfilippo <antirez at gmail dot com>
+ * Copyright (c) 2010-2011, Pieter Noordhuis <pcnoordhuis at gmail dot com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __HIREDIS_SUBSCRIBER_H
+#define __HIREDIS_SUBSCRIBER_H
+#include "async.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct redisSubscriber; /* need forward declaration of redisSubscriber */
+struct dict; /* dictionary header is included in subscriber.c */
+
+/* A pub/sub message, shared by all listeners it is delivered to. It is valid
+ * during the listener callback; call redisMessageRetain() to keep it longer
+ * and redisMessageRelease() when done. */
+typedef struct redisMessage {
+    redisReply *reply; /* ["message", channel, payload] or
+                          ["pmessage", pattern, channel, payload] */
+    redisReply *channel;
+    redisReply *payload;
+
+    /* Private to the subscriber */
+    int refcount;
+    void (*freeObject)(void*);
+} redisMessage;
+
+typedef void (redisListenerFn)(struct redisSubscriber*, redisMessage*, void*);
+
+typedef struct redisListener {
+    redisListenerFn *fn; /* NULL once removed */
+    void *privdata;
+    struct redisSubscription *sub;
+    struct redisListener *next;
+} redisListener;
+
+/* A channel or pattern the server was asked to deliver */
+typedef struct redisSubscription {
+    sds name;
+    int pattern;
+    int state; /* REDIS_SUBSCRIPTION_* */
+    redisListener *listeners;
+} redisSubscription;
+
+#define REDIS_SUBSCRIPTION_PENDING 0 /* SUBSCRIBE sent, not confirmed yet */
+#define REDIS_SUBSCRIPTION_ACTIVE 1
+#define REDIS_SUBSCRIPTION_LEAVING 2 /* UNSUBSCRIBE sent for the last listener */
+
+/* Multiplexes one connection's subscriptions to any number of in-process
+ * listeners. The server is only told to (un)subscribe when the first listener
+ * of a channel arrives or the last one leaves. */
+typedef struct redisSubscriber {
+    redisAsyncContext *ac; /* NULL once the context is gone */
+    struct dict *channels;
+    struct dict *patterns;
+    redisSubscription *dispatching; /* Its listeners are removed lazily */
+    int removed; /* Listeners removed while dispatching */
+} redisSubscriber;
+
+/* Take over an async context that is used for nothing else: its callbacks own
+ * their replies from now on (REDIS_NO_AUTO_FREE_REPLIES). */
+redisSubscriber *redisSubscriberCreate(redisAsyncContext *ac);
+
+/* Free the subscriber, its listeners and the context. Must not be called from
+ * a listener callback. */
+void redisSubscriberFree(redisSubscriber *s);
+
+/* Deliver the messages of a channel (or of the channels that match a pattern)
+ * to "fn". Returns NULL when out of memory or when the context is gone. */
+redisListener *redisSubscriberListen(redisSubscriber *s, const char *channel,
+                                     redisListenerFn *fn, void *privdata);
+redisListener *redisSubscriberListenPattern(redisSubscriber *s, const char *pattern,
+                                            redisListenerFn *fn, void *privdata);
+
+/* Stop delivering to a listener. Safe to call from any listener callback. */
+void redisSubscriberUnlisten(redisSubscriber *s, redisListener *l);
+
+void redisMessageRetain(redisMessage *msg);
+void redisMessageRelease(redisMessage *msg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -9,9 +9,33 @@
 #include <signal.h>
 #include <errno.h>
 #include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/wait.h>
+/* Keep connect(2) from clashing with the helper below */
+#define connect __socket_connect
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#undef connect
 
 #include "hiredis.h"
 #include "net.h"
+#include "pool.h"
+#include "dns.h"
+#include "async.h"
+#include "subscriber.h"
+#include "shard.h"
+#include "cluster.h"
+#include "ring.h"
+#include "sentinel.h"
+#include "router.h"
+#ifdef __linux__
+#include "adapters/epoll.h"
+#include "adapters/iouring.h"
+#endif
 
 enum connection_type {
     CONN_TCP,
@@ -123,8 +147,12 @@ static redisContext *connect(struct config config) {
 }
 
 static void test_format_commands(void) {
+    const char *ro[] = {"bitcount","bitfield_ro","eval_ro","fcall_ro","georadius_ro",
+        "georadiusbymember_ro","geosearch","hscan","lpos","scan","sdiff","sinter","sort_ro",
+        "srandmember","sscan","sunion","xrange","xread","zrangebylex","zrevrangebyscore",
+        "zscan","zscore","zunion"};
     char *cmd;
-    int len;
+    int len, i, ok;
 
     test("Format command without interpolation: ");
     len = redisFormatCommand(&cmd,"SET foo bar");
@@ -240,6 +268,21 @@ static void test_format_commands(void) {
     test_cond(strncmp(sds_cmd,"*3\r\n$3\r\nSET\r\n$7\r\nfoo\0xxx\r\n$3\r\nbar\r\n",len) == 0 &&
         len == 4+4+(3+2)+4+(7+2)+4+(3+2));
     sdsfree(sds_cmd);
+
+    test("Command flags tell read-only and idempotent commands apart: ");
+    test_cond(redisCommandFlags("GET",3) == (REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT) &&
+        redisCommandFlags("set",3) == 0 && redisCommandFlags("zadd",4) == 0 &&
+        redisCommandFlags("hset",4) == REDIS_CMD_IDEMPOTENT &&
+        redisCommandFlags("zscore",6) != 0 && redisCommandFlags("getx",3) != 0 &&
+        redisCommandFlags("incr",4) == 0 && redisCommandFlags("expire",6) == 0 &&
+        redisCommandFlags("ge",2) == 0 && redisCommandFlags("getx",4) == 0);
+
+    /* The lookup is a binary search, so one entry out of order hides others */
+    test("Command flags know the read-only commands of every type: ");
+    for (i = 0, ok = 1; i < (int)(sizeof(ro)/sizeof(ro[0])); i++)
+        ok &= (redisCommandFlags(ro[i],strlen(ro[i])) ==
+               (REDIS_CMD_READONLY|REDIS_CMD_IDEMPOTENT));
+    test_cond(ok && redisCommandFlags("georadius",9) == 0 && redisCommandFlags("sort",4) == 0);
 }
 
 static void test_append_formatted_commands(struct config config) {
@@ -383,6 +426,685 @@ static void test_blocking_connection_errors(void) {
     redisFree(c);
 }
 
+/* Resolver stub: "db.test" has two IPv4 addresses, "slow.test" has the same
+ * ones after 200ms, "empty.test" succeeds without any and nothing else
+ * exists. */
+static pthread_mutex_t __test_dns_lock = PTHREAD_MUTEX_INITIALIZER;
+static int __test_dns_calls = 0;
+
+static int __test_dns_resolve(const char *node, const char *service,
+                              const struct addrinfo *hints, struct addrinfo **res) {
+    const char *ips[] = {"127.0.0.2", "127.0.0.1"};
+    struct addrinfo *ai, **last = res;
+    struct sockaddr_in *sa;
+    int i;
+
+    ((void)service);
+    ((void)hints);
+    pthread_mutex_lock(&__test_dns_lock);
+    __test_dns_calls++;
+    pthread_mutex_unlock(&__test_dns_lock);
+    if (strcmp(node,"empty.test") == 0) {
+        *res = NULL;
+        return 0;
+    }
+    if (strcmp(node,"slow.test") == 0)
+        usleep(200000);
+    else if (strcmp(node,"db.test") != 0)
+        return EAI_NONAME;
+
+    for (i = 0; i < 2; i++) {
+        ai = calloc(1,sizeof(*ai)+sizeof(*sa));
+        assert(ai != NULL);
+        sa = (struct sockaddr_in*)(ai+1);
+        sa->sin_family = AF_INET;
+        inet_pton(AF_INET,ips[i],&sa->sin_addr);
+        ai->ai_family = AF_INET;
+        ai->ai_socktype = SOCK_STREAM;
+        ai->ai_protocol = IPPROTO_TCP;
+        ai->ai_addrlen = sizeof(*sa);
+        ai->ai_addr = (struct sockaddr*)sa;
+        *last = ai;
+        last = &ai->ai_next;
+    }
+    *last = NULL;
+    return 0;
+}
+
+static void __test_dns_free(struct addrinfo *res) {
+    struct addrinfo *next;
+
+    for (; res != NULL; res = next) {
+        next = res->ai_next;
+        free(res);
+    }
+}
+
+static int __test_dns_get_calls(void) {
+    int calls;
+
+    pthread_mutex_lock(&__test_dns_lock);
+    calls = __test_dns_calls;
+    pthread_mutex_unlock(&__test_dns_lock);
+    return calls;
+}
+
+static int __test_dns_wait_refreshes(unsigned long long refreshes) {
+    redisDnsStats stats;
+    int i;
+
+    for (i = 0; i < 1000; i++) {
+        redisDnsGetStats(&stats);
+        if (stats.refreshes > refreshes)
+            return 1;
+        usleep(1000);
+    }
+    return 0;
+}
+
+static void test_dns_cache(void) {
+    struct timeval ttl = { REDIS_DNS_DEFAULT_TTL/1000, 0 };
+    struct timeval negative_ttl = { 0, REDIS_DNS_DEFAULT_NEGATIVE_TTL*1000 };
+    struct timeval off = { 0, 0 };
+    struct addrinfo *res;
+    redisDnsStats before, after;
+    int rv1, rv2, calls;
+
+    redisDnsSetResolver(__test_dns_resolve,__test_dns_free);
+
+    test("DNS cache is off by default: ");
+    calls = __test_dns_get_calls();
+    rv1 = redisDnsLookup("db.test",6379,&res);
+    if (rv1 == 0) redisDnsFreeAddrinfo(res);
+    rv2 = redisDnsLookup("db.test",6379,&res);
+    if (rv2 == 0) redisDnsFreeAddrinfo(res);
+    redisDnsGetStats(&after);
+    test_cond(rv1 == 0 && rv2 == 0 && __test_dns_get_calls() == calls+2 &&
+              after.entries == 0);
+
+    test("DNS cache answers repeated lookups: ");
+    redisDnsSetTTL(ttl,negative_ttl);
+    redisDnsFlush();
+    calls = __test_dns_get_calls();
+    redisDnsGetStats(&before);
+    rv1 = redisDnsLookup("db.test",6379,&res);
+    if (rv1 == 0) redisDnsFreeAddrinfo(res);
+    rv2 = redisDnsLookup("db.test",6380,&res);
+    redisDnsGetStats(&after);
+    test_cond(rv1 == 0 && rv2 == 0 && after.misses == before.misses+1 &&
+              after.hits == before.hits+1 && after.entries == 1 &&
+              __test_dns_get_calls() == calls+1 &&
+              ntohs(((struct sockaddr_in*)res->ai_addr)->sin_port) == 6380 &&
+              res->ai_next != NULL && res->ai_next->ai_next == NULL);
+    if (rv2 == 0) redisDnsFreeAddrinfo(res);
+
+    test("DNS cache keeps negative results: ");
+    calls = __test_dns_get_calls();
+    rv1 = redisDnsLookup("idontexist.test",6379,&res);
+    redisDnsGetStats(&before);
+    rv2 = redisDnsLookup("idontexist.test",6379,&res);
+    redisDnsGetStats(&after);
+    test_cond(rv1 == EAI_NONAME && rv2 == rv1 && after.hits == before.hits+1 &&
+              __test_dns_get_calls() == calls+1);
+
+    test("DNS lookup fails when the resolver returns no address: ");
+    rv1 = redisDnsLookup("empty.test",6379,&res);
+    test_cond(rv1 == EAI_NONAME);
+
+    test("DNS cache serves expired entries while refreshing them: ");
+    redisDnsSetTTL((struct timeval){ 0, 1000 },negative_ttl);
+    redisDnsFlush();
+    rv1 = redisDnsLookup("db.test",6379,&res);
+    if (rv1 == 0) redisDnsFreeAddrinfo(res);
+    usleep(5000);
+    redisDnsGetStats(&before);
+    rv1 = redisDnsLookup("db.test",6379,&res);
+    if (rv1 == 0) redisDnsFreeAddrinfo(res);
+    redisDnsGetStats(&after);
+    test_cond(rv1 == 0 && after.hits == before.hits+1 &&
+              after.stale == before.stale+1 &&
+              __test_dns_wait_refreshes(before.refreshes));
+
+    test("DNS prefetch resolves in the background: ");
+    redisDnsSetTTL(ttl,negative_ttl);
+    redisDnsFlush();
+    redisDnsGetStats(&before);
+    assert(redisDnsPrefetch("db.test") == REDIS_OK);
+    rv1 = __test_dns_wait_refreshes(before.refreshes);
+    rv2 = redisDnsLookup("db.test",6379,&res);
+    if (rv2 == 0) redisDnsFreeAddrinfo(res);
+    redisDnsGetStats(&after);
+    test_cond(rv1 && rv2 == 0 && after.misses == before.misses &&
+              after.hits == before.hits+1);
+
+    redisDnsFlush();
+    redisDnsSetTTL(off,negative_ttl);
+    redisDnsSetResolver(NULL,NULL);
+}
+
+/* Cluster stand-in: three nodes on loopback, served by a forked process and
+ * sharing one keyspace. Every node owns a third of the slots and redirects
+ * commands on the others. "STANDIN MOVE <slot> <node>" hands a slot over and
+ * "STANDIN ASK <slot> <node>" makes its owner answer ASK for it. The nodes
+ * also act as sentinels of "mymaster", which is node 1 until "STANDIN SWITCH
+ * <node>" publishes a +switch-master, and answer ECHO with their number and
+ * the name given by CLIENT SETNAME, if any.
+ * INFO lists nodes 1 and 2 as online replicas of node 0. */
+#define __TEST_CLUSTER_NODES 3
+
+static int __test_cluster_ports[__TEST_CLUSTER_NODES];
+static unsigned char __test_cluster_owner[REDIS_CLUSTER_SLOTS];
+static signed char __test_cluster_ask[REDIS_CLUSTER_SLOTS];
+static sds *__test_cluster_keys, *__test_cluster_vals;
+static int __test_cluster_nkeys;
+static int __test_sentinel_master = 1;
+static int __test_sentinel_subs[16], __test_sentinel_nsubs;
+static char __test_cluster_names[256][16]; /* By descriptor */
+
+static sds *__test_cluster_lookup(sds key) {
+    int i;
+
+    for (i = 0; i < __test_cluster_nkeys; i++)
+        if (sdscmp(__test_cluster_keys[i],key) == 0)
+            return &__test_cluster_vals[i];
+    __test_cluster_keys = realloc(__test_cluster_keys,(i+1)*sizeof(sds));
+    __test_cluster_vals = realloc(__test_cluster_vals,(i+1)*sizeof(sds));
+    __test_cluster_keys[i] = sdsdup(key);
+    __test_cluster_vals[i] = NULL;
+    __test_cluster_nkeys++;
+    return &__test_cluster_vals[i];
+}
+
+static sds __test_cluster_slots(sds out) {
+    int start, end, n = 0;
+
+    for (start = 0; start < REDIS_CLUSTER_SLOTS; start = end+1, n++)
+        for (end = start; end+1 < REDIS_CLUSTER_SLOTS &&
+             __test_cluster_owner[end+1] == __test_cluster_owner[start]; end++);
+    out = sdscatprintf(out,"*%d\r\n",n);
+    for (start = 0; start < REDIS_CLUSTER_SLOTS; start = end+1) {
+        for (end = start; end+1 < REDIS_CLUSTER_SLOTS &&
+             __test_cluster_owner[end+1] == __test_cluster_owner[start]; end++);
+        out = sdscatprintf(out,"*3\r\n:%d\r\n:%d\r\n*2\r\n$9\r\n127.0.0.1\r\n:%d\r\n",
+            start,end,__test_cluster_ports[__test_cluster_owner[start]]);
+    }
+    return out;
+}
+
+static sds __test_sentinel_exec(sds out, int fd, int node, int argc, sds *argv) {
+    sds payload, msg;
+    int i;
+
+    if (!strcasecmp(argv[0],"SENTINEL") && argc == 3) {
+        if (strcmp(argv[2],"mymaster") != 0)
+            return sdscat(out,"*-1\r\n");
+        return sdscatprintf(out,"*2\r\n$9\r\n127.0.0.1\r\n$%d\r\n%d\r\n",
+            (int)snprintf(NULL,0,"%d",__test_cluster_ports[__test_sentinel_master]),
+            __test_cluster_ports[__test_sentinel_master]);
+    } else if (!strcasecmp(argv[0],"PING")) {
+        /* Subscribed connections answer like Redis does, others as nodes */
+        for (i = 0; i < __test_sentinel_nsubs && __test_sentinel_subs[i] != fd; i++);
+        return i < __test_sentinel_nsubs ? sdscat(out,"*2\r\n$4\r\npong\r\n$0\r\n\r\n") : NULL;
+    } else if (!strcasecmp(argv[0],"SUBSCRIBE")) {
+        if (__test_sentinel_nsubs < 16)
+            __test_sentinel_subs[__test_sentinel_nsubs++] = fd;
+        return sdscatprintf(out,"*3\r\n$9\r\nsubscribe\r\n$%zu\r\n%s\r\n:1\r\n",
+            sdslen(argv[1]),argv[1]);
+    } else if (!strcasecmp(argv[0],"STANDIN") && argc == 3) {
+        payload = sdscatprintf(sdsempty(),"mymaster 127.0.0.1 %d 127.0.0.1 %d",
+            __test_cluster_ports[__test_sentinel_master],__test_cluster_ports[atoi(argv[2])]);
+        __test_sentinel_master = atoi(argv[2]);
+        msg = sdscatprintf(sdsempty(),"*3\r\n$7\r\nmessage\r\n$14\r\n+switch-master\r\n"
+                                      "$%zu\r\n%s\r\n",sdslen(payload),payload);
+        for (i = 0; i < __test_sentinel_nsubs; i++)
+            assert(write(__test_sentinel_subs[i],msg,sdslen(msg)) == (ssize_t)sdslen(msg));
+        sdsfree(payload);
+        sdsfree(msg);
+        return sdscat(out,"+OK\r\n");
+    } else if (!strcasecmp(argv[0],"ROLE")) {
+        return sdscat(out,"*3\r\n$6\r\nmaster\r\n:0\r\n*0\r\n");
+    } else if (!strcasecmp(argv[0],"CLIENT") && argc == 3 && !strcasecmp(argv[1],"SETNAME")) {
+        snprintf(__test_cluster_names[fd],sizeof(__test_cluster_names[0]),"%s",argv[2]);
+        return sdscat(out,"+OK\r\n");
+    } else if (!strcasecmp(argv[0],"ECHO") && argc == 2) {
+        payload = sdscatprintf(sdsempty(),"%d:%s%s%s",node,__test_cluster_names[fd],
+                               __test_cluster_names[fd][0] ? ":" : "",argv[1]);
+        out = sdscatprintf(out,"$%zu\r\n%s\r\n",sdslen(payload),payload);
+        sdsfree(payload);
+        return out;
+    } else if (!strcasecmp(argv[0],"INFO")) {
+        payload = sdsnew("# Replication\r\n");
+        if (node == 0) {
+            payload = sdscatprintf(payload,"role:master\r\nconnected_slaves:3\r\n");
+            for (i = 1; i < __TEST_CLUSTER_NODES; i++)
+                payload = sdscatprintf(payload,"slave%d:ip=127.0.0.1,port=%d,state=online,"
+                                               "offset=0,lag=0\r\n",i-1,__test_cluster_ports[i]);
+            payload = sdscatprintf(payload,"slave%d:ip=127.0.0.1,port=1,state=wait_bgsave,"
+                                           "offset=0,lag=0\r\n",i-1);
+        } else {
+            payload = sdscat(payload,"role:slave\r\n");
+        }
+        out = sdscatprintf(out,"$%zu\r\n",sdslen(payload));
+        out = sdscatsds(out,payload);
+        sdsfree(payload);
+        return sdscat(out,"\r\n");
+    } else if (!strcasecmp(argv[0],"READONLY") || !strcasecmp(argv[0],"READWRITE")) {
+        return sdscat(out,"+OK\r\n");
+    }
+    return NULL;
+}
+
+static sds __test_cluster_exec(sds out, int fd, int node, int *asking, int argc, sds *argv) {
+    int slot, step, i, n, ask = *asking;
+    sds *val, res;
+
+    *asking = 0;
+    if ((res = __test_sentinel_exec(out,fd,node,argc,argv)) != NULL)
+        return res;
+    if (!strcasecmp(argv[0],"ASKING")) {
+        *asking = 1;
+        return sdscat(out,"+OK\r\n");
+    } else if (!strcasecmp(argv[0],"PING")) {
+        return sdscat(out,"+PONG\r\n");
+    } else if (!strcasecmp(argv[0],"CLUSTER")) {
+        return __test_cluster_slots(out);
+    } else if (!strcasecmp(argv[0],"STANDIN") && argc == 4) {
+        slot = atoi(argv[2]);
+        if (!strcasecmp(argv[1],"MOVE"))
+            __test_cluster_owner[slot] = atoi(argv[3]);
+        else
+            __test_cluster_ask[slot] = atoi(argv[3]);
+        return sdscat(out,"+OK\r\n");
+    } else if (argc < 2) {
+        return sdscat(out,"-ERR wrong number of arguments\r\n");
+    }
+
+    /* Multi-key commands need all their keys in one slot */
+    step = !strcasecmp(argv[0],"MSET") ? 2 :
+           (!strcasecmp(argv[0],"MGET") || !strcasecmp(argv[0],"DEL") ||
+            !strcasecmp(argv[0],"EXISTS")) ? 1 : argc;
+    slot = redisKeySlot(argv[1],sdslen(argv[1]));
+    for (i = 1+step; i < argc; i += step)
+        if ((int)redisKeySlot(argv[i],sdslen(argv[i])) != slot)
+            return sdscat(out,"-CROSSSLOT Keys don't hash to the same slot\r\n");
+    if (__test_cluster_owner[slot] != node && !(ask && __test_cluster_ask[slot] == node))
+        return sdscatprintf(out,"-MOVED %d 127.0.0.1:%d\r\n",slot,
+                            __test_cluster_ports[__test_cluster_owner[slot]]);
+    if (__test_cluster_owner[slot] == node && __test_cluster_ask[slot] >= 0)
+        return sdscatprintf(out,"-ASK %d 127.0.0.1:%d\r\n",slot,
+                            __test_cluster_ports[__test_cluster_ask[slot]]);
+
+    if (!strcasecmp(argv[0],"MGET")) {
+        out = sdscatprintf(out,"*%d\r\n",argc-1);
+        for (i = 1; i < argc; i++) {
+            val = __test_cluster_lookup(argv[i]);
+            if (*val == NULL) {
+                out = sdscat(out,"$-1\r\n");
+            } else {
+                out = sdscatprintf(out,"$%zu\r\n",sdslen(*val));
+                out = sdscatsds(out,*val);
+                out = sdscat(out,"\r\n");
+            }
+        }
+        return out;
+    } else if (!strcasecmp(argv[0],"MSET") && argc % 2 == 1) {
+        for (i = 1; i < argc; i += 2) {
+            val = __test_cluster_lookup(argv[i]);
+            sdsfree(*val);
+            *val = sdsdup(argv[i+1]);
+        }
+        return sdscat(out,"+OK\r\n");
+    } else if (!strcasecmp(argv[0],"DEL") || !strcasecmp(argv[0],"EXISTS")) {
+        for (i = 1, n = 0; i < argc; i++) {
+            val = __test_cluster_lookup(argv[i]);
+            if (*val == NULL) continue;
+            n++;
+            if (!strcasecmp(argv[0],"DEL")) {
+                sdsfree(*val);
+                *val = NULL;
+            }
+        }
+        return sdscatprintf(out,":%d\r\n",n);
+    }
+
+    val = __test_cluster_lookup(argv[1]);
+    if (!strcasecmp(argv[0],"SET") && argc == 3) {
+        sdsfree(*val);
+        *val = sdsdup(argv[2]);
+        return sdscat(out,"+OK\r\n");
+    } else if (!strcasecmp(argv[0],"GET")) {
+        if (*val == NULL)
+            return sdscat(out,"$-1\r\n");
+        out = sdscatprintf(out,"$%zu\r\n",sdslen(*val));
+        out = sdscatsds(out,*val);
+        return sdscat(out,"\r\n");
+    }
+    return sdscat(out,"-ERR unknown command\r\n");
+}
+
+/* Parse and run the complete commands in "buf", returns the bytes used. */
+static size_t __test_cluster_serve(int fd, int node, int *asking, const char *buf, size_t len) {
+    const char *p, *q, *end = buf+len, *start = buf;
+    sds out = sdsempty(), argv[16];
+    long argc, alen, i;
+
+    while (start < end && *start == '*') {
+        p = start;
+        argc = strtol(p+1,NULL,10);
+        if ((p = memchr(p,'\n',end-p)) == NULL)
+            break;
+        p++;
+        for (i = 0; i < argc; i++) {
+            if (p >= end || (q = memchr(p,'\n',end-p)) == NULL)
+                break;
+            alen = strtol(p+1,NULL,10);
+            p = q+1;
+            if (end-p < alen+2)
+                break;
+            if (i < 16) argv[i] = sdsnewlen(p,alen);
+            p += alen+2;
+        }
+        if (i < argc) {
+            while (i-- > 0) if (i < 16) sdsfree(argv[i]);
+            break;
+        }
+        out = __test_cluster_exec(out,fd,node,asking,argc < 16 ? argc : 16,argv);
+        for (i = 0; i < argc && i < 16; i++)
+            sdsfree(argv[i]);
+        start = p;
+    }
+    if (sdslen(out) > 0)
+        assert(write(fd,out,sdslen(out)) == (ssize_t)sdslen(out));
+    sdsfree(out);
+    return start-buf;
+}
+
+static void __test_cluster_standin(int *lfd) {
+    struct pollfd fds[64];
+    int node[64], asking[64], nfds = __TEST_CLUSTER_NODES, i, j;
+    sds buf[64];
+    char chunk[16384];
+    ssize_t n;
+    size_t used;
+
+    for (i = 0; i < REDIS_CLUSTER_SLOTS; i++) {
+        __test_cluster_owner[i] = i*__TEST_CLUSTER_NODES/REDIS_CLUSTER_SLOTS;
+        __test_cluster_ask[i] = -1;
+    }
+    for (i = 0; i < nfds; i++) {
+        fds[i].fd = lfd[i];
+        fds[i].events = POLLIN;
+    }
+
+    while (poll(fds,nfds,-1) > 0) {
+        for (i = 0; i < nfds; i++) {
+            if (!(fds[i].revents & (POLLIN|POLLHUP|POLLERR)))
+                continue;
+            if (i < __TEST_CLUSTER_NODES) {
+                if ((j = accept(fds[i].fd,NULL,NULL)) != -1 && nfds < 64) {
+                    fds[nfds].fd = j;
+                    fds[nfds].events = POLLIN;
+                    fds[nfds].revents = 0;
+                    node[nfds] = i;
+                    asking[nfds] = 0;
+                    buf[nfds++] = sdsempty();
+                }
+                continue;
+            }
+            if ((n = read(fds[i].fd,chunk,sizeof(chunk))) <= 0) {
+                for (j = 0; j < __test_sentinel_nsubs; j++)
+                    if (__test_sentinel_subs[j] == fds[i].fd)
+                        __test_sentinel_subs[j--] = __test_sentinel_subs[--__test_sentinel_nsubs];
+                __test_cluster_names[fds[i].fd][0] = '\0';
+                close(fds[i].fd);
+                sdsfree(buf[i]);
+                fds[i] = fds[--nfds];
+                node[i] = node[nfds];
+                asking[i] = asking[nfds];
+                buf[i--] = buf[nfds];
+                continue;
+            }
+            buf[i] = sdscatlen(buf[i],chunk,n);
+            used = __test_cluster_serve(fds[i].fd,node[i],&asking[i],buf[i],sdslen(buf[i]));
+            sdsrange(buf[i],used,-1);
+        }
+    }
+    exit(0);
+}
+
+static pid_t __test_cluster_start(void) {
+    struct sockaddr_in sa;
+    socklen_t len;
+    int lfd[__TEST_CLUSTER_NODES], i;
+    pid_t pid;
+
+    for (i = 0; i < __TEST_CLUSTER_NODES; i++) {
+        len = sizeof(sa);
+        memset(&sa,0,sizeof(sa));
+        sa.sin_family = AF_INET;
+        sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        lfd[i] = socket(AF_INET,SOCK_STREAM,0);
+        assert(lfd[i] != -1 && bind(lfd[i],(struct sockaddr*)&sa,sizeof(sa)) == 0 &&
+               listen(lfd[i],16) == 0 &&
+               getsockname(lfd[i],(struct sockaddr*)&sa,&len) == 0);
+        __test_cluster_ports[i] = ntohs(sa.sin_port);
+    }
+    if ((pid = fork()) == 0)
+        __test_cluster_standin(lfd);
+    for (i = 0; i < __TEST_CLUSTER_NODES; i++)
+        close(lfd[i]);
+    return pid;
+}
+
+static int __test_cluster_node(redisClusterNode *node) {
+    int i;
+
+    for (i = 0; i < __TEST_CLUSTER_NODES; i++)
+        if (node != NULL && node->port == __test_cluster_ports[i]) return i;
+    return -1;
+}
+
+/* Run a control command of the stand-in on the first node. */
+static void __test_cluster_control(const char *op, int slot, int node) {
+    redisContext *c = redisConnect("127.0.0.1",__test_cluster_ports[0]);
+    freeReplyObject(redisCommand(c,"STANDIN %s %d %d",op,slot,node));
+    redisFree(c);
+}
+
+/* Bit at a time reference of the slot hash */
+static unsigned int __test_cluster_slot(const char *key, size_t len) {
+    unsigned int crc = 0;
+    size_t i;
+    int j;
+
+    for (i = 0; i < len; i++) {
+        crc ^= (unsigned char)key[i] << 8;
+        for (j = 0; j < 8; j++)
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+    return crc & 0x3fff;
+}
+
+/* Shard of a key by the slot map the stand-in starts with */
+static int __test_cluster_shard(const char *key, size_t len, void *privdata) {
+    (void)privdata;
+    return redisKeySlot(key,len)*__TEST_CLUSTER_NODES/REDIS_CLUSTER_SLOTS;
+}
+
+static int __test_reply_is(redisReply *reply, const char *str) {
+    if (str == NULL)
+        return reply->type == REDIS_REPLY_NIL;
+    return reply->type == REDIS_REPLY_STRING && strcmp(reply->str,str) == 0;
+}
+
+static void test_cluster(void) {
+    redisClusterContext *cc;
+    redisContext *shards[__TEST_CLUSTER_NODES];
+    redisReply *reply;
+    char addrs[64], keys[__TEST_CLUSTER_NODES][24], missing[__TEST_CLUSTER_NODES][32];
+    const char *argv[8];
+    pid_t pid = __test_cluster_start();
+    int i, ok, used[__TEST_CLUSTER_NODES] = {0}, slot, owner;
+
+    test("Key slots are the CRC16 of the key or of its hash tag: ");
+    test_cond(redisKeySlot("foo",3) == 12182 && redisKeySlot("123456789",9) == 12739 &&
+              redisKeySlot("{user1000}.following",20) == redisKeySlot("user1000",8) &&
+              redisKeySlot("foo{}{bar}",10) != redisKeySlot("bar",3) &&
+              redisKeySlot("foo{{bar}}zap",13) == redisKeySlot("{bar",4));
+
+    test("Key slots of keys of any length match a bitwise CRC16, one by one and in batches: ");
+    {
+        const char *keys[100];
+        size_t lens[100];
+        unsigned int slots[100];
+        char buf[100];
+
+        for (i = 0; i < 100; i++) {
+            buf[i] = 'a'+(i*7)%26;
+            keys[i] = buf;
+            lens[i] = i;
+        }
+        redisKeySlots(keys,lens,100,slots);
+        for (i = 0, ok = 1; i < 100; i++)
+            ok &= (slots[i] == __test_cluster_slot(buf,i) &&
+                   redisKeySlot(buf,i) == slots[i]);
+        test_cond(ok);
+    }
+
+    test("Cluster context without any node fails commands instead of crashing: ");
+    cc = redisClusterConnect("nowhere",NULL);
+    reply = redisClusterCommand(cc,"GET foo");
+    test_cond(cc->err == REDIS_ERR_OTHER && reply == NULL &&
+              strcmp(cc->errstr,"No cluster node") == 0);
+    redisClusterFree(cc);
+
+    test("Cluster context loads the slot map from a reachable node: ");
+    snprintf(addrs,sizeof(addrs),"127.0.0.1:1,127.0.0.1:%d",__test_cluster_ports[1]);
+    cc = redisClusterConnect(addrs,NULL);
+    test_cond(cc != NULL && cc->err == 0 &&
+              __test_cluster_node(cc->slots[0]) == 0 &&
+              __test_cluster_node(cc->slots[8191]) == 1 &&
+              __test_cluster_node(cc->slots[16383]) == 2);
+
+    test("Cluster pipeline splits commands over the nodes: ");
+    for (i = 0; i < 300; i++)
+        redisClusterAppendCommand(cc,"SET key:%d %d",i,i);
+    for (i = 0; i < 300; i++)
+        redisClusterAppendCommand(cc,"GET key:%d",i);
+    for (i = 0, ok = 1; i < 600; i++) {
+        if (redisClusterGetReply(cc,(void**)&reply) != REDIS_OK) {
+            ok = 0;
+            break;
+        }
+        if (i < 300)
+            ok &= (reply->type == REDIS_REPLY_STATUS);
+        else
+            ok &= (reply->type == REDIS_REPLY_STRING && atoi(reply->str) == i-300);
+        freeReplyObject(reply);
+    }
+    for (i = 0; i < cc->nnodes; i++)
+        if (cc->nodes[i]->c != NULL && __test_cluster_node(cc->nodes[i]) >= 0)
+            used[__test_cluster_node(cc->nodes[i])] = 1;
+    test_cond(ok && used[0] && used[1] && used[2]);
+
+    /* A key on every node, and a missing key in the same slot */
+    for (i = 0, slot = 0; slot < __TEST_CLUSTER_NODES; i++) {
+        snprintf(keys[slot],sizeof(keys[slot]),"multi:%d",i);
+        if (__test_cluster_shard(keys[slot],strlen(keys[slot]),NULL) == slot) {
+            snprintf(missing[slot],sizeof(missing[slot]),"{%s}nokey",keys[slot]);
+            slot++;
+        }
+    }
+
+    test("Cluster MSET and MGET are split per slot and merged in key order: ");
+    argv[0] = "MSET";
+    argv[1] = keys[0]; argv[2] = "a";
+    argv[3] = keys[1]; argv[4] = "b";
+    argv[5] = keys[2]; argv[6] = "c";
+    reply = redisClusterMultiCommandArgv(cc,7,argv,NULL);
+    ok = (reply != NULL && reply->type == REDIS_REPLY_STATUS);
+    freeReplyObject(reply);
+    argv[0] = "MGET";
+    argv[1] = keys[2];
+    argv[2] = missing[0];
+    argv[3] = keys[0];
+    argv[4] = keys[1];
+    reply = redisClusterMultiCommandArgv(cc,5,argv,NULL);
+    test_cond(ok && reply != NULL && reply->type == REDIS_REPLY_ARRAY && reply->elements == 4 &&
+              __test_reply_is(reply->element[0],"c") && __test_reply_is(reply->element[1],NULL) &&
+              __test_reply_is(reply->element[2],"a") && __test_reply_is(reply->element[3],"b"));
+    freeReplyObject(reply);
+
+    test("Cluster DEL and EXISTS sum the counts of every node: ");
+    argv[0] = "DEL";
+    argv[1] = keys[0];
+    argv[2] = missing[2];
+    argv[3] = keys[1];
+    reply = redisClusterMultiCommandArgv(cc,4,argv,NULL);
+    ok = (reply != NULL && reply->type == REDIS_REPLY_INTEGER && reply->integer == 2);
+    freeReplyObject(reply);
+    argv[0] = "exists";
+    argv[1] = keys[0];
+    argv[2] = keys[1];
+    argv[3] = keys[2];
+    argv[4] = missing[1];
+    reply = redisClusterMultiCommandArgv(cc,5,argv,NULL);
+    test_cond(ok && reply != NULL && reply->type == REDIS_REPLY_INTEGER && reply->integer == 1);
+    freeReplyObject(reply);
+
+    test("Multi-key commands are split over contexts by a shard function: ");
+    for (i = 0; i < __TEST_CLUSTER_NODES; i++)
+        shards[i] = redisConnect("127.0.0.1",__test_cluster_ports[i]);
+    argv[0] = "MSET";
+    argv[1] = keys[1]; argv[2] = "x";
+    argv[3] = keys[0]; argv[4] = "y";
+    reply = redisMultiCommandArgv(shards,__TEST_CLUSTER_NODES,__test_cluster_shard,NULL,5,argv,NULL);
+    ok = (reply != NULL && reply->type == REDIS_REPLY_STATUS);
+    freeReplyObject(reply);
+    argv[0] = "MGET";
+    argv[1] = keys[0];
+    argv[2] = keys[1];
+    argv[3] = keys[2];
+    reply = redisMultiCommandArgv(shards,__TEST_CLUSTER_NODES,__test_cluster_shard,NULL,4,argv,NULL);
+    test_cond(ok && reply != NULL && reply->type == REDIS_REPLY_ARRAY && reply->elements == 3 &&
+              __test_reply_is(reply->element[0],"y") && __test_reply_is(reply->element[1],"x") &&
+              __test_reply_is(reply->element[2],"c"));
+    freeReplyObject(reply);
+    for (i = 0; i < __TEST_CLUSTER_NODES; i++)
+        redisFree(shards[i]);
+
+    test("Cluster context follows MOVED and updates the slot map: ");
+    slot = redisKeySlot("moved",5);
+    owner = __test_cluster_node(cc->slots[slot]);
+    __test_cluster_control("MOVE",slot,(owner+1)%__TEST_CLUSTER_NODES);
+    reply = redisClusterCommand(cc,"SET moved 1");
+    test_cond(reply != NULL && reply->type == REDIS_REPLY_STATUS &&
+              __test_cluster_node(cc->slots[slot]) == (owner+1)%__TEST_CLUSTER_NODES);
+    freeReplyObject(reply);
+
+    test("Cluster context follows ASK but keeps the slot map: ");
+    slot = redisKeySlot("asked",5);
+    owner = __test_cluster_node(cc->slots[slot]);
+    __test_cluster_control("ASK",slot,(owner+1)%__TEST_CLUSTER_NODES);
+    reply = redisClusterCommand(cc,"SET asked 1");
+    test_cond(reply != NULL && reply->type == REDIS_REPLY_STATUS &&
+              __test_cluster_node(cc->slots[slot]) == owner);
+    freeReplyObject(reply);
+
+    test("Cluster context gives up after too many redirects: ");
+    /* The new owner keeps asking for itself */
+    __test_cluster_control("MOVE",slot,(owner+1)%__TEST_CLUSTER_NODES);
+    __test_cluster_control("ASK",slot,(owner+1)%__TEST_CLUSTER_NODES);
+    reply = redisClusterCommand(cc,"GET asked");
+    test_cond(reply != NULL && reply->type == REDIS_REPLY_ERROR &&
+              strncmp(reply->str,"ASK ",4) == 0);
+    freeReplyObject(reply);
+
+    redisClusterFree(cc);
+    kill(pid,SIGTERM);
+    waitpid(pid,NULL,0);
+}
+
 static void test_blocking_connection(struct config config) {
     redisContext *c;
     redisReply *reply;
@@ -458,6 +1180,346 @@ static void test_blocking_connection(struct config config) {
               strcasecmp(reply->element[1]->str,"pong") == 0);
     freeReplyObject(reply);
 
+    test("Read size grows for large replies: ");
+    {
+        char *big = malloc(1024*1024*2);
+        size_t grown;
+        int j;
+
+        memset(big,'x',1024*1024*2);
+        freeReplyObject(redisCommand(c,"SET bigkey %b",big,(size_t)1024*1024*2));
+        reply = redisCommand(c,"GET bigkey");
+        grown = c->readsize;
+        test_cond(reply->type == REDIS_REPLY_STRING && reply->len == 1024*1024*2 &&
+                  memcmp(reply->str,big,reply->len) == 0 && grown > REDIS_READ_MIN);
+        freeReplyObject(reply);
+        for (j = 0; j < 10; j++)
+            freeReplyObject(redisCommand(c,"PING"));
+        test("Read size shrinks back for small replies: ");
+        test_cond(c->readsize == REDIS_READ_MIN);
+        free(big);
+    }
+
+    disconnect(c, 0);
+}
+
+static int __test_timer_armed = 0;
+static struct timeval __test_timer_tv;
+static int __test_timeout_status = 0, __test_timeout_err = 0;
+
+static void __test_schedule_timer(void *privdata, struct timeval tv) {
+    ((void)privdata);
+    __test_timer_armed++;
+    __test_timer_tv = tv;
+}
+
+static void __test_timeout_connect_callback(const redisAsyncContext *ac, int status) {
+    __test_timeout_status = status;
+    __test_timeout_err = ac->err;
+}
+
+static void test_async_deadlines(struct config config) {
+    redisAsyncContext *ac;
+    struct timeval tv = {0,50000};
+
+    /* Drive the timer hook by hand, before the connection had a chance to
+     * report that it is established. */
+    test("Async connect deadline arms the adapter timer: ");
+    if (config.type == CONN_TCP)
+        ac = redisAsyncConnect(config.tcp.host,config.tcp.port);
+    else
+        ac = redisAsyncConnectUnix(config.unix_sock.path);
+    assert(ac->err == 0);
+    __test_timer_armed = 0;
+    __test_timeout_status = REDIS_OK;
+    ac->ev.scheduleTimer = __test_schedule_timer;
+    redisAsyncSetConnectCallback(ac,__test_timeout_connect_callback);
+    redisAsyncSetConnectTimeout(ac,tv);
+    test_cond(__test_timer_armed == 1 && __test_timer_tv.tv_sec == 0 &&
+              __test_timer_tv.tv_usec > 0 && __test_timer_tv.tv_usec <= 50000);
+
+    test("Async timer that fires early is re-armed: ");
+    redisAsyncHandleTimeout(ac);
+    test_cond(__test_timer_armed == 2 && __test_timeout_status == REDIS_OK);
+
+    test("Async connect deadline fails the connect callback: ");
+    usleep(60000);
+    redisAsyncHandleTimeout(ac);
+    test_cond(__test_timeout_status == REDIS_ERR && __test_timeout_err == REDIS_ERR_TIMEOUT);
+}
+
+static int __test_budget_replies = 0;
+
+static void __test_budget_callback(redisAsyncContext *ac, void *r, void *privdata) {
+    redisReply *reply = r;
+    ((void)ac); ((void)privdata);
+    if (reply != NULL && reply->len == 100000)
+        __test_budget_replies++;
+}
+
+/* Fetch ten 100k values over an async context driven by hand and return the
+ * number of read events it took. */
+static int __test_async_read_events(struct config config, size_t budget) {
+    redisAsyncContext *ac;
+    struct pollfd pfd;
+    int j, events = 0;
+
+    if (config.type == CONN_TCP)
+        ac = redisAsyncConnect(config.tcp.host,config.tcp.port);
+    else
+        ac = redisAsyncConnectUnix(config.unix_sock.path);
+    assert(ac->err == 0);
+    redisAsyncSetReadBudget(ac,budget);
+
+    __test_budget_replies = 0;
+    redisAsyncCommand(ac,NULL,NULL,"SELECT 9");
+    for (j = 0; j < 10; j++)
+        redisAsyncCommand(ac,__test_budget_callback,NULL,"GET budget:big");
+
+    pfd.fd = ac->c.fd;
+    while (!(ac->c.flags & REDIS_CONNECTED) || sdslen(ac->c.obuf) > 0) {
+        pfd.events = POLLOUT;
+        if (poll(&pfd,1,1000) <= 0) break;
+        redisAsyncHandleWrite(ac);
+    }
+    while (__test_budget_replies < 10) {
+        usleep(1000);
+        pfd.events = POLLIN;
+        if (poll(&pfd,1,1000) <= 0) break;
+        redisAsyncHandleRead(ac);
+        events++;
+    }
+    if (__test_budget_replies < 10) events = -1;
+    redisAsyncFree(ac);
+    return events;
+}
+
+static void test_async_read_budget(struct config config) {
+    redisContext *c;
+    char *big;
+    int single, drained;
+
+    c = connect(config);
+    big = malloc(100000);
+    memset(big,'x',100000);
+    freeReplyObject(redisCommand(c,"SET budget:big %b",big,(size_t)100000));
+    free(big);
+
+    test("Async read budget drains more per read event: ");
+    single = __test_async_read_events(config,0);
+    drained = __test_async_read_events(config,4*1024*1024);
+    test_cond(single > 0 && drained > 0 && drained < single);
+
+    disconnect(c, 0);
+}
+
+static void test_fastopen(struct config config) {
+    redisContext *c;
+    redisReply *reply;
+
+    test("Fast Open connect delivers the first pipeline: ");
+    c = redisConnectFastOpen(config.tcp.host,config.tcp.port);
+    assert(c != NULL && c->err == 0);
+    redisAppendCommand(c,"SET fastopen yes");
+    redisAppendCommand(c,"GET fastopen");
+    assert(redisGetReply(c,(void**)&reply) == REDIS_OK);
+    freeReplyObject(reply);
+    assert(redisGetReply(c,(void**)&reply) == REDIS_OK);
+    test_cond(reply->type == REDIS_REPLY_STRING && strcmp(reply->str,"yes") == 0);
+    freeReplyObject(reply);
+
+    test("Fast Open is kept on reconnect: ");
+    assert(redisReconnect(c) == REDIS_OK);
+    reply = redisCommand(c,"PING");
+    test_cond((c->flags & REDIS_FASTOPEN) && reply != NULL &&
+              reply->type == REDIS_REPLY_STATUS);
+    freeReplyObject(reply);
+    redisFree(c);
+
+    test("Fast Open connect reports a closed port: ");
+    c = redisConnectFastOpen(config.tcp.host,1);
+    if (c->err == 0) {
+        /* The handshake was deferred to the first write. */
+        reply = redisCommand(c,"PING");
+        assert(reply == NULL);
+    }
+    test_cond(c->err == REDIS_ERR_IO && strcmp(c->errstr,"Connection refused") == 0);
+    redisFree(c);
+}
+
+static int __test_getsockopt(int fd, int level, int name) {
+    socklen_t len = sizeof(int);
+    int val;
+
+    if (getsockopt(fd,level,name,&val,&len) == -1)
+        return -1;
+    return val;
+}
+
+static void test_connect_with_options(struct config config) {
+    struct timeval timeout = { 1, 0 };
+    redisOptions options;
+    redisContext *c;
+    redisReply *reply;
+    int ok, rcvbuf, sndbuf;
+
+    memset(&options,0,sizeof(options));
+    if (config.type == CONN_TCP)
+        REDIS_OPTIONS_SET_TCP(&options,config.tcp.host,config.tcp.port);
+    else
+        REDIS_OPTIONS_SET_UNIX(&options,config.unix_sock.path);
+    options.timeout = &timeout;
+    options.sockopts.rcvbuf = 1<<15;
+    options.sockopts.sndbuf = 1<<15;
+    options.sockopts.quickack = 1;
+    options.sockopts.notsent_lowat = 1<<14;
+    options.sockopts.priority = 4;
+    options.sockopts.tos = 0x10;
+
+    test("Can connect with options: ");
+    c = redisConnectWithOptions(&options);
+    reply = redisCommand(c,"PING");
+    test_cond(c->err == 0 && (c->flags & REDIS_BLOCK) && reply != NULL &&
+              reply->type == REDIS_REPLY_STATUS);
+    freeReplyObject(reply);
+
+    /* Linux reports twice the buffer size that was set. */
+    test("Socket options are kept on reconnect: ");
+    assert(redisReconnect(c) == REDIS_OK);
+    reply = redisCommand(c,"PING");
+    ok = reply != NULL && reply->type == REDIS_REPLY_STATUS;
+    rcvbuf = __test_getsockopt(c->fd,SOL_SOCKET,SO_RCVBUF);
+    sndbuf = __test_getsockopt(c->fd,SOL_SOCKET,SO_SNDBUF);
+    ok = ok && rcvbuf >= 1<<15 && rcvbuf <= 1<<16 &&
+         sndbuf >= 1<<15 && sndbuf <= 1<<16;
+    if (config.type == CONN_TCP) {
+        ok = ok && __test_getsockopt(c->fd,IPPROTO_IP,IP_TOS) == 0x10;
+#ifdef TCP_NOTSENT_LOWAT
+        ok = ok && __test_getsockopt(c->fd,IPPROTO_TCP,TCP_NOTSENT_LOWAT) == 1<<14;
+#endif
+    }
+    test_cond(ok);
+    freeReplyObject(reply);
+    redisFree(c);
+
+    test("Returns error for an invalid connection type: ");
+    options.type = (enum redisConnectionType)42;
+    c = redisConnectWithOptions(&options);
+    test_cond(c->err == REDIS_ERR_OTHER);
+    redisFree(c);
+}
+
+static void test_zerocopy(struct config config) {
+    redisOptions options;
+    redisContext *c;
+    redisReply *reply;
+    unsigned int sends;
+    char *big;
+    int i, ok, done;
+
+    memset(&options,0,sizeof(options));
+    REDIS_OPTIONS_SET_TCP(&options,config.tcp.host,config.tcp.port);
+    options.sockopts.zerocopy = 1<<16;
+    big = malloc(1<<20);
+    for (i = 0; i < 1<<20; i++)
+        big[i] = 'a'+i%26;
+
+    test("Zero copy sends large values intact: ");
+    c = redisConnectWithOptions(&options);
+    assert(c->err == 0);
+    freeReplyObject(redisCommand(c,"SELECT 9"));
+    freeReplyObject(redisCommand(c,"SET zerocopy:big %b",big,(size_t)1<<20));
+    reply = redisCommand(c,"GET zerocopy:big");
+    test_cond(reply != NULL && reply->type == REDIS_REPLY_STRING &&
+              reply->len == 1<<20 && memcmp(reply->str,big,1<<20) == 0);
+    freeReplyObject(reply);
+
+    /* Every command is sent on its own before any reply is read, and every
+     * value is different: a buffer that was freed while the kernel still
+     * sent from it, and reused for the next command, shows up as a wrong
+     * value. */
+    test("Zero copy keeps pipelined buffers until they were sent: ");
+    sends = redisContextZeroCopySends(c);
+    for (i = 0; i < 16; i++) {
+        memset(big,'A'+i,1<<18);
+        redisAppendCommand(c,"SET zerocopy:%d %b",i,big,(size_t)1<<18);
+        do {
+            assert(redisBufferWrite(c,&done) == REDIS_OK);
+        } while (!done);
+    }
+    ok = redisContextZeroCopySends(c) >= sends+16;
+    for (i = 0; i < 16; i++) {
+        assert(redisGetReply(c,(void**)&reply) == REDIS_OK);
+        freeReplyObject(reply);
+    }
+    for (i = 0; i < 16; i++) {
+        memset(big,'A'+i,1<<18);
+        reply = redisCommand(c,"GET zerocopy:%d",i);
+        ok &= reply != NULL && reply->len == 1<<18 && memcmp(reply->str,big,1<<18) == 0;
+        freeReplyObject(reply);
+    }
+    test_cond(ok);
+
+    disconnect(c, 0);
+    free(big);
+}
+
+static void test_send_file(struct config config) {
+    redisContext *c;
+    redisReply *reply;
+    const char *argv[2] = {"SET", NULL};
+    size_t argvlen[2] = {3, 0};
+    char path[] = "/tmp/hiredis-test-XXXXXX";
+    char *buf;
+    int fd, i, ok;
+
+    buf = malloc(1<<20);
+    for (i = 0; i < 1<<20; i++)
+        buf[i] = 'a'+i%26;
+    fd = mkstemp(path);
+    assert(fd != -1 && write(fd,buf,1<<20) == 1<<20);
+    unlink(path);
+    c = connect(config);
+
+    test("Bulk payloads are sent from a file descriptor: ");
+    argv[1] = "sendfile:big";
+    argvlen[1] = strlen(argv[1]);
+    reply = redisCommandArgvFromFd(c,2,argv,argvlen,fd,0,1<<20);
+    ok = reply != NULL && reply->type == REDIS_REPLY_STATUS;
+    freeReplyObject(reply);
+    reply = redisCommand(c,"GET sendfile:big");
+    test_cond(ok && reply != NULL && reply->type == REDIS_REPLY_STRING &&
+              reply->len == 1<<20 && memcmp(reply->str,buf,1<<20) == 0);
+    freeReplyObject(reply);
+
+    test("File payloads keep their place in a pipeline: ");
+    for (i = 0; i < 8; i++) {
+        redisAppendCommand(c,"SET sendfile:%d -",i);
+        argv[1] = "sendfile:part";
+        argvlen[1] = strlen(argv[1]);
+        redisAppendCommandArgvFromFd(c,2,argv,argvlen,fd,i*1000,(i+1)*1000);
+        redisAppendCommand(c,"GET sendfile:part");
+    }
+    for (i = 0, ok = 1; i < 8; i++) {
+        assert(redisGetReply(c,(void**)&reply) == REDIS_OK);
+        freeReplyObject(reply);
+        assert(redisGetReply(c,(void**)&reply) == REDIS_OK);
+        freeReplyObject(reply);
+        assert(redisGetReply(c,(void**)&reply) == REDIS_OK);
+        ok &= reply->len == (size_t)(i+1)*1000 &&
+              memcmp(reply->str,buf+i*1000,(i+1)*1000) == 0;
+        freeReplyObject(reply);
+    }
+    test_cond(ok);
+
+    test("A file that ends early is an error: ");
+    reply = redisCommandArgvFromFd(c,2,argv,argvlen,fd,(1<<20)-10,100);
+    test_cond(reply == NULL && c->err == REDIS_ERR_OTHER);
+
+    assert(redisReconnect(c) == REDIS_OK);
+    freeReplyObject(redisCommand(c,"SELECT 9"));
+    close(fd);
+    free(buf);
     disconnect(c, 0);
 }
 
@@ -507,6 +1569,52 @@ static void test_blocking_connection_timeouts(struct config config) {
     disconnect(c, 0);
 }
 
+static void test_blocking_spin(struct config config) {
+    redisContext *c;
+    redisReply *reply;
+    const char *cmd = "DEBUG SLEEP 0.5\r\n";
+    struct timeval tv = {0,10000};
+    ssize_t s;
+    int i;
+
+    c = connect(config);
+    test("Spin mode can only be enabled on blocking contexts: ");
+    test_cond(redisSetSpin(c,-1) == REDIS_ERR && redisSetSpin(c,100) == REDIS_OK &&
+              (c->flags & REDIS_SPIN) && c->spin_usec == 100);
+
+    test("Spin mode delivers pipelined replies: ");
+    for (i = 0; i < 100; i++)
+        redisAppendCommand(c,"INCR spin:counter");
+    for (i = 0; i < 100; i++) {
+        assert(redisGetReply(c,(void**)&reply) == REDIS_OK);
+        if (i < 99) freeReplyObject(reply);
+    }
+    test_cond(reply->type == REDIS_REPLY_INTEGER && reply->integer == 100);
+    freeReplyObject(reply);
+
+    test("Spin mode honors the read timeout: ");
+    s = write(c->fd,cmd,strlen(cmd));
+    redisSetTimeout(c,tv);
+    reply = redisCommand(c,"PING");
+    test_cond(s > 0 && reply == NULL && c->err == REDIS_ERR_IO &&
+              strcmp(c->errstr,"Resource temporarily unavailable") == 0);
+
+    test("Spin mode is kept across reconnects: ");
+    redisReconnect(c);
+    reply = redisCommand(c,"PING");
+    test_cond(reply != NULL && reply->type == REDIS_REPLY_STATUS &&
+              strcmp(reply->str,"PONG") == 0 && (c->flags & REDIS_SPIN));
+    freeReplyObject(reply);
+
+    test("Spin mode can be turned off: ");
+    redisSetSpin(c,0);
+    reply = redisCommand(c,"PING");
+    test_cond(reply != NULL && reply->type == REDIS_REPLY_STATUS && !(c->flags & REDIS_SPIN));
+    freeReplyObject(reply);
+
+    disconnect(c, 0);
+}
+
 static void test_blocking_io_errors(struct config config) {
     redisContext *c;
     redisReply *reply;
@@ -582,6 +1690,1224 @@ static void test_invalid_timeout_errors(struct config config) {
     redisFree(c);
 }
 
+/* A loopback socket that listens, for servers that hang up or stay silent:
+ * connects complete in the backlog without any accept(). */
+static int __test_listen(int *port) {
+    struct sockaddr_in sa;
+    socklen_t len = sizeof(sa);
+    int fd = socket(AF_INET,SOCK_STREAM,0);
+
+    memset(&sa,0,sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    assert(fd != -1 && bind(fd,(struct sockaddr*)&sa,sizeof(sa)) == 0 &&
+           listen(fd,16) == 0 && getsockname(fd,(struct sockaddr*)&sa,&len) == 0);
+    *port = ntohs(sa.sin_port);
+    return fd;
+}
+
+/* Accept two connections and close them right away. */
+static void *__test_pool_hangup(void *privdata) {
+    int fd, i, lfd = *(int*)privdata;
+
+    for (i = 0; i < 2; i++)
+        if ((fd = accept(lfd,NULL,NULL)) != -1)
+            close(fd);
+    return NULL;
+}
+
+#define __TEST_POOL_THREADS 8
+#define __TEST_POOL_ROUNDS 500
+
+/* Check out, PING and return, with more threads than connections. Returns
+ * non-NULL on failure. */
+static void *__test_pool_thread(void *privdata) {
+    redisPool *pool = privdata;
+    struct timeval wait = { 5, 0 };
+    redisPoolConnection *conn;
+    redisPoolError err;
+    redisReply *reply;
+    int i, ok = 1;
+
+    for (i = 0; i < __TEST_POOL_ROUNDS && ok; i++) {
+        if ((conn = redisPoolGet(pool,&wait,&err)) == NULL)
+            return privdata;
+        reply = redisCommand(conn->c,"PING");
+        ok = (reply != NULL && reply->type == REDIS_REPLY_STATUS);
+        freeReplyObject(reply);
+        redisPoolPut(conn);
+    }
+    return ok ? NULL : privdata;
+}
+
+static void test_pool(struct config config) {
+    redisPool *pool;
+    redisPoolConnection *a, *b, *d;
+    redisPoolStats stats;
+    redisPoolError err;
+    redisReply *reply;
+    struct timeval wait = { 0, 10000 };
+    pthread_t threads[__TEST_POOL_THREADS];
+    void *res;
+    int i, ok, lfd, port;
+
+    if (config.type == CONN_TCP)
+        pool = redisPoolCreate(config.tcp.host,config.tcp.port,1,2,NULL);
+    else
+        pool = redisPoolCreateUnix(config.unix_sock.path,1,2,NULL);
+
+    test("Pool opens min_size connections on create: ");
+    redisPoolGetStats(pool,&stats);
+    test_cond(pool->err == 0 && stats.open == 1 && stats.in_use == 0);
+
+    test("Pool grows up to max_size and times out beyond it: ");
+    a = redisPoolGet(pool,NULL,NULL);
+    b = redisPoolGet(pool,NULL,NULL);
+    d = redisPoolGet(pool,&wait,NULL);
+    redisPoolGetStats(pool,&stats);
+    test_cond(a != NULL && b != NULL && a != b && d == NULL &&
+              stats.open == 2 && stats.in_use == 2 && stats.timeouts == 1 &&
+              stats.max_wait_usec >= 10000);
+
+    test("Pool hands out returned connections: ");
+    redisPoolPut(b);
+    d = redisPoolGet(pool,NULL,NULL);
+    test_cond(d == b);
+    redisPoolPut(d);
+
+    test("Pool reconnects a connection that was returned with an error: ");
+    reply = redisCommand(a->c,"QUIT");
+    freeReplyObject(reply);
+    assert(redisGetReply(a->c,(void**)&reply) == REDIS_ERR);
+    redisPoolPut(a);
+    a = redisPoolGet(pool,NULL,NULL);
+    assert(a != NULL);
+    b = redisPoolGet(pool,NULL,NULL);
+    assert(b != NULL);
+    reply = redisCommand(a->c,"PING");
+    test_cond(reply != NULL && reply->type == REDIS_REPLY_STATUS && b->c->err == 0);
+    freeReplyObject(reply);
+    redisPoolPut(a);
+    redisPoolPut(b);
+
+    test("Pool evicts idle connections down to min_size: ");
+    redisPoolSetIdleTimeout(pool,(struct timeval){ 1, 0 });
+    ok = (redisPoolEvictIdle(pool) == 0);
+    a->last_used = b->last_used = 0; /* Idle since the epoch */
+    ok &= (redisPoolEvictIdle(pool) == 1);
+    redisPoolGetStats(pool,&stats);
+    test_cond(ok && stats.open == 1 && stats.evictions == 1);
+
+    test("Pool serves threads that check out concurrently: ");
+    for (i = 0; i < __TEST_POOL_THREADS; i++)
+        pthread_create(&threads[i],NULL,__test_pool_thread,pool);
+    for (i = 0, ok = 1; i < __TEST_POOL_THREADS; i++) {
+        pthread_join(threads[i],&res);
+        ok &= (res == NULL);
+    }
+    redisPoolGetStats(pool,&stats);
+    test_cond(ok && stats.in_use == 0 && stats.open <= 2 &&
+              stats.checkouts >= __TEST_POOL_THREADS*__TEST_POOL_ROUNDS);
+    redisPoolFree(pool);
+
+    if (config.type == CONN_TCP) {
+        test("Pool closes connections to its old address when they are returned: ");
+        pool = redisPoolCreate(config.tcp.host,config.tcp.port,0,1,NULL);
+        a = redisPoolGet(pool,NULL,NULL);
+        ok = (a != NULL && redisPoolSetAddress(pool,config.tcp.host,config.tcp.port) == REDIS_OK);
+        redisPoolPut(a);
+        redisPoolGetStats(pool,&stats);
+        test_cond(ok && a->c == NULL && stats.open == 0 && stats.in_use == 0);
+        redisPoolFree(pool);
+    }
+
+    test("Pool reports errors to the calling thread: ");
+    pool = redisPoolCreate("127.0.0.1",1,0,1,NULL);
+    memset(&err,0,sizeof(err));
+    a = redisPoolGet(pool,NULL,&err);
+    test_cond(a == NULL && err.err == REDIS_ERR_IO && pool->err == 0);
+    redisPoolFree(pool);
+
+    test("Pool reports a health check that finds the server gone: ");
+    lfd = __test_listen(&port);
+    pthread_create(&threads[0],NULL,__test_pool_hangup,&lfd);
+    pool = redisPoolCreate("127.0.0.1",port,0,1,NULL);
+    a = redisPoolGet(pool,NULL,NULL);
+    assert(a != NULL);
+    reply = redisCommand(a->c,"PING");
+    assert(reply == NULL);
+    redisPoolPut(a);
+    memset(&err,0,sizeof(err));
+    a = redisPoolGet(pool,NULL,&err);
+    redisPoolGetStats(pool,&stats);
+    test_cond(a == NULL && err.err != 0 && err.errstr[0] != '\0' &&
+              stats.health_failures == 1);
+    redisPoolFree(pool);
+    pthread_join(threads[0],NULL);
+    close(lfd);
+}
+
+static void test_ring(struct config config) {
+    redisRingContext *rc;
+    redisReply *reply;
+    int i, counts[3] = {0}, ok, failed, down;
+    char key[32];
+
+    test("Ring hashes keys like libketama and spreads them by weight: ");
+    rc = redisRingCreate(NULL);
+    redisRingAddServer(rc,"10.0.0.1",6379,1,NULL);
+    redisRingAddServer(rc,"10.0.0.2",6379,1,NULL);
+    redisRingAddServer(rc,"10.0.0.3",6379,2,"big");
+    for (i = 0; i < 10000; i++) {
+        snprintf(key,sizeof(key),"key:%d",i);
+        counts[redisRingKeyServer(rc,key,strlen(key))]++;
+    }
+    test_cond(redisRingHashMd5("abc",3) == 0x98500190 && rc->npoints == 480 &&
+              !strcmp(rc->servers[0].name,"10.0.0.1:6379") &&
+              counts[0] > 2000 && counts[1] > 2000 && counts[2] > 4000);
+
+    test("Ring hashes the {tag} of keys only when asked to: ");
+    for (i = 0, ok = 0; i < 100; i++) {
+        snprintf(key,sizeof(key),"{user1}.%d",i);
+        ok += (redisRingKeyServer(rc,key,strlen(key)) == redisRingKeyServer(rc,"user1",5));
+    }
+    redisRingSetHashTags(rc,1);
+    for (i = 0, failed = 0; i < 100; i++) {
+        snprintf(key,sizeof(key),"{user1}.%d",i);
+        failed += (redisRingKeyServer(rc,key,strlen(key)) == redisRingKeyServer(rc,"user1",5));
+    }
+    test_cond(ok < 100 && failed == 100);
+    redisRingFree(rc);
+
+    /* One live server and one that refuses connections */
+    rc = redisRingCreate(NULL);
+    redisRingAddServer(rc,config.tcp.host,config.tcp.port,1,NULL);
+    redisRingAddServer(rc,"127.0.0.1",1,1,NULL);
+    redisRingSetEjection(rc,2,200);
+
+    test("Ring fails only the commands of a server that is down: ");
+    for (i = 0; i < 100; i++)
+        redisRingAppendCommand(rc,"SET ring:%d %d",i,i);
+    for (i = 0, ok = failed = down = 0; i < 100; i++) {
+        snprintf(key,sizeof(key),"ring:%d",i);
+        if (rc->cmds[i].server == 1) down++;
+        if (redisRingGetReply(rc,(void**)&reply) == REDIS_OK) {
+            ok += (reply->type == REDIS_REPLY_STATUS);
+            freeReplyObject(reply);
+        } else {
+            failed += (rc->err == REDIS_ERR_IO);
+        }
+    }
+    test_cond(down > 0 && failed == down && ok == 100-down);
+
+    test("Ring connects to a dead server once per pipeline: ");
+    test_cond(rc->servers[1].failures == 1 && !rc->servers[1].ejected);
+
+    /* The first command of the dead server fails again and ejects it */
+    test("Ring ejects a failing server and moves its keys: ");
+    for (i = 0, ok = 0; i < 100; i++) {
+        reply = redisRingCommand(rc,"SET ring:%d %d",i,i);
+        ok += (reply != NULL && reply->type == REDIS_REPLY_STATUS);
+        freeReplyObject(reply);
+    }
+    test_cond(rc->servers[1].ejected && rc->npoints == 160 && ok == 99);
+
+    test("Ring tries an ejected server again after the retry timeout: ");
+    usleep(250000);
+    i = redisRingKeyServer(rc,"ring:0",6);
+    test_cond(i >= 0 && !rc->servers[1].ejected && rc->npoints == 320);
+
+    for (i = 0; i < 100; i++) {
+        snprintf(key,sizeof(key),"ring:%d",i);
+        freeReplyObject(redisCommand(rc->servers[0].c,"DEL %s",key));
+    }
+    redisRingFree(rc);
+}
+
+#ifdef __linux__
+static int __test_epoll_replies = 0;
+static int __test_epoll_status = 0;
+static char __test_epoll_timers[4];
+static int __test_epoll_ntimers = 0;
+
+static void __test_epoll_connect_callback(const redisAsyncContext *ac, int status) {
+    ((void)ac);
+    __test_epoll_status = status;
+}
+
+static int __test_epoll_timedout = 0;
+
+static void __test_epoll_deadline_callback(redisAsyncContext *ac, void *r, void *privdata) {
+    ((void)privdata);
+    if (r == NULL && ac->err == REDIS_ERR_TIMEOUT)
+        __test_epoll_timedout++;
+}
+
+static void __test_epoll_reply_callback(redisAsyncContext *ac, void *r, void *privdata) {
+    redisReply *reply = r;
+    long expected = (long)privdata;
+
+    if (reply != NULL && ((expected == 0 && reply->type == REDIS_REPLY_STATUS) ||
+                          (expected > 0 && reply->len == (size_t)expected)))
+        __test_epoll_replies++;
+    if (privdata == (void*)-1)
+        redisAsyncDisconnect(ac);
+}
+
+/* Every reply issues the next command, so the callback queue keeps wrapping
+ * around while it still holds earlier callbacks. */
+static void __test_epoll_chain_callback(redisAsyncContext *ac, void *r, void *privdata) {
+    redisReply *reply = r;
+    long n = (long)privdata;
+
+    if (reply == NULL || reply->type != REDIS_REPLY_STRING || atol(reply->str) != n)
+        __test_epoll_replies = -1000000;
+    else if (__test_epoll_replies >= 0)
+        __test_epoll_replies++;
+    if (n+40 < 1000)
+        redisAsyncCommand(ac,__test_epoll_chain_callback,(void*)(n+40),
+                          "ECHO %ld",n+40);
+    else if (n == 999)
+        redisAsyncDisconnect(ac);
+}
+
+static redisContext *__test_epoll_publisher;
+static int __test_epoll_subs, __test_epoll_messages, __test_epoll_mismatches;
+
+/* Channel callbacks get "c" and pattern callbacks "p" as privdata. */
+static void __test_epoll_pubsub_callback(redisAsyncContext *ac, void *r, void *privdata) {
+    redisReply *reply = r;
+    const char *type;
+
+    if (reply == NULL || reply->type != REDIS_REPLY_ARRAY)
+        return;
+    type = reply->element[0]->str;
+    if ((type[0] == 'p') != (*(char*)privdata == 'p'))
+        __test_epoll_mismatches++;
+    if (strstr(type,"unsubscribe") != NULL) {
+        if (--__test_epoll_subs == 0)
+            redisAsyncDisconnect(ac);
+    } else if (strstr(type,"subscribe") != NULL) {
+        if (++__test_epoll_subs == 3) {
+            freeReplyObject(redisCommand(__test_epoll_publisher,"PUBLISH pubsub:a 1"));
+            freeReplyObject(redisCommand(__test_epoll_publisher,"PUBLISH pubsub:bb 2"));
+        }
+    } else if (++__test_epoll_messages == 4) {
+        redisAsyncCommand(ac,NULL,NULL,"UNSUBSCRIBE");
+        redisAsyncCommand(ac,NULL,NULL,"PUNSUBSCRIBE");
+    }
+}
+
+static void __test_epoll_mass_sub_callback(redisAsyncContext *ac, void *r, void *privdata) {
+    redisReply *reply = r;
+    long n = (long)privdata;
+
+    if (reply == NULL || reply->type != REDIS_REPLY_ARRAY)
+        return;
+    if (strcmp(reply->element[0]->str,"subscribe") == 0) {
+        if (++__test_epoll_subs == n)
+            redisAsyncCommand(ac,NULL,NULL,"UNSUBSCRIBE");
+    } else if (strcmp(reply->element[0]->str,"unsubscribe") == 0) {
+        __test_epoll_messages++;
+        if (reply->element[2]->integer == 0)
+            redisAsyncDisconnect(ac);
+    }
+}
+
+static int __test_epoll_batches, __test_epoll_largest;
+
+/* Publishes 100 messages once subscribed, so they arrive in a few reads. */
+static void __test_epoll_batch_sub_callback(redisAsyncContext *ac, void *r, void *privdata) {
+    redisReply *reply = r;
+    int i;
+    ((void) privdata);
+
+    if (reply == NULL || reply->type != REDIS_REPLY_ARRAY)
+        return;
+    if (strcmp(reply->element[0]->str,"subscribe") == 0) {
+        for (i = 0; i < 100; i++)
+            redisAppendCommand(__test_epoll_publisher,"PUBLISH batch:a %d",i);
+        for (i = 0; i < 100; i++) {
+            assert(redisGetReply(__test_epoll_publisher,&r) == REDIS_OK);
+            freeReplyObject(r);
+        }
+    } else if (strcmp(reply->element[0]->str,"unsubscribe") == 0) {
+        redisAsyncDisconnect(ac);
+    } else {
+        /* Messages must not get here */
+        __test_epoll_mismatches++;
+    }
+}
+
+static void __test_epoll_batch_callback(redisAsyncContext *ac, void **replies,
+                                        size_t count, void *privdata)
+{
+    redisReply *reply;
+    size_t j;
+    ((void) privdata);
+
+    __test_epoll_batches++;
+    if ((int)count > __test_epoll_largest)
+        __test_epoll_largest = count;
+    for (j = 0; j < count; j++) {
+        reply = replies[j];
+        if (atoi(reply->element[2]->str) != __test_epoll_messages++)
+            __test_epoll_mismatches++;
+    }
+    if (__test_epoll_messages == 100)
+        redisAsyncCommand(ac,NULL,NULL,"UNSUBSCRIBE");
+}
+
+static redisShardedContext *__test_sharded;
+static int __test_sharded_replies, __test_sharded_per_shard[4];
+
+/* privdata is the value the INCR must return: commands on a key stay in
+ * order even though the keys are spread over the shards. */
+static void __test_sharded_callback(redisAsyncContext *ac, void *r, void *privdata) {
+    redisReply *reply = r;
+    int i;
+
+    if (reply == NULL || reply->integer != (long)privdata)
+        __test_epoll_mismatches++;
+    for (i = 0; i < __test_sharded->n; i++)
+        if (__test_sharded->shards[i] == ac) __test_sharded_per_shard[i]++;
+    if (++__test_sharded_replies == 400)
+        redisShardedDisconnect(__test_sharded);
+}
+
+static redisSubscriber *__test_fanout;
+static redisListener *__test_fanout_listeners[5];
+static redisMessage *__test_fanout_kept;
+static int __test_fanout_got[5], __test_fanout_shared;
+static long long __test_fanout_receivers[4];
+
+/* Listeners get their index as privdata. Of the first two listeners, the one
+ * that runs first keeps the first message and the other one checks that it
+ * got the very same reply. */
+static void __test_fanout_listener(redisSubscriber *s, redisMessage *msg, void *privdata) {
+    long i = (long)privdata;
+    ((void) s);
+
+    if (strcmp(msg->channel->str,"fanout:a") != 0)
+        return;
+    if (i < 2 && __test_fanout_kept == NULL) {
+        redisMessageRetain(msg);
+        __test_fanout_kept = msg;
+    } else if (i < 2 && __test_fanout_got[i] == 0) {
+        __test_fanout_shared = (msg == __test_fanout_kept &&
+                                msg->reply == __test_fanout_kept->reply);
+    }
+    __test_fanout_got[i]++;
+}
+
+static void __test_fanout_publish(int n) {
+    redisReply *reply = redisCommand(__test_epoll_publisher,"PUBLISH fanout:a m%d",n);
+    __test_fanout_receivers[n] = reply->integer;
+    freeReplyObject(reply);
+}
+
+/* Listen on a channel of its own and wait until the server confirmed it.
+ * Replies come in order, so by then everything sent before was answered and
+ * the messages published before were delivered. */
+static void __test_fanout_sync(redisEpollLoop *loop) {
+    redisListener *l;
+    int i;
+
+    l = redisSubscriberListen(__test_fanout,"fanout:sync",__test_fanout_listener,(void*)0);
+    assert(l != NULL);
+    for (i = 0; i < 100 && l->sub->state != REDIS_SUBSCRIPTION_ACTIVE; i++)
+        redisEpollRunOnce(loop,100);
+    redisSubscriberUnlisten(__test_fanout,l);
+}
+
+static void __test_epoll_timer(redisEpollLoop *loop, void *privdata) {
+    __test_epoll_timers[__test_epoll_ntimers++] = *(char*)privdata;
+    if (__test_epoll_ntimers == 3)
+        redisEpollStop(loop);
+}
+
+static redisAsyncContext *__test_epoll_connect(struct config config) {
+    if (config.type == CONN_TCP)
+        return redisAsyncConnect(config.tcp.host,config.tcp.port);
+    return redisAsyncConnectUnix(config.unix_sock.path);
+}
+
+static void test_async_epoll(struct config config) {
+    redisEpollLoop *loop = redisEpollCreate();
+    redisAsyncContext *ac[64];
+    redisEpollTimer *t;
+    struct timeval tv;
+    long long start;
+    char *big;
+    int i, j, k, lfd, fd, port;
+
+    __test_epoll_replies = __test_epoll_ntimers = 0;
+    test("Epoll loop dispatches replies to many contexts: ");
+    big = malloc(100000);
+    memset(big,'x',100000);
+    for (i = 0; i < 64; i++) {
+        ac[i] = __test_epoll_connect(config);
+        assert(ac[i]->err == 0 && redisEpollAttach(loop,ac[i]) == REDIS_OK);
+        if (i == 0)
+            redisAsyncCommand(ac[i],NULL,NULL,"SET epoll:big %b",big,(size_t)100000);
+        for (j = 0; j < 100; j++)
+            redisAsyncCommand(ac[i],__test_epoll_reply_callback,(void*)0,"PING");
+        redisAsyncCommand(ac[i],__test_epoll_reply_callback,(void*)-1,"PING");
+    }
+    assert(redisEpollRun(loop) == REDIS_OK);
+    test_cond(loop->contexts == 0 && __test_epoll_replies == 64*100);
+
+    test("Epoll loop drains replies larger than a read: ");
+    __test_epoll_replies = 0;
+    ac[0] = __test_epoll_connect(config);
+    redisEpollAttach(loop,ac[0]);
+    for (j = 0; j < 10; j++)
+        redisAsyncCommand(ac[0],__test_epoll_reply_callback,(void*)100000,"GET epoll:big");
+    redisAsyncCommand(ac[0],__test_epoll_reply_callback,(void*)-1,"PING");
+    redisEpollRun(loop);
+    test_cond(__test_epoll_replies == 10);
+    free(big);
+
+    test("Epoll loop reads no more than the read budget per iteration: ");
+    __test_epoll_replies = 0;
+    lfd = __test_listen(&port);
+    ac[0] = redisAsyncConnect("127.0.0.1",port);
+    redisEpollAttach(loop,ac[0]);
+    redisAsyncCommand(ac[0],__test_epoll_reply_callback,(void*)60000,"GET x");
+    fd = accept(lfd,NULL,NULL);
+    big = malloc(60000+32);
+    i = snprintf(big,32,"$%d\r\n",60000);
+    memset(big+i,'x',60000);
+    memcpy(big+i+60000,"\r\n",2);
+    assert(write(fd,big,i+60002) == i+60002);
+    for (j = 0; j < 100 && __test_epoll_replies == 0; j++)
+        redisEpollRunOnce(loop,100);
+    /* Reads of REDIS_READ_MIN, twice that and the rest */
+    test_cond(__test_epoll_replies == 1 && j >= 3);
+    redisAsyncFree(ac[0]);
+    close(fd);
+    close(lfd);
+    free(big);
+
+    test("Epoll loop keeps replies in order while the callback queue wraps: ");
+    __test_epoll_replies = 0;
+    ac[0] = __test_epoll_connect(config);
+    redisEpollAttach(loop,ac[0]);
+    for (j = 0; j < 40; j++)
+        redisAsyncCommand(ac[0],__test_epoll_chain_callback,(void*)(long)j,"ECHO %d",j);
+    redisEpollRun(loop);
+    test_cond(__test_epoll_replies == 1000);
+
+    test("Epoll loop fires timers in order and skips deleted ones: ");
+    redisEpollAddTimer(loop,20,__test_epoll_timer,(void*)"c");
+    redisEpollAddTimer(loop,1,__test_epoll_timer,(void*)"a");
+    t = redisEpollAddTimer(loop,5,__test_epoll_timer,(void*)"x");
+    redisEpollAddTimer(loop,10,__test_epoll_timer,(void*)"b");
+    redisEpollDelTimer(loop,t);
+    t = redisEpollAddTimer(loop,1000,__test_epoll_timer,(void*)"d");
+    redisEpollRun(loop);
+    test_cond(__test_epoll_ntimers == 3 && memcmp(__test_epoll_timers,"abc",3) == 0);
+    redisEpollDelTimer(loop,t);
+
+    test("Epoll loop reports connection errors: ");
+    __test_epoll_status = REDIS_OK;
+    ac[0] = redisAsyncConnect("127.0.0.1",1);
+    if (ac[0]->err == 0) {
+        redisEpollAttach(loop,ac[0]);
+        redisAsyncSetConnectCallback(ac[0],__test_epoll_connect_callback);
+        redisEpollRun(loop);
+    } else {
+        __test_epoll_status = REDIS_ERR;
+        redisAsyncFree(ac[0]);
+    }
+    test_cond(__test_epoll_status == REDIS_ERR && loop->contexts == 0);
+
+    /* The first address refuses only once the connect is in progress. */
+    test("Epoll loop connects to the next address when the first fails: ");
+    redisDnsSetResolver(__test_dns_resolve,__test_dns_free);
+    __test_epoll_status = -1;
+    lfd = __test_listen(&port);
+    ac[0] = redisAsyncConnect("db.test",port);
+    assert(ac[0]->err == 0);
+    redisEpollAttach(loop,ac[0]);
+    redisAsyncSetConnectCallback(ac[0],__test_epoll_connect_callback);
+    for (j = 0; j < 100 && __test_epoll_status == -1; j++)
+        redisEpollRunOnce(loop,100);
+    fd = __test_epoll_status == REDIS_OK ? accept(lfd,NULL,NULL) : -1;
+    test_cond(__test_epoll_status == REDIS_OK && fd != -1);
+    if (__test_epoll_status != REDIS_ERR)
+        redisAsyncFree(ac[0]);
+    if (fd != -1)
+        close(fd);
+    close(lfd);
+
+    /* The lookup runs on the resolver thread while the loop keeps turning. */
+    test("Epoll loop keeps running while the host of a connect resolves: ");
+    __test_epoll_status = -1;
+    __test_epoll_ntimers = 0;
+    lfd = __test_listen(&port);
+    start = usec();
+    ac[0] = redisAsyncConnect("slow.test",port);
+    j = (int)(usec()-start);
+    assert(ac[0]->err == 0);
+    redisEpollAttach(loop,ac[0]);
+    redisAsyncSetConnectCallback(ac[0],__test_epoll_connect_callback);
+    redisEpollAddTimer(loop,20,__test_epoll_timer,(void*)"a");
+    while (__test_epoll_ntimers == 0)
+        redisEpollRunOnce(loop,100);
+    i = __test_epoll_status;
+    for (k = 0; k < 100 && __test_epoll_status == -1; k++)
+        redisEpollRunOnce(loop,100);
+    fd = __test_epoll_status == REDIS_OK ? accept(lfd,NULL,NULL) : -1;
+    test_cond(j < 100000 && i == -1 && __test_epoll_status == REDIS_OK && fd != -1);
+    if (__test_epoll_status != REDIS_ERR)
+        redisAsyncFree(ac[0]);
+    if (fd != -1)
+        close(fd);
+    close(lfd);
+
+    test("Epoll loop reports a host that doesn't resolve to the connect callback: ");
+    __test_epoll_status = 1; /* REDIS_ERR is -1 */
+    ac[0] = redisAsyncConnect("idontexist.test",6379);
+    assert(ac[0]->err == 0);
+    redisEpollAttach(loop,ac[0]);
+    redisAsyncSetConnectCallback(ac[0],__test_epoll_connect_callback);
+    for (j = 0; j < 100 && __test_epoll_status == 1; j++)
+        redisEpollRunOnce(loop,100);
+    test_cond(__test_epoll_status == REDIS_ERR && loop->contexts == 0);
+    if (__test_epoll_status == 1)
+        redisAsyncFree(ac[0]);
+    redisDnsSetResolver(NULL,NULL);
+
+    test("Epoll loop fails commands past their deadline: ");
+    __test_epoll_timedout = 0;
+    ac[0] = __test_epoll_connect(config);
+    redisEpollAttach(loop,ac[0]);
+    tv.tv_sec = 0;
+    tv.tv_usec = 100000;
+    redisAsyncSetTimeout(ac[0],tv);
+    redisAsyncCommand(ac[0],__test_epoll_deadline_callback,NULL,"DEBUG SLEEP 0.5");
+    redisAsyncCommand(ac[0],__test_epoll_deadline_callback,NULL,"PING");
+    start = usec();
+    redisEpollRun(loop);
+    test_cond(__test_epoll_timedout == 2 && usec()-start < 400000 && loop->contexts == 0);
+
+    test("Epoll loop finds the earliest deadline behind later ones: ");
+    __test_epoll_timedout = 0;
+    ac[0] = __test_epoll_connect(config);
+    redisEpollAttach(loop,ac[0]);
+    tv.tv_sec = 2;
+    redisAsyncSetTimeout(ac[0],tv);
+    redisAsyncCommand(ac[0],__test_epoll_deadline_callback,NULL,"DEBUG SLEEP 0.5");
+    redisAsyncCommand(ac[0],__test_epoll_deadline_callback,NULL,"PING");
+    tv.tv_sec = 0;
+    redisAsyncSetTimeout(ac[0],tv);
+    redisAsyncCommand(ac[0],__test_epoll_deadline_callback,NULL,"PING");
+    start = usec();
+    redisEpollRun(loop);
+    test_cond(__test_epoll_timedout == 3 && usec()-start < 400000 && loop->contexts == 0);
+
+    test("Epoll loop answers commands within their deadline: ");
+    __test_epoll_replies = 0;
+    ac[0] = __test_epoll_connect(config);
+    redisEpollAttach(loop,ac[0]);
+    tv.tv_sec = 1;
+    redisAsyncSetTimeout(ac[0],tv);
+    redisAsyncCommand(ac[0],__test_epoll_reply_callback,(void*)0,"PING");
+    redisAsyncCommand(ac[0],__test_epoll_reply_callback,(void*)-1,"PING");
+    redisEpollRun(loop);
+    test_cond(__test_epoll_replies == 1 && loop->ntimers == 0);
+
+    test("Epoll loop dispatches pub/sub messages to their callbacks: ");
+    __test_epoll_subs = __test_epoll_messages = __test_epoll_mismatches = 0;
+    __test_epoll_publisher = connect(config);
+    ac[0] = __test_epoll_connect(config);
+    redisEpollAttach(loop,ac[0]);
+    redisAsyncCommand(ac[0],__test_epoll_pubsub_callback,(void*)"c","SUBSCRIBE pubsub:a pubsub:bb");
+    redisAsyncCommand(ac[0],__test_epoll_pubsub_callback,(void*)"p","PSUBSCRIBE pubsub:*");
+    redisEpollRun(loop);
+    test_cond(__test_epoll_messages == 4 && __test_epoll_subs == 0 &&
+              __test_epoll_mismatches == 0 && loop->contexts == 0);
+    disconnect(__test_epoll_publisher, 0);
+
+    test("Epoll loop keeps subscription callbacks while their table grows: ");
+    __test_epoll_subs = __test_epoll_messages = 0;
+    ac[0] = __test_epoll_connect(config);
+    redisEpollAttach(loop,ac[0]);
+    for (i = 0; i < 5000; i++)
+        redisAsyncCommand(ac[0],__test_epoll_mass_sub_callback,(void*)5000L,
+                          "SUBSCRIBE mass:%d",i);
+    redisEpollRun(loop);
+    test_cond(__test_epoll_subs == 5000 && __test_epoll_messages == 5000 &&
+              loop->contexts == 0);
+
+    test("Epoll loop delivers the messages of a read in batches: ");
+    __test_epoll_messages = __test_epoll_mismatches = 0;
+    __test_epoll_batches = __test_epoll_largest = 0;
+    __test_epoll_publisher = connect(config);
+    ac[0] = __test_epoll_connect(config);
+    redisEpollAttach(loop,ac[0]);
+    redisAsyncSetBatchCallback(ac[0],__test_epoll_batch_callback,NULL,32);
+    redisAsyncCommand(ac[0],__test_epoll_batch_sub_callback,NULL,"SUBSCRIBE batch:a");
+    redisEpollRun(loop);
+    test_cond(__test_epoll_messages == 100 && __test_epoll_mismatches == 0 &&
+              __test_epoll_batches >= 4 && __test_epoll_batches < 100 &&
+              __test_epoll_largest == 32 &&
+              loop->contexts == 0);
+    disconnect(__test_epoll_publisher, 0);
+
+    test("Subscriber fans one subscription out to local listeners: ");
+    memset(__test_fanout_got,0,sizeof(__test_fanout_got));
+    __test_fanout_shared = 0;
+    __test_fanout_kept = NULL;
+    __test_epoll_publisher = connect(config);
+    ac[0] = __test_epoll_connect(config);
+    redisEpollAttach(loop,ac[0]);
+    __test_fanout = redisSubscriberCreate(ac[0]);
+    for (i = 0; i < 2; i++)
+        __test_fanout_listeners[i] = redisSubscriberListen(__test_fanout,"fanout:a",
+            __test_fanout_listener,(void*)(long)i);
+    __test_fanout_listeners[2] = redisSubscriberListenPattern(__test_fanout,"fanout:*",
+        __test_fanout_listener,(void*)2);
+    /* The server only hears about the first and last listener of fanout:a */
+    __test_fanout_sync(loop);
+    __test_fanout_publish(0);
+    __test_fanout_sync(loop);
+    redisSubscriberUnlisten(__test_fanout,__test_fanout_listeners[0]);
+    __test_fanout_publish(1);
+    __test_fanout_sync(loop);
+    redisSubscriberUnlisten(__test_fanout,__test_fanout_listeners[1]);
+    __test_fanout_sync(loop);
+    __test_fanout_publish(2);
+    /* Unsubscribing while subscribing, then listening again */
+    __test_fanout_listeners[3] = redisSubscriberListen(__test_fanout,"fanout:a",
+        __test_fanout_listener,(void*)3);
+    redisSubscriberUnlisten(__test_fanout,__test_fanout_listeners[3]);
+    __test_fanout_listeners[4] = redisSubscriberListen(__test_fanout,"fanout:a",
+        __test_fanout_listener,(void*)4);
+    __test_fanout_sync(loop);
+    __test_fanout_publish(3);
+    __test_fanout_sync(loop);
+    redisSubscriberFree(__test_fanout);
+    redisEpollRun(loop);
+    test_cond(__test_fanout_got[0] == 1 && __test_fanout_got[1] == 2 &&
+              __test_fanout_got[2] == 4 && __test_fanout_got[3] == 0 &&
+              __test_fanout_got[4] == 1 && __test_fanout_shared &&
+              loop->contexts == 0);
+
+    test("Subscriber only (un)subscribes for the first and last listener: ");
+    test_cond(__test_fanout_receivers[0] == 2 && __test_fanout_receivers[1] == 2 &&
+              __test_fanout_receivers[2] == 1 && __test_fanout_receivers[3] == 2);
+
+    test("Subscriber messages outlive the callback when retained: ");
+    test_cond(__test_fanout_kept != NULL &&
+              strcmp(__test_fanout_kept->payload->str,"m0") == 0);
+    if (__test_fanout_kept) redisMessageRelease(__test_fanout_kept);
+    disconnect(__test_epoll_publisher, 0);
+
+    redisEpollFree(loop);
+}
+
+static int __test_reconnects = 0, __test_reconnect_lost = 0;
+static int __test_resubscribed = 0, __test_reconnect_messages = 0;
+static char __test_reconnect_got[16];
+static redisContext *__test_publisher;
+
+static void __test_reconnect_callback(redisAsyncContext *ac) {
+    __test_reconnects++;
+    redisAsyncCommand(ac,NULL,NULL,"SELECT 9");
+}
+
+static void __test_reconnect_reply(redisAsyncContext *ac, void *r, void *privdata) {
+    redisReply *reply = r;
+
+    if (reply == NULL)
+        __test_reconnect_lost++;
+    else if (reply->type == REDIS_REPLY_STRING)
+        snprintf(__test_reconnect_got,sizeof(__test_reconnect_got),"%s",reply->str);
+    if (privdata == (void*)-1)
+        redisAsyncDisconnect(ac);
+}
+
+static void __test_reconnect_sub(redisAsyncContext *ac, void *r, void *privdata) {
+    redisReply *reply = r;
+    ((void)privdata);
+
+    if (reply == NULL || reply->type != REDIS_REPLY_ARRAY)
+        return;
+    if (strcmp(reply->element[0]->str,"subscribe") == 0) {
+        /* Drop the connection after subscribing, publish once restored. */
+        if (++__test_resubscribed == 1)
+            redisAsyncCommand(ac,NULL,NULL,"QUIT");
+        else
+            freeReplyObject(redisCommand(__test_publisher,"PUBLISH reconnect:chan hi"));
+    } else if (strcmp(reply->element[0]->str,"message") == 0) {
+        __test_reconnect_messages++;
+        redisAsyncDisconnect(ac);
+    }
+}
+
+static void test_async_reconnect(struct config config) {
+    redisEpollLoop *loop = redisEpollCreate();
+    redisReconnectPolicy policy;
+    redisAsyncContext *ac;
+    redisContext *c;
+
+    c = connect(config);
+    memset(&policy,0,sizeof(policy));
+    policy.min_delay.tv_usec = 10000;
+    policy.max_delay.tv_usec = 100000;
+    policy.replay = REDIS_CMD_READONLY;
+
+    test("Async reconnect sends read-only in-flight commands again: ");
+    __test_reconnects = __test_reconnect_lost = 0;
+    __test_reconnect_got[0] = '\0';
+    ac = __test_epoll_connect(config);
+    redisEpollAttach(loop,ac);
+    redisAsyncSetReconnect(ac,&policy);
+    redisAsyncSetReconnectCallback(ac,__test_reconnect_callback);
+    redisAsyncCommand(ac,NULL,NULL,"SELECT 9");
+    redisAsyncCommand(ac,NULL,NULL,"SET reconnect:key hello");
+    /* The server closes the connection after QUIT, so GET and INCR are in
+     * flight: GET is replayed, INCR fails. */
+    redisAsyncCommand(ac,NULL,NULL,"QUIT");
+    redisAsyncCommand(ac,__test_reconnect_reply,(void*)-1,"GET reconnect:key");
+    redisAsyncCommand(ac,__test_reconnect_reply,NULL,"INCR reconnect:counter");
+    redisEpollRun(loop);
+    test_cond(__test_reconnects == 1 && __test_reconnect_lost == 1 &&
+              strcmp(__test_reconnect_got,"hello") == 0 && loop->contexts == 0);
+
+    test("Async reconnect doesn't send ZADD again when replaying idempotent commands: ");
+    __test_reconnects = __test_reconnect_lost = 0;
+    __test_reconnect_got[0] = '\0';
+    policy.replay = REDIS_CMD_IDEMPOTENT;
+    ac = __test_epoll_connect(config);
+    redisEpollAttach(loop,ac);
+    redisAsyncSetReconnect(ac,&policy);
+    redisAsyncSetReconnectCallback(ac,__test_reconnect_callback);
+    redisAsyncCommand(ac,NULL,NULL,"SELECT 9");
+    redisAsyncCommand(ac,NULL,NULL,"QUIT");
+    redisAsyncCommand(ac,__test_reconnect_reply,NULL,"ZADD reconnect:zset INCR 1 m");
+    redisAsyncCommand(ac,__test_reconnect_reply,(void*)-1,"GET reconnect:key");
+    redisEpollRun(loop);
+    test_cond(__test_reconnects == 1 && __test_reconnect_lost == 1 &&
+              strcmp(__test_reconnect_got,"hello") == 0 && loop->contexts == 0);
+    policy.replay = REDIS_CMD_READONLY;
+
+    test("Async reconnect restores subscriptions: ");
+    __test_reconnects = __test_resubscribed = __test_reconnect_messages = 0;
+    __test_publisher = c;
+    ac = __test_epoll_connect(config);
+    redisEpollAttach(loop,ac);
+    redisAsyncSetReconnect(ac,&policy);
+    redisAsyncSetReconnectCallback(ac,__test_reconnect_callback);
+    redisAsyncCommand(ac,__test_reconnect_sub,NULL,"SUBSCRIBE reconnect:chan");
+    redisEpollRun(loop);
+    test_cond(__test_reconnects == 1 && __test_resubscribed == 2 &&
+              __test_reconnect_messages == 1 && loop->contexts == 0);
+
+    redisEpollFree(loop);
+    disconnect(c, 0);
+}
+
+static int __test_iouring_replies;
+
+static void __test_iouring_reply(redisAsyncContext *ac, void *r, void *privdata) {
+    redisReply *reply = r;
+    ((void)privdata);
+
+    if (reply != NULL && reply->type == REDIS_REPLY_STATUS)
+        __test_iouring_replies++;
+    if (__test_iouring_replies == 2)
+        redisAsyncDisconnect(ac);
+}
+
+static void test_sharded(struct config config) {
+    redisEpollLoop *loop = redisEpollCreate();
+    const char *argv[2] = {"SELECT", "9"};
+    redisOptions options;
+    redisContext *c = connect(config);
+    int i, j;
+
+    memset(&options,0,sizeof(options));
+    if (config.type == CONN_TCP) {
+        REDIS_OPTIONS_SET_TCP(&options,config.tcp.host,config.tcp.port);
+    } else {
+        REDIS_OPTIONS_SET_UNIX(&options,config.unix_sock.path);
+    }
+
+    test("Sharded context routes commands on a key to one connection: ");
+    __test_epoll_mismatches = __test_sharded_replies = 0;
+    memset(__test_sharded_per_shard,0,sizeof(__test_sharded_per_shard));
+    __test_sharded = redisShardedConnect(&options,4);
+    assert(__test_sharded != NULL && __test_sharded->err == 0);
+    for (i = 0; i < 4; i++) {
+        redisEpollAttach(loop,__test_sharded->shards[i]);
+        redisAsyncCommand(__test_sharded->shards[i],NULL,NULL,"SELECT 9");
+    }
+    for (i = 1; i <= 10; i++)
+        for (j = 0; j < 40; j++)
+            redisShardedCommand(__test_sharded,__test_sharded_callback,(void*)(long)i,
+                                "INCR shard:%d",j);
+    redisEpollRun(loop);
+    test_cond(__test_sharded_replies == 400 && __test_epoll_mismatches == 0 &&
+              __test_sharded_per_shard[0] && __test_sharded_per_shard[1] &&
+              __test_sharded_per_shard[2] && __test_sharded_per_shard[3] &&
+              loop->contexts == 0);
+    disconnect(c, 0);
+
+    test("Sharded context routes keys with the same tag together: ");
+    __test_sharded = redisShardedConnect(&options,4);
+    for (i = 0, j = 0; i < 100; i++) {
+        char a[32], b[32];
+        snprintf(a,sizeof(a),"{user%d}:name",i);
+        snprintf(b,sizeof(b),"x{user%d}:mail",i);
+        j += redisShardedKeyIndex(__test_sharded,a,strlen(a)) !=
+             redisShardedKeyIndex(__test_sharded,b,strlen(b));
+    }
+    test_cond(j == 0);
+
+    test("Sharded context refuses connection and transaction commands: ");
+    test_cond(redisShardedCommand(__test_sharded,NULL,NULL,"SELECT 9") == REDIS_ERR &&
+              redisShardedCommand(__test_sharded,NULL,NULL,"auth secret") == REDIS_ERR &&
+              redisShardedCommand(__test_sharded,NULL,NULL,"MULTI") == REDIS_ERR &&
+              redisShardedCommand(__test_sharded,NULL,NULL,"EXEC") == REDIS_ERR &&
+              redisShardedCommand(__test_sharded,NULL,NULL,"WATCH k") == REDIS_ERR &&
+              redisShardedCommandArgv(__test_sharded,NULL,NULL,2,argv,NULL) == REDIS_ERR &&
+              redisShardedCommand(__test_sharded,NULL,NULL,"SELECTED k") == REDIS_OK);
+    redisShardedFree(__test_sharded);
+
+    redisEpollFree(loop);
+}
+
+static void test_iouring(struct config config) {
+    redisIoUring *ring = redisIoUringCreate(64);
+    struct timeval tv = { 0, 100000 };
+    redisAsyncContext *ac;
+    redisContext *c;
+    redisReply *reply[3];
+    long long t;
+    int lfd, fd, port, i;
+
+    if (ring == NULL) {
+        printf("Skipping io_uring tests: not supported by this kernel\n");
+        return;
+    }
+
+    test("io_uring returns pipelined replies in order: ");
+    c = connect(config);
+    redisAppendCommand(c,"SET iouring:key %s","value");
+    redisAppendCommand(c,"GET iouring:key");
+    redisAppendCommand(c,"DEL iouring:key");
+    for (i = 0; i < 3; i++)
+        if (redisIoUringGetReply(ring,c,(void**)&reply[i]) != REDIS_OK) reply[i] = NULL;
+    test_cond(reply[0] && reply[0]->type == REDIS_REPLY_STATUS &&
+              reply[1] && reply[1]->type == REDIS_REPLY_STRING &&
+              strcmp(reply[1]->str,"value") == 0 &&
+              reply[2] && reply[2]->type == REDIS_REPLY_INTEGER && reply[2]->integer == 1);
+    for (i = 0; i < 3; i++)
+        freeReplyObject(reply[i]);
+    disconnect(c,0);
+
+    lfd = __test_listen(&port);
+
+    test("io_uring reports a server that hangs up: ");
+    c = redisConnect("127.0.0.1",port);
+    redisAppendCommand(c,"PING");
+    fd = accept(lfd,NULL,NULL);
+    close(fd);
+    test_cond(redisIoUringGetReply(ring,c,(void**)&reply[0]) == REDIS_ERR &&
+              (c->err == REDIS_ERR_EOF || c->err == REDIS_ERR_IO));
+    redisFree(c);
+
+    test("io_uring times out a server that doesn't answer: ");
+    c = redisConnectWithTimeout("127.0.0.1",port,tv);
+    redisAppendCommand(c,"PING");
+    t = usec();
+    test_cond(redisIoUringGetReply(ring,c,(void**)&reply[0]) == REDIS_ERR &&
+              c->err == REDIS_ERR_IO && usec()-t >= 90000 && usec()-t < 2000000);
+    redisFree(c);
+    close(lfd);
+
+    test("io_uring runs async contexts: ");
+    ac = redisAsyncConnect(config.tcp.host,config.tcp.port);
+    redisIoUringAttach(ring,ac);
+    __test_iouring_replies = 0;
+    redisAsyncCommand(ac,__test_iouring_reply,NULL,"PING");
+    redisAsyncCommand(ac,__test_iouring_reply,NULL,"PING");
+    redisIoUringRun(ring);
+    test_cond(__test_iouring_replies == 2);
+
+    redisIoUringFree(ring);
+}
+
+static redisSentinel *__test_sentinel;
+static int __test_sentinel_switches = 0, __test_sentinel_failures = 0;
+static int __test_sentinel_reconnects = 0;
+static char __test_sentinel_echo[2][32];
+
+static int __test_sentinel_attach(redisAsyncContext *ac, void *privdata) {
+    return redisEpollAttach(privdata,ac);
+}
+
+static void __test_sentinel_switch(redisEpollLoop *loop, void *privdata) {
+    redisContext *c = redisConnect("127.0.0.1",__test_cluster_ports[0]);
+    ((void)loop);
+    ((void)privdata);
+    freeReplyObject(redisCommand(c,"STANDIN SWITCH 2"));
+    redisFree(c);
+}
+
+static void __test_sentinel_echo_reply(redisAsyncContext *ac, void *r, void *privdata) {
+    redisReply *reply = r;
+    long after = (long)privdata;
+
+    if (reply != NULL && reply->type == REDIS_REPLY_STRING)
+        snprintf(__test_sentinel_echo[after],sizeof(__test_sentinel_echo[after]),"%s",reply->str);
+    if (after) {
+        redisSentinelRemoveAsync(__test_sentinel,ac);
+        redisAsyncDisconnect(ac);
+    }
+}
+
+static void __test_sentinel_switched(redisSentinel *st, int status) {
+    if (status != REDIS_OK)
+        return;
+    __test_sentinel_switches++;
+    redisAsyncCommand(st->contexts[0],__test_sentinel_echo_reply,(void*)1,"ECHO after");
+}
+
+static void __test_sentinel_failed(redisSentinel *st, int status) {
+    ((void)st);
+    if (status == REDIS_ERR)
+        __test_sentinel_failures++;
+}
+
+static void __test_sentinel_reconnected(redisAsyncContext *ac) {
+    ((void)ac);
+    __test_sentinel_reconnects++;
+}
+
+static void test_sentinel(void) {
+    redisEpollLoop *loop = redisEpollCreate();
+    redisReconnectPolicy policy;
+    redisPoolConnection *conn;
+    redisAsyncContext *ac;
+    redisSentinel *st;
+    redisContext *c;
+    redisReply *reply;
+    redisPool *pool;
+    pid_t pid = __test_cluster_start();
+    char addrs[64];
+    long long t, at;
+    int i, ok;
+
+    test("Sentinel lookup skips unreachable sentinels and checks the master's role: ");
+    snprintf(addrs,sizeof(addrs),"127.0.0.1:1,127.0.0.1:%d",__test_cluster_ports[0]);
+    st = redisSentinelCreate(addrs,"mymaster",NULL);
+    c = redisSentinelConnect(st);
+    reply = c ? redisCommand(c,"ECHO hi") : NULL;
+    test_cond(c != NULL && st->master_port == __test_cluster_ports[1] &&
+              st->ports[0] == __test_cluster_ports[0] &&
+              reply != NULL && strcmp(reply->str,"1:hi") == 0);
+    freeReplyObject(reply);
+    redisFree(c);
+    redisSentinelFree(st);
+
+    test("Sentinel lookup of an unknown master fails: ");
+    st = redisSentinelCreate(addrs,"nomaster",NULL);
+    test_cond(redisSentinelGetMaster(st) == REDIS_ERR &&
+              strcmp(st->errstr,"Unknown master") == 0);
+    redisSentinelFree(st);
+
+    test("Sentinel switch moves pools and async contexts to the new master: ");
+    st = __test_sentinel = redisSentinelCreate(addrs,"mymaster",NULL);
+    redisSentinelGetMaster(st);
+    pool = redisPoolCreate("127.0.0.1",__test_cluster_ports[1],1,1,NULL);
+    redisSentinelAddPool(st,pool);
+    memset(&policy,0,sizeof(policy));
+    policy.min_delay.tv_usec = 10000;
+    policy.max_delay.tv_usec = 100000;
+    ac = redisAsyncConnect("127.0.0.1",__test_cluster_ports[1]);
+    redisEpollAttach(loop,ac);
+    redisAsyncSetReconnect(ac,&policy);
+    redisSentinelAddAsync(st,ac);
+    redisAsyncCommand(ac,__test_sentinel_echo_reply,(void*)0,"ECHO before");
+    st->ping_interval = 100;
+    redisSentinelWatch(st,__test_sentinel_attach,loop,__test_sentinel_switched);
+
+    conn = redisPoolGet(pool,NULL,NULL);
+    reply = redisCommand(conn->c,"ECHO x");
+    ok = (reply != NULL && strcmp(reply->str,"1:x") == 0);
+    freeReplyObject(reply);
+    redisPoolPut(conn);
+
+    /* The sentinel connection stays, so stop once the switch was handled */
+    redisEpollAddTimer(loop,100,__test_sentinel_switch,NULL);
+    for (i = 0; i < 100 && st->ncontexts > 0; i++)
+        redisEpollRunOnce(loop,100);
+    conn = redisPoolGet(pool,NULL,NULL);
+    reply = redisCommand(conn->c,"ECHO x");
+    test_cond(ok && __test_sentinel_switches == 1 &&
+              st->master_port == __test_cluster_ports[2] &&
+              strcmp(__test_sentinel_echo[0],"1:before") == 0 &&
+              strcmp(__test_sentinel_echo[1],"2:after") == 0 &&
+              reply != NULL && strcmp(reply->str,"2:x") == 0);
+    freeReplyObject(reply);
+    redisPoolPut(conn);
+
+    /* Unanswered PINGs would time out and drop the connection */
+    test("Sentinel watch PINGs its subscribed connection: ");
+    ac = st->ac;
+    at = ac->ping_at;
+    redisAsyncSetReconnectCallback(ac,__test_sentinel_reconnected);
+    for (t = usec(); usec()-t < 350000;)
+        redisEpollRunOnce(loop,100);
+    test_cond(st->ac == ac && ac->ping_at > at && (ac->c.flags & REDIS_CONNECTED) &&
+              __test_sentinel_reconnects == 0 && ac->sub.invalid.len <= 1);
+    redisSentinelFree(st);
+
+    test("Sentinel watch retries with backoff when no sentinel can be reached: ");
+    st = redisSentinelCreate("127.0.0.1:1","mymaster",NULL);
+    redisSentinelWatch(st,__test_sentinel_attach,loop,__test_sentinel_failed);
+    for (t = usec(); usec()-t < 600000 && __test_sentinel_failures < 2;)
+        redisEpollRunOnce(loop,100);
+    test_cond(__test_sentinel_failures >= 2 && st->ac != NULL &&
+              st->retry_delay == 4*REDIS_SENTINEL_RETRY_MIN_DELAY);
+    redisSentinelFree(st);
+
+    redisEpollRun(loop);
+    redisEpollFree(loop);
+    redisPoolFree(pool);
+    kill(pid,SIGTERM);
+    waitpid(pid,NULL,0);
+}
+
+static char __test_router_replies[16][32];
+static int __test_router_nreplies, __test_router_discovered;
+
+static void __test_router_reply(redisAsyncContext *ac, void *r, void *privdata) {
+    redisReply *reply = r;
+    ((void)ac);
+    ((void)privdata);
+
+    if (__test_router_nreplies < 16)
+        snprintf(__test_router_replies[__test_router_nreplies],sizeof(__test_router_replies[0]),
+                 "%s",reply ? reply->str : "");
+    __test_router_nreplies++;
+}
+
+static void __test_router_discover(redisRouter *rt, int status) {
+    ((void)rt);
+    __test_router_discovered = (status == REDIS_OK) ? 1 : -1;
+}
+
+/* Send "n" ECHOs, wait for them and count the replies of every node. */
+static void __test_router_echo(redisEpollLoop *loop, redisRouter *rt, int n, int *count) {
+    int i;
+
+    __test_router_nreplies = 0;
+    for (i = 0; i < n; i++)
+        redisRouterCommand(rt,__test_router_reply,NULL,"ECHO x");
+    for (i = 0; i < 100 && __test_router_nreplies < n; i++)
+        redisEpollRunOnce(loop,100);
+    memset(count,0,__TEST_CLUSTER_NODES*sizeof(int));
+    for (i = 0; i < n && i < 16; i++)
+        if (__test_router_replies[i][0] >= '0' && __test_router_replies[i][1] == ':')
+            count[__test_router_replies[i][0]-'0']++;
+}
+
+static void test_router(void) {
+    redisEpollLoop *loop = redisEpollCreate();
+    redisOptions options;
+    redisRouter *rt;
+    pid_t pid = __test_cluster_start();
+    int count[__TEST_CLUSTER_NODES], i, ok;
+    char key[16];
+
+    /* A key of node 0, which the other nodes redirect */
+    for (i = 0; __test_cluster_shard(key,snprintf(key,sizeof(key),"k%d",i),NULL) != 0; i++);
+
+    memset(&options,0,sizeof(options));
+    REDIS_OPTIONS_SET_TCP(&options,"127.0.0.1",__test_cluster_ports[0]);
+
+    test("Router discovers the online replicas and spreads reads over them: ");
+    rt = redisRouterConnect(&options,__test_sentinel_attach,loop);
+    redisRouterSetReadOnly(rt,1);
+    redisRouterCommand(rt,NULL,NULL,"CLIENT SETNAME early");
+    redisRouterDiscover(rt,__test_router_discover);
+    for (i = 0; i < 100 && __test_router_discovered == 0; i++)
+        redisEpollRunOnce(loop,100);
+    __test_router_echo(loop,rt,4,count);
+    test_cond(__test_router_discovered == 1 && rt->n == 3 &&
+              rt->nodes[1]->port == __test_cluster_ports[1] &&
+              rt->nodes[2]->port == __test_cluster_ports[2] &&
+              count[0] == 0 && count[1] == 2 && count[2] == 2 &&
+              rt->nodes[1]->outstanding == 0 && rt->nodes[1]->latency > 0);
+
+    test("Router sends writes and the reads of a MULTI block to the primary: ");
+    __test_router_nreplies = 0;
+    redisRouterCommand(rt,__test_router_reply,NULL,"SET %s v",key);
+    redisRouterCommand(rt,NULL,NULL,"MULTI");
+    redisRouterCommand(rt,__test_router_reply,NULL,"ECHO in");
+    redisRouterCommand(rt,NULL,NULL,"EXEC");
+    redisRouterCommand(rt,__test_router_reply,NULL,"ECHO out");
+    for (i = 0; i < 100 && __test_router_nreplies < 3; i++)
+        redisEpollRunOnce(loop,100);
+    /* The replica may answer first */
+    for (i = 0, ok = 0; i < 3; i++)
+        ok += (strcmp(__test_router_replies[i],"OK") == 0) +
+              (strcmp(__test_router_replies[i],"0:early:in") == 0) +
+              (strcmp(__test_router_replies[i],"1:early:out") == 0 ||
+               strcmp(__test_router_replies[i],"2:early:out") == 0);
+    test_cond(__test_router_nreplies == 3 && ok == 3 && rt->multi == 0);
+
+    /* Named before the replicas were discovered, and again after */
+    test("Router sends connection state commands to every replica: ");
+    __test_router_echo(loop,rt,4,count);
+    for (i = 0, ok = 0; i < 4; i++)
+        ok += (strcmp(__test_router_replies[i]+1,":early:x") == 0);
+    redisRouterCommand(rt,NULL,NULL,"CLIENT SETNAME late");
+    __test_router_echo(loop,rt,4,count);
+    for (i = 0; i < 4; i++)
+        ok += (strcmp(__test_router_replies[i]+1,":late:x") == 0);
+    redisRouterCommand(rt,NULL,NULL,"MULTI");
+    ok += (redisRouterCommand(rt,NULL,NULL,"SELECT 1") == REDIS_ERR);
+    redisRouterCommand(rt,NULL,NULL,"DISCARD");
+    test_cond(ok == 9 && count[0] == 0);
+
+    test("Router prefers the replica that answers faster: ");
+    rt->nodes[1]->latency = 5000;
+    rt->nodes[2]->latency = 100;
+    rt->nodes[1]->updated = rt->nodes[2]->updated;
+    __test_router_echo(loop,rt,10,count);
+    ok = (count[2] == 10);
+    rt->nodes[1]->latency = 100;
+    rt->nodes[2]->latency = 5000;
+    __test_router_echo(loop,rt,10,count);
+    test_cond(ok && count[1] == 10);
+
+    test("Router tries a slow replica again once it has been idle a while: ");
+    rt->nodes[1]->latency = 100;
+    rt->nodes[2]->latency = 5000;
+    rt->nodes[2]->updated -= REDIS_ROUTER_PROBE_INTERVAL;
+    __test_router_echo(loop,rt,1,count);
+    test_cond(count[2] == 1 && rt->nodes[2]->latency < 5000);
+    redisRouterDisconnect(rt);
+    redisEpollRun(loop);
+
+    test("Router reads from the primary without replicas: ");
+    rt = redisRouterConnect(&options,__test_sentinel_attach,loop);
+    __test_router_echo(loop,rt,2,count);
+    test_cond(rt->n == 1 && count[0] == 2);
+    redisRouterFree(rt);
+
+    redisEpollFree(loop);
+    kill(pid,SIGTERM);
+    waitpid(pid,NULL,0);
+}
+#endif
+
 static void test_throughput(struct config config) {
     redisContext *c = connect(config);
     redisReply **replies;
@@ -788,22 +3114,56 @@ int main(int argc, char **argv) {
     test_format_commands();
     test_reply_reader();
     test_blocking_connection_errors();
+    test_dns_cache();
     test_free_null();
+    test_cluster();
+#ifdef __linux__
+    test_sentinel();
+    test_router();
+#endif
 
     printf("\nTesting against TCP connection (%s:%d):\n", cfg.tcp.host, cfg.tcp.port);
     cfg.type = CONN_TCP;
     test_blocking_connection(cfg);
+    test_connect_with_options(cfg);
+#ifdef __linux__
+    test_zerocopy(cfg);
+#endif
     test_blocking_connection_timeouts(cfg);
+    test_blocking_spin(cfg);
     test_blocking_io_errors(cfg);
     test_invalid_timeout_errors(cfg);
     test_append_formatted_commands(cfg);
+    test_send_file(cfg);
+    test_fastopen(cfg);
+    test_pool(cfg);
+    test_ring(cfg);
+    test_async_read_budget(cfg);
+    test_async_deadlines(cfg);
+#ifdef __linux__
+    test_async_epoll(cfg);
+    test_sharded(cfg);
+    test_async_reconnect(cfg);
+    test_iouring(cfg);
+#endif
     if (throughput) test_throughput(cfg);
 
     printf("\nTesting against Unix socket connection (%s):\n", cfg.unix_sock.path);
     cfg.type = CONN_UNIX;
     test_blocking_connection(cfg);
+    test_connect_with_options(cfg);
     test_blocking_connection_timeouts(cfg);
+    test_blocking_spin(cfg);
     test_blocking_io_errors(cfg);
+    test_send_file(cfg);
+    test_pool(cfg);
+    test_async_read_budget(cfg);
+    test_async_deadlines(cfg);
+#ifdef __linux__
+    test_async_epoll(cfg);
+    test_sharded(cfg);
+    test_async_reconnect(cfg);
+#endif
     if (throughput) test_throughput(cfg);
 
     if (test_inherit_fd) {